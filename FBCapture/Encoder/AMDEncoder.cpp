@@ -137,7 +137,10 @@ namespace FBCapture {
     }
 
     FBCAPTURE_STATUS AMDEncoder::initialization(void* texturePtr) {
-      codec_ = AMFVideoEncoderVCE_AVC;
+      if (videoCodec_ == VIDEO_CODEC::HEVC)
+        codec_ = AMFVideoEncoder_HEVC;
+      else
+        codec_ = AMFVideoEncoderVCE_AVC;
       memoryTypeIn_ = amf::AMF_MEMORY_DX11;
       formatIn_ = amf::AMF_SURFACE_RGBA;
       maximumSpeed_ = true;
@@ -294,8 +297,8 @@ namespace FBCapture {
         }
 
 #if defined(ENABLE_4K)
-        encoder->SetProperty(AMF_VIDEO_ENCODER_HEVC_TIER, AMF_VIDEO_ENCODER_HEVC_TIER_HIGH);
-        hr = encoder->SetProperty(AMF_VIDEO_ENCODER_HEVC_PROFILE_LEVEL, AMF_LEVEL_5_1);
+        encoder_->SetProperty(AMF_VIDEO_ENCODER_HEVC_TIER, AMF_VIDEO_ENCODER_HEVC_TIER_HIGH);
+        hr = encoder_->SetProperty(AMF_VIDEO_ENCODER_HEVC_PROFILE_LEVEL, AMF_LEVEL_5_1);
         if (hr != AMF_OK) {
           DEBUG_ERROR_VAR("Failed to set proprty(AMF_VIDEO_ENCODER_HEVC_PROFILE_LEVEL)", "AMF_LEVEL_5_1");
           return FBCAPTURE_GPU_ENCODER_INIT_FAILED;
@@ -382,6 +385,7 @@ namespace FBCapture {
     }
 
     FBCAPTURE_STATUS AMDEncoder::processOutput(void **buffer,
+                                               uint32_t *capacity,
                                                uint32_t *length,
                                                uint64_t *timestamp,
                                                uint64_t *duration,
@@ -389,7 +393,7 @@ namespace FBCapture {
                                                bool *isKeyframe) {
       amf::AMFDataPtr data;
       const auto hr = encoder_->QueryOutput(&data);
-      if (hr == AMF_EOF)
+      if (hr == AMF_EOF || hr == AMF_REPEAT)  // AMF_REPEAT: no output ready yet
         return FBCAPTURE_GPU_ENCODER_BUFFER_EMPTY;
 
       if (hr != AMF_OK || !data)
@@ -397,16 +401,28 @@ namespace FBCapture {
 
       amf::AMFBufferPtr amfBuffer(data); // query for buffer interface
 
-      *buffer = malloc(amfBuffer->GetSize());
-      memcpy(*buffer, amfBuffer->GetNative(), amfBuffer->GetSize());
-      *length = static_cast<uint32_t>(amfBuffer->GetSize());
+      const auto size = static_cast<uint32_t>(amfBuffer->GetSize());
+      if (size > *capacity) {
+        free(*buffer);
+        *buffer = malloc(size);
+        *capacity = *buffer ? size : 0;
+        if (!*buffer)
+          return FBCAPTURE_GPU_ENCODER_PROCESS_OUTPUT_FAILED;
+      }
+      memcpy(*buffer, amfBuffer->GetNative(), size);
+      *length = size;
       *timestamp = amfBuffer->GetPts();
       *frameIdx = frameIdx_;
 
       amf_int64 frameType;
-      amfBuffer->GetProperty(AMF_VIDEO_ENCODER_OUTPUT_DATA_TYPE, &frameType);
-      *isKeyframe = frameType == AMF_VIDEO_ENCODER_OUTPUT_DATA_TYPE_IDR ||
-        frameType == AMF_VIDEO_ENCODER_OUTPUT_DATA_TYPE_I;
+      if (videoCodec_ == VIDEO_CODEC::HEVC) {
+        amfBuffer->GetProperty(AMF_VIDEO_ENCODER_HEVC_OUTPUT_DATA_TYPE, &frameType);
+        *isKeyframe = frameType == AMF_VIDEO_ENCODER_HEVC_OUTPUT_DATA_TYPE_I;
+      } else {
+        amfBuffer->GetProperty(AMF_VIDEO_ENCODER_OUTPUT_DATA_TYPE, &frameType);
+        *isKeyframe = frameType == AMF_VIDEO_ENCODER_OUTPUT_DATA_TYPE_IDR ||
+          frameType == AMF_VIDEO_ENCODER_OUTPUT_DATA_TYPE_I;
+      }
 
       if (file_)
         fwrite(amfBuffer->GetNative(), 1, amfBuffer->GetSize(), file_);
@@ -419,7 +435,28 @@ namespace FBCapture {
       return encoder->GetInputCount();
     }
 
-    FBCAPTURE_STATUS AMDEncoder::getSequenceParams(uint8_t **sps, uint32_t *spsLen, uint8_t **pps, uint32_t *ppsLen) {
+    FBCAPTURE_STATUS AMDEncoder::reconfigureBitrate(const uint32_t bitrate) {
+      if (!encoder_) {
+        bitrate_ = bitrate;
+        return FBCAPTURE_OK;
+      }
+
+      // AMF applies rate control properties to a running encoder
+      const auto property = amf_wstring(codec_) == amf_wstring(AMFVideoEncoderVCE_AVC) ?
+        AMF_VIDEO_ENCODER_TARGET_BITRATE : AMF_VIDEO_ENCODER_HEVC_TARGET_BITRATE;
+      const auto hr = encoder_->SetProperty(property, bitrate);
+      if (hr != AMF_OK) {
+        DEBUG_ERROR_VAR("Failed to set proprty(TARGET_BITRATE) ", "bit rate: " + to_string(bitrate));
+        return FBCAPTURE_GPU_ENCODER_RECONFIGURE_FAILED;
+      }
+
+      bitrate_ = bitrate;
+      return FBCAPTURE_OK;
+    }
+
+    FBCAPTURE_STATUS AMDEncoder::getSequenceParams(uint8_t **sps, uint32_t *spsLen,
+                                                   uint8_t **pps, uint32_t *ppsLen,
+                                                   uint8_t **vps, uint32_t *vpsLen) {
 //      amf::AMFVariant amfVar;
 //      const auto hr = encoder_->GetProperty(AMF_VIDEO_ENCODER_EXTRADATA, amfVar.ToInterface());
 //      if (hr != AMF_OK) {
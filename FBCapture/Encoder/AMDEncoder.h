@@ -46,14 +46,18 @@ namespace FBCapture {
 
       FBCAPTURE_STATUS encode(void* texturePtr) override;
       FBCAPTURE_STATUS processOutput(void **buffer,
+                                     uint32_t *capacity,
                                      uint32_t *length,
                                      uint64_t *timestamp,
                                      uint64_t *duration,
                                      uint32_t *frameIdx,
                                      bool *isKeyframe) override;
       FBCAPTURE_STATUS finalize() override;
+      FBCAPTURE_STATUS reconfigureBitrate(uint32_t bitrate) override;
       FBCAPTURE_STATUS saveScreenShot(void* texturePtr, const DESTINATION_URL dstUrl, bool flipTexture) override;
-      FBCAPTURE_STATUS getSequenceParams(uint8_t **sps, uint32_t *spsLen, uint8_t **pps, uint32_t *ppsLen) override;
+      FBCAPTURE_STATUS getSequenceParams(uint8_t **sps, uint32_t *spsLen,
+                                         uint8_t **pps, uint32_t *ppsLen,
+                                         uint8_t **vps, uint32_t *vpsLen) override;
       uint32_t getPendingCount() override;
 
     protected:
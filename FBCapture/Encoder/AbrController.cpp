@@ -0,0 +1,87 @@
+/****************************************************************************************************************
+
+Filename	:	AbrController.cpp
+Content		:
+Copyright	:
+
+****************************************************************************************************************/
+
+#include "AbrController.h"
+#include "Log.h"
+
+namespace FBCapture {
+  namespace Streaming {
+
+    AbrController::AbrController(AbrControllerDelegate* delegate, const uint32_t maxBitrate, const uint32_t minBitrate) :
+      delegate_(delegate),
+      maxBitrate_(maxBitrate),
+      minBitrate_(minBitrate < maxBitrate ? minBitrate : maxBitrate),
+      bitrate_(maxBitrate),
+      started_(false),
+      lastUpdateMs_(0),
+      lastStepDownMs_(0),
+      clearSinceMs_(0),
+      lastWrittenBytes_(0),
+      lastDropped_(0) {}
+
+    void AbrController::update(const SinkQueueStats& stats, const uint64_t nowMs) {
+      if (!started_) {
+        started_ = true;
+        lastUpdateMs_ = nowMs;
+        clearSinceMs_ = nowMs;
+        lastWrittenBytes_ = stats.writtenBytes;
+        lastDropped_ = stats.dropped;
+        return;
+      }
+
+      const auto elapsedMs = nowMs - lastUpdateMs_;
+      if (elapsedMs < kUpdateIntervalMs)
+        return;
+
+      // stats.dropped restarts from zero with the sink, so any change means new drops
+      const auto dropped = stats.dropped != lastDropped_;
+      const auto throughput = (stats.writtenBytes - lastWrittenBytes_) * 8 * 1000 / elapsedMs;
+      lastUpdateMs_ = nowMs;
+      lastWrittenBytes_ = stats.writtenBytes;
+      lastDropped_ = stats.dropped;
+
+      if (stats.durationMs >= kCongestedBacklogMs || dropped) {
+        clearSinceMs_ = nowMs;
+        if (nowMs - lastStepDownMs_ < kStepDownHoldMs)
+          return;
+
+        // Already below what the sink drains, so the backlog is shrinking and only needs time
+        const auto drained = throughput * kThroughputPercent / 100;
+        if (!dropped && drained > 0 && bitrate_ <= drained)
+          return;
+
+        auto bitrate = static_cast<uint64_t>(bitrate_) * kStepDownPercent / 100;
+        if (drained > 0 && drained < bitrate)
+          bitrate = drained;
+        lastStepDownMs_ = nowMs;
+        setBitrate(bitrate > minBitrate_ ? static_cast<uint32_t>(bitrate) : minBitrate_);
+        return;
+      }
+
+      if (stats.durationMs > kClearBacklogMs) {
+        clearSinceMs_ = nowMs;
+        return;
+      }
+
+      if (bitrate_ < maxBitrate_ && nowMs - clearSinceMs_ >= kStepUpHoldMs) {
+        clearSinceMs_ = nowMs;
+        const auto bitrate = static_cast<uint64_t>(bitrate_) * kStepUpPercent / 100;
+        setBitrate(bitrate < maxBitrate_ ? static_cast<uint32_t>(bitrate) : maxBitrate_);
+      }
+    }
+
+    void AbrController::setBitrate(const uint32_t bitrate) {
+      if (bitrate == bitrate_)
+        return;
+
+      DEBUG_LOG_VAR("Target video bitrate", to_string(bitrate_) + " -> " + to_string(bitrate));
+      bitrate_ = bitrate;
+      delegate_->onTargetBitrate(bitrate);
+    }
+  }
+}
@@ -0,0 +1,69 @@
+/****************************************************************************************************************
+
+Filename	:	AbrController.h
+Content		:	Steps the video bitrate up and down with the backlog and throughput of the RTMP sink
+Copyright	:
+
+****************************************************************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+
+#include "SinkWorker.h"
+
+namespace FBCapture {
+  namespace Streaming {
+
+    class AbrControllerDelegate {
+    public:
+      virtual ~AbrControllerDelegate() = default;
+
+      // Called on the thread that calls AbrController::update(). Apply the bitrate on the encoder's own thread.
+      virtual void onTargetBitrate(uint32_t bitrate) = 0;
+    };
+
+    /*
+    * Fed with the queue stats of a sink on every muxed packet and evaluated once per kUpdateIntervalMs.
+    * A backlog past kCongestedBacklogMs or any dropped packet steps the bitrate down to the lower of
+    * kStepDownPercent of the current bitrate and what the sink actually drained in the last interval,
+    * unless the bitrate is already below that and the backlog just needs time to drain.
+    * It only steps back up by kStepUpPercent after the backlog has stayed under kClearBacklogMs for
+    * kStepUpHoldMs, and never above the bitrate the session was configured with.
+    */
+    class AbrController {
+    public:
+      static const uint32_t kUpdateIntervalMs = 1000;
+      static const uint32_t kCongestedBacklogMs = 400;  // below SinkWorker::kDropDisposableMs, so bitrate goes before frames do
+      static const uint32_t kClearBacklogMs = 100;
+      static const uint32_t kStepDownHoldMs = 2000;     // time for a lower bitrate to drain the backlog
+      static const uint32_t kStepUpHoldMs = 5000;
+      static const uint32_t kStepDownPercent = 70;
+      static const uint32_t kStepUpPercent = 110;
+      static const uint32_t kThroughputPercent = 90;
+
+      AbrController(AbrControllerDelegate* delegate, uint32_t maxBitrate, uint32_t minBitrate);
+
+      void update(const SinkQueueStats& stats, uint64_t nowMs);
+
+      uint32_t bitrate() const {
+        return bitrate_;
+      }
+
+    private:
+      AbrControllerDelegate* delegate_;
+      uint32_t maxBitrate_;
+      uint32_t minBitrate_;
+      uint32_t bitrate_;
+
+      bool started_;
+      uint64_t lastUpdateMs_;
+      uint64_t lastStepDownMs_;
+      uint64_t clearSinceMs_;        // start of the current run of intervals without congestion
+      uint64_t lastWrittenBytes_;
+      uint32_t lastDropped_;
+
+      void setBitrate(uint32_t bitrate);
+    };
+  }
+}
@@ -0,0 +1,205 @@
+/****************************************************************************************************************
+
+Filename	:	Amf0Reader.cpp
+Content		:
+Copyright	:
+
+****************************************************************************************************************/
+
+#include "Amf0Reader.h"
+
+#include <stdio.h>
+#include <string.h>
+
+namespace FBCapture {
+  namespace Streaming {
+
+    Amf0Reader::Amf0Reader(const uint8_t* data, const uint32_t size) :
+      data_(data),
+      size_(size),
+      offset_(0) {}
+
+    bool Amf0Reader::atEnd() const {
+      return offset_ >= size_;
+    }
+
+    uint8_t Amf0Reader::peekType() const {
+      return atEnd() ? static_cast<uint8_t>(AMF_DATA_UNSUPPORTED) : data_[offset_];
+    }
+
+    bool Amf0Reader::readNumber(double* value) {
+      if (peekType() != AMF_DATA_NUMBER || size_ - offset_ < 9)
+        return false;
+      offset_++;
+
+      // big endian IEEE 754
+      uint32_t high, low;
+      readU32(&high);
+      readU32(&low);
+      const auto bits = static_cast<uint64_t>(high) << 32 | low;
+      memcpy(value, &bits, sizeof(bits));
+      return true;
+    }
+
+    bool Amf0Reader::readBool(bool* value) {
+      if (peekType() != AMF_DATA_BOOL || size_ - offset_ < 2)
+        return false;
+      *value = data_[offset_ + 1] != 0;
+      offset_ += 2;
+      return true;
+    }
+
+    bool Amf0Reader::readString(string* value) {
+      const auto start = offset_;
+      const auto type = peekType();
+      uint32_t length = 0;
+      offset_++;
+      if (type == AMF_DATA_STRING) {
+        uint16_t shortLength;
+        if (readU16(&shortLength)) {
+          length = shortLength;
+          if (readStringBody(length, value))
+            return true;
+        }
+      } else if (type == AMF_DATA_LONG_STRING) {
+        if (readU32(&length) && readStringBody(length, value))
+          return true;
+      }
+      offset_ = start;
+      return false;
+    }
+
+    bool Amf0Reader::readNull() {
+      const auto type = peekType();
+      if (type != AMF_DATA_NULL && type != AMF_DATA_UNDEFINED)
+        return false;
+      offset_++;
+      return true;
+    }
+
+    bool Amf0Reader::readObject(map<string, string>* properties) {
+      const auto start = offset_;
+      const auto type = peekType();
+      offset_++;
+
+      uint32_t count;
+      if ((type == AMF_DATA_OBJECT || (type == AMF_DATA_MIXEDARRAY && readU32(&count))) &&
+          readProperties(properties, 0))
+        return true;
+
+      offset_ = start;
+      return false;
+    }
+
+    bool Amf0Reader::skip() {
+      const auto start = offset_;
+      if (skipValue(0))
+        return true;
+      offset_ = start;
+      return false;
+    }
+
+    bool Amf0Reader::readBytes(void* value, const uint32_t length) {
+      if (offset_ > size_ || size_ - offset_ < length)
+        return false;
+      memcpy(value, data_ + offset_, length);
+      offset_ += length;
+      return true;
+    }
+
+    bool Amf0Reader::readU16(uint16_t* value) {
+      uint8_t bytes[2];
+      if (!readBytes(bytes, 2))
+        return false;
+      *value = static_cast<uint16_t>(bytes[0] << 8 | bytes[1]);
+      return true;
+    }
+
+    bool Amf0Reader::readU32(uint32_t* value) {
+      uint8_t bytes[4];
+      if (!readBytes(bytes, 4))
+        return false;
+      *value = static_cast<uint32_t>(bytes[0]) << 24 | bytes[1] << 16 | bytes[2] << 8 | bytes[3];
+      return true;
+    }
+
+    bool Amf0Reader::readStringBody(const uint32_t length, string* value) {
+      if (offset_ > size_ || size_ - offset_ < length)
+        return false;
+      if (value)
+        value->assign(reinterpret_cast<const char*>(data_ + offset_), length);
+      offset_ += length;
+      return true;
+    }
+
+    bool Amf0Reader::readProperties(map<string, string>* properties, const uint32_t depth) {
+      // name/value pairs up to an empty name and the object end marker
+      while (true) {
+        uint16_t nameLength;
+        string name;
+        if (!readU16(&nameLength) || !readStringBody(nameLength, &name))
+          return false;
+        if (nameLength == 0 && peekType() == AMF_DATA_OBJECT_END) {
+          offset_++;
+          return true;
+        }
+
+        const auto type = peekType();
+        if (properties && type == AMF_DATA_NUMBER) {
+          double number;
+          if (!readNumber(&number))
+            return false;
+          char text[32];
+          snprintf(text, sizeof(text), "%.17g", number);
+          (*properties)[name] = text;
+        } else if (properties && (type == AMF_DATA_STRING || type == AMF_DATA_LONG_STRING)) {
+          if (!readString(&(*properties)[name]))
+            return false;
+        } else if (!skipValue(depth + 1)) {
+          return false;
+        }
+      }
+    }
+
+    bool Amf0Reader::skipValue(const uint32_t depth) {
+      if (depth > kMaxDepth || atEnd())
+        return false;
+
+      const auto type = data_[offset_++];
+      uint16_t shortLength;
+      uint32_t length;
+      switch (type) {
+      case AMF_DATA_NUMBER:
+        return readStringBody(8, NULL);
+      case AMF_DATA_BOOL:
+        return readStringBody(1, NULL);
+      case AMF_DATA_STRING:
+        return readU16(&shortLength) && readStringBody(shortLength, NULL);
+      case AMF_DATA_LONG_STRING:
+        return readU32(&length) && readStringBody(length, NULL);
+      case AMF_DATA_NULL:
+      case AMF_DATA_UNDEFINED:
+      case AMF_DATA_UNSUPPORTED:
+        return true;
+      case AMF_DATA_REFERENCE:
+        return readStringBody(2, NULL);
+      case AMF_DATA_DATE:
+        return readStringBody(10, NULL);  // number and time zone
+      case AMF_DATA_OBJECT:
+        return readProperties(NULL, depth);
+      case AMF_DATA_MIXEDARRAY:
+        return readU32(&length) && readProperties(NULL, depth);
+      case AMF_DATA_ARRAY:
+        if (!readU32(&length))
+          return false;
+        for (uint32_t i = 0; i < length; i++) {
+          if (!skipValue(depth + 1))
+            return false;
+        }
+        return true;
+      default:
+        return false;
+      }
+    }
+  }
+}
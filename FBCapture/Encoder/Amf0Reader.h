@@ -0,0 +1,59 @@
+/****************************************************************************************************************
+
+Filename	:	Amf0Reader.h
+Content		:	Parses the AMF0 values of RTMP command messages
+Copyright	:
+
+****************************************************************************************************************/
+
+#pragma once
+
+#include <map>
+#include <string>
+#include <stdint.h>
+
+#include "Amf0Writer.h"
+
+using namespace std;
+
+namespace FBCapture {
+  namespace Streaming {
+
+    // Reads AMF0 values one after another from a buffer it doesn't own. Every read fails without moving on
+    // if the next value has another type or is truncated.
+    class Amf0Reader {
+    public:
+      Amf0Reader(const uint8_t* data, uint32_t size);
+
+      bool atEnd() const;
+      // Type marker of the next value, AMF_DATA_UNSUPPORTED at the end
+      uint8_t peekType() const;
+
+      bool readNumber(double* value);
+      bool readBool(bool* value);
+      bool readString(string* value);
+      bool readNull();
+
+      // Reads an object or ECMA array. Keeps its string and number properties, numbers formatted as text,
+      // and skips the others. properties may be NULL to skip the whole object.
+      bool readObject(map<string, string>* properties);
+
+      // Skips one value of any type, including nested objects and arrays
+      bool skip();
+
+    private:
+      const uint8_t* data_;
+      uint32_t size_;
+      uint32_t offset_;
+
+      bool readBytes(void* value, uint32_t length);
+      bool readU16(uint16_t* value);
+      bool readU32(uint32_t* value);
+      bool readStringBody(uint32_t length, string* value);
+      bool readProperties(map<string, string>* properties, uint32_t depth);
+      bool skipValue(uint32_t depth);
+
+      static const uint32_t kMaxDepth = 16;
+    };
+  }
+}
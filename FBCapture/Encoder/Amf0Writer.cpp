@@ -0,0 +1,139 @@
+/****************************************************************************************************************
+
+Filename	:	Amf0Writer.cpp
+Content		:
+Copyright	:
+
+****************************************************************************************************************/
+
+#include "Amf0Writer.h"
+
+#include <string.h>
+
+namespace FBCapture {
+  namespace Streaming {
+
+    Amf0Writer::Amf0Writer() {}
+
+    void Amf0Writer::clear() {
+      buffer_.clear();
+    }
+
+    const uint8_t* Amf0Writer::data() const {
+      return buffer_.data();
+    }
+
+    uint32_t Amf0Writer::size() const {
+      return static_cast<uint32_t>(buffer_.size());
+    }
+
+    void Amf0Writer::writeNumber(const double value) {
+      // big endian IEEE 754
+      uint64_t bits;
+      memcpy(&bits, &value, sizeof(bits));
+      writeU8(AMF_DATA_NUMBER);
+      writeU32(static_cast<uint32_t>(bits >> 32));
+      writeU32(static_cast<uint32_t>(bits));
+    }
+
+    void Amf0Writer::writeBool(const bool value) {
+      writeU8(AMF_DATA_BOOL);
+      writeU8(value ? 1 : 0);
+    }
+
+    void Amf0Writer::writeString(const string& value) {
+      if (value.size() > 0xffff) {
+        writeU8(AMF_DATA_LONG_STRING);
+        writeU32(static_cast<uint32_t>(value.size()));
+      } else {
+        writeU8(AMF_DATA_STRING);
+        writeU16(static_cast<uint16_t>(value.size()));
+      }
+      writeBytes(value.data(), value.size());
+    }
+
+    void Amf0Writer::writeNull() {
+      writeU8(AMF_DATA_NULL);
+    }
+
+    void Amf0Writer::writeObjectStart() {
+      writeU8(AMF_DATA_OBJECT);
+    }
+
+    void Amf0Writer::writeEcmaArrayStart(const uint32_t count) {
+      writeU8(AMF_DATA_MIXEDARRAY);
+      writeU32(count);
+    }
+
+    void Amf0Writer::writeObjectEnd() {
+      // empty property name followed by the object end marker
+      writeU16(0);
+      writeU8(AMF_DATA_OBJECT_END);
+    }
+
+    void Amf0Writer::writeStrictArrayStart(const uint32_t count) {
+      writeU8(AMF_DATA_ARRAY);
+      writeU32(count);
+    }
+
+    void Amf0Writer::writePropertyName(const string& name) {
+      writeU16(static_cast<uint16_t>(name.size()));
+      writeBytes(name.data(), name.size());
+    }
+
+    void Amf0Writer::writeNumberProperty(const string& name, const double value) {
+      writePropertyName(name);
+      writeNumber(value);
+    }
+
+    void Amf0Writer::writeBoolProperty(const string& name, const bool value) {
+      writePropertyName(name);
+      writeBool(value);
+    }
+
+    void Amf0Writer::writeStringProperty(const string& name, const string& value) {
+      writePropertyName(name);
+      writeString(value);
+    }
+
+    bool Amf0Writer::writePaddingProperty(const string& name, const uint32_t size) {
+      const auto overhead = paddingPropertyOverhead(name);
+      if (size < overhead || size - overhead > 0xffff)
+        return false;
+
+      writePropertyName(name);
+      writeU8(AMF_DATA_STRING);
+      writeU16(static_cast<uint16_t>(size - overhead));
+      buffer_.insert(buffer_.end(), size - overhead, ' ');
+      return true;
+    }
+
+    uint32_t Amf0Writer::paddingPropertyOverhead(const string& name) {
+      // property name, string marker and 16 bit string length
+      return static_cast<uint32_t>(2 + name.size() + 1 + 2);
+    }
+
+    uint32_t Amf0Writer::numberArraySize(const uint32_t count) {
+      return 1 + 4 + count * (1 + 8);
+    }
+
+    void Amf0Writer::writeU8(const uint8_t value) {
+      buffer_.push_back(value);
+    }
+
+    void Amf0Writer::writeU16(const uint16_t value) {
+      writeU8(static_cast<uint8_t>(value >> 8));
+      writeU8(static_cast<uint8_t>(value));
+    }
+
+    void Amf0Writer::writeU32(const uint32_t value) {
+      writeU16(static_cast<uint16_t>(value >> 16));
+      writeU16(static_cast<uint16_t>(value));
+    }
+
+    void Amf0Writer::writeBytes(const void* data, const size_t length) {
+      const auto bytes = static_cast<const uint8_t*>(data);
+      buffer_.insert(buffer_.end(), bytes, bytes + length);
+    }
+  }
+}
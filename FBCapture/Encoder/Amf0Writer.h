@@ -0,0 +1,78 @@
+/****************************************************************************************************************
+
+Filename	:	Amf0Writer.h
+Content		:	Serializes AMF0 values for FLV script data and RTMP commands
+Copyright	:
+
+****************************************************************************************************************/
+
+#pragma once
+
+#include <vector>
+#include <string>
+#include <stdint.h>
+
+using namespace std;
+
+namespace FBCapture {
+  namespace Streaming {
+
+    enum AMF_DATA_TYPE {
+      AMF_DATA_NUMBER = 0x00,
+      AMF_DATA_BOOL = 0x01,
+      AMF_DATA_STRING = 0x02,
+      AMF_DATA_OBJECT = 0x03,
+      AMF_DATA_NULL = 0x05,
+      AMF_DATA_UNDEFINED = 0x06,
+      AMF_DATA_REFERENCE = 0x07,
+      AMF_DATA_MIXEDARRAY = 0x08,
+      AMF_DATA_OBJECT_END = 0x09,
+      AMF_DATA_ARRAY = 0x0a,
+      AMF_DATA_DATE = 0x0b,
+      AMF_DATA_LONG_STRING = 0x0c,
+      AMF_DATA_UNSUPPORTED = 0x0d,
+    };
+
+    // Appends AMF0 values to a buffer that is reused across clear() calls
+    class Amf0Writer {
+    public:
+      Amf0Writer();
+
+      void clear();
+      const uint8_t* data() const;
+      uint32_t size() const;
+
+      void writeNumber(double value);
+      void writeBool(bool value);
+      void writeString(const string& value);
+      void writeNull();
+
+      // Objects and ECMA arrays hold properties and are closed with writeObjectEnd()
+      void writeObjectStart();
+      void writeEcmaArrayStart(uint32_t count);
+      void writeObjectEnd();
+
+      // Followed by count values
+      void writeStrictArrayStart(uint32_t count);
+
+      void writePropertyName(const string& name);
+      void writeNumberProperty(const string& name, double value);
+      void writeBoolProperty(const string& name, bool value);
+      void writeStringProperty(const string& name, const string& value);
+
+      // Writes a string property of exactly size bytes in total. Used to reserve space to be overwritten later.
+      bool writePaddingProperty(const string& name, uint32_t size);
+
+      static uint32_t paddingPropertyOverhead(const string& name);
+      static uint32_t numberArraySize(uint32_t count);
+
+    private:
+      vector<uint8_t> buffer_;
+
+      void writeU8(uint8_t value);
+      void writeU16(uint16_t value);
+      void writeU32(uint32_t value);
+      void writeBytes(const void* data, size_t length);
+    };
+  }
+}
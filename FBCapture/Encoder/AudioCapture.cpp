@@ -286,7 +286,8 @@ namespace FBCapture {
       BYTE *outputData, *inputData;
       uint32_t outputNumFrames = 0, inputNumFrames = 0;
 
-      // Write Output Data
+      // Write Output Data. Keep reading while the clients have packets, but never wait on them:
+      // the caller is woken up again on its capture period when nothing has been buffered yet.
       while (true) {
         CHECK_HR_STATUS(
           captureAudioFromClient(outputAudioCaptureClient_, outputAudioClock_, &outputData, &outputNumFrames, &outputTimePosition_),
@@ -309,6 +310,9 @@ namespace FBCapture {
         const auto length = buffer_->getBufferLength();
         if (length > 0)
           break;
+
+        if (outputNumFrames == 0 && inputNumFrames == 0)
+          return FBCAPTURE_ENCODER_NEED_MORE_INPUT;
       }
 
       outputDuration_ = outputTimePosition_ - outputTimestamp_;
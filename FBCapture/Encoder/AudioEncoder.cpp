@@ -25,7 +25,10 @@ namespace FBCapture {
       mute_(mute),
       mixMic_(mixMic),
       useRiftAudioSources_(useRiftAudioSources),
-      outputPath_(NULL) {}
+      outputPath_(NULL) {
+      // WASAPI loopback capture can't signal new packets, so poll at a fraction of the 10 ms device period
+      period_ = chrono::milliseconds(kCapturePeriodMs);
+    }
 
     AudioEncoder::~AudioEncoder() {
       if (audioCapture_) {
@@ -73,6 +76,8 @@ namespace FBCapture {
 
     FBCAPTURE_STATUS AudioEncoder::getPacket(EncodePacket** packet) {
       FBCAPTURE_STATUS status = audioCapture_->captureAudio();
+      if (status == FBCAPTURE_ENCODER_NEED_MORE_INPUT)
+        return status;
       if (status != FBCAPTURE_OK) {
         DEBUG_ERROR_VAR("Failed capturing raw audio packets", to_string(status));
         return status;
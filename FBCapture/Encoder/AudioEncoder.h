@@ -11,6 +11,8 @@ namespace FBCapture {
 
     class AudioEncoder : public FBCaptureEncoderModule {
     public:
+      static const uint32_t kCapturePeriodMs = 5;
+
       AudioEncoder(FBCaptureEncoderDelegate *mainDelegate,
                    EncodePacketProcessorDelegate *processorDelegate,
                    bool mute,
@@ -0,0 +1,151 @@
+/****************************************************************************************************************
+
+Filename	:	CmafManifest.cpp
+Content		:
+Copyright	:
+
+****************************************************************************************************************/
+
+#include "CmafManifest.h"
+
+#include <algorithm>
+#include <ctime>
+#include <stdio.h>
+
+#define CMAF_TIMESCALE 10000000  // packet timestamps are in 100 nanosec unit
+
+namespace FBCapture {
+  namespace Streaming {
+
+    namespace {
+      string seconds(const uint64_t time) {
+        char value[32];
+        snprintf(value, sizeof(value), "%.3f", static_cast<double>(time) / CMAF_TIMESCALE);
+        return value;
+      }
+
+      string isoDuration(const uint64_t time) {
+        return "PT" + seconds(time) + "S";
+      }
+    }
+
+    string FormatUtcTime(const uint64_t millisSinceEpoch) {
+      const auto time = static_cast<time_t>(millisSinceEpoch / 1000);
+      tm utc;
+#ifdef _WIN32
+      gmtime_s(&utc, &time);
+#else
+      gmtime_r(&time, &utc);
+#endif
+      char value[32];
+      const auto length = strftime(value, sizeof(value), "%Y-%m-%dT%H:%M:%S", &utc);
+      snprintf(value + length, sizeof(value) - length, ".%03uZ", static_cast<uint32_t>(millisSinceEpoch % 1000));
+      return value;
+    }
+
+    string BuildHlsPlaylist(const CmafStreamInfo& info, const deque<CmafSegment>& segments) {
+      // every EXTINF rounded to the nearest second must fit in the target duration
+      auto targetDuration = info.segmentTarget;
+      for (const auto& segment : segments)
+        targetDuration = max(targetDuration, segment.duration);
+      const auto targetSeconds = max<uint64_t>((targetDuration + CMAF_TIMESCALE / 2) / CMAF_TIMESCALE, 1);
+
+      string playlist;
+      playlist += "#EXTM3U\n";
+      playlist += "#EXT-X-VERSION:6\n";
+      playlist += "#EXT-X-TARGETDURATION:" + to_string(targetSeconds) + "\n";
+      playlist += "#EXT-X-SERVER-CONTROL:PART-HOLD-BACK=" + seconds(info.partTarget * 3) + "\n";
+      playlist += "#EXT-X-PART-INF:PART-TARGET=" + seconds(info.partTarget) + "\n";
+      playlist += "#EXT-X-MEDIA-SEQUENCE:" + to_string(segments.empty() ? 0 : segments.front().number) + "\n";
+      playlist += "#EXT-X-INDEPENDENT-SEGMENTS\n";
+      playlist += "#EXT-X-MAP:URI=\"" + info.initUri + "\"\n";
+
+      // only the segments near the live edge list their parts, older ones are loaded whole
+      size_t completeCount = 0;
+      for (const auto& segment : segments)
+        completeCount += segment.complete ? 1 : 0;
+      const auto firstWithParts = completeCount > info.partListSegments ? completeCount - info.partListSegments : 0;
+
+      size_t index = 0;
+      for (const auto& segment : segments) {
+        if (!info.ended && (index >= firstWithParts || !segment.complete)) {
+          for (const auto& part : segment.parts) {
+            playlist += "#EXT-X-PART:DURATION=" + seconds(part.duration) + ",URI=\"" + segment.uri + "\"," +
+              "BYTERANGE=\"" + to_string(part.size) + "@" + to_string(part.offset) + "\"";
+            if (part.independent)
+              playlist += ",INDEPENDENT=YES";
+            playlist += "\n";
+          }
+        }
+        if (segment.complete)
+          playlist += "#EXTINF:" + seconds(segment.duration) + ",\n" + segment.uri + "\n";
+        index++;
+      }
+
+      if (info.ended)
+        playlist += "#EXT-X-ENDLIST\n";
+      return playlist;
+    }
+
+    string BuildDashManifest(const CmafStreamInfo& info, const deque<CmafSegment>& segments) {
+      uint64_t maxDuration = info.segmentTarget;
+      uint64_t window = 0;
+      uint64_t end = 0;
+      const CmafSegment* first = NULL;
+      for (const auto& segment : segments) {
+        if (!segment.complete)
+          continue;
+        if (!first)
+          first = &segment;
+        maxDuration = max(maxDuration, segment.duration);
+        window += segment.duration;
+        end = segment.startTime + segment.duration;
+      }
+
+      // CMAF allows a single track per segment, so muxed audio and video are only isoff-live
+      string mpd;
+      mpd += "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n";
+      mpd += "<MPD xmlns=\"urn:mpeg:dash:schema:mpd:2011\" profiles=\"urn:mpeg:dash:profile:isoff-live:2011";
+      if (!info.muxedAudio)
+        mpd += ",urn:mpeg:dash:profile:cmaf:2019";
+      mpd += "\" type=\"dynamic\"";
+      mpd += " availabilityStartTime=\"" + info.availabilityStartTime + "\"";
+      mpd += " publishTime=\"" + info.publishTime + "\"";
+      // an ended live stream is signalled by its duration and no more updates
+      if (info.ended)
+        mpd += " mediaPresentationDuration=\"" + isoDuration(end) + "\"";
+      else
+        mpd += " minimumUpdatePeriod=\"" + isoDuration(info.segmentTarget) + "\"";
+      mpd += " minBufferTime=\"" + isoDuration(info.segmentTarget) + "\"";
+      mpd += " timeShiftBufferDepth=\"" + isoDuration(window) + "\"";
+      mpd += " maxSegmentDuration=\"" + isoDuration(maxDuration) + "\">\n";
+
+      mpd += "  <Period id=\"0\" start=\"PT0S\">\n";
+      // the content type of a muxed adaptation set is given per component instead
+      mpd += "    <AdaptationSet id=\"0\"";
+      if (!info.muxedAudio)
+        mpd += " contentType=\"video\"";
+      mpd += " mimeType=\"video/mp4\" segmentAlignment=\"true\" startWithSAP=\"1\">\n";
+      if (info.muxedAudio) {
+        mpd += "      <ContentComponent id=\"1\" contentType=\"video\"/>\n";
+        mpd += "      <ContentComponent id=\"2\" contentType=\"audio\"/>\n";
+      }
+      mpd += "      <Representation id=\"0\" codecs=\"" + info.codecs + "\" bandwidth=\"" + to_string(info.bandwidth) + "\"" +
+        " width=\"" + to_string(info.width) + "\" height=\"" + to_string(info.height) + "\">\n";
+      mpd += "        <SegmentTemplate timescale=\"" + to_string(CMAF_TIMESCALE) + "\" initialization=\"" + info.initUri + "\"" +
+        " media=\"" + info.mediaTemplate + "\" startNumber=\"" + to_string(first ? first->number : 0) + "\">\n";
+      mpd += "          <SegmentTimeline>\n";
+      for (const auto& segment : segments) {
+        if (segment.complete)
+          mpd += "            <S t=\"" + to_string(segment.startTime) + "\" d=\"" + to_string(segment.duration) + "\"/>\n";
+      }
+      mpd += "          </SegmentTimeline>\n";
+      mpd += "        </SegmentTemplate>\n";
+      mpd += "      </Representation>\n";
+      mpd += "    </AdaptationSet>\n";
+      mpd += "  </Period>\n";
+      mpd += "</MPD>\n";
+      return mpd;
+    }
+  }
+}
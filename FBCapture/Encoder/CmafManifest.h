@@ -0,0 +1,68 @@
+/****************************************************************************************************************
+
+Filename	:	CmafManifest.h
+Content		:	Builds the rolling HLS playlist and DASH manifest of the CMAF segment output
+Copyright	:
+
+****************************************************************************************************************/
+
+#pragma once
+
+#include <deque>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+using namespace std;
+
+namespace FBCapture {
+  namespace Streaming {
+
+    // Times in 100 nanosec unit like the packet timestamps, relative to the first keyframe
+
+    // A moof/mdat pair of a segment, which LL-HLS clients can load before the segment is complete
+    struct CmafPart {
+      uint64_t offset;       // in the segment file
+      uint32_t size;
+      uint64_t duration;
+      bool independent;      // starts with a keyframe
+    };
+
+    struct CmafSegment {
+      uint32_t number;
+      string uri;            // relative to the manifests
+      uint64_t startTime;
+      uint64_t duration;
+      vector<CmafPart> parts;
+      bool complete;         // only the last segment can still be growing
+    };
+
+    struct CmafStreamInfo {
+      string initUri;
+      string mediaTemplate;        // DASH SegmentTemplate@media, with $Number$
+      string codecs;               // RFC 6381
+      bool muxedAudio;             // the segments carry an audio track next to the video one
+      uint32_t width;
+      uint32_t height;
+      uint32_t bandwidth;          // in bits per second
+      uint64_t segmentTarget;
+      uint64_t partTarget;
+      uint32_t partListSegments;   // complete segments at the end of the playlist that still list their parts
+      string availabilityStartTime;  // ISO 8601 wall clock of media time 0
+      string publishTime;
+      bool ended;
+    };
+
+    /*
+    * LL-HLS media playlist. Parts are listed as byte ranges of their segment file, so a plain static web server
+    * can serve them. There is no blocking reload, which needs server support, so clients poll for updates.
+    */
+    string BuildHlsPlaylist(const CmafStreamInfo& info, const deque<CmafSegment>& segments);
+
+    // Dynamic DASH MPD with a SegmentTimeline of the complete segments. Once ended it gets its final duration.
+    string BuildDashManifest(const CmafStreamInfo& info, const deque<CmafSegment>& segments);
+
+    // ISO 8601 UTC time of the wall clock, like 2017-09-14T10:00:00.000Z
+    string FormatUtcTime(uint64_t millisSinceEpoch);
+  }
+}
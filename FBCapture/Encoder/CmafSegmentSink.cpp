@@ -0,0 +1,266 @@
+/****************************************************************************************************************
+
+Filename	:	CmafSegmentSink.cpp
+Content		:
+Copyright	:
+
+****************************************************************************************************************/
+
+#include "CmafSegmentSink.h"
+#include "FileUtil.h"
+#include "Log.h"
+
+#include <chrono>
+#include <algorithm>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+namespace FBCapture {
+  namespace Streaming {
+
+    CmafSegmentSink::CmafSegmentSink(const string& manifestPath) :
+      segmentFile_(NULL),
+      segmentSize_(0),
+      nextNumber_(0),
+      initWritten_(false),
+      started_(false),
+      segmentStart_(0),
+      partStart_(0),
+      lastVideoTimestamp_(0),
+      frameDuration_(0),
+      startWallClock_(0),
+      peakBandwidth_(0) {
+      const auto nameStart = manifestPath.find_last_of("/\\");
+      directory_ = nameStart == string::npos ? "" : manifestPath.substr(0, nameStart + 1);
+      const auto fileName = nameStart == string::npos ? manifestPath : manifestPath.substr(nameStart + 1);
+      baseName_ = fileName.substr(0, fileName.rfind('.'));
+      hlsPath_ = directory_ + baseName_ + ".m3u8";
+      dashPath_ = directory_ + baseName_ + ".mpd";
+      initName_ = baseName_ + "_init.mp4";
+    }
+
+    CmafSegmentSink::~CmafSegmentSink() {
+      close();
+    }
+
+    uint64_t CmafSegmentSink::wallClockMillis() {
+      const auto sinceEpoch = chrono::duration_cast<chrono::milliseconds>(chrono::system_clock::now().time_since_epoch());
+      return static_cast<uint64_t>(sinceEpoch.count());
+    }
+
+    FBCAPTURE_STATUS CmafSegmentSink::open() {
+      muxer_.reset();
+      segments_.clear();
+      expired_.clear();
+      segmentSize_ = 0;
+      nextNumber_ = 0;
+      initWritten_ = false;
+      started_ = false;
+      frameDuration_ = 0;
+      peakBandwidth_ = 0;
+      return FBCAPTURE_OK;
+    }
+
+    FBCAPTURE_STATUS CmafSegmentSink::write(EncodePacket* packet) {
+      if (packet->type() != PACKET_TYPE::VIDEO) {
+        muxer_.addPacket(packet);
+        return FBCAPTURE_OK;
+      }
+
+      const auto timestamp = packet->timestamp;
+      if (!started_) {
+        // the first segment starts at the first keyframe
+        if (!muxer_.addPacket(packet))
+          return FBCAPTURE_OK;
+        started_ = true;
+        segmentStart_ = timestamp;
+        partStart_ = timestamp;
+        lastVideoTimestamp_ = timestamp;
+        startWallClock_ = wallClockMillis();
+        return FBCAPTURE_OK;
+      }
+
+      if (timestamp > lastVideoTimestamp_)
+        frameDuration_ = timestamp - lastVideoTimestamp_;
+      lastVideoTimestamp_ = timestamp;
+
+      // queueing the packet completes the one before it, everything before this packet can be written
+      muxer_.addPacket(packet);
+
+      // half a frame of slack, since 100 nanosec timestamps of a GOP rarely add up to the exact target
+      auto status = FBCAPTURE_OK;
+      const auto segmentDuration = timestamp - segmentStart_ + frameDuration_ / 2;
+      if (static_cast<VideoEncodePacket*>(packet)->isKeyframe && segmentDuration >= kSegmentTargetDuration) {
+        status = writePart();
+        if (status == FBCAPTURE_OK)
+          status = closeSegment();
+        segmentStart_ = timestamp;
+        partStart_ = timestamp;
+      } else if (timestamp - partStart_ + frameDuration_ > kPartTargetDuration) {
+        // cut before the part would outgrow the part target, which LL-HLS doesn't allow
+        status = writePart();
+        partStart_ = timestamp;
+      }
+      return status;
+    }
+
+    FBCAPTURE_STATUS CmafSegmentSink::writeInitSegment() {
+      box_.clear();
+      const auto cmaf = true;
+      if (!muxer_.writeInitSegment(&box_, cmaf))
+        return FBCAPTURE_OK;
+
+      const auto path = directory_ + initName_;
+      FILE* file = NULL;
+      OPEN_FILE(file, path);
+      const auto written = fwrite(box_.data(), 1, box_.size(), file) == box_.size();
+      CLOSE_FILE(file);
+      if (!written) {
+        DEBUG_ERROR_VAR("Failed writing CMAF init segment", path);
+        return FBCAPTURE_MP4_WRITE_FAILED;
+      }
+
+      initWritten_ = true;
+      return FBCAPTURE_OK;
+    }
+
+    FBCAPTURE_STATUS CmafSegmentSink::writePart() {
+      if (!initWritten_) {
+        const auto status = writeInitSegment();
+        if (status != FBCAPTURE_OK || !initWritten_)
+          return status;
+      }
+
+      box_.clear();
+      Mp4FragmentInfo info;
+      if (!muxer_.writeFragment(&box_, &iov_, &info))
+        return FBCAPTURE_OK;
+
+      if (!segmentFile_) {
+        CmafSegment segment;
+        segment.number = nextNumber_++;
+        segment.uri = baseName_ + "_" + to_string(segment.number) + ".m4s";
+        segment.startTime = info.startTime;
+        segment.duration = 0;
+        segment.complete = false;
+        const auto path = directory_ + segment.uri;
+        OPEN_FILE(segmentFile_, path);
+        segmentSize_ = 0;
+        segments_.push_back(segment);
+      }
+
+      // flushed so the web server can hand out the part as soon as the playlist lists it
+      const auto written = WriteV(segmentFile_, iov_.data(), static_cast<uint32_t>(iov_.size())) && fflush(segmentFile_) == 0;
+      muxer_.releaseFragment();
+      if (!written) {
+        DEBUG_ERROR_VAR("Failed writing CMAF segment", segments_.back().uri);
+        return FBCAPTURE_MP4_WRITE_FAILED;
+      }
+
+      auto& segment = segments_.back();
+      segment.parts.push_back({ segmentSize_, info.size, info.duration, info.independent });
+      segment.duration += info.duration;
+      segmentSize_ += info.size;
+
+      const auto withDash = false;
+      const auto ended = false;
+      return writeManifests(withDash, ended);
+    }
+
+    FBCAPTURE_STATUS CmafSegmentSink::closeSegment() {
+      if (!segmentFile_)
+        return FBCAPTURE_OK;
+      CLOSE_FILE(segmentFile_);
+
+      auto& segment = segments_.back();
+      segment.complete = true;
+      if (segment.duration > 0) {
+        const auto bandwidth = segmentSize_ * 8 * 10000000 / segment.duration;
+        peakBandwidth_ = max(peakBandwidth_, static_cast<uint32_t>(min<uint64_t>(bandwidth, UINT32_MAX)));
+      }
+
+      expireSegments();
+
+      const auto withDash = true;
+      const auto ended = false;
+      return writeManifests(withDash, ended);
+    }
+
+    void CmafSegmentSink::expireSegments() {
+      while (segments_.size() > kPlaylistSegments && segments_.front().complete) {
+        expired_.push_back(segments_.front().uri);
+        segments_.pop_front();
+      }
+      while (expired_.size() > kRetainedSegments - kPlaylistSegments) {
+        remove((directory_ + expired_.front()).c_str());
+        expired_.pop_front();
+      }
+    }
+
+    FBCAPTURE_STATUS CmafSegmentSink::writeManifests(const bool withDash, const bool ended) {
+      CmafStreamInfo info;
+      info.initUri = initName_;
+      info.mediaTemplate = baseName_ + "_$Number$.m4s";
+      info.codecs = muxer_.codecs();
+      info.muxedAudio = muxer_.hasAudioTrack();
+      info.width = muxer_.width();
+      info.height = muxer_.height();
+      info.bandwidth = peakBandwidth_;
+      info.segmentTarget = kSegmentTargetDuration;
+      info.partTarget = kPartTargetDuration;
+      info.partListSegments = kPartListSegments;
+      info.availabilityStartTime = FormatUtcTime(startWallClock_);
+      info.publishTime = FormatUtcTime(wallClockMillis());
+      info.ended = ended;
+
+      auto status = replaceFile(hlsPath_, BuildHlsPlaylist(info, segments_));
+      if (status == FBCAPTURE_OK && withDash)
+        status = replaceFile(dashPath_, BuildDashManifest(info, segments_));
+      return status;
+    }
+
+    FBCAPTURE_STATUS CmafSegmentSink::replaceFile(const string& path, const string& content) {
+      const auto tempPath = path + ".tmp";
+      FILE* file = NULL;
+      OPEN_FILE(file, tempPath);
+      const auto written = fwrite(content.data(), 1, content.size(), file) == content.size();
+      CLOSE_FILE(file);
+
+#ifdef _WIN32
+      const auto replaced = written && MoveFileExA(tempPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+      const auto replaced = written && rename(tempPath.c_str(), path.c_str()) == 0;
+#endif
+      if (!replaced) {
+        remove(tempPath.c_str());
+        DEBUG_ERROR_VAR("Failed writing manifest", path);
+        return FBCAPTURE_MP4_WRITE_FAILED;
+      }
+      return FBCAPTURE_OK;
+    }
+
+    FBCAPTURE_STATUS CmafSegmentSink::close() {
+      if (!started_)
+        return FBCAPTURE_OK;
+      started_ = false;
+
+      muxer_.endOfStream();
+      auto status = writePart();
+      if (status == FBCAPTURE_OK)
+        status = closeSegment();
+      CLOSE_FILE(segmentFile_);
+
+      // the last manifests stay on disk with the segments they list, for playback after the session
+      if (status == FBCAPTURE_OK && initWritten_) {
+        const auto withDash = true;
+        const auto ended = true;
+        status = writeManifests(withDash, ended);
+      }
+
+      muxer_.reset();
+      return status;
+    }
+  }
+}
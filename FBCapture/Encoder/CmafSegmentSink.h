@@ -0,0 +1,93 @@
+/****************************************************************************************************************
+
+Filename	:	CmafSegmentSink.h
+Content		:	Cuts encoded packets into CMAF segments with rolling HLS and DASH manifests for web playback
+Copyright	:
+
+****************************************************************************************************************/
+
+#pragma once
+
+#include <deque>
+#include <string>
+#include <vector>
+#include <stdio.h>
+
+#include "PacketSink.h"
+#include "Mp4Muxer.h"
+#include "CmafManifest.h"
+
+using namespace std;
+
+namespace FBCapture {
+  namespace Streaming {
+
+    /*
+    * For .m3u8 and .mpd destinations. Writes <name>_init.mp4 and numbered <name>_<n>.m4s fragmented mp4
+    * segments next to both <name>.m3u8 and <name>.mpd, so any static web server can serve the capture to
+    * HLS and DASH players without an RTMP relay.
+    *
+    * Segments start at the first keyframe after kSegmentTargetDuration. Every kPartTargetDuration a moof/mdat
+    * part is appended to the segment being written and listed in the playlist as a byte range of it, which lets
+    * LL-HLS players start on a part instead of waiting for the whole segment. Audio and video share the segments.
+    *
+    * The manifests list the last kPlaylistSegments segments. Segment files are deleted once they are
+    * kRetainedSegments old, so players that loaded an older playlist can still fetch them. Manifests are written
+    * to a temporary file and renamed over the old one, so the web server never serves a half written one.
+    */
+    class CmafSegmentSink : public PacketSink {
+    public:
+      static const uint64_t kSegmentTargetDuration = 20000000;  // 2 sec, in 100 nanosec unit
+      static const uint64_t kPartTargetDuration = 3330000;      // 333 ms
+      static const uint32_t kPlaylistSegments = 6;
+      static const uint32_t kRetainedSegments = 10;
+      static const uint32_t kPartListSegments = 2;             // complete segments that still list their parts
+
+      explicit CmafSegmentSink(const string& manifestPath);
+      ~CmafSegmentSink();
+
+      FBCAPTURE_STATUS open() override;
+      FBCAPTURE_STATUS write(EncodePacket* packet) override;
+      FBCAPTURE_STATUS close() override;
+
+      const char* name() const override {
+        return "CMAF segment sink";
+      }
+
+    private:
+      string directory_;           // with the trailing separator
+      string baseName_;
+      string hlsPath_;
+      string dashPath_;
+      string initName_;
+
+      Mp4Muxer muxer_;
+      Mp4BoxWriter box_;
+      vector<IoVec> iov_;
+
+      FILE* segmentFile_;
+      uint64_t segmentSize_;
+      deque<CmafSegment> segments_;  // listed in the manifests, the last one may still be written
+      deque<string> expired_;        // segment files no longer listed but kept for a while
+      uint32_t nextNumber_;
+      bool initWritten_;
+
+      bool started_;
+      uint64_t segmentStart_;      // packet timestamps
+      uint64_t partStart_;
+      uint64_t lastVideoTimestamp_;
+      uint64_t frameDuration_;
+      uint64_t startWallClock_;    // in millisec since the epoch, when the first keyframe came in
+      uint32_t peakBandwidth_;
+
+      FBCAPTURE_STATUS writePart();
+      FBCAPTURE_STATUS closeSegment();
+      FBCAPTURE_STATUS writeInitSegment();
+      FBCAPTURE_STATUS writeManifests(bool withDash, bool ended);
+      void expireSegments();
+
+      static FBCAPTURE_STATUS replaceFile(const string& path, const string& content);
+      static uint64_t wallClockMillis();
+    };
+  }
+}
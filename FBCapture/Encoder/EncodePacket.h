@@ -1,7 +1,12 @@
 #pragma once
 
+#include <atomic>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "NalParser.h"
 
 using namespace std;
 
@@ -13,11 +18,77 @@ namespace FBCapture {
       VIDEO
     };
 
+    class EncodePacket;
+
+    // Takes back packets whose last reference was released, see PacketPool
+    class EncodePacketRecycler {
+    public:
+      virtual ~EncodePacketRecycler() {}
+      virtual void recycle(EncodePacket* packet) = 0;
+    };
+
+    // Sequence parameter sets of an encoding session. Shared by every video packet of the session
+    // instead of being copied into each one, and freed when the last packet referencing them is released.
+    // A new instance is only made when the parameter sets change. vps is only set for HEVC.
+    class SequenceParams {
+    public:
+      uint8_t *sps, *pps, *vps;
+      uint32_t spsLen, ppsLen, vpsLen;
+
+      SequenceParams(const uint8_t* spsData, uint32_t spsLength, const uint8_t* ppsData, uint32_t ppsLength,
+                     const uint8_t* vpsData = NULL, uint32_t vpsLength = 0) :
+        sps(static_cast<uint8_t*>(malloc(spsLength))),
+        pps(static_cast<uint8_t*>(malloc(ppsLength))),
+        vps(vpsLength > 0 ? static_cast<uint8_t*>(malloc(vpsLength)) : NULL),
+        spsLen(spsLength),
+        ppsLen(ppsLength),
+        vpsLen(vpsLength),
+        refCount_(1) {
+        memcpy(sps, spsData, spsLen);
+        memcpy(pps, ppsData, ppsLen);
+        if (vps)
+          memcpy(vps, vpsData, vpsLen);
+      }
+
+      bool matches(const uint8_t* spsData, uint32_t spsLength, const uint8_t* ppsData, uint32_t ppsLength,
+                   const uint8_t* vpsData = NULL, uint32_t vpsLength = 0) const {
+        return spsLen == spsLength && ppsLen == ppsLength && vpsLen == vpsLength &&
+          memcmp(sps, spsData, spsLen) == 0 && memcmp(pps, ppsData, ppsLen) == 0 &&
+          (vpsLen == 0 || memcmp(vps, vpsData, vpsLen) == 0);
+      }
+
+      bool matches(const SequenceParams& other) const {
+        return matches(other.sps, other.spsLen, other.pps, other.ppsLen, other.vps, other.vpsLen);
+      }
+
+      SequenceParams* addRef() {
+        refCount_.fetch_add(1, memory_order_relaxed);
+        return this;
+      }
+
+      void release() {
+        if (refCount_.fetch_sub(1, memory_order_acq_rel) == 1)
+          delete this;
+      }
+
+    private:
+      atomic<uint32_t> refCount_;
+
+      ~SequenceParams() {
+        free(sps);
+        free(pps);
+        free(vps);
+      }
+    };
+
+    // Reference counted. Whoever holds a packet owns one reference and must release() it instead of deleting it;
+    // the last release hands the packet back to its pool, or deletes it if it wasn't pooled.
     class EncodePacket {
     public:
       PACKET_TYPE packetType;
       uint8_t *buffer;
       uint32_t length;
+      uint32_t capacity;  // allocated size of buffer, which is reused across pooled packets
       uint64_t timestamp;
       uint64_t duration;
       uint32_t frameIdx;
@@ -26,9 +97,12 @@ namespace FBCapture {
         packetType {},
         buffer(NULL),
         length { 0 },
+        capacity { 0 },
         timestamp { 0 },
         duration { 0 },
-        frameIdx { 0 } {}
+        frameIdx { 0 },
+        recycler_(NULL),
+        refCount_ { 1 } {}
 
       virtual ~EncodePacket() {
         free(buffer);
@@ -37,26 +111,92 @@ namespace FBCapture {
       PACKET_TYPE type() const {
         return packetType;
       }
+
+      EncodePacket* addRef() {
+        refCount_.fetch_add(1, memory_order_relaxed);
+        return this;
+      }
+
+      void release() {
+        if (refCount_.fetch_sub(1, memory_order_acq_rel) != 1)
+          return;
+        if (recycler_)
+          recycler_->recycle(this);
+        else
+          delete this;
+      }
+
+      // Makes buffer hold at least size bytes. The contents are only preserved when it grows if keepContents is set.
+      bool reserve(uint32_t size, bool keepContents = false) {
+        if (size <= capacity)
+          return true;
+        if (keepContents) {
+          auto grown = static_cast<uint8_t*>(realloc(buffer, size));
+          if (!grown)
+            return false;
+          buffer = grown;
+          capacity = size;
+          return true;
+        }
+        free(buffer);
+        buffer = static_cast<uint8_t*>(malloc(size));
+        capacity = buffer ? size : 0;
+        return buffer != NULL;
+      }
+
+      // Drops per-frame state before the packet is reused. buffer is kept.
+      virtual void reset() {
+        length = 0;
+        timestamp = 0;
+        duration = 0;
+        frameIdx = 0;
+      }
+
+    private:
+      template<class T> friend class PacketPool;
+
+      EncodePacketRecycler* recycler_;
+      atomic<uint32_t> refCount_;
     };
 
+    // buffer holds the frame in AVCC form, every NAL unit prefixed with its 4 byte big endian length
     class VideoEncodePacket : public EncodePacket {
     public:
+      VIDEO_CODEC codec;
       bool isKeyframe;
-      uint8_t *sps, *pps;
-      uint32_t spsLen, ppsLen;
+      SequenceParams* seqParams;  // referenced, may be NULL if the encoder hasn't reported them
+      vector<NalUnit> nals;  // NAL units of the frame, so sinks don't have to scan the buffer again
 
       VideoEncodePacket():
+        codec{VIDEO_CODEC::H264},
         isKeyframe{false},
-        sps(NULL),
-        pps(NULL),
-        spsLen(0),
-        ppsLen(0) {
+        seqParams(NULL) {
         packetType = PACKET_TYPE::VIDEO;
       }
 
       ~VideoEncodePacket() {
-        free(sps);
-        free(pps);
+        if (seqParams)
+          seqParams->release();
+      }
+
+      // False for disposable frames, whose slices no other frame references
+      bool isReference() const {
+        for (const auto& nal : nals) {
+          const auto isSlice = codec == VIDEO_CODEC::HEVC ?
+            nal.type <= HEVC_NAL_VCL_END : nal.type == NAL_SLICE || nal.type == NAL_IDR_SLICE;
+          if (isSlice && nal.refIdc != 0)
+            return true;
+        }
+        return nals.empty();
+      }
+
+      void reset() override {
+        EncodePacket::reset();
+        isKeyframe = false;
+        nals.clear();
+        if (seqParams)
+          seqParams->release();
+        seqParams = NULL;
       }
     };
 
@@ -72,6 +212,16 @@ namespace FBCapture {
       ~AudioEncodePacket() {}
 
       uint32_t profileLevel, sampleRate, numChannels;
+
+      // samplingFrequencyIndex of the AudioSpecificConfig
+      uint32_t sampleRateIndex() const {
+        static const uint32_t kSampleRates[] = { 96000, 88200, 64000, 48000, 44100, 32000, 24000, 22050, 16000, 12000, 11025, 8000, 7350 };
+        for (uint32_t i = 0; i < sizeof(kSampleRates) / sizeof(kSampleRates[0]); i++) {
+          if (kSampleRates[i] == sampleRate)
+            return i;
+        }
+        return 3;  // 48 kHz, what MFAudioEncoder outputs
+      }
     };
   }
-}
\ No newline at end of file
+}
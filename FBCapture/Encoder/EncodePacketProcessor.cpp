@@ -14,21 +14,59 @@ namespace FBCapture {
   namespace Streaming {
 
     EncodePacketProcessor::EncodePacketProcessor() :
-      flvPacketizer_(NULL),
-      rtmp_(NULL),
+      defaultSinkCount_(0),
+      rtmpSink_(NULL),
+      abrDelegate_(NULL),
+      abrMaxBitrate_(0),
+      abr_(NULL),
+      mp4Fps_(0),
+      mp4ExpectedDuration_(kDefaultMp4Duration),
+      mp4FragmentInterval_(0),
       destinationUrl_(NULL),
       flvOutputPath_(NULL),
+      sdpOutputPath_(NULL),
+      manifestOutputPath_(NULL),
       mp4OutputPath_(NULL),
-      h264OutputPath_(NULL),
-      aacOutputPath_(NULL),
-      h264File_(NULL),
-      aacFile_(NULL),
-      flvFile_(NULL),
-      avcSeqHdrSet_(false),
-      aacSeqHdrSet_(false) {}
+      muxThread_(NULL),
+      muxStopRequested_(false),
+      muxFlushRequested_(false),
+      muxStatus_(FBCAPTURE_OK) {
+      for (auto& ring : rings_)
+        ring.initialize(kPacketRingCapacity);
+      for (auto& ended : streamEnded_)
+        ended = false;
+    }
 
     EncodePacketProcessor::~EncodePacketProcessor() {
       release();
+
+      for (auto sink : sinks_)
+        delete sink;
+      sinks_.clear();
+    }
+
+    FBCAPTURE_STATUS EncodePacketProcessor::addSink(PacketSink* sink, const SINK_OVERFLOW_POLICY policy) {
+      if (muxThread_) {
+        delete sink;
+        return FBCAPTURE_INVALID_FUNCTION_CALL;
+      }
+
+      sinks_.push_back(new SinkWorker(sink, kSinkQueueCapacity, policy));
+      return FBCAPTURE_OK;
+    }
+
+    void EncodePacketProcessor::enableAdaptiveBitrate(AbrControllerDelegate* delegate, const uint32_t maxBitrate) {
+      abrDelegate_ = delegate;
+      abrMaxBitrate_ = maxBitrate;
+    }
+
+    void EncodePacketProcessor::reserveMp4Movie(const uint32_t fps, const uint32_t expectedDuration) {
+      mp4Fps_ = fps;
+      mp4ExpectedDuration_ = expectedDuration > 0 ? expectedDuration : kDefaultMp4Duration;
+    }
+
+    void EncodePacketProcessor::enableMp4Fragments(const uint32_t interval) {
+      mp4FragmentInterval_ = interval;
     }
 
     FBCAPTURE_STATUS EncodePacketProcessor::initialize(const DESTINATION_URL dstUrl) {
@@ -36,171 +74,264 @@ namespace FBCapture {
       if (status != FBCAPTURE_OK)
         return status;
 
-      if (rtmp_) {
-        status = rtmp_->initialize(destinationUrl_);
+      for (auto sink : sinks_) {
+        status = sink->start();
         if (status != FBCAPTURE_OK)
           return status;
-
-        uint8_t* flvHeader = nullptr;
-        const auto haveAudio = true;
-        const auto haveVideo = true;
-        status = flvPacketizer_->getFlvHeader(haveAudio, haveVideo, &flvHeader);
-        if (status != FBCAPTURE_OK) {
-          DEBUG_ERROR("Failed getting FLV header");
-          return status;
-        }
-
-        fwrite(flvHeader, FLV_HEADER_SIZE, sizeof(uint8_t), flvFile_);
-        status = rtmp_->sendFlvPacket(reinterpret_cast<const char*>(flvHeader), FLV_HEADER_SIZE);
-        if (status != FBCAPTURE_OK)
-          return status;
-
-        free(flvHeader);
       }
 
-      avcSeqHdrSet_ = false;
-      aacSeqHdrSet_ = false;
+      startMuxThread();
 
       return status;
     }
 
     FBCAPTURE_STATUS EncodePacketProcessor::onPacket(EncodePacket* packet) {
-      auto status = FBCAPTURE_UNKNOWN_ENCODE_PACKET_TYPE;
-      if (packet->type() == PACKET_TYPE::VIDEO)
-        status = processVideoPacket(dynamic_cast<VideoEncodePacket*>(packet));
-      else if (packet->type() == PACKET_TYPE::AUDIO)
-        status = processAudioPacket(dynamic_cast<AudioEncodePacket*>(packet));
-      return status;
+      const FBCAPTURE_STATUS muxStatus = muxStatus_;
+      if (muxStatus != FBCAPTURE_OK || !muxThread_) {
+        packet->release();
+        return muxStatus != FBCAPTURE_OK ? muxStatus : FBCAPTURE_THREAD_NOT_INITIALIZED;
+      }
+
+      // Apply backpressure to the encoder thread if the mux thread falls a full ring behind
+      auto& ring = rings_[ringIndex(packet->type())];
+      while (!ring.push(packet)) {
+        if (muxStopRequested_.load()) {
+          packet->release();
+          return FBCAPTURE_OK;
+        }
+        unique_lock<mutex> lock(muxMtx_);
+        spaceCv_.wait_for(lock, chrono::milliseconds(kMuxIdleWaitMs));
+      }
+
+      notifyMux();
+      return FBCAPTURE_OK;
     }
 
-    FBCAPTURE_STATUS EncodePacketProcessor::processVideoPacket(VideoEncodePacket* packet) {
-      auto status = FBCAPTURE_OK;
+    void EncodePacketProcessor::onStreamEnd(const PACKET_TYPE type) {
+      streamEnded_[ringIndex(type)] = true;
+      notifyMux();
+    }
 
-      fwrite(packet->buffer, 1, packet->length, h264File_);
+    void EncodePacketProcessor::notifyMux() {
+      // Taking the lock orders the notification after a waiter's predicate check
+      { lock_guard<mutex> lock(muxMtx_); }
+      muxCv_.notify_one();
+    }
 
-      if (rtmp_) {
-        if (!avcSeqHdrSet_) {
-          uint8_t* avcHdrPacket;
-          status = flvPacketizer_->getAvcSeqHeaderTag(packet->sps, packet->spsLen, packet->pps, packet->ppsLen, &avcHdrPacket);
-          if (status != FBCAPTURE_OK)
-            return status;
+    bool EncodePacketProcessor::hasPendingPackets() const {
+      return !rings_[0].empty() || !rings_[1].empty();
+    }
 
-          fwrite(avcHdrPacket, 1, sizeof(avcHdrPacket), flvFile_);
-          status = rtmp_->sendFlvPacket(reinterpret_cast<const char*>(avcHdrPacket), sizeof(avcHdrPacket));
-          if (status != FBCAPTURE_OK)
-            return status;
-          avcSeqHdrSet_ = true;
-          free(avcHdrPacket);
-        }
+    void EncodePacketProcessor::startMuxThread() {
+      muxStopRequested_ = false;
+      muxFlushRequested_ = false;
+      muxStatus_ = FBCAPTURE_OK;
+      for (auto& ended : streamEnded_)
+        ended = false;
 
-        uint8_t* flvDataPacket;
-        status = flvPacketizer_->getAvcDataTag(packet->buffer, packet->length, packet->timestamp, packet->isKeyframe, &flvDataPacket);
-        if (status != FBCAPTURE_OK)
-          return status;
+      if (!muxThread_)
+        muxThread_ = new thread([this] { this->runMux(); });
+    }
 
-        fwrite(flvDataPacket, 1, sizeof(flvDataPacket), flvFile_);
-        rtmp_->sendFlvPacket(reinterpret_cast<const char*>(flvDataPacket), sizeof(flvDataPacket));
-        if (status != FBCAPTURE_OK)
-          return status;
-        free(flvDataPacket);
+    void EncodePacketProcessor::stopMuxThread(const bool flush) {
+      if (flush)
+        muxFlushRequested_ = true;
+      else
+        muxStopRequested_ = true;
+      notifyMux();
+      spaceCv_.notify_all();
+
+      if (muxThread_) {
+        if (muxThread_->joinable())
+          muxThread_->join();
+        delete muxThread_;
+        muxThread_ = nullptr;
       }
 
-      return status;
+      // Anything left behind was dropped by a non-flushing stop
+      EncodePacket* packet;
+      for (auto& ring : rings_) {
+        while (ring.pop(&packet))
+          packet->release();
+      }
     }
 
-    FBCAPTURE_STATUS EncodePacketProcessor::processAudioPacket(AudioEncodePacket* packet) {
-      auto status = FBCAPTURE_OK;
+    /*
+     * Picks the stream to write next. With both rings non-empty the older timestamp wins. With only one
+     * stream queued we hold off, since the other stream may still deliver an older packet, unless that
+     * stream has ended, we are flushing, or the queued ring is half full and needs to make room.
+     */
+    bool EncodePacketProcessor::nextPacketType(PACKET_TYPE* type) const {
+      EncodePacket* video = nullptr;
+      EncodePacket* audio = nullptr;
+      const auto haveVideo = rings_[ringIndex(PACKET_TYPE::VIDEO)].peek(&video);
+      const auto haveAudio = rings_[ringIndex(PACKET_TYPE::AUDIO)].peek(&audio);
+
+      if (haveVideo && haveAudio) {
+        *type = audio->timestamp < video->timestamp ? PACKET_TYPE::AUDIO : PACKET_TYPE::VIDEO;
+        return true;
+      }
 
-      if (aacFile_) // TODO: remove if check once aac archive fixed
-        fwrite(packet->buffer, 1, packet->length, aacFile_);
+      if (!haveVideo && !haveAudio)
+        return false;
 
-      if (rtmp_) {
-        if (!aacSeqHdrSet_) {
-          uint8_t* aacHdrPacket;
-          status = flvPacketizer_->getAacSeqHeaderTag(packet->profileLevel, packet->numChannels, packet->timestamp, &aacHdrPacket);
-          if (status != FBCAPTURE_OK)
-            return status;
+      *type = haveVideo ? PACKET_TYPE::VIDEO : PACKET_TYPE::AUDIO;
+      const auto other = haveVideo ? PACKET_TYPE::AUDIO : PACKET_TYPE::VIDEO;
+      const auto& ring = rings_[ringIndex(*type)];
+      return muxFlushRequested_.load() ||
+        streamEnded_[ringIndex(other)].load() ||
+        ring.size() >= ring.capacity() / 2;
+    }
+
+    void EncodePacketProcessor::runMux() {
+      while (!muxStopRequested_.load()) {
+        PACKET_TYPE type;
+        if (!nextPacketType(&type)) {
+          if (muxFlushRequested_.load() && !hasPendingPackets())
+            break;
+
+          unique_lock<mutex> lock(muxMtx_);
+          muxCv_.wait_for(lock, chrono::milliseconds(kMuxIdleWaitMs), [this, &type] {
+            return muxStopRequested_.load() || muxFlushRequested_.load() || nextPacketType(&type);
+          });
+          continue;
+        }
+
+        EncodePacket* packet = nullptr;
+        rings_[ringIndex(type)].pop(&packet);
 
-          fwrite(aacHdrPacket, 1, sizeof(aacHdrPacket), flvFile_);
-          rtmp_->sendFlvPacket(reinterpret_cast<const char*>(aacHdrPacket), sizeof(aacHdrPacket));
+        // Keep draining after a failure so the encoder threads never block on a full ring;
+        // the failure is reported to them through onPacket()
+        if (muxStatus_ == FBCAPTURE_OK) {
+          const auto status = processPacket(packet);
           if (status != FBCAPTURE_OK)
-            return status;
-          aacSeqHdrSet_ = true;
-          free(aacHdrPacket);
+            muxStatus_ = status;
         }
+        if (abr_ && !rtmpSink_->isDetached()) {
+          const auto now = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now().time_since_epoch());
+          abr_->update(rtmpSink_->queueStats(), now.count());
+        }
+        packet->release();
+        spaceCv_.notify_one();
+      }
+    }
 
-        uint8_t* flvDataPacket;
-        status = flvPacketizer_->getAacDataTag(packet->buffer, packet->length, packet->timestamp, &flvDataPacket);
-        if (status != FBCAPTURE_OK)
-          return status;
+    FBCAPTURE_STATUS EncodePacketProcessor::processPacket(EncodePacket* packet) {
+      if (packet->type() != PACKET_TYPE::VIDEO && packet->type() != PACKET_TYPE::AUDIO)
+        return FBCAPTURE_UNKNOWN_ENCODE_PACKET_TYPE;
 
-        fwrite(flvDataPacket, 1, sizeof(flvDataPacket), flvFile_);
-        rtmp_->sendFlvPacket(reinterpret_cast<const char*>(flvDataPacket), sizeof(flvDataPacket));
-        if (status != FBCAPTURE_OK)
+      // every sink queues its own reference to the same packet
+      for (auto sink : sinks_) {
+        if (sink->isDetached())
+          continue;
+
+        const auto status = sink->submit(packet);
+        if (status == FBCAPTURE_OK)
+          continue;
+        if (sink->policy() != SINK_OVERFLOW_POLICY::DROP)
           return status;
-        free(flvDataPacket);
+
+        // A sink allowed to drop packets is best effort, like a live stream that gave up reconnecting.
+        // Losing it mustn't cost the archive and the other outputs.
+        DEBUG_ERROR_VAR(string("Detaching failed ") + sink->sink()->name(), to_string(status));
+        sink->detach();
       }
+      return FBCAPTURE_OK;
+    }
 
-      return status;
+    void EncodePacketProcessor::stopSinks(const bool flush) {
+      for (auto sink : sinks_)
+        sink->stop(flush);
     }
 
     FBCAPTURE_STATUS EncodePacketProcessor::openOutputFiles(const DESTINATION_URL url) {
       ConvertToByte(const_cast<wchar_t*>(url), &destinationUrl_);
 
+      // The default sinks go first so custom sinks added with addSink() can't hold back the archive
+      vector<SinkWorker*> sinks;
+
       if (IsStreamingUrl(url)) {
         mp4OutputPath_ = new string(GetDefaultOutputPath(kMp4Ext).c_str());
-        rtmp_ = new LibRTMP();
-        flvPacketizer_ = new FlvPacketizer();
         flvOutputPath_ = new string(ChangeFileExt(*mp4OutputPath_, kMp4Ext, kFlvExt));
-        OPEN_FILE(flvFile_, (*flvOutputPath_));
+        sinks.push_back(new SinkWorker(new FlvFileSink(flvOutputPath_), kSinkQueueCapacity, SINK_OVERFLOW_POLICY::BLOCK));
+        if (wcscmp(GetUrlType(url), kRtp) == 0) {
+          // UDP never pushes back, so there is no backlog for the bitrate to adapt to
+          sdpOutputPath_ = new string(ChangeFileExt(*mp4OutputPath_, kMp4Ext, kSdpExt));
+          sinks.push_back(new SinkWorker(new RtpSink(destinationUrl_, sdpOutputPath_), kSinkQueueCapacity, SINK_OVERFLOW_POLICY::DROP));
+        } else {
+          rtmpSink_ = new SinkWorker(new RtmpSink(destinationUrl_), kSinkQueueCapacity, SINK_OVERFLOW_POLICY::DROP);
+          sinks.push_back(rtmpSink_);
+          if (abrDelegate_)
+            abr_ = new AbrController(abrDelegate_, abrMaxBitrate_, abrMaxBitrate_ / kAbrMinBitrateDivisor);
+        }
+      } else if (IsSegmentedUrl(url)) {
+        // the segments are the output, there is no mp4
+        manifestOutputPath_ = new string(destinationUrl_);
+        sinks.push_back(new SinkWorker(new CmafSegmentSink(*manifestOutputPath_), kSinkQueueCapacity, SINK_OVERFLOW_POLICY::BLOCK));
       } else
         mp4OutputPath_ = new string(destinationUrl_);
 
-      h264OutputPath_ = new string(ChangeFileExt(*mp4OutputPath_, kMp4Ext, kH264Ext));
-      OPEN_FILE(h264File_, (*h264OutputPath_));
+      if (mp4OutputPath_) {
+        const auto layout = mp4FragmentInterval_ > 0 ? MP4_LAYOUT::FRAGMENTED : MP4_LAYOUT::FASTSTART;
+        const auto reservedMovieSize = Mp4Muxer::estimateMovieSize(mp4Fps_, mp4ExpectedDuration_, Mp4FileSink::kChunkDuration);
+        const auto fragmentDuration = static_cast<uint64_t>(mp4FragmentInterval_) * 10000000;  // in 100 nanosec unit
+        const auto sink = new Mp4FileSink(mp4OutputPath_, layout, reservedMovieSize, fragmentDuration);
+        sinks.insert(sinks.begin(), new SinkWorker(sink, kSinkQueueCapacity, SINK_OVERFLOW_POLICY::BLOCK));
+      }
 
-      aacOutputPath_ = new string(ChangeFileExt(*mp4OutputPath_, kMp4Ext, kAacExt));
-      // TODO: archive aac packets here instead from MFAudioEncoder
-      // OPEN_FILE(aacFile_, (*aacOutputPath_));
+      sinks_.insert(sinks_.begin(), sinks.begin(), sinks.end());
+      defaultSinkCount_ = static_cast<uint32_t>(sinks.size());
 
       return FBCAPTURE_OK;
     }
 
     const string* EncodePacketProcessor::getOutputPath(FILE_EXT ext) const {
-      if (ext.compare(kH264Ext) == 0)
-        return h264OutputPath_;
-      else if (ext.compare(kAacExt) == 0)
-        return aacOutputPath_;
-      else if (ext.compare(kFlvExt) == 0)
+      if (ext.compare(kFlvExt) == 0)
         return flvOutputPath_;
+      else if (ext.compare(kSdpExt) == 0)
+        return sdpOutputPath_;
       else if (ext.compare(kMp4Ext) == 0)
         return mp4OutputPath_;
+      else if (ext.compare(kM3u8Ext) == 0 || ext.compare(kMpdExt) == 0)
+        return manifestOutputPath_;
       else
         return nullptr;
     }
 
     void EncodePacketProcessor::finalize() {
-      CLOSE_FILE(h264File_);
-      CLOSE_FILE(aacFile_);
-      CLOSE_FILE(flvFile_);
-      if (rtmp_)
-        rtmp_->close();
+      stopMuxThread(true);
+      stopSinks(true);
     }
 
     void EncodePacketProcessor::release() {
-      finalize();
-
-      REMOVE_FILE(h264OutputPath_);
-      REMOVE_FILE(aacOutputPath_);
-      REMOVE_FILE(flvOutputPath_);
-
-      if (flvPacketizer_)
-        delete flvPacketizer_;
-      flvPacketizer_ = nullptr;
-
-      if (rtmp_)
-        delete rtmp_;
-      rtmp_ = nullptr;
+      stopMuxThread(false);
+      stopSinks(false);
+
+      // The default sinks point at the output paths below, so they go with them. Custom sinks stay registered.
+      for (uint32_t i = 0; i < defaultSinkCount_; i++)
+        delete sinks_[i];
+      sinks_.erase(sinks_.begin(), sinks_.begin() + defaultSinkCount_);
+      defaultSinkCount_ = 0;
+      rtmpSink_ = nullptr;
+
+      if (abr_)
+        delete abr_;
+      abr_ = nullptr;
+
+      // the flv is the archive of the stream, with the metadata and keyframe index written at close
+      if (flvOutputPath_)
+        delete flvOutputPath_;
+      flvOutputPath_ = nullptr;
+
+      // receivers keep reading the SDP after the session
+      if (sdpOutputPath_)
+        delete sdpOutputPath_;
+      sdpOutputPath_ = nullptr;
+
+      // the segments and manifests are served after the session
+      if (manifestOutputPath_)
+        delete manifestOutputPath_;
+      manifestOutputPath_ = nullptr;
 
       if (destinationUrl_)
         delete destinationUrl_;
@@ -208,9 +339,6 @@ namespace FBCapture {
       if (mp4OutputPath_)
         delete mp4OutputPath_;
       mp4OutputPath_ = nullptr;
-
-      avcSeqHdrSet_ = false;
-      aacSeqHdrSet_ = false;
     }
 
   }
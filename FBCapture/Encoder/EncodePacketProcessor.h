@@ -8,50 +8,124 @@ Copyright	:
 
 #pragma once
 
-#include "LibRTMP.h"
+#include <thread>
+#include <mutex>
+#include <vector>
+#include <condition_variable>
+
 #include "FBCaptureEncoderModule.h"
-#include "FlvPacketizer.h"
+#include "RtmpSink.h"
+#include "RtpSink.h"
+#include "FlvSink.h"
+#include "Mp4FileSink.h"
+#include "CmafSegmentSink.h"
+#include "SinkWorker.h"
+#include "AbrController.h"
 #include "FileUtil.h"
+#include "PacketRing.h"
 
 using namespace std;
 
 namespace FBCapture {
   namespace Streaming {
 
+    /*
+    * Encoders hand their packets to onPacket() on their own threads. Each packet type has its own
+    * bounded SPSC ring, and a single mux thread drains both rings in timestamp order so that the
+    * file/RTMP writes never run on an encoder thread and the FLV output is correctly interleaved.
+    *
+    * The mux thread then fans each packet out to every PacketSink. Each sink has its own bounded queue
+    * and worker thread (SinkWorker), so a slow RTMP connection doesn't hold back local archiving.
+    * A failed SINK_OVERFLOW_POLICY::BLOCK sink fails the session, a failed DROP sink is detached and the others carry on.
+    * With adaptive bitrate enabled, the mux thread also feeds the RTMP sink's backlog to an AbrController.
+    * Mp4 output is muxed while the session runs, faststart or crash safe fragments, .m3u8 and .mpd destinations get CMAF segments and manifests instead.
+    */
     class EncodePacketProcessor : public EncodePacketProcessorDelegate {
     public:
+      static const uint32_t kPacketRingCapacity = 64;           // ~1 sec of 60 fps video
+      static const uint32_t kMuxIdleWaitMs = 10;
+      static const uint32_t kSinkQueueCapacity = 128;          // ~1 sec of 60 fps video with audio
+      static const uint32_t kAbrMinBitrateDivisor = 4;         // adaptive bitrate goes down to a quarter of the configured one
+      static const uint32_t kDefaultMp4Duration = 600;         // 10 min, in sec
       EncodePacketProcessor();
       ~EncodePacketProcessor();
 
+      // Adds a custom output next to the default ones. Takes ownership of sink. Must be called before initialize().
+      FBCAPTURE_STATUS addSink(PacketSink* sink, SINK_OVERFLOW_POLICY policy);
+
+      // Lets streaming sessions lower the video bitrate below maxBitrate while the RTMP connection can't keep up.
+      // Must be called before initialize().
+      void enableAdaptiveBitrate(AbrControllerDelegate* delegate, uint32_t maxBitrate);
+
+      // Sizes the space reserved for the mp4 moov from the video frame rate and the expected capture length in sec,
+      // kDefaultMp4Duration if 0. Must be called before initialize().
+      void reserveMp4Movie(uint32_t fps, uint32_t expectedDuration);
+
+      // Writes the mp4 as fragments flushed at least every interval sec, so it survives a crash. 0 writes it faststart.
+      // Must be called before initialize().
+      void enableMp4Fragments(uint32_t interval);
+
       FBCAPTURE_STATUS initialize(DESTINATION_URL dstUrl);
+
+      // True if initialize() started a session whose video bitrate follows the RTMP connection
+      bool isAdaptiveBitrate() const {
+        return abr_ != nullptr;
+      }
+
       const string* getOutputPath(FILE_EXT ext) const;
       void finalize();
       void release();
 
     protected:
-      FlvPacketizer* flvPacketizer_;
-      LibRTMP* rtmp_;
+      vector<SinkWorker*> sinks_;                // default sinks first, then the ones added with addSink()
+      uint32_t defaultSinkCount_;
+      SinkWorker* rtmpSink_;                     // one of the default sinks, NULL unless streaming
+
+      AbrControllerDelegate* abrDelegate_;
+      uint32_t abrMaxBitrate_;
+      AbrController* abr_;                       // only touched by the mux thread while it runs
+
+      uint32_t mp4Fps_;
+      uint32_t mp4ExpectedDuration_;
+      uint32_t mp4FragmentInterval_;
 
       char* destinationUrl_;
 
       string* flvOutputPath_;               // flv muxing output path
+      string* sdpOutputPath_;               // session description of rtp:// streams
+      string* manifestOutputPath_;          // .m3u8 or .mpd of segmented output, NULL otherwise
       string* mp4OutputPath_;               // mp4 muxing output path
-      string* h264OutputPath_;              // input to transmuxer for video stream
-      string* aacOutputPath_;               // input to transmuxer for audio stream
 
-      FILE* h264File_;
-      FILE* aacFile_;
-      FILE* flvFile_;
+      // one ring per PACKET_TYPE, indexed with ringIndex()
+      PacketRing<EncodePacket*> rings_[2];
+      atomic<bool> streamEnded_[2];
 
-      bool avcSeqHdrSet_;
-      bool aacSeqHdrSet_;
+      thread* muxThread_;
+      mutex muxMtx_;
+      condition_variable muxCv_;                 // signalled when a packet is pushed or the mux is asked to stop
+      condition_variable spaceCv_;               // signalled when the mux thread frees a ring slot
+      atomic<bool> muxStopRequested_;            // stop immediately, dropping queued packets
+      atomic<bool> muxFlushRequested_;           // stop once every queued packet has been written
+      atomic<FBCAPTURE_STATUS> muxStatus_;       // first failure on the mux thread, reported back on onPacket()
 
       FBCAPTURE_STATUS openOutputFiles(DESTINATION_URL url);
-      FBCAPTURE_STATUS processVideoPacket(VideoEncodePacket* packet);
-      FBCAPTURE_STATUS processAudioPacket(AudioEncodePacket* packet);
+      FBCAPTURE_STATUS processPacket(EncodePacket* packet);
+      void stopSinks(bool flush);
+
+      void startMuxThread();
+      void stopMuxThread(bool flush);
+      void runMux();
+      bool nextPacketType(PACKET_TYPE* type) const;
+      bool hasPendingPackets() const;
+      void notifyMux();
+
+      static uint32_t ringIndex(PACKET_TYPE type) {
+        return type == PACKET_TYPE::VIDEO ? 0 : 1;
+      }
 
       /* EncodePacketProcessorDelegate */
       virtual FBCAPTURE_STATUS onPacket(EncodePacket* packet) override;
+      virtual void onStreamEnd(PACKET_TYPE type) override;
     };
   }
 }
\ No newline at end of file
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <stddef.h>
 #include <stdint.h>
 
 #ifdef __cplusplus
@@ -17,7 +18,10 @@ extern "C" {
         mute(false),
         mixMic(false),
         useRiftAudioSources(false),
-        enableAsyncMode(false) {}
+        enableAsyncMode(false),
+        useHevc(false),
+        expectedDuration(0),
+        fragmentInterval(0) {}
 
       // Encoding option [required]
       uint32_t bitrate;
@@ -34,7 +38,22 @@ extern "C" {
 
       // Enable async encoding mode for non-blocking FBCaptureEncodeFrame() call [optional]
       bool enableAsyncMode;
+
+      // Encode HEVC instead of H.264, written as hvc1 mp4 and CMAF segments, sent as enhanced RTMP 'hvc1' video or RFC 7798 RTP [optional]
+      bool useHevc;
+
+      // Expected capture length in seconds, sizes the space reserved ahead of the media data for the mp4 moov.
+      // 0 reserves for 10 minutes. Longer captures still play, with the moov at the end of the file [optional]
+      uint32_t expectedDuration;
+
+      // Seconds between flushes of the mp4 as moof/mdat fragments instead of writing it faststart. A crashed or killed
+      // capture then leaves an mp4 that plays up to at most this many seconds before the end. 0 disables it [optional]
+      uint32_t fragmentInterval;
     };
+
+    // CaptureConfig.cs mirrors this layout for the Unity plugin, keep the two in step
+    static_assert(offsetof(FBCaptureConfig, expectedDuration) == 20, "CaptureConfig.cs expects expectedDuration at offset 20");
+    static_assert(offsetof(FBCaptureConfig, fragmentInterval) == 24, "CaptureConfig.cs expects fragmentInterval at offset 24");
   }
 
 #ifdef __cplusplus
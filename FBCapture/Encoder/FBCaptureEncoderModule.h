@@ -20,6 +20,8 @@ namespace FBCapture {
     public:
       virtual ~EncodePacketProcessorDelegate() = default;
       virtual FBCAPTURE_STATUS onPacket(EncodePacket* packet) = 0;
+      // called once the encoder of the given type will not produce any more packets
+      virtual void onStreamEnd(PACKET_TYPE type) {}
     };
 
     class FBCaptureEncoderModule : public FBCaptureModule {
@@ -50,9 +52,7 @@ namespace FBCapture {
       FBCAPTURE_STATUS process() override {
         EncodePacket* packet;
         auto status = getPacket(&packet);
-        if (status == FBCAPTURE_ENCODER_NEED_MORE_INPUT)
-          return FBCAPTURE_OK;
-
+        // FBCAPTURE_ENCODER_NEED_MORE_INPUT is passed through so run() can wait for the next signal
         if (status == FBCAPTURE_OK)
           status = processor_->onPacket(packet);
         return status;
@@ -62,6 +62,7 @@ namespace FBCapture {
         const auto status = finalize();
         if (status != FBCAPTURE_OK)
           main_->onFailure(status);
+        processor_->onStreamEnd(type());
         dynamic_cast<FBCaptureEncoderDelegate*>(main_)->onFinish(type());
         isRunning_ = false;
         return status;
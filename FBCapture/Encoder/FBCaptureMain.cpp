@@ -17,7 +17,7 @@ namespace FBCapture {
     videoEncoder_(NULL),
     imageEncoder_(NULL),
     processor_(NULL),
-    transmuxer_(NULL),
+    videoCodec_(VIDEO_CODEC::H264),
     terminateSignaled_(false),
     terminateStatus_(FBCAPTURE_OK),
     videoFinished_(false),
@@ -33,8 +33,6 @@ namespace FBCapture {
       delete imageEncoder_;
     if (processor_)
       delete processor_;
-    if (transmuxer_)
-      delete transmuxer_;
     release();
   }
 
@@ -42,16 +40,20 @@ namespace FBCapture {
     if (sessionStatus_ != FBCAPTURE_OK)
       return FBCAPTURE_INVALID_FUNCTION_CALL;
 
+    videoCodec_ = config->useHevc ? VIDEO_CODEC::HEVC : VIDEO_CODEC::H264;
+
     processor_ = new EncodePacketProcessor();
     videoEncoder_ = new VideoEncoder(this, processor_,
                                     graphicsCardType, device,
-                                    config->bitrate, config->fps, config->gop,
+                                    config->bitrate, config->fps, config->gop, videoCodec_,
                                     config->flipTexture, config->enableAsyncMode);
+    processor_->enableAdaptiveBitrate(videoEncoder_, config->bitrate);
+    processor_->reserveMp4Movie(config->fps, config->expectedDuration);
+    processor_->enableMp4Fragments(config->fragmentInterval);
     audioEncoder_ = new AudioEncoder(this, processor_,
                                     config->mute, config->mixMic, config->useRiftAudioSources);
     imageEncoder_ = new ImageEncoder(this,
                                     graphicsCardType, device, true);
-    transmuxer_ = new Transmuxer(this, true);
 
     sessionStatus_ = FBCAPTURE_SESSION_INITIALIZED;
     return FBCAPTURE_OK;
@@ -67,22 +69,15 @@ namespace FBCapture {
     if (status != FBCAPTURE_OK)
       goto exit;
 
+    videoEncoder_->setAdaptiveBitrate(processor_->isAdaptiveBitrate());
     status = videoEncoder_->start();
     if (status != FBCAPTURE_OK)
       goto exit;
 
-    const auto path = processor_->getOutputPath(kAacExt);
-    audioEncoder_->setOutputPath(path);
     status = audioEncoder_->start();
     if (status != FBCAPTURE_OK)
       goto exit;
 
-    status = transmuxer_->setInput(processor_->getOutputPath(kH264Ext),
-                                  processor_->getOutputPath(kAacExt),
-                                  processor_->getOutputPath(kMp4Ext));
-    if (status != FBCAPTURE_OK)
-      goto exit;
-
     activeSessionId_.increment();
     sessionStatus_ = FBCAPTURE_SESSION_ACTIVE;
 
@@ -197,12 +192,10 @@ namespace FBCapture {
         break;
     }
 
+    // the outputs are complete once the sinks are flushed
     if (videoFinished_.load() && audioFinished_.load()) {
       processor_->finalize();
-
-      const auto status = transmuxer_->start();
-      if (status != FBCAPTURE_OK)
-        onFailure(status);
+      onFinish();
     }
   }
 
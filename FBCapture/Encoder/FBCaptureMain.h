@@ -7,12 +7,10 @@
 #include "VideoEncoder.h"
 #include "AudioEncoder.h"
 #include "ImageEncoder.h"
-#include "Transmuxer.h"
 #include "FrameCounter.h"
 
 using namespace FBCapture::Audio;
 using namespace FBCapture::Video;
-using namespace FBCapture::Mux;
 using namespace FBCapture::Streaming;
 
 namespace FBCapture {
@@ -54,8 +52,7 @@ namespace FBCapture {
     // and processes (saving to file_, streaming) the encoded video/audio encoded packets onPacket() callback
     EncodePacketProcessor* processor_;
 
-    // muxes the h264 and aac audio, mux to mp4 then inject spherical video metadata
-    Transmuxer* transmuxer_;
+    VIDEO_CODEC videoCodec_;
 
     FrameCounter frameCounter_;
 
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <thread>
+#include <chrono>
 #include <condition_variable>
 #include <mutex>
 #include <atomic>
@@ -28,6 +29,9 @@ namespace FBCapture {
     bool enableAsyncMode_;  // if true, runs process() on a separate thread and
                             // delegates the result to the main asynchronously
                             // for non-blocking operation. default true.
+    atomic<bool> signaled_; // set by signal() when new input is ready for process()
+    chrono::milliseconds period_;  // if non-zero, an idle module also wakes up on this period
+                                   // to poll sources that can't signal readiness. default 0.
 
   public:
     explicit FBCaptureModule(FBCaptureDelegate *delegate) :
@@ -35,6 +39,8 @@ namespace FBCapture {
       stopRequested_(false),
       isRunning_(false),
       enableAsyncMode_(true),
+      signaled_(false),
+      period_(0),
       main_(delegate) {}
 
     virtual ~FBCaptureModule() {
@@ -65,8 +71,10 @@ namespace FBCapture {
         return status;
 
       stopRequested_ = true;
-      if (enableAsyncMode_)
+      if (enableAsyncMode_) {
+        signal();
         return status;
+      }
 
       return finish();
     }
@@ -85,6 +93,15 @@ namespace FBCapture {
       return isRunning_;
     }
 
+    // Wakes up an idle module thread because new input is ready for process()
+    void signal() {
+      {
+        lock_guard<mutex> lock(mtx_);
+        signaled_ = true;
+      }
+      cv_.notify_one();
+    }
+
   protected:
     FBCaptureDelegate *main_;
 
@@ -105,6 +122,17 @@ namespace FBCapture {
       return status;
     }
 
+    // Blocks an idle module until signal(), stop() or the optional period elapses
+    void waitForSignal() {
+      unique_lock<mutex> lock(mtx_);
+      const auto ready = [this] { return signaled_.load() || stopRequested_.load(); };
+      if (period_.count() > 0)
+        cv_.wait_for(lock, period_, ready);
+      else
+        cv_.wait(lock, ready);
+      signaled_ = false;
+    }
+
     virtual FBCAPTURE_STATUS run() {
       isRunning_ = true;
       auto loop = !stopRequested_.load();
@@ -112,6 +140,11 @@ namespace FBCapture {
         if (stopRequested_.load())
           break;
         const auto status = process();
+        // process() had nothing to do, so sleep instead of spinning on it
+        if (status == FBCAPTURE_ENCODER_NEED_MORE_INPUT) {
+          waitForSignal();
+          continue;
+        }
         if (status != FBCAPTURE_OK) {
           main_->onFailure(status);
           return status;
@@ -9,6 +9,7 @@
 #define FBCAPTURE_FLV_PACKETIZER_ERROR		  600
 #define FBCAPTURE_RTMP_ERROR						    700
 #define FBCAPTURE_METADATA_ERROR            800
+#define FBCAPTURE_RTP_ERROR                 900
 
 typedef enum {
   // FBCapture session status
@@ -25,6 +26,7 @@ typedef enum {
   FBCAPTURE_INVALID_FUNCTION_CALL,
   FBCAPTURE_INVALID_SESSION_STATUS,
   FBCAPTURE_UNEXPECTED_EXCEPTION,
+  FBCAPTURE_UNSUPPORTED_VIDEO_CODEC,
 
   // Video/Image encoding specific error codes
   FBCAPTURE_GPU_ENCODER_UNSUPPORTED_DRIVER = FBCAPTURE_GPU_ENCODER_ERROR,
@@ -41,6 +43,8 @@ typedef enum {
   // WIC specific error codes
   FBCAPTURE_GPU_ENCODER_WIC_SAVE_IMAGE_FAILED,
 
+  FBCAPTURE_GPU_ENCODER_RECONFIGURE_FAILED,
+
   // Audio capture specific error codes
   FBCAPTURE_AUDIO_CAPTURE_INIT_FAILED = FBCAPTURE_AUDIO_CAPTURE_ERROR,
   FBCAPTURE_AUDIO_CAPTURE_NOT_INITIALIZED,
@@ -58,6 +62,8 @@ typedef enum {
 
   // WAMEDIA muxing specific error codes
   FBCAPTURE_WAMDEIA_MUXING_FAILED = FBCAPTURE_MUXING_ERROR,
+  FBCAPTURE_MP4_WRITE_FAILED,
+  FBCAPTURE_FLV_WRITE_FAILED,
 
   // FLV Packetizer specific error codes
   FBCAPTURE_FLV_SET_HEADER_FAILED = FBCAPTURE_FLV_PACKETIZER_ERROR,
@@ -65,6 +71,8 @@ typedef enum {
   FBCAPTURE_FLV_SET_AAC_DATA_FAILED,
   FBCAPTURE_FLV_SET_AVC_SEQ_HEADER_FAILED,
   FBCAPTURE_FLV_SET_AVC_DATA_FAILED,
+  FBCAPTURE_FLV_SET_HEVC_SEQ_HEADER_FAILED,
+  FBCAPTURE_FLV_SET_HEVC_DATA_FAILED,
 
   // RTMP specific error codes
   FBCAPTURE_RTMP_INVALID_FLV_FILE = FBCAPTURE_RTMP_ERROR,
@@ -79,4 +87,9 @@ typedef enum {
   FBCAPTURE_METADATA_INJECTION_NOT_READY,
   FBCAPTURE_METADATA_INJECTION_FAIL,
 
+  // RTP specific error codes
+  FBCAPTURE_RTP_INVALID_STREAM_URL = FBCAPTURE_RTP_ERROR,
+  FBCAPTURE_RTP_CONNECTION_FAILED,
+  FBCAPTURE_RTP_SEND_PACKET_FAILED,
+
 } FBCAPTURE_STATUS;
@@ -64,6 +64,21 @@ namespace FBCapture {
     return false;
   }
 
+  bool IsSegmentedUrl(const DESTINATION_URL url) {
+    if (IsStreamingUrl(url))
+      return false;
+
+    const auto path = ConvertToByte(url);
+    const auto extStart = path.rfind('.');
+    if (extStart == string::npos)
+      return false;
+
+    auto ext = path.substr(extStart + 1);
+    for (auto& c : ext)
+      c = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+    return ext == kM3u8Ext || ext == kMpdExt;
+  }
+
   string GetDefaultOutputPath(const FILE_EXT ext) {
     const LPWSTR wszPath = nullptr;
     HRESULT hr = GetCurrentDirectory(MAX_FILENAME_LENGTH, wszPath);
@@ -37,9 +37,11 @@ namespace FBCapture {
   const FILE_EXT kAacExt = "aac";
   const FILE_EXT kH264Ext = "h264";
   const FILE_EXT kFlvExt = "flv";
+  const FILE_EXT kSdpExt = "sdp";
   const FILE_EXT kMp4Ext = "mp4";
+  const FILE_EXT kM3u8Ext = "m3u8";
+  const FILE_EXT kMpdExt = "mpd";
   const FILE_EXT kJpgExt = "jpg";
-  const FILE_EXT kMetadataExt = "_injected.mp4";
 
   const URL_TYPE kRtmp = L"rtmp";
   const URL_TYPE kRtp = L"rtp";
@@ -48,6 +50,7 @@ namespace FBCapture {
   const URL_TYPE kFile = L"file_";
 
   bool IsStreamingUrl(DESTINATION_URL url);
+  bool IsSegmentedUrl(DESTINATION_URL url);  // local .m3u8 or .mpd manifest, written with CMAF segments
   URL_TYPE GetUrlType(DESTINATION_URL url);
   string GetDefaultOutputPath(const FILE_EXT ext);
   string ChangeFileExt(const string path, const FILE_EXT oldExt, const FILE_EXT newExt);
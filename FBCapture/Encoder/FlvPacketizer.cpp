@@ -5,89 +5,81 @@
  */
 
 #include "FlvPacketizer.h"
+#include "NalParser.h"
+#include "SpsParser.h"
 #include "Log.h"
 
-#define FLV_HEADER_SIZE 13
+#define FLV_MAX_TAG_BODY_SIZE 0xffffff
+#define FLV_AUDIO_CODEC_AAC 10
 
 namespace FBCapture {
   namespace Streaming {
-    FlvPacketizer::FlvPacketizer() {
-      prevSize_ = static_cast<uint8_t*>(malloc(4));
-    }
 
-    FlvPacketizer::~FlvPacketizer() {
-      if (prevSize_)
-        free(prevSize_);
+    const char* FlvPacketizer::kPaddingProperty = "padding";
+    FlvPacketizer::FlvPacketizer() :
+      videoConfig_(NULL),
+      videoConfigCapacity_(0) {
+      memset(aacConfig_, 0, sizeof(aacConfig_));
     }
 
-    FBCAPTURE_STATUS FlvPacketizer::packetizeVideo(VideoEncodePacket* packet, uint8_t** flvPacket) const {
-      if (!getAvcDataTag(packet->buffer, packet->length, static_cast<uint32_t>(packet->timestamp), packet->isKeyframe, flvPacket))
-        return FBCAPTURE_FLV_SET_AVC_DATA_FAILED;
-      return FBCAPTURE_OK;
+    FlvPacketizer::~FlvPacketizer() {
+      if (videoConfig_)
+        free(videoConfig_);
     }
 
-    FBCAPTURE_STATUS FlvPacketizer::packetizeAudio(AudioEncodePacket* packet, uint8_t** flvPacket) const {
-      if (!getAacDataTag(packet->buffer, packet->length, static_cast<uint32_t>(packet->timestamp), flvPacket))
-        return FBCAPTURE_FLV_SET_AAC_DATA_FAILED;
-      return FBCAPTURE_OK;
+    bool FlvPacketizer::reserveVideoConfig(const uint32_t size) {
+      if (size <= videoConfigCapacity_)
+        return true;
+      free(videoConfig_);
+      videoConfig_ = static_cast<uint8_t *>(malloc(size));
+      videoConfigCapacity_ = videoConfig_ ? size : 0;
+      return videoConfig_ != NULL;
     }
 
-    FBCAPTURE_STATUS FlvPacketizer::getFlvHeader(const bool haveAudio, const bool haveVideo, uint8_t** flv_header) {
-      char flvFileHeader[] = "FLV\x1\x5\0\0\0\x9\0\0\0\0"; // have audio and have video
+    void FlvPacketizer::getFlvHeader(const bool haveAudio, const bool haveVideo, uint8_t* flvHeader) {
+      const char flvFileHeader[] = "FLV\x1\x5\0\0\0\x9\0\0\0\0"; // have audio and have video
+      memcpy(flvHeader, flvFileHeader, FLV_HEADER_SIZE);
 
       if (haveAudio && haveVideo) {
-        flvFileHeader[4] = 0x05;
+        flvHeader[4] = 0x05;
       } else if (haveAudio && !haveVideo) {
-        flvFileHeader[4] = 0x04;
+        flvHeader[4] = 0x04;
       } else if (!haveAudio && haveVideo) {
-        flvFileHeader[4] = 0x01;
+        flvHeader[4] = 0x01;
       } else {
-        flvFileHeader[4] = 0x00;
+        flvHeader[4] = 0x00;
       }
-
-      *flv_header = static_cast<uint8_t*>(malloc(FLV_HEADER_SIZE));
-      memcpy(*flv_header, flvFileHeader, FLV_HEADER_SIZE);
-
-      return FBCAPTURE_OK;
     }
 
     /*
-     * @brief set flv tag to the packet data buffer.
-     * @param[in] buf:
-     * @param[in] buf_len: flv tag body size
-     * @param[in] timestamp: flv tag timestamp
+     * @brief set flv tag header and footer around the codec header already written to the tag's headroom.
+     * @param[in] codecHeaderLen: bytes of codec header in the headroom
+     * @param[in] payload: tag body after the codec header, referenced
+     * @param[in] timestamp: flv tag timestamp in millisec
      */
-    bool FlvPacketizer::setFlvTag(const FLV_TAG_TYPE type,
-                                  uint8_t *buf,
-                                  const uint32_t bufLen,
-                                  const uint32_t timestamp,
-                                  uint8_t **taggedData) const {
-
-      flv_tag flvtag;
-      memset(&flvtag, 0, sizeof(flvtag));
-
-      flvtag.type = type;
-      ui24ToBytes(flvtag.data_size, bufLen);
-      flvtag.timestamp_ex = static_cast<uint8_t>((timestamp >> 24) & 0xff);
-      flvtag.timestamp[0] = static_cast<uint8_t>((timestamp >> 16) & 0xff);
-      flvtag.timestamp[1] = static_cast<uint8_t>((timestamp >> 8) & 0xff);
-      flvtag.timestamp[2] = static_cast<uint8_t>((timestamp) & 0xff);
-
-      const auto pbuf = static_cast<uint8_t*>(malloc(sizeof(flvtag) + bufLen));
-      uint32_t idx = 0;
-
-      // flv tag
-      memcpy(pbuf, &flvtag, sizeof(flvtag));
-      idx += static_cast<uint32_t>(sizeof(flvtag));
-
-      // actual buffer data
-      memcpy(pbuf + idx, buf, bufLen);
-      idx += bufLen;
-
-      // update prev_size (24 bit)
-      ui32ToBytes(prevSize_, idx);
-
-      *taggedData = pbuf;
+    bool FlvPacketizer::setTagHeader(const FLV_TAG_TYPE type,
+                                     const uint32_t codecHeaderLen,
+                                     const uint8_t *payload,
+                                     const uint32_t payloadLen,
+                                     const uint32_t timestamp,
+                                     FlvTag* tag) {
+      const auto bodyLen = codecHeaderLen + payloadLen;
+      if (codecHeaderLen > FlvTag::kMaxCodecHeaderSize || payloadLen > FLV_MAX_TAG_BODY_SIZE - codecHeaderLen)
+        return false;
+
+      auto pbuf = tag->header;
+      pbuf = ui08ToBytes(pbuf, type);
+      pbuf = ui24ToBytes(pbuf, bodyLen);
+      pbuf = ui24ToBytes(pbuf, timestamp & 0xffffff);
+      pbuf = ui08ToBytes(pbuf, static_cast<uint8_t>((timestamp >> 24) & 0xff)); // timestamp extended
+      ui24ToBytes(pbuf, 0);                                                     // stream id
+
+      tag->headerLength = FLV_TAG_HEADER_SIZE + codecHeaderLen;
+      tag->payload = payload;
+      tag->payloadLength = payloadLen;
+
+      // previous tag size covers the tag header and body
+      ui32ToBytes(tag->footer, FLV_TAG_HEADER_SIZE + bodyLen);
 
       return true;
     }
@@ -95,32 +87,27 @@ namespace FBCapture {
     /*
      * @brief write Aac sequence header in header of audio tag data part, the first audio tag, fixed by 4 bytes
      */
-    FBCAPTURE_STATUS FlvPacketizer::getAacSeqHeaderTag(const int profileLevel,
-                                                       const int sampleRate,
-                                                       const int numChannels,
-                                                       uint8_t** aacSeqHeaderPacket) const {
-      const auto buf = static_cast<uint8_t *>(malloc(4));
-      auto pbuf = buf;
+    FBCAPTURE_STATUS FlvPacketizer::getAacSeqHeaderTag(const uint32_t profileLevel,
+                                                       const uint32_t sampleRateIndex,
+                                                       const uint32_t numChannels,
+                                                       FlvTag* tag) {
+      auto pbuf = tag->header + FLV_TAG_HEADER_SIZE;
 
       // SoundFormat (UB4) 10 - AAC, SoundRate (UB2) 3 = 44-kHz, SoundSize (UB1) 1 = snd16Bit, SoundType(UB1) 1 = sndStereo
       const uint8_t flag = 0xaf;
       pbuf = ui08ToBytes(pbuf, flag);
       // AACPacketType: 0x00 - AAC sequence header
-      pbuf = ui08ToBytes(pbuf, 0);
-      // AudioObjectType (UB5) 0x2 (2: LC), samplingFrequency (UB4) 0x3 (48kHz), channelConfiguration (UB4) 0x2 (stereo)
-      // first byte: (profile__level=0x2 << 3) | (sample_rate=0x3 >> 1 & 0x5)
-      pbuf = ui08ToBytes(pbuf, (profileLevel << 3) | (sampleRate >> 1 & 0x5));
-      // second byte: (sample_rate=0x3 & 0x1) << 7 | (num_channels=2 & 0xf) << 3
-      pbuf = ui08ToBytes(pbuf, (sampleRate & 0x1) << 7 | (numChannels & 0xf) << 3);
-
-      uint8_t* flvTagBuf;
-      if (!setFlvTag(FLV_TAG_TYPE::AUDIO, buf, static_cast<uint32_t>(pbuf - buf), 0, &flvTagBuf)) {
+      ui08ToBytes(pbuf, 0);
+
+      // AudioSpecificConfig: AudioObjectType (UB5) 0x2 (2: LC), samplingFrequencyIndex (UB4) 0x3 (48kHz), channelConfiguration (UB4) 0x2 (stereo)
+      aacConfig_[0] = static_cast<uint8_t>((profileLevel << 3) | ((sampleRateIndex >> 1) & 0x7));
+      aacConfig_[1] = static_cast<uint8_t>(((sampleRateIndex & 0x1) << 7) | ((numChannels & 0xf) << 3));
+
+      if (!setTagHeader(FLV_TAG_TYPE::AUDIO, 2, aacConfig_, sizeof(aacConfig_), 0, tag)) {
         DEBUG_ERROR("Failed setting FLV aac sequence header tag.");
         return FBCAPTURE_FLV_SET_AAC_SEQ_HEADER_FAILED;
       }
 
-      *aacSeqHeaderPacket = flvTagBuf;
-
       return FBCAPTURE_OK;
     }
 
@@ -130,27 +117,19 @@ namespace FBCapture {
     FBCAPTURE_STATUS FlvPacketizer::getAacDataTag(const uint8_t *data,
                                                   const uint32_t dataLen,
                                                   const uint32_t timestamp,
-                                                  uint8_t** aacData) const {
-      const auto buf = static_cast<uint8_t *>(malloc(dataLen + 2));
-      auto pbuf = buf;
+                                                  FlvTag* tag) const {
+      auto pbuf = tag->header + FLV_TAG_HEADER_SIZE;
 
       // SoundFormat (UB4) 10 - AAC, SoundRate (UB2) 3 = 44-kHz, SoundSize (UB1) 1 = snd16Bit, SoundType(UB1) 1 = sndStereo
       const uint8_t flag = 0xaf;
       pbuf = ui08ToBytes(pbuf, flag);
+      ui08ToBytes(pbuf, 1);    // AACPacketType: 0x01 - Raw AAC frame data
 
-      pbuf = ui08ToBytes(pbuf, 1);    // AACPacketType: 0x01 - Raw AAC frame data
-
-      memcpy(pbuf, data, dataLen);
-      pbuf += dataLen;
-
-      uint8_t* flvTagBuf;
-      if (!setFlvTag(FLV_TAG_TYPE::AUDIO, buf, static_cast<uint32_t>(pbuf - buf), timestamp, &flvTagBuf)) {
+      if (!setTagHeader(FLV_TAG_TYPE::AUDIO, 2, data, dataLen, timestamp, tag)) {
         DEBUG_ERROR("Failed setting FLV aac data tag.");
         return FBCAPTURE_FLV_SET_AAC_DATA_FAILED;
       }
 
-      *aacData = buf;
-
       return FBCAPTURE_OK;
     }
 
@@ -161,10 +140,18 @@ namespace FBCapture {
                                                        const uint32_t spsLen,
                                                        const uint8_t *pps,
                                                        const uint32_t ppsLen,
-                                                       uint8_t** avcSeqHeaderPacket) const {
-      // AVCC length 11 + 2 (sps_len) + sps_len (sps length) + 1 (number of pps) + 2 (pps_len) + pps_len (pps length)
-      const auto avcSeqBuf = static_cast<uint8_t *>(malloc(11 + 2 + spsLen + 1 + 2 + ppsLen));
-      auto pbuf = avcSeqBuf;
+                                                       FlvTag* tag) {
+      if (!sps || spsLen < 4 || !pps || ppsLen == 0) {
+        DEBUG_ERROR("Invalid sequence parameters for FLV avc sequence header tag.");
+        return FBCAPTURE_FLV_SET_AVC_SEQ_HEADER_FAILED;
+      }
+
+      // AVCC length 6 + 2 (sps_len) + sps_len (sps length) + 1 (number of pps) + 2 (pps_len) + pps_len (pps length)
+      const auto avcConfigLen = 6 + 2 + spsLen + 1 + 2 + ppsLen;
+      if (!reserveVideoConfig(avcConfigLen))
+        return FBCAPTURE_FLV_SET_AVC_SEQ_HEADER_FAILED;
+
+      auto pbuf = tag->header + FLV_TAG_HEADER_SIZE;
 
       const uint8_t flag = (1 << 4) // frametype "1 == keyframe"
         | 7; // codecid "7 == AVC"
@@ -172,10 +159,10 @@ namespace FBCapture {
       pbuf = ui08ToBytes(pbuf, flag);
 
       pbuf = ui08ToBytes(pbuf, 0); // AVCPacketType: 0x00 - AVC sequence header
-      pbuf = ui24ToBytes(pbuf, 0); // composition time
-
-                                   // generate AVCC with sps and pps, AVCDecoderConfigurationRecord
+      ui24ToBytes(pbuf, 0);        // composition time
 
+      // generate AVCC with sps and pps, AVCDecoderConfigurationRecord
+      pbuf = videoConfig_;
       pbuf = ui08ToBytes(pbuf, 1);      // configurationVersion
       pbuf = ui08ToBytes(pbuf, sps[1]); // AVCProfile_Indication
       pbuf = ui08ToBytes(pbuf, sps[2]); // profile__compatibility
@@ -196,60 +183,201 @@ namespace FBCapture {
       pbuf = ui08ToBytes(pbuf, 1); // number of pps
       pbuf = ui16ToBytes(pbuf, static_cast<uint16_t>(ppsLen));
       memcpy(pbuf, pps, ppsLen);
-      pbuf += ppsLen;
 
-      uint8_t* flvTagBuf;
-      if (!setFlvTag(FLV_TAG_TYPE::VIDEO, avcSeqBuf, static_cast<uint32_t>(pbuf - avcSeqBuf), 0, &flvTagBuf)) {
+      if (!setTagHeader(FLV_TAG_TYPE::VIDEO, 5, videoConfig_, avcConfigLen, 0, tag)) {
         DEBUG_ERROR("Failed setting FLV avc sequence header tag.");
         return FBCAPTURE_FLV_SET_AVC_SEQ_HEADER_FAILED;
       }
 
-      *avcSeqHeaderPacket = flvTagBuf;
+      return FBCAPTURE_OK;
+    }
+
+    /*
+     * @brief write onMetaData script tag, padded to reservedSize so it can be rewritten in place later, 0 for no padding
+     */
+    FBCAPTURE_STATUS FlvPacketizer::getMetaDataTag(const FlvMetaData& metaData,
+                                                   const uint32_t reservedSize,
+                                                   FlvTag* tag) {
+      const auto keyframeCount = static_cast<uint32_t>(metaData.keyframeTimes.size());
+
+      metaData_.clear();
+      metaData_.writeString("onMetaData");
+      // the property count is only a hint for readers, but keep it right
+      metaData_.writeEcmaArrayStart(reservedSize > 0 ? 15 : 14);
+      metaData_.writeNumberProperty("duration", metaData.duration);
+      metaData_.writeNumberProperty("width", metaData.width);
+      metaData_.writeNumberProperty("height", metaData.height);
+      metaData_.writeNumberProperty("videodatarate", metaData.videoDataRate);
+      metaData_.writeNumberProperty("framerate", metaData.frameRate);
+      metaData_.writeNumberProperty("videocodecid", metaData.videoCodecId);
+      metaData_.writeNumberProperty("audiodatarate", metaData.audioDataRate);
+      metaData_.writeNumberProperty("audiosamplerate", metaData.audioSampleRate);
+      metaData_.writeNumberProperty("audiosamplesize", 16);
+      metaData_.writeBoolProperty("stereo", metaData.stereo);
+      metaData_.writeNumberProperty("audiocodecid", FLV_AUDIO_CODEC_AAC);
+      metaData_.writeNumberProperty("filesize", metaData.fileSize);
+      metaData_.writeBoolProperty("canSeekToEnd", keyframeCount > 0);
+
+      metaData_.writePropertyName("keyframes");
+      metaData_.writeObjectStart();
+      metaData_.writePropertyName("times");
+      metaData_.writeStrictArrayStart(keyframeCount);
+      for (const auto time : metaData.keyframeTimes)
+        metaData_.writeNumber(time);
+      metaData_.writePropertyName("filepositions");
+      metaData_.writeStrictArrayStart(static_cast<uint32_t>(metaData.keyframePositions.size()));
+      for (const auto position : metaData.keyframePositions)
+        metaData_.writeNumber(position);
+      metaData_.writeObjectEnd();
+
+      if (reservedSize > 0) {
+        // whatever is left before the object end marker goes into the padding property
+        const uint32_t objectEndSize = 3;
+        const auto used = metaData_.size() + objectEndSize;
+        if (used > reservedSize || !metaData_.writePaddingProperty(kPaddingProperty, reservedSize - used)) {
+          DEBUG_ERROR("FLV onMetaData doesn't fit in its reserved size.");
+          return FBCAPTURE_FLV_SET_HEADER_FAILED;
+        }
+      }
+      metaData_.writeObjectEnd();
+
+      if (!setTagHeader(FLV_TAG_TYPE::META, 0, metaData_.data(), metaData_.size(), 0, tag)) {
+        DEBUG_ERROR("Failed setting FLV onMetaData tag.");
+        return FBCAPTURE_FLV_SET_HEADER_FAILED;
+      }
 
       return FBCAPTURE_OK;
     }
 
+    /*
+     * @brief body size of an onMetaData tag with room for a keyframe index of maxKeyframes entries
+     */
+    uint32_t FlvPacketizer::getMetaDataReservedSize(const uint32_t maxKeyframes) {
+      FlvMetaData empty;
+      FlvTag tag;
+      getMetaDataTag(empty, 0, &tag);
+
+      // both keyframe arrays at full length plus the padding property itself
+      const auto keyframeIndexSize = 2 * (Amf0Writer::numberArraySize(maxKeyframes) - Amf0Writer::numberArraySize(0));
+      return tag.bodySize() + keyframeIndexSize + Amf0Writer::paddingPropertyOverhead(kPaddingProperty);
+    }
+
     /*
      * @brief write header of video tag data part, fixed 5 bytes
      */
     FBCAPTURE_STATUS FlvPacketizer::getAvcDataTag(const uint8_t *data,
                                                   const uint32_t dataLen,
                                                   const uint32_t timestamp,
-                                                  const int isKeyframe,
-                                                  uint8_t** avcDataPacket) const {
-      const auto buf = static_cast<uint8_t *>(malloc(dataLen + 5));
-      auto pbuf = buf;
+                                                  const bool isKeyframe,
+                                                  FlvTag* tag) const {
+      auto pbuf = tag->header + FLV_TAG_HEADER_SIZE;
 
-      uint8_t flag;
       // (FrameType << 4) | CodecID, 1 - keyframe, 2 - inner frame, 7 - AVC(h264)
-      if (isKeyframe) {
-        flag = 0x17;
-      } else {
-        flag = 0x27;
-      }
-
+      const uint8_t flag = isKeyframe ? 0x17 : 0x27;
       pbuf = ui08ToBytes(pbuf, flag);
 
       pbuf = ui08ToBytes(pbuf, 1);    // AVCPacketType: 0x00 - AVC sequence header; 0x01 - AVC NALU
-      pbuf = ui24ToBytes(pbuf, 0);    // composition time
-
-      memcpy(pbuf, data, dataLen);
-      pbuf += dataLen;
+      ui24ToBytes(pbuf, 0);           // composition time
 
-      uint8_t* flvTagBuf;
-      if (!setFlvTag(FLV_TAG_TYPE::VIDEO, buf, static_cast<uint32_t>(pbuf - buf), timestamp, &flvTagBuf)) {
+      if (!setTagHeader(FLV_TAG_TYPE::VIDEO, 5, data, dataLen, timestamp, tag)) {
         DEBUG_ERROR("Failed setting FLV avc data tag.");
         return FBCAPTURE_FLV_SET_AVC_DATA_FAILED;
       }
 
-      *avcDataPacket = flvTagBuf;
+      return FBCAPTURE_OK;
+    }
+
+    /*
+     * @brief write enhanced RTMP hvc1 sequence start, ExVideoTagHeader and HEVCDecoderConfigurationRecord with vps, sps and pps
+     */
+    FBCAPTURE_STATUS FlvPacketizer::getHevcSeqHeaderTag(const uint8_t *vps,
+                                                        const uint32_t vpsLen,
+                                                        const uint8_t *sps,
+                                                        const uint32_t spsLen,
+                                                        const uint8_t *pps,
+                                                        const uint32_t ppsLen,
+                                                        FlvTag* tag) {
+      HevcSpsInfo spsInfo;
+      if (!vps || vpsLen == 0 || !pps || ppsLen == 0 || !ParseHevcSps(sps, spsLen, &spsInfo)) {
+        DEBUG_ERROR("Invalid sequence parameters for FLV hevc sequence header tag.");
+        return FBCAPTURE_FLV_SET_HEVC_SEQ_HEADER_FAILED;
+      }
+
+      // 23 bytes of fixed fields, then 3 arrays of one NAL unit: type (1), numNalus (2), nalUnitLength (2) and the NAL unit
+      const auto hevcConfigLen = 23 + 3 * 5 + vpsLen + spsLen + ppsLen;
+      if (!reserveVideoConfig(hevcConfigLen))
+        return FBCAPTURE_FLV_SET_HEVC_SEQ_HEADER_FAILED;
+
+      auto pbuf = tag->header + FLV_TAG_HEADER_SIZE;
+      // IsExHeader (UB1) 1, FrameType (UB3) 1 - keyframe, PacketType (UB4) 0 - sequence start
+      pbuf = ui08ToBytes(pbuf, 0x80 | (1 << 4) | EX_VIDEO_SEQUENCE_START);
+      ui32ToBytes(pbuf, FLV_VIDEO_FOURCC_HVC1);
+
+      pbuf = videoConfig_;
+      pbuf = ui08ToBytes(pbuf, 1);  // configurationVersion
+      pbuf = ui08ToBytes(pbuf, static_cast<uint8_t>(spsInfo.profileSpace << 6 | spsInfo.tierFlag << 5 | spsInfo.profileIdc));
+      pbuf = ui32ToBytes(pbuf, spsInfo.profileCompatibilityFlags);
+      pbuf = ui16ToBytes(pbuf, static_cast<uint16_t>(spsInfo.constraintIndicatorFlags >> 32));
+      pbuf = ui32ToBytes(pbuf, static_cast<uint32_t>(spsInfo.constraintIndicatorFlags));
+      pbuf = ui08ToBytes(pbuf, spsInfo.levelIdc);
+      pbuf = ui16ToBytes(pbuf, 0xf000);  // 4 bits reserved (1111) + min_spatial_segmentation_idc 0
+      pbuf = ui08ToBytes(pbuf, 0xfc);    // 6 bits reserved (111111) + parallelismType 0, unknown
+      pbuf = ui08ToBytes(pbuf, static_cast<uint8_t>(0xfc | spsInfo.chromaFormatIdc));
+      pbuf = ui08ToBytes(pbuf, static_cast<uint8_t>(0xf8 | (spsInfo.bitDepthLumaMinus8 & 0x7)));
+      pbuf = ui08ToBytes(pbuf, static_cast<uint8_t>(0xf8 | (spsInfo.bitDepthChromaMinus8 & 0x7)));
+      pbuf = ui16ToBytes(pbuf, 0);       // avgFrameRate, unspecified
+      // constantFrameRate (UB2) 0, numTemporalLayers (UB3), temporalIdNested (UB1), lengthSizeMinusOne (UB2) 3
+      pbuf = ui08ToBytes(pbuf, static_cast<uint8_t>((spsInfo.maxSubLayersMinus1 + 1) << 3 | spsInfo.temporalIdNesting << 2 |
+                                                    (AVCC_LENGTH_SIZE - 1)));
+      pbuf = ui08ToBytes(pbuf, 3);       // numOfArrays
+
+      const struct {
+        uint8_t type;
+        const uint8_t* nal;
+        uint32_t length;
+      } arrays[] = {
+        { HEVC_NAL_VPS, vps, vpsLen },
+        { HEVC_NAL_SPS, sps, spsLen },
+        { HEVC_NAL_PPS, pps, ppsLen },
+      };
+      for (const auto& array : arrays) {
+        pbuf = ui08ToBytes(pbuf, 0x80 | array.type);  // array_completeness 1, reserved 0, NAL_unit_type
+        pbuf = ui16ToBytes(pbuf, 1);                  // numNalus
+        pbuf = ui16ToBytes(pbuf, static_cast<uint16_t>(array.length));
+        memcpy(pbuf, array.nal, array.length);
+        pbuf += array.length;
+      }
+
+      if (!setTagHeader(FLV_TAG_TYPE::VIDEO, 5, videoConfig_, hevcConfigLen, 0, tag)) {
+        DEBUG_ERROR("Failed setting FLV hevc sequence header tag.");
+        return FBCAPTURE_FLV_SET_HEVC_SEQ_HEADER_FAILED;
+      }
 
       return FBCAPTURE_OK;
     }
 
-    FBCAPTURE_STATUS FlvPacketizer::getPreviousTagSize(uint8_t** prevTagSize) const {
-      *prevTagSize = prevSize_;
+    /*
+     * @brief write ExVideoTagHeader of hevc coded frames, fixed 5 bytes. Frames without B-frames have composition time 0,
+     * so they go out as CodedFramesX which leaves it out.
+     */
+    FBCAPTURE_STATUS FlvPacketizer::getHevcDataTag(const uint8_t *data,
+                                                   const uint32_t dataLen,
+                                                   const uint32_t timestamp,
+                                                   const bool isKeyframe,
+                                                   FlvTag* tag) const {
+      auto pbuf = tag->header + FLV_TAG_HEADER_SIZE;
+
+      // IsExHeader (UB1) 1, FrameType (UB3) 1 - keyframe, 2 - inter frame, PacketType (UB4) 3 - coded frames without composition time
+      const uint8_t frameType = isKeyframe ? 1 : 2;
+      pbuf = ui08ToBytes(pbuf, static_cast<uint8_t>(0x80 | frameType << 4 | EX_VIDEO_CODED_FRAMES_X));
+      ui32ToBytes(pbuf, FLV_VIDEO_FOURCC_HVC1);
+
+      if (!setTagHeader(FLV_TAG_TYPE::VIDEO, 5, data, dataLen, timestamp, tag)) {
+        DEBUG_ERROR("Failed setting FLV hevc data tag.");
+        return FBCAPTURE_FLV_SET_HEVC_DATA_FAILED;
+      }
+
       return FBCAPTURE_OK;
     }
   }
-}
\ No newline at end of file
+}
@@ -9,87 +9,232 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <vector>
 
 #include "EncodePacket.h"
 #include "FBCaptureStatus.h"
+#include "IoVec.h"
+#include "Amf0Writer.h"
 
 using namespace std;
 
+#define FLV_HEADER_SIZE     13
+#define FLV_TAG_HEADER_SIZE 11
+#define FLV_TAG_FOOTER_SIZE  4
+
+#define FLV_VIDEO_CODEC_AVC   7
+#define FLV_VIDEO_FOURCC_HVC1 0x68766331  // 'hvc1', enhanced RTMP
+
 namespace FBCapture {
   namespace Streaming {
 
-    struct flv_tag {
-      uint8_t type;
-      uint8_t data_size[3];
-      uint8_t timestamp[3];
-      uint8_t timestamp_ex;
-      uint8_t streamid[3];
-    };
-
     enum FLV_TAG_TYPE {
       AUDIO = 0x08,
       VIDEO = 0x09,
       META = 0x12,
     };
 
-    enum AMF_DATA_TYPE {
-      AMF_DATA_NUMBER = 0x00,
-      AMF_DATA_BOOL = 0x01,
-      AMF_DATA_STRING = 0x02,
-      AMF_DATA_OBJECT = 0x03,
-      AMF_DATA_NULL = 0x05,
-      AMF_DATA_UNDEFINED = 0x06,
-      AMF_DATA_REFERENCE = 0x07,
-      AMF_DATA_MIXEDARRAY = 0x08,
-      AMF_DATA_OBJECT_END = 0x09,
-      AMF_DATA_ARRAY = 0x0a,
-      AMF_DATA_DATE = 0x0b,
-      AMF_DATA_LONG_STRING = 0x0c,
-      AMF_DATA_UNSUPPORTED = 0x0d,
+    // Enhanced RTMP ExVideoTagHeader packet types, in the low nibble of the first video tag byte when its top bit is set
+    enum FLV_EX_VIDEO_PACKET_TYPE {
+      EX_VIDEO_SEQUENCE_START = 0,
+      EX_VIDEO_CODED_FRAMES = 1,      // with composition time
+      EX_VIDEO_SEQUENCE_END = 2,
+      EX_VIDEO_CODED_FRAMES_X = 3,    // composition time 0, left out
+    };
+
+    // Properties of the onMetaData script tag. Times in seconds, rates in kbps, sizes in bytes.
+    struct FlvMetaData {
+      double duration;
+      double fileSize;
+      double width;
+      double height;
+      double frameRate;
+      double videoDataRate;
+      double audioDataRate;
+      double audioSampleRate;
+      double videoCodecId;                // 7 for AVC, the FourCC for enhanced RTMP codecs
+      bool stereo;
+      vector<double> keyframeTimes;       // keyframe index for seeking without scanning the file
+      vector<double> keyframePositions;   // file offsets of the keyframe tags
+
+      FlvMetaData() :
+        duration(0),
+        fileSize(0),
+        width(0),
+        height(0),
+        frameRate(0),
+        videoDataRate(0),
+        audioDataRate(0),
+        audioSampleRate(0),
+        videoCodecId(FLV_VIDEO_CODEC_AVC),
+        stereo(false) {}
     };
 
+    /*
+    * An FLV tag that references its payload instead of owning a copy of it. The tag header and codec header
+    * are written into fixed headroom in front of the payload and PreviousTagSize into a footer after it,
+    * so a tag goes out as three IoVecs with the encoded frame straight from the EncodePacket.
+    * The tag is only valid as long as the buffer it references.
+    */
+    class FlvTag {
+    public:
+      // AVC: frame type/codec id, packet type, composition time. HEVC: frame type/packet type, FourCC
+      static const uint32_t kMaxCodecHeaderSize = 5;
+      static const uint32_t kIoVecCount = 3;
+
+      uint8_t header[FLV_TAG_HEADER_SIZE + kMaxCodecHeaderSize];
+      uint32_t headerLength;                 // tag header plus codec header
+      const uint8_t* payload;
+      uint32_t payloadLength;
+      uint8_t footer[FLV_TAG_FOOTER_SIZE];   // PreviousTagSize
+
+      FlvTag() : headerLength(0), payload(NULL), payloadLength(0) {}
+
+      uint8_t type() const {
+        return header[0];
+      }
+
+      uint32_t timestamp() const {
+        return (header[7] << 24) | (header[4] << 16) | (header[5] << 8) | header[6];
+      }
+
+      // tag data size as written in the tag header
+      uint32_t bodySize() const {
+        return headerLength - FLV_TAG_HEADER_SIZE + payloadLength;
+      }
+
+      // tag header and body, without the footer
+      uint32_t tagSize() const {
+        return headerLength + payloadLength;
+      }
+
+      const uint8_t* codecHeader() const {
+        return header + FLV_TAG_HEADER_SIZE;
+      }
+
+      uint32_t codecHeaderLength() const {
+        return headerLength - FLV_TAG_HEADER_SIZE;
+      }
+
+      // video tag with an enhanced RTMP ExVideoTagHeader
+      bool isExVideo() const {
+        return type() == FLV_TAG_TYPE::VIDEO && codecHeaderLength() >= 1 && (codecHeader()[0] & 0x80) != 0;
+      }
+
+      // AVC/AAC/HEVC decoder configuration rather than media
+      bool isSequenceHeader() const {
+        if (isExVideo())
+          return (codecHeader()[0] & 0x0f) == EX_VIDEO_SEQUENCE_START;
+        return codecHeaderLength() >= 2 && codecHeader()[1] == 0;
+      }
+
+      // AVC NALU, raw AAC or HEVC coded frames
+      bool isMediaData() const {
+        if (isExVideo()) {
+          const auto packetType = codecHeader()[0] & 0x0f;
+          return packetType == EX_VIDEO_CODED_FRAMES || packetType == EX_VIDEO_CODED_FRAMES_X;
+        }
+        return (type() == FLV_TAG_TYPE::VIDEO || type() == FLV_TAG_TYPE::AUDIO) &&
+          codecHeaderLength() >= 2 && codecHeader()[1] == 1;
+      }
+
+      bool isKeyframe() const {
+        return type() == FLV_TAG_TYPE::VIDEO && codecHeaderLength() >= 1 && ((codecHeader()[0] >> 4) & 0x7) == 1;
+      }
+
+      // Fills up to kIoVecCount buffers for the whole tag and returns how many were used
+      uint32_t getIoVecs(IoVec* iov, const bool withFooter) const {
+        uint32_t count = 0;
+        iov[count++] = { header, headerLength };
+        if (payloadLength > 0)
+          iov[count++] = { payload, payloadLength };
+        if (withFooter)
+          iov[count++] = { footer, FLV_TAG_FOOTER_SIZE };
+        return count;
+      }
+    };
+
+    /*
+    * Serializes encoded packets into FlvTags. Data tags never allocate. Sequence header tags reference
+    * storage inside the packetizer and stay valid until the next sequence header of the same codec.
+    */
     class FlvPacketizer {
     public:
 
       FlvPacketizer();
       ~FlvPacketizer();
 
-      FBCAPTURE_STATUS packetizeVideo(VideoEncodePacket* packet, uint8_t** flvPacket) const;
-      FBCAPTURE_STATUS packetizeAudio(AudioEncodePacket* packet, uint8_t** flvPacket) const;
+      // flvHeader must hold FLV_HEADER_SIZE bytes, including the first PreviousTagSize
+      static void getFlvHeader(bool haveAudio, bool haveVideo, uint8_t* flvHeader);
 
-      static FBCAPTURE_STATUS getFlvHeader(bool haveAudio, bool haveVideo, uint8_t** flvHeader);
-
-      FBCAPTURE_STATUS getAacSeqHeaderTag(int profileLevel,
-                                          int sampleRate,
-                                          int numChannels,
-                                          uint8_t** aacSeqHeaderPacket) const;
+      FBCAPTURE_STATUS getAacSeqHeaderTag(uint32_t profileLevel,
+                                          uint32_t sampleRateIndex,
+                                          uint32_t numChannels,
+                                          FlvTag* tag);
 
       FBCAPTURE_STATUS getAacDataTag(const uint8_t *data,
                                      uint32_t dataLen,
                                      uint32_t timestamp,
-                                     uint8_t** aacDatPacketa) const;
+                                     FlvTag* tag) const;
 
       FBCAPTURE_STATUS getAvcSeqHeaderTag(const uint8_t *sps,
                                           uint32_t spsLen,
                                           const uint8_t *pps,
                                           uint32_t ppsLen,
-                                          uint8_t** avcSeqHeaderPacket) const;
+                                          FlvTag* tag);
 
       FBCAPTURE_STATUS getAvcDataTag(const uint8_t *data,
                                      uint32_t dataLen,
                                      uint32_t timestamp,
-                                     int isKeyframe,
-                                     uint8_t** avcDataPacket) const;
-
-      FBCAPTURE_STATUS getPreviousTagSize(uint8_t** prevTagSize) const;
+                                     bool isKeyframe,
+                                     FlvTag* tag) const;
+
+      // Enhanced RTMP 'hvc1' sequence start with an HEVCDecoderConfigurationRecord
+      FBCAPTURE_STATUS getHevcSeqHeaderTag(const uint8_t *vps,
+                                           uint32_t vpsLen,
+                                           const uint8_t *sps,
+                                           uint32_t spsLen,
+                                           const uint8_t *pps,
+                                           uint32_t ppsLen,
+                                           FlvTag* tag);
+
+      // Enhanced RTMP 'hvc1' coded frames. data holds length prefixed NAL units like AVC.
+      FBCAPTURE_STATUS getHevcDataTag(const uint8_t *data,
+                                      uint32_t dataLen,
+                                      uint32_t timestamp,
+                                      bool isKeyframe,
+                                      FlvTag* tag) const;
+
+      /*
+      * Serializes an onMetaData script tag. With reservedSize the body is padded to exactly that many bytes,
+      * so the tag can later be rewritten in place with different values and a longer keyframe index.
+      */
+      FBCAPTURE_STATUS getMetaDataTag(const FlvMetaData& metaData,
+                                      uint32_t reservedSize,
+                                      FlvTag* tag);
+
+      // Body size to reserve for an onMetaData tag that can hold up to maxKeyframes in its index
+      uint32_t getMetaDataReservedSize(uint32_t maxKeyframes);
 
     private:
 
-      uint8_t* prevSize_;
+      uint8_t aacConfig_[2];    // AudioSpecificConfig
+      uint8_t* videoConfig_;    // AVCDecoderConfigurationRecord or HEVCDecoderConfigurationRecord
+      uint32_t videoConfigCapacity_;
+      Amf0Writer metaData_;     // onMetaData script data
 
-    public:
+      static const char* kPaddingProperty;
+
+      bool reserveVideoConfig(uint32_t size);
 
-      bool setFlvTag(FLV_TAG_TYPE type, uint8_t *buf, uint32_t bufLen, uint32_t timestamp, uint8_t **taggedData) const;
+      static bool setTagHeader(FLV_TAG_TYPE type,
+                               uint32_t codecHeaderLen,
+                               const uint8_t *payload,
+                               uint32_t payloadLen,
+                               uint32_t timestamp,
+                               FlvTag* tag);
+
+    public:
 
       static inline uint8_t *ui08ToBytes(uint8_t *buf, const uint8_t val) {
         buf[0] = (val) & 0xff;
@@ -157,7 +302,7 @@ namespace FBCapture {
         return buf + 8;
       }
 
-      static inline uint8_t bytesToUi32(const uint8_t *buf) {
+      static inline uint32_t bytesToUi32(const uint8_t *buf) {
         return (((buf[0]) << 24) & 0xff000000)
           | (((buf[1]) << 16) & 0xff0000)
           | (((buf[2]) << 8) & 0xff00)
@@ -0,0 +1,275 @@
+/****************************************************************************************************************
+
+Filename	:	FlvSink.cpp
+Content		:
+Copyright	:
+
+****************************************************************************************************************/
+
+#include "FlvSink.h"
+#include "SpsParser.h"
+#include "FileUtil.h"
+
+#include <algorithm>
+#include "Log.h"
+
+namespace FBCapture {
+  namespace Streaming {
+
+    FlvSink::FlvSink() :
+      videoSeqParams_(NULL),
+      aacSeqHdrSet_(false) {}
+
+    FlvSink::~FlvSink() {
+      resetStream();
+    }
+
+    void FlvSink::resetStream() {
+      if (videoSeqParams_)
+        videoSeqParams_->release();
+      videoSeqParams_ = NULL;
+      aacSeqHdrSet_ = false;
+    }
+
+    FBCAPTURE_STATUS FlvSink::write(EncodePacket* packet) {
+      if (packet->type() == PACKET_TYPE::VIDEO)
+        return writeVideo(static_cast<VideoEncodePacket*>(packet));
+      else if (packet->type() == PACKET_TYPE::AUDIO)
+        return writeAudio(static_cast<AudioEncodePacket*>(packet));
+      return FBCAPTURE_UNKNOWN_ENCODE_PACKET_TYPE;
+    }
+
+    FBCAPTURE_STATUS FlvSink::writeVideo(VideoEncodePacket* packet) {
+      auto status = FBCAPTURE_OK;
+
+      // the sequence header can only be sent once the encoder has reported its parameter sets
+      const auto seqParams = packet->seqParams;
+      if (!seqParams && !videoSeqParams_)
+        return status;
+
+      const auto isHevc = packet->codec == VIDEO_CODEC::HEVC;
+
+      // GPUEncoder only makes new SequenceParams when the bytes change, so comparing the bytes is the rare path
+      if (seqParams && seqParams != videoSeqParams_) {
+        const auto changed = !videoSeqParams_ || !videoSeqParams_->matches(*seqParams);
+        if (changed) {
+          status = isHevc ?
+            packetizer_.getHevcSeqHeaderTag(seqParams->vps, seqParams->vpsLen, seqParams->sps, seqParams->spsLen,
+                                            seqParams->pps, seqParams->ppsLen, &tag_) :
+            packetizer_.getAvcSeqHeaderTag(seqParams->sps, seqParams->spsLen, seqParams->pps, seqParams->ppsLen, &tag_);
+          if (status != FBCAPTURE_OK)
+            return status;
+
+          status = writeTag(tag_);
+          if (status != FBCAPTURE_OK)
+            return status;
+        }
+
+        if (videoSeqParams_)
+          videoSeqParams_->release();
+        videoSeqParams_ = seqParams->addRef();
+      }
+
+      const auto timestamp = toFlvTimestamp(packet->timestamp);
+      status = isHevc ?
+        packetizer_.getHevcDataTag(packet->buffer, packet->length, timestamp, packet->isKeyframe, &tag_) :
+        packetizer_.getAvcDataTag(packet->buffer, packet->length, timestamp, packet->isKeyframe, &tag_);
+      if (status != FBCAPTURE_OK)
+        return status;
+
+      return writeTag(tag_);
+    }
+
+    FBCAPTURE_STATUS FlvSink::writeAudio(AudioEncodePacket* packet) {
+      auto status = FBCAPTURE_OK;
+
+      if (!aacSeqHdrSet_) {
+        status = packetizer_.getAacSeqHeaderTag(packet->profileLevel, packet->sampleRateIndex(), packet->numChannels, &tag_);
+        if (status != FBCAPTURE_OK)
+          return status;
+
+        status = writeTag(tag_);
+        if (status != FBCAPTURE_OK)
+          return status;
+        aacSeqHdrSet_ = true;
+      }
+
+      status = packetizer_.getAacDataTag(packet->buffer, packet->length, toFlvTimestamp(packet->timestamp), &tag_);
+      if (status != FBCAPTURE_OK)
+        return status;
+
+      return writeTag(tag_);
+    }
+
+    uint32_t FlvSink::toFlvTimestamp(const uint64_t timestamp) {
+      // packet timestamps are in 100 nanosec unit, FLV timestamps in millisec
+      return static_cast<uint32_t>(timestamp / 10000);
+    }
+
+    FlvFileSink::FlvFileSink(const string* path) :
+      path_(path),
+      file_(NULL),
+      metaDataSize_(0),
+      fileSize_(0),
+      videoBytes_(0),
+      audioBytes_(0),
+      videoFrames_(0),
+      firstTimestamp_(0),
+      lastTimestamp_(0),
+      hasTimestamp_(false),
+      keyframeStride_(1),
+      keyframeCount_(0) {}
+
+    FlvFileSink::~FlvFileSink() {
+      close();
+    }
+
+    FBCAPTURE_STATUS FlvFileSink::open() {
+      OPEN_FILE(file_, (*path_));
+
+      uint8_t flvHeader[FLV_HEADER_SIZE];
+      const auto haveAudio = true;
+      const auto haveVideo = true;
+      FlvPacketizer::getFlvHeader(haveAudio, haveVideo, flvHeader);
+
+      // the header already ends with PreviousTagSize0
+      if (fwrite(flvHeader, 1, FLV_HEADER_SIZE, file_) != FLV_HEADER_SIZE) {
+        DEBUG_ERROR_VAR("Failed writing FLV header", *path_);
+        return FBCAPTURE_FLV_WRITE_FAILED;
+      }
+      fileSize_ = FLV_HEADER_SIZE;
+
+      metaData_ = FlvMetaData();
+      videoBytes_ = 0;
+      audioBytes_ = 0;
+      videoFrames_ = 0;
+      firstTimestamp_ = 0;
+      lastTimestamp_ = 0;
+      hasTimestamp_ = false;
+      keyframeStride_ = 1;
+      keyframeCount_ = 0;
+
+      // placeholder onMetaData, rewritten with the real values in close()
+      metaDataSize_ = packetizer_.getMetaDataReservedSize(kMaxIndexedKeyframes);
+      auto status = packetizer_.getMetaDataTag(metaData_, metaDataSize_, &tag_);
+      if (status != FBCAPTURE_OK)
+        return status;
+      status = FlvFileSink::writeTag(tag_);
+      if (status != FBCAPTURE_OK)
+        return status;
+
+      resetStream();
+      return FBCAPTURE_OK;
+    }
+
+    FBCAPTURE_STATUS FlvFileSink::write(EncodePacket* packet) {
+      if (packet->type() == PACKET_TYPE::VIDEO && metaData_.width == 0) {
+        const auto videoPacket = static_cast<VideoEncodePacket*>(packet);
+        const auto seqParams = videoPacket->seqParams;
+        if (videoPacket->codec == VIDEO_CODEC::HEVC) {
+          HevcSpsInfo spsInfo;
+          if (seqParams && ParseHevcSps(seqParams->sps, seqParams->spsLen, &spsInfo)) {
+            metaData_.width = spsInfo.width;
+            metaData_.height = spsInfo.height;
+          }
+          metaData_.videoCodecId = FLV_VIDEO_FOURCC_HVC1;
+        } else {
+          SpsInfo spsInfo;
+          if (seqParams && ParseSps(seqParams->sps, seqParams->spsLen, &spsInfo)) {
+            metaData_.width = spsInfo.width;
+            metaData_.height = spsInfo.height;
+          }
+        }
+      } else if (packet->type() == PACKET_TYPE::AUDIO) {
+        const auto audioPacket = static_cast<AudioEncodePacket*>(packet);
+        metaData_.audioSampleRate = audioPacket->sampleRate;
+        metaData_.stereo = audioPacket->numChannels == 2;
+      }
+
+      return FlvSink::write(packet);
+    }
+
+    FBCAPTURE_STATUS FlvFileSink::writeTag(const FlvTag& tag) {
+      if (tag.isMediaData()) {
+        const auto timestamp = tag.timestamp();
+        if (!hasTimestamp_)
+          firstTimestamp_ = timestamp;
+        hasTimestamp_ = true;
+        lastTimestamp_ = max(lastTimestamp_, timestamp);
+
+        if (tag.type() == FLV_TAG_TYPE::VIDEO) {
+          videoBytes_ += tag.payloadLength;
+          videoFrames_++;
+          if (tag.isKeyframe())
+            addKeyframe(timestamp / 1000.0, static_cast<double>(fileSize_));
+        } else
+          audioBytes_ += tag.payloadLength;
+      }
+
+      IoVec iov[FlvTag::kIoVecCount];
+      const auto withFooter = true;
+      const auto count = tag.getIoVecs(iov, withFooter);
+      if (!WriteV(file_, iov, count)) {
+        DEBUG_ERROR_VAR("Failed writing FLV tag", *path_);
+        return FBCAPTURE_FLV_WRITE_FAILED;
+      }
+      fileSize_ += tag.tagSize() + FLV_TAG_FOOTER_SIZE;
+      return FBCAPTURE_OK;
+    }
+
+    void FlvFileSink::addKeyframe(const double time, const double position) {
+      if (keyframeCount_++ % keyframeStride_ != 0)
+        return;
+
+      if (metaData_.keyframeTimes.size() >= kMaxIndexedKeyframes) {
+        // keep every other entry and from now on only index every other keyframe
+        uint32_t kept = 0;
+        for (size_t i = 0; i < metaData_.keyframeTimes.size(); i += 2, kept++) {
+          metaData_.keyframeTimes[kept] = metaData_.keyframeTimes[i];
+          metaData_.keyframePositions[kept] = metaData_.keyframePositions[i];
+        }
+        metaData_.keyframeTimes.resize(kept);
+        metaData_.keyframePositions.resize(kept);
+        keyframeStride_ *= 2;
+        if ((keyframeCount_ - 1) % keyframeStride_ != 0)
+          return;
+      }
+
+      metaData_.keyframeTimes.push_back(time);
+      metaData_.keyframePositions.push_back(position);
+    }
+
+    void FlvFileSink::updateMetaData() {
+      const auto durationMs = hasTimestamp_ ? lastTimestamp_ - firstTimestamp_ : 0;
+      metaData_.duration = durationMs / 1000.0;
+      metaData_.fileSize = static_cast<double>(fileSize_);
+      if (durationMs > 0) {
+        // bits per millisec is kbps
+        metaData_.videoDataRate = videoBytes_ * 8.0 / durationMs;
+        metaData_.audioDataRate = audioBytes_ * 8.0 / durationMs;
+        metaData_.frameRate = videoFrames_ > 1 ? (videoFrames_ - 1) * 1000.0 / durationMs : 0;
+      }
+    }
+
+    FBCAPTURE_STATUS FlvFileSink::close() {
+      if (!file_)
+        return FBCAPTURE_OK;
+
+      // patch the placeholder onMetaData in place, it starts right after the FLV header
+      updateMetaData();
+      auto status = packetizer_.getMetaDataTag(metaData_, metaDataSize_, &tag_);
+      if (status == FBCAPTURE_OK && fseek(file_, FLV_HEADER_SIZE, SEEK_SET) == 0) {
+        IoVec iov[FlvTag::kIoVecCount];
+        const auto withFooter = true;
+        const auto count = tag_.getIoVecs(iov, withFooter);
+        if (!WriteV(file_, iov, count))
+          status = FBCAPTURE_FLV_SET_HEADER_FAILED;
+      }
+      if (status != FBCAPTURE_OK)
+        DEBUG_ERROR_VAR("Failed updating FLV onMetaData", to_string(status));
+
+      CLOSE_FILE(file_);
+      return status;
+    }
+  }
+}
@@ -0,0 +1,95 @@
+/****************************************************************************************************************
+
+Filename	:	FlvSink.h
+Content		:	Packetizes encoded packets into FLV tags for the FLV file and RTMP sinks
+Copyright	:
+
+****************************************************************************************************************/
+
+#pragma once
+
+#include <string>
+#include <stdio.h>
+
+#include "PacketSink.h"
+#include "FlvPacketizer.h"
+
+using namespace std;
+
+namespace FBCapture {
+  namespace Streaming {
+
+    /*
+    * Sends the AVC or HEVC and AAC sequence headers ahead of the first packet of each stream and every
+    * packet after that as an FLV tag. HEVC goes out as enhanced RTMP 'hvc1' video. The video sequence header
+    * is sent again whenever the encoder changes its parameter sets. Subclasses decide where the serialized tags go.
+    */
+    class FlvSink : public PacketSink {
+    public:
+      FlvSink();
+      virtual ~FlvSink();
+
+      FBCAPTURE_STATUS write(EncodePacket* packet) override;
+
+    protected:
+      FlvPacketizer packetizer_;
+      FlvTag tag_;
+      SequenceParams* videoSeqParams_;  // referenced, the parameter sets of the last video sequence header sent
+      bool aacSeqHdrSet_;
+
+      void resetStream();
+
+      // The tag references the packet being written and is only valid during the call
+      virtual FBCAPTURE_STATUS writeTag(const FlvTag& tag) = 0;
+
+      static uint32_t toFlvTimestamp(uint64_t timestamp);
+
+    private:
+      FBCAPTURE_STATUS writeVideo(VideoEncodePacket* packet);
+      FBCAPTURE_STATUS writeAudio(AudioEncodePacket* packet);
+    };
+
+    /*
+    * Writes an onMetaData tag with reserved space right after the FLV header and rewrites it in place on close(),
+    * once duration, file size, rates and the keyframe index are known. The index keeps at most kMaxIndexedKeyframes
+    * entries and is thinned to every other keyframe when it fills up.
+    */
+    class FlvFileSink : public FlvSink {
+    public:
+      static const uint32_t kMaxIndexedKeyframes = 2000;
+
+      explicit FlvFileSink(const string* path);
+      ~FlvFileSink();
+
+      FBCAPTURE_STATUS open() override;
+      FBCAPTURE_STATUS write(EncodePacket* packet) override;
+      FBCAPTURE_STATUS close() override;
+
+      const char* name() const override {
+        return "FLV file sink";
+      }
+
+    protected:
+      FBCAPTURE_STATUS writeTag(const FlvTag& tag) override;
+
+    private:
+      const string* path_;
+      FILE* file_;
+
+      FlvMetaData metaData_;
+      uint32_t metaDataSize_;     // reserved onMetaData body size
+      uint64_t fileSize_;         // bytes written so far
+      uint64_t videoBytes_;
+      uint64_t audioBytes_;
+      uint32_t videoFrames_;
+      uint32_t firstTimestamp_;   // in millisec
+      uint32_t lastTimestamp_;
+      bool hasTimestamp_;
+      uint32_t keyframeStride_;   // index every keyframeStride_ th keyframe
+      uint32_t keyframeCount_;
+
+      void addKeyframe(double time, double position);
+      void updateMetaData();
+    };
+  }
+}
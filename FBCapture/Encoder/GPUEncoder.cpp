@@ -31,25 +31,45 @@ namespace FBCapture {
       bitrate_(NULL),
       fps_(NULL),
       gop_(NULL),
+      videoCodec_(VIDEO_CODEC::H264),
       flipTexture_(false),
       enableAsyncMode_(false),
+      adaptiveBitrate_(false),
       outputBuffer_(NULL),
       outputBufferLength_(0),
       timestamp_(0),
-      firstFrame_(true) {}
-
-    GPUEncoder::~GPUEncoder() {}
+      firstFrame_(true),
+      packetPool_(PacketPool<VideoEncodePacket>::create(kPacketPoolSize)),
+      seqParams_(NULL),
+      seqParamsRequested_(false) {}
+
+    GPUEncoder::~GPUEncoder() {
+      if (seqParams_)
+        seqParams_->release();
+      packetPool_->destroy();
+    }
 
     FBCAPTURE_STATUS GPUEncoder::initialize(const uint32_t bitrate,
                                             const uint32_t fps,
                                             const uint32_t gop,
+                                            const VIDEO_CODEC codec,
                                             const bool flipTexture,
-                                            const bool enableAsyncMode) {
+                                            const bool enableAsyncMode,
+                                            const bool adaptiveBitrate) {
       bitrate_ = bitrate;
       fps_ = fps;
       gop_ = gop;
+      videoCodec_ = codec;
       flipTexture_ = flipTexture;
       enableAsyncMode_ = enableAsyncMode;
+      adaptiveBitrate_ = adaptiveBitrate;
+
+      // A new session may come up with different sequence parameters
+      if (seqParams_)
+        seqParams_->release();
+      seqParams_ = NULL;
+      seqParamsRequested_ = false;
+
       return FBCAPTURE_OK;
     }
 
@@ -65,43 +85,108 @@ namespace FBCapture {
       return gop_;
     }
 
+    VIDEO_CODEC GPUEncoder::getCodec() const {
+      return videoCodec_;
+    }
+
     FBCAPTURE_STATUS GPUEncoder::getEncodePacket(VideoEncodePacket** packet) {
-      void *buffer = nullptr;
+      auto videoPacket = packetPool_->acquire(0);
+      if (!videoPacket)
+        return FBCAPTURE_GPU_ENCODER_PROCESS_OUTPUT_FAILED;
+
+      void *buffer = videoPacket->buffer;
+      uint32_t capacity = videoPacket->capacity;
       uint32_t length;
       uint64_t timestamp;
       uint64_t duration;
       uint32_t frameIdx;
       bool isKeyframe;
 
-      auto status = processOutput(&buffer, &length, &timestamp, &duration, &frameIdx, &isKeyframe);
+      auto status = processOutput(&buffer, &capacity, &length, &timestamp, &duration, &frameIdx, &isKeyframe);
+      // the encoder may have grown the packet buffer even if it failed
+      videoPacket->buffer = static_cast<uint8_t*>(buffer);
+      videoPacket->capacity = capacity;
       if (status != FBCAPTURE_OK) {
-        DEBUG_ERROR_VAR("Failed during processing encoded frame output", to_string(status));
+        videoPacket->release();
+        if (status != FBCAPTURE_GPU_ENCODER_BUFFER_EMPTY)
+          DEBUG_ERROR_VAR("Failed during processing encoded frame output", to_string(status));
         return status;
       }
 
-      uint8_t *sps = nullptr, *pps = nullptr;
-      uint32_t spsLen, ppsLen;
-      status = getSequenceParams(&sps, &spsLen, &pps, &ppsLen);
+      // DEBUG_LOG_VAR("  Video packet pts (frameIdx:keyframe)", to_string((uint32_t)(timestamp / pow(10, 4))) + " ms (" + to_string(frameIdx) + ":" + to_string(isKeyframe) + ")");
+
+      videoPacket->length = length;
+
+      // Rewrite to AVCC once here rather than in every sink that needs length prefixed NAL units
+      if (!AnnexBToAvcc(videoPacket, &videoPacket->nals, videoCodec_)) {
+        videoPacket->release();
+        DEBUG_ERROR("Failed converting encoded frame to AVCC");
+        return FBCAPTURE_GPU_ENCODER_PROCESS_OUTPUT_FAILED;
+      }
+
+      SequenceParams* seqParams;
+      status = getSessionSequenceParams(videoPacket, &seqParams);
       if (status != FBCAPTURE_OK) {
+        videoPacket->release();
         DEBUG_ERROR_VAR("Failed getting sequence parameters for hardware encoder", to_string(status));
         return status;
       }
 
-      // DEBUG_LOG_VAR("  Video packet pts (frameIdx:keyframe)", to_string((uint32_t)(timestamp / pow(10, 4))) + " ms (" + to_string(frameIdx) + ":" + to_string(isKeyframe) + ")");
-
-      *packet = new VideoEncodePacket();
-      (*packet)->buffer = static_cast<uint8_t*>(buffer);
-      (*packet)->length = length;
-      (*packet)->timestamp = timestamp;
-      (*packet)->frameIdx = frameIdx;
-      (*packet)->isKeyframe = isKeyframe;
-      (*packet)->sps = sps;
-      (*packet)->spsLen = spsLen;
-      (*packet)->pps = pps;
-      (*packet)->ppsLen = ppsLen;
+      videoPacket->codec = videoCodec_;
+      videoPacket->timestamp = timestamp;
+      videoPacket->frameIdx = frameIdx;
+      videoPacket->isKeyframe = isKeyframe;
+      videoPacket->seqParams = seqParams ? seqParams->addRef() : NULL;
+      *packet = videoPacket;
 
       return status;
     }
 
+    FBCAPTURE_STATUS GPUEncoder::getSessionSequenceParams(const VideoEncodePacket* packet, SequenceParams** seqParams) {
+      // Encoders repeat the parameter sets in front of IDR frames. Take them from there and only replace the cached copy
+      // when the bytes differ, so sinks can tell a real change by the SequenceParams they are handed.
+      const auto isHevc = videoCodec_ == VIDEO_CODEC::HEVC;
+      const uint8_t spsType = isHevc ? HEVC_NAL_SPS : NAL_SPS;
+      const uint8_t ppsType = isHevc ? HEVC_NAL_PPS : NAL_PPS;
+      const NalUnit *spsNal = nullptr, *ppsNal = nullptr, *vpsNal = nullptr;
+      for (const auto& nal : packet->nals) {
+        if (nal.type == spsType && !spsNal)
+          spsNal = &nal;
+        else if (nal.type == ppsType && !ppsNal)
+          ppsNal = &nal;
+        else if (isHevc && nal.type == HEVC_NAL_VPS && !vpsNal)
+          vpsNal = &nal;
+      }
+
+      if (spsNal && ppsNal && (vpsNal || !isHevc)) {
+        const auto sps = packet->buffer + spsNal->offset;
+        const auto pps = packet->buffer + ppsNal->offset;
+        const auto vps = vpsNal ? packet->buffer + vpsNal->offset : NULL;
+        const auto vpsLen = vpsNal ? vpsNal->length : 0;
+        if (!seqParams_ || !seqParams_->matches(sps, spsNal->length, pps, ppsNal->length, vps, vpsLen)) {
+          if (seqParams_)
+            seqParams_->release();
+          seqParams_ = new SequenceParams(sps, spsNal->length, pps, ppsNal->length, vps, vpsLen);
+        }
+      } else if (!seqParams_ && !seqParamsRequested_) {
+        // Not in the bitstream, so ask the encoder once per session instead
+        seqParamsRequested_ = true;
+        uint8_t *sps = nullptr, *pps = nullptr, *vps = nullptr;
+        uint32_t spsLen = 0, ppsLen = 0, vpsLen = 0;
+        const auto status = getSequenceParams(&sps, &spsLen, &pps, &ppsLen, &vps, &vpsLen);
+        if (status != FBCAPTURE_OK)
+          return status;
+
+        if (sps && pps && spsLen > 0 && ppsLen > 0 && (vpsLen > 0 || !isHevc))
+          seqParams_ = new SequenceParams(sps, spsLen, pps, ppsLen, vps, vpsLen);
+        free(sps);
+        free(pps);
+        free(vps);
+      }
+
+      *seqParams = seqParams_;
+      return FBCAPTURE_OK;
+    }
+
   }
 }
@@ -8,6 +8,7 @@
 #endif
 
 #include "EncodePacket.h"
+#include "PacketPool.h"
 #include "ScreenGrab.h"
 #include "FBCaptureStatus.h"
 #include "FileUtil.h"
@@ -62,11 +63,14 @@ namespace FBCapture {
         return FBCAPTURE_OK;
       }
 
+      // adaptiveBitrate picks a rate control that follows reconfigureBitrate() over a constant quality
       virtual FBCAPTURE_STATUS initialize(uint32_t bitrate,
                                           uint32_t fps,
                                           uint32_t gop,
+                                          VIDEO_CODEC codec,
                                           bool flipTexture,
-                                          bool enableAsyncMode);
+                                          bool enableAsyncMode,
+                                          bool adaptiveBitrate);
 
       // submit input texture ptr for encoding
       virtual FBCAPTURE_STATUS encode(void* texturePtr) {
@@ -78,8 +82,15 @@ namespace FBCapture {
         return FBCAPTURE_OK;
       }
 
-      // get sequence parameters for a frame that was just encoded.
-      virtual FBCAPTURE_STATUS getSequenceParams(uint8_t **sps, uint32_t *spsLen, uint8_t **pps, uint32_t *ppsLen) {
+      // change the target bitrate of a running session. Called on the thread that calls encode().
+      virtual FBCAPTURE_STATUS reconfigureBitrate(uint32_t bitrate) {
+        return FBCAPTURE_OK;
+      }
+
+      // get sequence parameters for a frame that was just encoded. vps is only reported for HEVC.
+      virtual FBCAPTURE_STATUS getSequenceParams(uint8_t **sps, uint32_t *spsLen,
+                                                 uint8_t **pps, uint32_t *ppsLen,
+                                                 uint8_t **vps, uint32_t *vpsLen) {
         return FBCAPTURE_OK;
       }
 
@@ -95,14 +106,20 @@ namespace FBCapture {
       uint32_t getFps() const;
       uint32_t getBitrate() const;
       uint32_t getGop() const;
+      VIDEO_CODEC getCodec() const;
       FBCAPTURE_STATUS getEncodePacket(VideoEncodePacket** packet);
 
+    protected:
+      FBCAPTURE_STATUS getSessionSequenceParams(const VideoEncodePacket* packet, SequenceParams** seqParams);
+
     protected:
       uint32_t bitrate_;
       uint32_t fps_;
       uint32_t gop_;
+      VIDEO_CODEC videoCodec_;
       bool flipTexture_;
       bool enableAsyncMode_;
+      bool adaptiveBitrate_;
       const void* outputBuffer_;
       uint32_t outputBufferLength_;
 
@@ -110,8 +127,14 @@ namespace FBCapture {
       chrono::time_point<chrono::system_clock> firstFrameTp_;
       bool firstFrame_;
 
-      // get output encoded data
+      static const uint32_t kPacketPoolSize = 16;
+      PacketPool<VideoEncodePacket>* packetPool_;
+      SequenceParams* seqParams_;  // latest parameter sets of the session, referenced by every packet
+      bool seqParamsRequested_;  // getSequenceParams() was already called this session
+
+      // get output encoded data. buffer is a reusable buffer of capacity bytes which is grown if the output doesn't fit.
       virtual FBCAPTURE_STATUS processOutput(void **buffer,
+                                             uint32_t *capacity,
                                              uint32_t *length,
                                              uint64_t *timestamp,
                                              uint64_t *duration,
@@ -0,0 +1,32 @@
+/****************************************************************************************************************
+
+Filename	:	IoVec.h
+Content		:	Scatter/gather buffer references for writing packets without assembling them first
+Copyright	:
+
+****************************************************************************************************************/
+
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+
+namespace FBCapture {
+  namespace Streaming {
+
+    // References memory owned by someone else, like a POSIX iovec or a WSABUF
+    struct IoVec {
+      const uint8_t* data;
+      uint32_t length;
+    };
+
+    // Writes the buffers back to back. stdio has no writev, but large buffers bypass its own buffering.
+    static inline bool WriteV(FILE* file, const IoVec* iov, const uint32_t count) {
+      for (uint32_t i = 0; i < count; i++) {
+        if (iov[i].length > 0 && fwrite(iov[i].data, 1, iov[i].length, file) != iov[i].length)
+          return false;
+      }
+      return true;
+    }
+  }
+}
@@ -19,6 +19,7 @@ namespace FBCapture {
       lastFrameTime_(false),
       rtmp_(NULL),
       packet_(NULL),
+      packetCapacity_(0),
       sessionInitialized_(false) {}
 
     LibRTMP::~LibRTMP() {
@@ -68,6 +69,51 @@ namespace FBCapture {
       memset(packet_, 0, sizeof(RTMPPacket));
       RTMPPacket_Reset(packet_);
       RTMPPacket_Alloc(packet_, packetSize);
+      packetCapacity_ = packetSize;
+
+      return FBCAPTURE_OK;
+    }
+
+    FBCAPTURE_STATUS LibRTMP::sendMessage(const uint8_t type, const uint32_t timestamp, const IoVec* body, const uint32_t count) {
+      if (!rtmp_ || !packet_ || !RTMP_IsConnected(rtmp_)) {
+        DEBUG_ERROR("RTMP is disconnected");
+        return FBCAPTURE_RTMP_DISCONNECTED;
+      }
+
+      uint32_t bodySize = 0;
+      for (uint32_t i = 0; i < count; i++)
+        bodySize += body[i].length;
+
+      if (static_cast<int>(bodySize) > packetCapacity_) {
+        RTMPPacket_Free(packet_);
+        if (!RTMPPacket_Alloc(packet_, bodySize)) {
+          DEBUG_ERROR_VAR("failed to allocate packet", to_string(bodySize));
+          packetCapacity_ = 0;
+          return FBCAPTURE_RTMP_SEND_PACKET_FAILED;
+        }
+        packetCapacity_ = bodySize;
+      }
+
+      // librtmp writes the chunk headers in place in front of the body and encrypts or tunnels
+      // what it sends, so the body has to be assembled once in the packet's own buffer
+      auto dst = packet_->m_body;
+      for (uint32_t i = 0; i < count; i++) {
+        memcpy(dst, body[i].data, body[i].length);
+        dst += body[i].length;
+      }
+
+      packet_->m_packetType = type;
+      packet_->m_nBodySize = bodySize;
+      packet_->m_nTimeStamp = timestamp;
+      packet_->m_nChannel = 0x04;   /* source channel */
+      packet_->m_nInfoField2 = rtmp_->m_stream_id;
+      packet_->m_hasAbsTimestamp = 0;
+      packet_->m_headerType = packet_->m_nTimeStamp == 0 ? RTMP_PACKET_SIZE_LARGE : RTMP_PACKET_SIZE_MEDIUM;
+
+      if (!RTMP_SendPacket(rtmp_, packet_, FALSE)) {
+        DEBUG_ERROR("Failed to send packet");
+        return FBCAPTURE_RTMP_SEND_PACKET_FAILED;
+      }
 
       return FBCAPTURE_OK;
     }
@@ -281,7 +327,8 @@ namespace FBCapture {
           if (!PeekU8(&type, file)) {
             break;
           }
-          if (type == 0x17)
+          // frame type 1 in bits 4-6, for AVC and ExVideoTagHeader video alike
+          if (((type >> 4) & 0x7) == 1)
             nextIsKey = 1;
           else
             nextIsKey = 0;
@@ -317,6 +364,7 @@ namespace FBCapture {
         RTMPPacket_Free(packet_);
         packet_ = NULL;
       }
+      packetCapacity_ = 0;
 
       if (streamUrl_)
         delete streamUrl_;
@@ -7,11 +7,14 @@ Copyright	:
 ****************************************************************************************************************/
 #pragma once
 #include <string>
+#include <vector>
 #include "RTMP/include/librtmp/rtmp_sys.h"
 #include "RTMP/include/librtmp/rtmp.h"
 #include "RTMP/include/librtmp/log.h"
 
 #include "FBCaptureStatus.h"
+#include "FlvPacketizer.h"
+#include "IoVec.h"
 
 using namespace std;
 
@@ -48,6 +51,9 @@ namespace FBCapture {
 
       FBCAPTURE_STATUS initialize(const string& streamUrl);
       FBCAPTURE_STATUS sendFlvPacket(const char* buf, int size) const;
+      // Sends one audio/video message whose body is the buffers back to back. Only used for the rtmpt, rtmpe and
+      // rtmps links librtmp tunnels or encrypts, plain rtmp:// goes through RtmpPublisher.
+      FBCAPTURE_STATUS sendMessage(uint8_t type, uint32_t timestamp, const IoVec* body, uint32_t count);
       FBCAPTURE_STATUS sendFlvPacketFromFile(const string& filepath);
       FBCAPTURE_STATUS close();
 
@@ -66,6 +72,7 @@ namespace FBCapture {
       long lastFrameTime_ = 0;
       RTMP* rtmp_;
       RTMPPacket* packet_;
+      int packetCapacity_;  // body size allocated for packet_
       bool sessionInitialized_;
     };
   }
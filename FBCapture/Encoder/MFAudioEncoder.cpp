@@ -50,11 +50,13 @@ namespace FBCapture {
       outputBufferData_(NULL),
       outputBufferLength_(0),
       outputSamplePts_(0),
-      outputSampleDuration_(0) {}
+      outputSampleDuration_(0),
+      packetPool_(PacketPool<AudioEncodePacket>::create(kPacketPoolSize)) {}
 
     MFAudioEncoder::~MFAudioEncoder() {
       finalize();
       shutdownSessions();
+      packetPool_->destroy();
     }
 
     HRESULT MFAudioEncoder::setTransformInputType(IMFTransform** transform) {
@@ -273,8 +275,12 @@ namespace FBCapture {
         return status;
       }
 
-      *packet = new AudioEncodePacket();
-      (*packet)->buffer = static_cast<uint8_t*>(buffer);
+      // The output buffer is reused by the next encode, while the packet is written later on the mux thread
+      *packet = packetPool_->acquire(length);
+      if (!*packet)
+        return FBCAPTURE_AUDIO_ENCODER_PROCESS_OUTPUT_FAILED;
+
+      memcpy((*packet)->buffer, buffer, length);
       (*packet)->length = length;
       (*packet)->timestamp = timestamp;
       (*packet)->duration = duration;
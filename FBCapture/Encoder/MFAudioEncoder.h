@@ -16,6 +16,7 @@ Copyright	:
 #include <iostream>
 
 #include "EncodePacket.h"
+#include "PacketPool.h"
 #include "FBCaptureStatus.h"
 
 using namespace std;
@@ -133,8 +134,11 @@ namespace FBCapture {
       LONGLONG outputSamplePts_;
       LONGLONG outputSampleDuration_;
 
+      PacketPool<AudioEncodePacket>* packetPool_;
+
     public:
       static const uint32_t kProfileLevel;
+      static const uint32_t kPacketPoolSize = 32;
       static const MFT_REGISTER_TYPE_INFO kInInfo;
       static const MFT_REGISTER_TYPE_INFO kOutInfo;
     };
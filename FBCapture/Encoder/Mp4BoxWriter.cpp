@@ -0,0 +1,105 @@
+/****************************************************************************************************************
+
+Filename	:	Mp4BoxWriter.cpp
+Content		:
+Copyright	:
+
+****************************************************************************************************************/
+
+#include "Mp4BoxWriter.h"
+
+#include <string.h>
+
+namespace FBCapture {
+  namespace Streaming {
+
+    Mp4BoxWriter::Mp4BoxWriter() {}
+
+    void Mp4BoxWriter::clear() {
+      buffer_.clear();
+      openBoxes_.clear();
+    }
+
+    const uint8_t* Mp4BoxWriter::data() const {
+      return buffer_.data();
+    }
+
+    uint32_t Mp4BoxWriter::size() const {
+      return static_cast<uint32_t>(buffer_.size());
+    }
+
+    void Mp4BoxWriter::beginBox(const uint32_t type) {
+      openBoxes_.push_back(size());
+      writeU32(0);  // size, set by endBox()
+      writeU32(type);
+    }
+
+    void Mp4BoxWriter::beginFullBox(const uint32_t type, const uint8_t version, const uint32_t flags) {
+      beginBox(type);
+      writeU8(version);
+      writeU24(flags);
+    }
+
+    void Mp4BoxWriter::endBox() {
+      if (openBoxes_.empty())
+        return;
+      const auto start = openBoxes_.back();
+      openBoxes_.pop_back();
+      patchU32(start, size() - start);
+    }
+
+    void Mp4BoxWriter::writeU8(const uint8_t value) {
+      buffer_.push_back(value);
+    }
+
+    void Mp4BoxWriter::writeU16(const uint16_t value) {
+      buffer_.push_back(static_cast<uint8_t>(value >> 8));
+      buffer_.push_back(static_cast<uint8_t>(value));
+    }
+
+    void Mp4BoxWriter::writeU24(const uint32_t value) {
+      buffer_.push_back(static_cast<uint8_t>(value >> 16));
+      buffer_.push_back(static_cast<uint8_t>(value >> 8));
+      buffer_.push_back(static_cast<uint8_t>(value));
+    }
+
+    void Mp4BoxWriter::writeU32(const uint32_t value) {
+      buffer_.push_back(static_cast<uint8_t>(value >> 24));
+      buffer_.push_back(static_cast<uint8_t>(value >> 16));
+      buffer_.push_back(static_cast<uint8_t>(value >> 8));
+      buffer_.push_back(static_cast<uint8_t>(value));
+    }
+
+    void Mp4BoxWriter::writeU64(const uint64_t value) {
+      writeU32(static_cast<uint32_t>(value >> 32));
+      writeU32(static_cast<uint32_t>(value));
+    }
+
+    void Mp4BoxWriter::writeBytes(const void* data, const size_t length) {
+      const auto bytes = static_cast<const uint8_t*>(data);
+      buffer_.insert(buffer_.end(), bytes, bytes + length);
+    }
+
+    void Mp4BoxWriter::writeZeros(const size_t length) {
+      buffer_.insert(buffer_.end(), length, 0);
+    }
+
+    void Mp4BoxWriter::writeString(const string& value) {
+      writeBytes(value.c_str(), value.size() + 1);
+    }
+
+    void Mp4BoxWriter::patchU32(const uint32_t offset, const uint32_t value) {
+      if (offset + 4 > buffer_.size())
+        return;
+      buffer_[offset] = static_cast<uint8_t>(value >> 24);
+      buffer_[offset + 1] = static_cast<uint8_t>(value >> 16);
+      buffer_[offset + 2] = static_cast<uint8_t>(value >> 8);
+      buffer_[offset + 3] = static_cast<uint8_t>(value);
+    }
+
+    void Mp4BoxWriter::patchU64(const uint32_t offset, const uint64_t value) {
+      patchU32(offset, static_cast<uint32_t>(value >> 32));
+      patchU32(offset + 4, static_cast<uint32_t>(value));
+    }
+  }
+}
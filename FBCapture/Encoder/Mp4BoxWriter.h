@@ -0,0 +1,60 @@
+/****************************************************************************************************************
+
+Filename	:	Mp4BoxWriter.h
+Content		:	Serializes ISO base media file format boxes for the fragmented mp4 outputs
+Copyright	:
+
+****************************************************************************************************************/
+
+#pragma once
+
+#include <vector>
+#include <string>
+#include <stdint.h>
+
+using namespace std;
+
+#define MP4_FOURCC(a, b, c, d) (static_cast<uint32_t>(a) << 24 | static_cast<uint32_t>(b) << 16 | \
+                                static_cast<uint32_t>(c) << 8 | static_cast<uint32_t>(d))
+
+#define MP4_BOX_HEADER_SIZE 8
+
+namespace FBCapture {
+  namespace Streaming {
+
+    /*
+    * Appends big endian box fields to a buffer that is reused across clear() calls. Boxes are nested with
+    * beginBox()/endBox(), and endBox() fills in the size once the box contents are known. Fields that are
+    * only known later, like trun data offsets, are written as placeholders and patched with patchU32().
+    */
+    class Mp4BoxWriter {
+    public:
+      Mp4BoxWriter();
+
+      void clear();
+      const uint8_t* data() const;
+      uint32_t size() const;
+
+      void beginBox(uint32_t type);
+      void beginFullBox(uint32_t type, uint8_t version, uint32_t flags);
+      void endBox();
+
+      void writeU8(uint8_t value);
+      void writeU16(uint16_t value);
+      void writeU24(uint32_t value);
+      void writeU32(uint32_t value);
+      void writeU64(uint64_t value);
+      void writeBytes(const void* data, size_t length);
+      void writeZeros(size_t length);
+      void writeString(const string& value);  // null terminated
+
+      // Overwrites 4 bytes at offset, which must have been written already
+      void patchU32(uint32_t offset, uint32_t value);
+      void patchU64(uint32_t offset, uint64_t value);
+
+    private:
+      vector<uint8_t> buffer_;
+      vector<uint32_t> openBoxes_;  // offsets of the boxes not ended yet
+    };
+  }
+}
@@ -0,0 +1,224 @@
+/****************************************************************************************************************
+
+Filename	:	Mp4FileSink.cpp
+Content		:
+Copyright	:
+
+****************************************************************************************************************/
+
+#include "Mp4FileSink.h"
+#include "FileUtil.h"
+#include "Log.h"
+#include "metadata_utils.h"
+
+using namespace FBCapture::SpatialMedia;
+
+namespace FBCapture {
+  namespace Streaming {
+
+    const string Mp4FileSink::kStitchingSoftware = "Facebook 360 Capture SDK";
+
+    Mp4FileSink::Mp4FileSink(const string* mp4Path, const MP4_LAYOUT layout, const uint32_t reservedMovieSize,
+                             const uint64_t fragmentDuration) :
+      mp4Path_(mp4Path),
+      layout_(layout),
+      reservedMovieSize_(reservedMovieSize),
+      fragmentDuration_(fragmentDuration),
+      file_(NULL),
+      headerWritten_(false) {}
+
+    Mp4FileSink::~Mp4FileSink() {
+      close();
+    }
+
+    FBCAPTURE_STATUS Mp4FileSink::open() {
+      muxer_.reset();
+      headerWritten_ = false;
+
+      Utils utils;
+      const auto& xml = utils.generate_spherical_xml(
+        Projection::EQUIRECT,
+        StereoMode::SM_NONE,
+        kStitchingSoftware,
+        NULL
+      );
+      if (xml.length() <= 1) {
+        DEBUG_ERROR("Failed to generate spherical video metadata.");
+        return FBCAPTURE_METADATA_INVALID;
+      }
+      muxer_.setSphericalMetadata(xml, kStitchingSoftware);
+
+      OPEN_FILE(file_, (*mp4Path_));
+      return FBCAPTURE_OK;
+    }
+
+    FBCAPTURE_STATUS Mp4FileSink::write(EncodePacket* packet) {
+      if (!file_ || !muxer_.addPacket(packet))
+        return FBCAPTURE_OK;
+      if (packet->type() != PACKET_TYPE::VIDEO)
+        return FBCAPTURE_OK;
+
+      const auto pendingDuration = muxer_.pendingVideoDuration();
+      if (pendingDuration == 0)
+        return FBCAPTURE_OK;
+
+      if (layout_ == MP4_LAYOUT::FASTSTART)
+        return pendingDuration >= kChunkDuration ? writeChunks() : FBCAPTURE_OK;
+
+      // a keyframe completes the fragment before it, the keyframe itself is held back to start the next one
+      if (static_cast<VideoEncodePacket*>(packet)->isKeyframe || pendingDuration >= fragmentDuration_)
+        return writeFragment();
+      return FBCAPTURE_OK;
+    }
+
+    FBCAPTURE_STATUS Mp4FileSink::writeHeader() {
+      // waits for the first fragment or chunk so that the audio track is known by then
+      box_.clear();
+      const auto cmaf = false;
+      if (layout_ == MP4_LAYOUT::FASTSTART) {
+        if (!muxer_.writeFileHeader(&box_, reservedMovieSize_, &iov_))
+          return FBCAPTURE_OK;
+      } else {
+        if (!muxer_.writeInitSegment(&box_, cmaf))
+          return FBCAPTURE_OK;
+        iov_.assign(1, { box_.data(), box_.size() });
+      }
+
+      // the fragments that follow are only playable with the init segment already on disk
+      const auto flush = layout_ == MP4_LAYOUT::FRAGMENTED;
+      if (!WriteV(file_, iov_.data(), static_cast<uint32_t>(iov_.size())) || (flush && fflush(file_) != 0)) {
+        DEBUG_ERROR_VAR("Failed writing mp4 header", *mp4Path_);
+        return FBCAPTURE_MP4_WRITE_FAILED;
+      }
+      headerWritten_ = true;
+      return FBCAPTURE_OK;
+    }
+
+    FBCAPTURE_STATUS Mp4FileSink::writeFragment() {
+      if (!headerWritten_) {
+        const auto status = writeHeader();
+        if (status != FBCAPTURE_OK || !headerWritten_)
+          return status;
+      }
+
+      box_.clear();
+      if (!muxer_.writeFragment(&box_, &iov_, NULL))
+        return FBCAPTURE_OK;
+
+      const auto written = WriteV(file_, iov_.data(), static_cast<uint32_t>(iov_.size()));
+      muxer_.releaseFragment();
+      if (!written) {
+        DEBUG_ERROR_VAR("Failed writing mp4 fragment", *mp4Path_);
+        return FBCAPTURE_MP4_WRITE_FAILED;
+      }
+      return writeFragmentDuration();
+    }
+
+    FBCAPTURE_STATUS Mp4FileSink::writeFragmentDuration() {
+      // players read the total duration from mehd, kept up to date in case the session never gets to close()
+      const auto offset = muxer_.fragmentDurationOffset();
+      if (offset == 0)
+        return FBCAPTURE_OK;
+      box_.clear();
+      box_.writeU64(muxer_.movieDuration());
+      const auto status = writeAt(offset, box_, "duration");
+      if (status != FBCAPTURE_OK)
+        return status;
+
+      if (fseek(file_, 0, SEEK_END) != 0 || fflush(file_) != 0) {
+        DEBUG_ERROR_VAR("Failed flushing mp4 fragment", *mp4Path_);
+        return FBCAPTURE_MP4_WRITE_FAILED;
+      }
+      return FBCAPTURE_OK;
+    }
+
+    FBCAPTURE_STATUS Mp4FileSink::writeChunks() {
+      if (!headerWritten_) {
+        const auto status = writeHeader();
+        if (status != FBCAPTURE_OK || !headerWritten_)
+          return status;
+      }
+
+      if (!muxer_.writeChunks(&iov_))
+        return FBCAPTURE_OK;
+
+      const auto written = WriteV(file_, iov_.data(), static_cast<uint32_t>(iov_.size()));
+      muxer_.releaseFragment();
+      if (!written) {
+        DEBUG_ERROR_VAR("Failed writing mp4 chunks", *mp4Path_);
+        return FBCAPTURE_MP4_WRITE_FAILED;
+      }
+      return FBCAPTURE_OK;
+    }
+
+    FBCAPTURE_STATUS Mp4FileSink::writeAt(const uint64_t offset, const Mp4BoxWriter& box, const char* what) {
+      // the patched fields all sit ahead of the mdat, within the reserved moov space
+      if (fseek(file_, static_cast<long>(offset), SEEK_SET) != 0 ||
+          fwrite(box.data(), 1, box.size(), file_) != box.size()) {
+        DEBUG_ERROR_VAR(string("Failed writing mp4 ") + what, *mp4Path_);
+        return FBCAPTURE_MP4_WRITE_FAILED;
+      }
+      return FBCAPTURE_OK;
+    }
+
+    FBCAPTURE_STATUS Mp4FileSink::writeFragmentedTrailer() {
+      // the mehd duration is already up to date with the last fragment
+      box_.clear();
+      if (muxer_.writeRandomAccessIndex(&box_) && fwrite(box_.data(), 1, box_.size(), file_) != box_.size()) {
+        DEBUG_ERROR_VAR("Failed writing mp4 seek index", *mp4Path_);
+        return FBCAPTURE_MP4_WRITE_FAILED;
+      }
+      return FBCAPTURE_OK;
+    }
+
+    FBCAPTURE_STATUS Mp4FileSink::writeMovie() {
+      box_.clear();
+      box_.writeU64(muxer_.outputSize() - muxer_.mediaDataOffset());
+      auto status = writeAt(muxer_.mediaDataOffset() + MP4_BOX_HEADER_SIZE, box_, "mdat size");
+      if (status != FBCAPTURE_OK)
+        return status;
+
+      box_.clear();
+      if (!muxer_.writeMovie(&box_))
+        return FBCAPTURE_OK;
+
+      // what is left of the reservation stays a free box, unless it is too small for a box header
+      const auto moovSize = box_.size();
+      if (moovSize == reservedMovieSize_ || moovSize + MP4_BOX_HEADER_SIZE <= reservedMovieSize_) {
+        if (moovSize < reservedMovieSize_) {
+          box_.writeU32(reservedMovieSize_ - moovSize);
+          box_.writeU32(MP4_FOURCC('f', 'r', 'e', 'e'));
+        }
+        return writeAt(muxer_.movieReserveOffset(), box_, "moov");
+      }
+
+      DEBUG_LOG_VAR("The moov outgrew its reserved space and goes to the end of the mp4", to_string(moovSize) + " > " + to_string(reservedMovieSize_));
+      if (fseek(file_, 0, SEEK_END) != 0 || fwrite(box_.data(), 1, box_.size(), file_) != box_.size()) {
+        DEBUG_ERROR_VAR("Failed writing mp4 moov", *mp4Path_);
+        return FBCAPTURE_MP4_WRITE_FAILED;
+      }
+      return FBCAPTURE_OK;
+    }
+
+    FBCAPTURE_STATUS Mp4FileSink::close() {
+      if (!file_)
+        return FBCAPTURE_OK;
+
+      muxer_.endOfStream();
+      auto status = FBCAPTURE_OK;
+      if (layout_ == MP4_LAYOUT::FASTSTART) {
+        status = writeChunks();
+        if (status == FBCAPTURE_OK && headerWritten_)
+          status = writeMovie();
+      } else {
+        status = writeFragment();
+        if (status == FBCAPTURE_OK && headerWritten_)
+          status = writeFragmentedTrailer();
+      }
+
+      CLOSE_FILE(file_);
+      muxer_.reset();
+      return status;
+    }
+  }
+}
@@ -0,0 +1,82 @@
+/****************************************************************************************************************
+
+Filename	:	Mp4FileSink.h
+Content		:	Writes encoded packets progressively into an mp4 file
+Copyright	:
+
+****************************************************************************************************************/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <stdio.h>
+
+#include "PacketSink.h"
+#include "Mp4Muxer.h"
+
+using namespace std;
+
+namespace FBCapture {
+  namespace Streaming {
+
+    using MP4_LAYOUT = enum class Mp4Layout {
+      FASTSTART,   // moov ahead of the mdat, for progressive download from a web server
+      FRAGMENTED   // init segment followed by moof/mdat fragments, playable up to the last one written
+    };
+
+    /*
+    * For mp4 destinations. Muxes the packets as they come in, so there are no elementary stream files to
+    * transmux once the session stops.
+    *
+    * FASTSTART appends the samples to the mdat in kChunkDuration chunks and keeps their sample tables in memory.
+    * The file starts with a free box of reservedMovieSize, and close() writes the moov into it, which makes the
+    * file web streamable without rewriting it. A moov that outgrows the reservation is appended to the end instead.
+    *
+    * FRAGMENTED starts a moof/mdat fragment at every keyframe, or once it holds fragmentDuration of video. The init
+    * segment and every fragment are flushed as soon as they are written, with the duration in mehd updated to match,
+    * so a capture whose process crashes or gets killed leaves an mp4 that plays up to the last fragment without any
+    * repair. close() only writes the last fragment and the mfra seek index.
+    *
+    * Either way the packets held in memory are bounded and the video track is written with the spherical video
+    * metadata of an equirectangular capture in place, so there is no metadata injection pass either.
+    */
+    class Mp4FileSink : public PacketSink {
+    public:
+      static const uint64_t kChunkDuration = 5000000;  // 500 ms, in 100 nanosec unit
+      static const string kStitchingSoftware;
+
+      // reservedMovieSize only applies to FASTSTART and fragmentDuration, in 100 nanosec unit, to FRAGMENTED
+      Mp4FileSink(const string* mp4Path, MP4_LAYOUT layout, uint32_t reservedMovieSize, uint64_t fragmentDuration);
+      ~Mp4FileSink();
+
+      FBCAPTURE_STATUS open() override;
+      FBCAPTURE_STATUS write(EncodePacket* packet) override;
+      FBCAPTURE_STATUS close() override;
+
+      const char* name() const override {
+        return "Mp4 file sink";
+      }
+
+    private:
+      const string* mp4Path_;
+      const MP4_LAYOUT layout_;
+      const uint32_t reservedMovieSize_;
+      const uint64_t fragmentDuration_;
+      FILE* file_;
+
+      Mp4Muxer muxer_;
+      Mp4BoxWriter box_;
+      vector<IoVec> iov_;
+      bool headerWritten_;         // the init segment, or ftyp, the reserved space and the mdat header
+
+      FBCAPTURE_STATUS writeHeader();
+      FBCAPTURE_STATUS writeFragment();
+      FBCAPTURE_STATUS writeChunks();
+      FBCAPTURE_STATUS writeFragmentDuration();
+      FBCAPTURE_STATUS writeFragmentedTrailer();
+      FBCAPTURE_STATUS writeMovie();
+      FBCAPTURE_STATUS writeAt(uint64_t offset, const Mp4BoxWriter& box, const char* what);
+    };
+  }
+}
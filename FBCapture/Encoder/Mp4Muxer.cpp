@@ -0,0 +1,913 @@
+/****************************************************************************************************************
+
+Filename	:	Mp4Muxer.cpp
+Content		:
+Copyright	:
+
+****************************************************************************************************************/
+
+#include "Mp4Muxer.h"
+#include "SpsParser.h"
+#include "Log.h"
+
+#include <algorithm>
+#include <stdio.h>
+
+#define MP4_TIMESTAMP_RATE 10000000      // packet timestamps are in 100 nanosec unit
+
+#define MP4_TKHD_FLAGS 0x000003          // track_enabled | track_in_movie
+#define MP4_TFHD_DEFAULT_BASE_IS_MOOF 0x020000
+#define MP4_TRUN_DATA_OFFSET 0x000001
+#define MP4_TRUN_SAMPLE_DURATION 0x000100
+#define MP4_TRUN_SAMPLE_SIZE 0x000200
+#define MP4_TRUN_SAMPLE_FLAGS 0x000400
+
+#define MP4_SYNC_SAMPLE_FLAGS 0x02000000       // sample_depends_on 2, no other sample
+#define MP4_NON_SYNC_SAMPLE_FLAGS 0x01010000   // sample_depends_on 1, sample_is_non_sync_sample
+
+#define MP4_LANGUAGE_UND 0x55c4          // 'und' packed into 3 x 5 bits
+
+#define MP4_STEREO_MODE_MONO 0
+
+
+// moov of a faststart file, everything but the sample tables, like decoder configs and the spherical xml
+#define MP4_MOVIE_BASE_SIZE 8192
+#define MP4_VIDEO_SAMPLE_COST 16         // stsz entry, a stts entry, a stss entry in the worst case
+#define MP4_AUDIO_SAMPLE_COST 12         // stsz entry, a stts entry
+#define MP4_CHUNK_COST 20                // co64 entry, a stsc entry
+#define MP4_MAX_AUDIO_FRAMES_PER_SEC 47  // 1024 sample AAC frames at 48 kHz
+#define MP4_MAX_MOVIE_RESERVE (32 * 1024 * 1024)  // hours of 60 fps video, a longer capture moves the moov to the end
+#define MP4_ZERO_BLOCK_SIZE (64 * 1024)
+
+namespace FBCapture {
+  namespace Streaming {
+
+    namespace {
+      // SPHERICAL_UUID_ID of the spherical video V1 RFC
+      const uint8_t kSphericalUuid[] = { 0xff, 0xcc, 0x82, 0x63, 0xf8, 0x55, 0x4a, 0x93, 0x88, 0x14, 0x58, 0x7a, 0x02, 0x52, 0x1f, 0xdd };
+
+      // the payload of the free box reserved for the moov, listed as many times as needed
+      const uint8_t kZeroBlock[MP4_ZERO_BLOCK_SIZE] = {};
+    }
+
+    Mp4Muxer::Track::Track() :
+      id(0),
+      timescale(0),
+      configured(false),
+      inInit(false),
+      codec(VIDEO_CODEC::H264),
+      seqParams(NULL),
+      width(0),
+      height(0),
+      profileLevel(0),
+      sampleRate(0),
+      numChannels(0),
+      sampleRateIndex(0),
+      held(),
+      hasHeld(false),
+      lastDuration(0),
+      writtenEnd(0),
+      firstDecodeTime(0) {}
+
+    Mp4Muxer::Mp4Muxer() :
+      baseTimestamp_(0),
+      started_(false),
+      initWritten_(false),
+      sequenceNumber_(0),
+      outputOffset_(0),
+      fragmentDurationOffset_(0),
+      movieReserveOffset_(0),
+      mediaDataOffset_(0) {
+      video_.id = kVideoTrackId;
+      video_.timescale = kVideoTimescale;
+      audio_.id = kAudioTrackId;
+    }
+
+    Mp4Muxer::~Mp4Muxer() {
+      reset();
+    }
+
+    void Mp4Muxer::releaseTrack(Track* track) {
+      for (auto& sample : track->samples)
+        sample.packet->release();
+      track->samples.clear();
+      if (track->hasHeld)
+        track->held.packet->release();
+      track->hasHeld = false;
+      track->lastDuration = 0;
+      track->writtenEnd = 0;
+      track->firstDecodeTime = 0;
+      track->sampleSizes.clear();
+      track->durations.clear();
+      track->syncSamples.clear();
+      track->chunks.clear();
+      if (track->seqParams)
+        track->seqParams->release();
+      track->seqParams = NULL;
+      track->configured = false;
+      track->inInit = false;
+    }
+
+    void Mp4Muxer::reset() {
+      releaseFragment();
+      releaseTrack(&video_);
+      releaseTrack(&audio_);
+      audio_.timescale = 0;
+      baseTimestamp_ = 0;
+      started_ = false;
+      initWritten_ = false;
+      sequenceNumber_ = 0;
+      outputOffset_ = 0;
+      fragmentDurationOffset_ = 0;
+      movieReserveOffset_ = 0;
+      mediaDataOffset_ = 0;
+      randomAccessPoints_.clear();
+    }
+
+    void Mp4Muxer::setSphericalMetadata(const string& xml, const string& metadataSource) {
+      sphericalXml_ = xml;
+      sphericalSource_ = metadataSource;
+    }
+
+    uint64_t Mp4Muxer::rescale(const uint64_t value, const uint64_t from, const uint64_t to) {
+      // no overflow for a day of 100 nanosec timestamps in a 96 kHz timescale
+      return value * to / from;
+    }
+
+    bool Mp4Muxer::configureVideo(const VideoEncodePacket* packet) {
+      const auto seqParams = packet->seqParams;
+      if (!seqParams)
+        return false;
+
+      if (packet->codec == VIDEO_CODEC::HEVC) {
+        HevcSpsInfo spsInfo;
+        if (!ParseHevcSps(seqParams->sps, seqParams->spsLen, &spsInfo))
+          return false;
+        video_.width = spsInfo.width;
+        video_.height = spsInfo.height;
+      } else {
+        SpsInfo spsInfo;
+        if (!ParseSps(seqParams->sps, seqParams->spsLen, &spsInfo))
+          return false;
+        video_.width = spsInfo.width;
+        video_.height = spsInfo.height;
+      }
+
+      video_.codec = packet->codec;
+      video_.seqParams = seqParams->addRef();
+      video_.configured = true;
+      return true;
+    }
+
+    void Mp4Muxer::configureAudio(const AudioEncodePacket* packet) {
+      audio_.profileLevel = packet->profileLevel;
+      audio_.sampleRate = packet->sampleRate;
+      audio_.numChannels = packet->numChannels;
+      audio_.sampleRateIndex = packet->sampleRateIndex();
+      // one tick per PCM sample, so AAC frames are exactly 1024 ticks
+      audio_.timescale = packet->sampleRate;
+      audio_.configured = true;
+    }
+
+    bool Mp4Muxer::addPacket(EncodePacket* packet) {
+      if (packet->timestamp < baseTimestamp_)
+        return false;
+
+      if (packet->type() == PACKET_TYPE::VIDEO) {
+        const auto videoPacket = static_cast<VideoEncodePacket*>(packet);
+        if (!started_) {
+          if (!videoPacket->isKeyframe || !configureVideo(videoPacket))
+            return false;
+          baseTimestamp_ = packet->timestamp;
+          started_ = true;
+        }
+        const auto decodeTime = rescale(packet->timestamp - baseTimestamp_, MP4_TIMESTAMP_RATE, video_.timescale);
+        queue(&video_, packet, decodeTime, videoPacket->isKeyframe);
+        return true;
+      }
+
+      if (!started_ || (initWritten_ && !audio_.inInit))
+        return false;
+      if (!audio_.configured)
+        configureAudio(static_cast<AudioEncodePacket*>(packet));
+      const auto decodeTime = rescale(packet->timestamp - baseTimestamp_, MP4_TIMESTAMP_RATE, audio_.timescale);
+      queue(&audio_, packet, decodeTime, true);
+      return true;
+    }
+
+    void Mp4Muxer::queue(Track* track, EncodePacket* packet, const uint64_t decodeTime, const bool isSync) {
+      if (track->hasHeld) {
+        auto& held = track->held;
+        // timestamps that don't advance still need a duration, or the samples after them would shift
+        const auto duration = decodeTime > held.decodeTime ?
+          static_cast<uint32_t>(decodeTime - held.decodeTime) : max<uint32_t>(track->lastDuration, 1);
+        held.duration = duration;
+        track->lastDuration = duration;
+        track->samples.push_back(held);
+      }
+
+      // the next sample's decode time follows from the durations, not from its own timestamp
+      uint64_t heldTime = decodeTime;
+      if (track->hasHeld)
+        heldTime = track->held.decodeTime + track->held.duration;
+      track->held = { packet->addRef(), heldTime, 0, isSync };
+      track->hasHeld = true;
+    }
+
+    void Mp4Muxer::flushHeld(Track* track) {
+      if (!track->hasHeld)
+        return;
+      auto duration = track->lastDuration;
+      if (duration == 0 && track->held.packet->duration > 0)
+        duration = static_cast<uint32_t>(rescale(track->held.packet->duration, MP4_TIMESTAMP_RATE, track->timescale));
+      track->held.duration = max<uint32_t>(duration, 1);
+      track->samples.push_back(track->held);
+      track->hasHeld = false;
+    }
+
+    void Mp4Muxer::endOfStream() {
+      flushHeld(&video_);
+      flushHeld(&audio_);
+    }
+
+    bool Mp4Muxer::isReady() const {
+      return video_.configured;
+    }
+
+    bool Mp4Muxer::hasPendingSamples() const {
+      return !video_.samples.empty() || (audio_.inInit && !audio_.samples.empty());
+    }
+
+    uint64_t Mp4Muxer::pendingVideoDuration() const {
+      uint64_t duration = 0;
+      for (const auto& sample : video_.samples)
+        duration += sample.duration;
+      return rescale(duration, video_.timescale, MP4_TIMESTAMP_RATE);
+    }
+
+    bool Mp4Muxer::hasAudioTrack() const {
+      return audio_.inInit;
+    }
+
+    uint32_t Mp4Muxer::width() const {
+      return video_.width;
+    }
+
+    uint32_t Mp4Muxer::height() const {
+      return video_.height;
+    }
+
+    string Mp4Muxer::codecs() const {
+      string codecs;
+      char value[64];
+
+      if (video_.configured) {
+        const auto seqParams = video_.seqParams;
+        if (video_.codec == VIDEO_CODEC::HEVC) {
+          HevcSpsInfo spsInfo;
+          if (ParseHevcSps(seqParams->sps, seqParams->spsLen, &spsInfo)) {
+            // the compatibility flags go in reverse bit order, the constraint bytes without the trailing zero ones
+            uint32_t compatibility = 0;
+            for (uint32_t i = 0; i < 32; i++)
+              compatibility |= (spsInfo.profileCompatibilityFlags >> i & 1) << (31 - i);
+            const char* profileSpace[] = { "", "A", "B", "C" };
+            snprintf(value, sizeof(value), "hvc1.%s%u.%X.%c%u", profileSpace[spsInfo.profileSpace & 0x3],
+                     spsInfo.profileIdc, compatibility, spsInfo.tierFlag ? 'H' : 'L', spsInfo.levelIdc);
+            codecs = value;
+            uint32_t constraintBytes = 6;
+            while (constraintBytes > 0 && (spsInfo.constraintIndicatorFlags >> (48 - constraintBytes * 8) & 0xff) == 0)
+              constraintBytes--;
+            for (uint32_t i = 0; i < constraintBytes; i++) {
+              snprintf(value, sizeof(value), ".%X", static_cast<uint32_t>(spsInfo.constraintIndicatorFlags >> (40 - i * 8) & 0xff));
+              codecs += value;
+            }
+          } else
+            codecs = "hvc1";
+        } else {
+          snprintf(value, sizeof(value), "avc1.%02x%02x%02x", seqParams->sps[1], seqParams->sps[2], seqParams->sps[3]);
+          codecs = value;
+        }
+      }
+
+      if (audio_.configured && (!initWritten_ || audio_.inInit)) {
+        snprintf(value, sizeof(value), "mp4a.40.%u", audio_.profileLevel);
+        if (!codecs.empty())
+          codecs += ",";
+        codecs += value;
+      }
+      return codecs;
+    }
+
+    void Mp4Muxer::fixTrackLayout() {
+      // audio that hasn't shown up by now is left out for good
+      video_.inInit = true;
+      audio_.inInit = audio_.configured;
+      initWritten_ = true;
+    }
+
+    void Mp4Muxer::writeFtyp(Mp4BoxWriter* out, const bool cmaf) const {
+      out->beginBox(MP4_FOURCC('f', 't', 'y', 'p'));
+      out->writeU32(MP4_FOURCC('i', 's', 'o', '6'));  // major_brand
+      out->writeU32(0);                               // minor_version
+      out->writeU32(MP4_FOURCC('i', 's', 'o', '6'));
+      out->writeU32(MP4_FOURCC('i', 's', 'o', 'm'));
+      out->writeU32(MP4_FOURCC('m', 'p', '4', '1'));
+      // a CMAF track file holds a single track, so segments with the audio muxed in are plain fragmented mp4
+      if (cmaf && !audio_.inInit)
+        out->writeU32(MP4_FOURCC('c', 'm', 'f', 'c'));
+      out->writeU32(video_.codec == VIDEO_CODEC::HEVC ? MP4_FOURCC('h', 'v', 'c', '1') : MP4_FOURCC('a', 'v', 'c', '1'));
+      out->endBox();
+    }
+
+    void Mp4Muxer::writeMvhd(Mp4BoxWriter* out, const uint64_t duration) const {
+      out->beginFullBox(MP4_FOURCC('m', 'v', 'h', 'd'), 0, 0);
+      out->writeU32(0);                  // creation_time
+      out->writeU32(0);                  // modification_time
+      out->writeU32(kMovieTimescale);
+      out->writeU32(static_cast<uint32_t>(duration));
+      out->writeU32(0x00010000);         // rate 1.0
+      out->writeU16(0x0100);             // volume 1.0
+      out->writeZeros(10);               // reserved
+      writeMatrix(out);
+      out->writeZeros(24);               // pre_defined
+      out->writeU32(audio_.inInit ? kAudioTrackId + 1 : kVideoTrackId + 1);  // next_track_ID
+      out->endBox();
+    }
+
+    bool Mp4Muxer::writeInitSegment(Mp4BoxWriter* out, const bool cmaf) {
+      if (!video_.configured)
+        return false;
+      fixTrackLayout();
+
+      const auto initStart = out->size();
+      writeFtyp(out, cmaf);
+
+      out->beginBox(MP4_FOURCC('m', 'o', 'o', 'v'));
+      writeMvhd(out, 0);                 // duration unknown up front
+      const auto withSamples = false;
+      writeTrak(out, video_, withSamples);
+      if (audio_.inInit)
+        writeTrak(out, audio_, withSamples);
+
+      out->beginBox(MP4_FOURCC('m', 'v', 'e', 'x'));
+      if (!cmaf) {
+        out->beginFullBox(MP4_FOURCC('m', 'e', 'h', 'd'), 1, 0);
+        fragmentDurationOffset_ = outputOffset_ + out->size() - initStart;
+        out->writeU64(0);                // fragment_duration, unknown until the file is complete
+        out->endBox();
+      }
+      for (const auto track : { &video_, &audio_ }) {
+        if (!track->inInit)
+          continue;
+        out->beginFullBox(MP4_FOURCC('t', 'r', 'e', 'x'), 0, 0);
+        out->writeU32(track->id);
+        out->writeU32(1);                // default_sample_description_index
+        out->writeU32(0);                // default_sample_duration
+        out->writeU32(0);                // default_sample_size
+        out->writeU32(0);                // default_sample_flags
+        out->endBox();
+      }
+      out->endBox();
+
+      out->endBox();  // moov
+
+      outputOffset_ += out->size() - initStart;
+      return true;
+    }
+
+    uint32_t Mp4Muxer::estimateMovieSize(const uint32_t fps, const uint32_t duration, const uint64_t chunkDuration) {
+      const auto chunksPerSec = static_cast<uint64_t>(MP4_TIMESTAMP_RATE / max<uint64_t>(chunkDuration, 1) + 1);
+      const auto costPerSec = fps * MP4_VIDEO_SAMPLE_COST + MP4_MAX_AUDIO_FRAMES_PER_SEC * MP4_AUDIO_SAMPLE_COST +
+        2 * chunksPerSec * MP4_CHUNK_COST;
+      return static_cast<uint32_t>(min<uint64_t>(MP4_MOVIE_BASE_SIZE + costPerSec * duration, MP4_MAX_MOVIE_RESERVE));
+    }
+
+    bool Mp4Muxer::writeFileHeader(Mp4BoxWriter* out, const uint32_t reservedSize, vector<IoVec>* iov) {
+      if (!video_.configured)
+        return false;
+      fixTrackLayout();
+
+      const auto headerStart = out->size();
+      writeFtyp(out, false);
+
+      // only the free box header goes into out, its payload is listed in iov so it never sits in memory
+      const auto freeSize = max<uint32_t>(reservedSize, MP4_BOX_HEADER_SIZE);
+      movieReserveOffset_ = outputOffset_ + out->size() - headerStart;
+      out->writeU32(freeSize);
+      out->writeU32(MP4_FOURCC('f', 'r', 'e', 'e'));
+      const auto paddingStart = out->size();
+
+      // the mdat size is only known at the end, so it always takes the 64 bit form
+      mediaDataOffset_ = movieReserveOffset_ + freeSize;
+      out->writeU32(1);
+      out->writeU32(MP4_FOURCC('m', 'd', 'a', 't'));
+      out->writeU64(0);                  // largesize, patched once every chunk is written
+
+      iov->clear();
+      iov->push_back({ out->data() + headerStart, paddingStart - headerStart });
+      for (auto padding = freeSize - MP4_BOX_HEADER_SIZE; padding > 0;) {
+        const auto length = min<uint32_t>(padding, MP4_ZERO_BLOCK_SIZE);
+        iov->push_back({ kZeroBlock, length });
+        padding -= length;
+      }
+      iov->push_back({ out->data() + paddingStart, out->size() - paddingStart });
+
+      outputOffset_ = mediaDataOffset_ + out->size() - paddingStart;
+      return true;
+    }
+
+    bool Mp4Muxer::writeChunks(vector<IoVec>* iov) {
+      if (!initWritten_ || !hasPendingSamples())
+        return false;
+
+      releaseFragment();
+      iov->clear();
+
+      for (const auto track : { &video_, &audio_ }) {
+        if (!track->inInit) {
+          for (auto& sample : track->samples)
+            sample.packet->release();
+          track->samples.clear();
+          continue;
+        }
+        if (track->samples.empty())
+          continue;
+
+        if (track->sampleSizes.empty())
+          track->firstDecodeTime = track->samples.front().decodeTime;
+        track->chunks.push_back({ outputOffset_, static_cast<uint32_t>(track->samples.size()) });
+
+        for (const auto& sample : track->samples) {
+          track->sampleSizes.push_back(sample.packet->length);
+          if (!track->durations.empty() && track->durations.back().value == sample.duration)
+            track->durations.back().count++;
+          else
+            track->durations.push_back({ 1, sample.duration });
+          if (sample.isSync)
+            track->syncSamples.push_back(static_cast<uint32_t>(track->sampleSizes.size()));
+
+          iov->push_back({ sample.packet->buffer, sample.packet->length });
+          written_.push_back(sample.packet);
+          outputOffset_ += sample.packet->length;
+        }
+
+        track->writtenEnd = track->samples.back().decodeTime + track->samples.back().duration;
+        track->samples.clear();
+      }
+      return true;
+    }
+
+    bool Mp4Muxer::writeMovie(Mp4BoxWriter* out) {
+      if (!initWritten_ || video_.sampleSizes.empty())
+        return false;
+
+      out->beginBox(MP4_FOURCC('m', 'o', 'o', 'v'));
+      writeMvhd(out, movieDuration());
+      const auto withSamples = true;
+      writeTrak(out, video_, withSamples);
+      if (audio_.inInit && !audio_.sampleSizes.empty())
+        writeTrak(out, audio_, withSamples);
+      out->endBox();
+      return true;
+    }
+
+    uint64_t Mp4Muxer::movieReserveOffset() const {
+      return movieReserveOffset_;
+    }
+
+    uint64_t Mp4Muxer::mediaDataOffset() const {
+      return mediaDataOffset_;
+    }
+
+    uint64_t Mp4Muxer::outputSize() const {
+      return outputOffset_;
+    }
+
+    void Mp4Muxer::writeMatrix(Mp4BoxWriter* out) {
+      const uint32_t unity[] = { 0x00010000, 0, 0, 0, 0x00010000, 0, 0, 0, 0x40000000 };
+      for (const auto value : unity)
+        out->writeU32(value);
+    }
+
+    void Mp4Muxer::writeTrak(Mp4BoxWriter* out, const Track& track, const bool withSamples) {
+      const auto isVideo = &track == &video_;
+      // a track that starts after the first keyframe begins with an empty edit, the sample tables start at 0
+      const auto trackDuration = withSamples ? rescale(track.writtenEnd, track.timescale, kMovieTimescale) : 0;
+      const auto emptyDuration = withSamples ? rescale(track.firstDecodeTime, track.timescale, kMovieTimescale) : 0;
+      const auto mediaDuration = withSamples ? track.writtenEnd - track.firstDecodeTime : 0;
+
+      out->beginBox(MP4_FOURCC('t', 'r', 'a', 'k'));
+
+      out->beginFullBox(MP4_FOURCC('t', 'k', 'h', 'd'), 0, MP4_TKHD_FLAGS);
+      out->writeU32(0);                  // creation_time
+      out->writeU32(0);                  // modification_time
+      out->writeU32(track.id);
+      out->writeU32(0);                  // reserved
+      out->writeU32(static_cast<uint32_t>(trackDuration));
+      out->writeZeros(8);                // reserved
+      out->writeU16(0);                  // layer
+      out->writeU16(isVideo ? 0 : 1);    // alternate_group
+      out->writeU16(isVideo ? 0 : 0x0100);  // volume
+      out->writeU16(0);                  // reserved
+      writeMatrix(out);
+      out->writeU32(isVideo ? track.width << 16 : 0);   // 16.16 fixed point
+      out->writeU32(isVideo ? track.height << 16 : 0);
+      out->endBox();
+
+      if (emptyDuration > 0) {
+        out->beginBox(MP4_FOURCC('e', 'd', 't', 's'));
+        out->beginFullBox(MP4_FOURCC('e', 'l', 's', 't'), 0, 0);
+        out->writeU32(2);                // entry_count
+        out->writeU32(static_cast<uint32_t>(emptyDuration));  // segment_duration
+        out->writeU32(0xffffffff);       // media_time -1, empty edit
+        out->writeU32(0x00010000);       // media_rate 1.0
+        out->writeU32(static_cast<uint32_t>(trackDuration - emptyDuration));
+        out->writeU32(0);                // media_time
+        out->writeU32(0x00010000);
+        out->endBox();
+        out->endBox();
+      }
+
+      out->beginBox(MP4_FOURCC('m', 'd', 'i', 'a'));
+
+      out->beginFullBox(MP4_FOURCC('m', 'd', 'h', 'd'), 0, 0);
+      out->writeU32(0);                  // creation_time
+      out->writeU32(0);                  // modification_time
+      out->writeU32(track.timescale);
+      out->writeU32(static_cast<uint32_t>(mediaDuration));
+      out->writeU16(MP4_LANGUAGE_UND);
+      out->writeU16(0);                  // pre_defined
+      out->endBox();
+
+      out->beginFullBox(MP4_FOURCC('h', 'd', 'l', 'r'), 0, 0);
+      out->writeU32(0);                  // pre_defined
+      out->writeU32(isVideo ? MP4_FOURCC('v', 'i', 'd', 'e') : MP4_FOURCC('s', 'o', 'u', 'n'));
+      out->writeZeros(12);               // reserved
+      out->writeString(isVideo ? "VideoHandler" : "SoundHandler");
+      out->endBox();
+
+      out->beginBox(MP4_FOURCC('m', 'i', 'n', 'f'));
+      if (isVideo) {
+        out->beginFullBox(MP4_FOURCC('v', 'm', 'h', 'd'), 0, 1);
+        out->writeU16(0);                // graphicsmode copy
+        out->writeZeros(6);              // opcolor
+      } else {
+        out->beginFullBox(MP4_FOURCC('s', 'm', 'h', 'd'), 0, 0);
+        out->writeU16(0);                // balance
+        out->writeU16(0);                // reserved
+      }
+      out->endBox();
+
+      out->beginBox(MP4_FOURCC('d', 'i', 'n', 'f'));
+      out->beginFullBox(MP4_FOURCC('d', 'r', 'e', 'f'), 0, 0);
+      out->writeU32(1);                  // entry_count
+      out->beginFullBox(MP4_FOURCC('u', 'r', 'l', ' '), 0, 1);  // media data in this file
+      out->endBox();
+      out->endBox();
+      out->endBox();
+
+      out->beginBox(MP4_FOURCC('s', 't', 'b', 'l'));
+      out->beginFullBox(MP4_FOURCC('s', 't', 's', 'd'), 0, 0);
+      out->writeU32(1);                  // entry_count
+      writeSampleEntry(out, track);
+      out->endBox();
+      if (withSamples)
+        writeSampleTables(out, track);
+      else {
+        // the samples are described by the fragments
+        for (const auto type : { MP4_FOURCC('s', 't', 't', 's'), MP4_FOURCC('s', 't', 's', 'c'), MP4_FOURCC('s', 't', 'c', 'o') }) {
+          out->beginFullBox(type, 0, 0);
+          out->writeU32(0);              // entry_count
+          out->endBox();
+        }
+        out->beginFullBox(MP4_FOURCC('s', 't', 's', 'z'), 0, 0);
+        out->writeU32(0);                // sample_size
+        out->writeU32(0);                // sample_count
+        out->endBox();
+      }
+      out->endBox();  // stbl
+
+      out->endBox();  // minf
+      out->endBox();  // mdia
+
+      if (isVideo && !sphericalXml_.empty()) {
+        out->beginBox(MP4_FOURCC('u', 'u', 'i', 'd'));
+        out->writeBytes(kSphericalUuid, sizeof(kSphericalUuid));
+        out->writeBytes(sphericalXml_.data(), sphericalXml_.size());
+        out->endBox();
+      }
+
+      out->endBox();  // trak
+    }
+
+    void Mp4Muxer::writeSampleTables(Mp4BoxWriter* out, const Track& track) {
+      out->beginFullBox(MP4_FOURCC('s', 't', 't', 's'), 0, 0);
+      out->writeU32(static_cast<uint32_t>(track.durations.size()));
+      for (const auto& run : track.durations) {
+        out->writeU32(run.count);
+        out->writeU32(run.value);
+      }
+      out->endBox();
+
+      // without stss every sample is a sync sample, which holds for audio
+      if (&track == &video_) {
+        out->beginFullBox(MP4_FOURCC('s', 't', 's', 's'), 0, 0);
+        out->writeU32(static_cast<uint32_t>(track.syncSamples.size()));
+        for (const auto number : track.syncSamples)
+          out->writeU32(number);
+        out->endBox();
+      }
+
+      // one entry per run of chunks with the same sample count
+      vector<const Chunk*> runStarts;
+      for (size_t i = 0; i < track.chunks.size(); i++) {
+        if (i == 0 || track.chunks[i].sampleCount != track.chunks[i - 1].sampleCount)
+          runStarts.push_back(&track.chunks[i]);
+      }
+      out->beginFullBox(MP4_FOURCC('s', 't', 's', 'c'), 0, 0);
+      out->writeU32(static_cast<uint32_t>(runStarts.size()));
+      for (const auto chunk : runStarts) {
+        out->writeU32(static_cast<uint32_t>(chunk - track.chunks.data() + 1));  // first_chunk
+        out->writeU32(chunk->sampleCount);
+        out->writeU32(1);                // sample_description_index
+      }
+      out->endBox();
+
+      out->beginFullBox(MP4_FOURCC('s', 't', 's', 'z'), 0, 0);
+      out->writeU32(0);                  // sample_size, they all differ
+      out->writeU32(static_cast<uint32_t>(track.sampleSizes.size()));
+      for (const auto size : track.sampleSizes)
+        out->writeU32(size);
+      out->endBox();
+
+      // 32 bit chunk offsets unless the mdat grew past 4 GB
+      const auto largeOffsets = !track.chunks.empty() && track.chunks.back().offset > UINT32_MAX;
+      out->beginFullBox(largeOffsets ? MP4_FOURCC('c', 'o', '6', '4') : MP4_FOURCC('s', 't', 'c', 'o'), 0, 0);
+      out->writeU32(static_cast<uint32_t>(track.chunks.size()));
+      for (const auto& chunk : track.chunks) {
+        if (largeOffsets)
+          out->writeU64(chunk.offset);
+        else
+          out->writeU32(static_cast<uint32_t>(chunk.offset));
+      }
+      out->endBox();
+    }
+
+    void Mp4Muxer::writeSampleEntry(Mp4BoxWriter* out, const Track& track) {
+      if (&track == &video_) {
+        out->beginBox(track.codec == VIDEO_CODEC::HEVC ? MP4_FOURCC('h', 'v', 'c', '1') : MP4_FOURCC('a', 'v', 'c', '1'));
+        out->writeZeros(6);              // reserved
+        out->writeU16(1);                // data_reference_index
+        out->writeZeros(16);             // pre_defined and reserved
+        out->writeU16(static_cast<uint16_t>(track.width));
+        out->writeU16(static_cast<uint16_t>(track.height));
+        out->writeU32(0x00480000);       // 72 dpi
+        out->writeU32(0x00480000);
+        out->writeU32(0);                // reserved
+        out->writeU16(1);                // frame_count
+        out->writeZeros(32);             // compressorname
+        out->writeU16(0x0018);           // depth
+        out->writeU16(0xffff);           // pre_defined -1
+        writeDecoderConfig(out, track);
+        if (!sphericalXml_.empty())
+          writeSphericalV2(out);
+        out->endBox();
+        return;
+      }
+
+      out->beginBox(MP4_FOURCC('m', 'p', '4', 'a'));
+      out->writeZeros(6);                // reserved
+      out->writeU16(1);                  // data_reference_index
+      out->writeZeros(8);                // reserved
+      out->writeU16(static_cast<uint16_t>(track.numChannels));
+      out->writeU16(16);                 // samplesize
+      out->writeU16(0);                  // pre_defined
+      out->writeU16(0);                  // reserved
+      out->writeU32(track.sampleRate <= 0xffff ? track.sampleRate << 16 : 0);  // 16.16 fixed point
+      writeEsds(out, track);
+      out->endBox();
+    }
+
+    bool Mp4Muxer::writeDecoderConfig(Mp4BoxWriter* out, const Track& track) {
+      const auto seqParams = track.seqParams;
+      const auto isHevc = track.codec == VIDEO_CODEC::HEVC;
+      const auto status = isHevc ?
+        configPacketizer_.getHevcSeqHeaderTag(seqParams->vps, seqParams->vpsLen, seqParams->sps, seqParams->spsLen,
+                                              seqParams->pps, seqParams->ppsLen, &configTag_) :
+        configPacketizer_.getAvcSeqHeaderTag(seqParams->sps, seqParams->spsLen, seqParams->pps, seqParams->ppsLen, &configTag_);
+      if (status != FBCAPTURE_OK)
+        return false;
+
+      // the FLV sequence header tag's payload is the decoder configuration record
+      out->beginBox(isHevc ? MP4_FOURCC('h', 'v', 'c', 'C') : MP4_FOURCC('a', 'v', 'c', 'C'));
+      out->writeBytes(configTag_.payload, configTag_.payloadLength);
+      out->endBox();
+      return true;
+    }
+
+    void Mp4Muxer::writeSphericalV2(Mp4BoxWriter* out) const {
+      out->beginFullBox(MP4_FOURCC('s', 't', '3', 'd'), 0, 0);
+      out->writeU8(MP4_STEREO_MODE_MONO);
+      out->endBox();
+
+      out->beginBox(MP4_FOURCC('s', 'v', '3', 'd'));
+      out->beginFullBox(MP4_FOURCC('s', 'v', 'h', 'd'), 0, 0);
+      out->writeString(sphericalSource_);
+      out->endBox();
+
+      out->beginBox(MP4_FOURCC('p', 'r', 'o', 'j'));
+      out->beginFullBox(MP4_FOURCC('p', 'r', 'h', 'd'), 0, 0);
+      out->writeU32(0);                  // pose_yaw_degrees
+      out->writeU32(0);                  // pose_pitch_degrees
+      out->writeU32(0);                  // pose_roll_degrees
+      out->endBox();
+      // the whole frame is the full sphere, nothing cropped from any edge
+      out->beginFullBox(MP4_FOURCC('e', 'q', 'u', 'i'), 0, 0);
+      out->writeU32(0);                  // projection_bounds_top
+      out->writeU32(0);                  // projection_bounds_bottom
+      out->writeU32(0);                  // projection_bounds_left
+      out->writeU32(0);                  // projection_bounds_right
+      out->endBox();
+      out->endBox();  // proj
+
+      out->endBox();  // sv3d
+    }
+
+    void Mp4Muxer::writeEsds(Mp4BoxWriter* out, const Track& track) {
+      // ES_Descriptor with a DecoderConfigDescriptor holding the AudioSpecificConfig. Every descriptor fits a 1 byte size.
+      const auto audioSpecificConfig = static_cast<uint16_t>(track.profileLevel << 11 | track.sampleRateIndex << 7 |
+                                                             (track.numChannels & 0xf) << 3);
+      out->beginFullBox(MP4_FOURCC('e', 's', 'd', 's'), 0, 0);
+      out->writeU8(0x03);                // ES_DescrTag
+      out->writeU8(3 + 2 + 13 + 2 + 2 + 2 + 1);
+      out->writeU16(static_cast<uint16_t>(track.id));  // ES_ID
+      out->writeU8(0);                   // flags
+      out->writeU8(0x04);                // DecoderConfigDescrTag
+      out->writeU8(13 + 2 + 2);
+      out->writeU8(0x40);                // objectTypeIndication, MPEG-4 audio
+      out->writeU8(0x15);                // streamType audio (5) << 2 | reserved 1
+      out->writeU24(0);                  // bufferSizeDB
+      out->writeU32(0);                  // maxBitrate
+      out->writeU32(0);                  // avgBitrate
+      out->writeU8(0x05);                // DecSpecificInfoTag
+      out->writeU8(2);
+      out->writeU16(audioSpecificConfig);
+      out->writeU8(0x06);                // SLConfigDescrTag
+      out->writeU8(1);
+      out->writeU8(0x02);                // predefined for MP4
+      out->endBox();
+    }
+
+    bool Mp4Muxer::writeFragment(Mp4BoxWriter* out, vector<IoVec>* iov, Mp4FragmentInfo* info) {
+      if (!initWritten_ || !hasPendingSamples())
+        return false;
+
+      releaseFragment();
+
+      Track* tracks[] = { &video_, &audio_ };
+      uint32_t dataOffsetFields[2] = { 0, 0 };
+      uint64_t trackBytes[2] = { 0, 0 };
+
+      const auto moofStart = out->size();
+      out->beginBox(MP4_FOURCC('m', 'o', 'o', 'f'));
+
+      out->beginFullBox(MP4_FOURCC('m', 'f', 'h', 'd'), 0, 0);
+      out->writeU32(++sequenceNumber_);
+      out->endBox();
+
+      for (uint32_t t = 0; t < 2; t++) {
+        const auto track = tracks[t];
+        if (!track->inInit || track->samples.empty())
+          continue;
+        const auto isVideo = track == &video_;
+
+        out->beginBox(MP4_FOURCC('t', 'r', 'a', 'f'));
+
+        out->beginFullBox(MP4_FOURCC('t', 'f', 'h', 'd'), 0, MP4_TFHD_DEFAULT_BASE_IS_MOOF);
+        out->writeU32(track->id);
+        out->endBox();
+
+        out->beginFullBox(MP4_FOURCC('t', 'f', 'd', 't'), 1, 0);
+        out->writeU64(track->samples.front().decodeTime);  // baseMediaDecodeTime
+        out->endBox();
+
+        auto flags = MP4_TRUN_DATA_OFFSET | MP4_TRUN_SAMPLE_DURATION | MP4_TRUN_SAMPLE_SIZE;
+        if (isVideo)
+          flags |= MP4_TRUN_SAMPLE_FLAGS;
+        out->beginFullBox(MP4_FOURCC('t', 'r', 'u', 'n'), 0, flags);
+        out->writeU32(static_cast<uint32_t>(track->samples.size()));
+        dataOffsetFields[t] = out->size();
+        out->writeU32(0);                // data_offset, patched once the moof size is known
+        for (const auto& sample : track->samples) {
+          out->writeU32(sample.duration);
+          out->writeU32(sample.packet->length);
+          if (isVideo)
+            out->writeU32(sample.isSync ? MP4_SYNC_SAMPLE_FLAGS : MP4_NON_SYNC_SAMPLE_FLAGS);
+          trackBytes[t] += sample.packet->length;
+        }
+        out->endBox();
+
+        out->endBox();  // traf
+      }
+
+      out->endBox();  // moof
+
+      // each track's samples follow the ones of the track before in the mdat
+      const auto moofSize = out->size() - moofStart;
+      uint64_t dataOffset = moofSize + MP4_BOX_HEADER_SIZE;
+      for (uint32_t t = 0; t < 2; t++) {
+        if (dataOffsetFields[t] == 0)
+          continue;
+        out->patchU32(dataOffsetFields[t], static_cast<uint32_t>(dataOffset));
+        dataOffset += trackBytes[t];
+      }
+
+      const auto mdatSize = MP4_BOX_HEADER_SIZE + trackBytes[0] + trackBytes[1];
+      out->writeU32(static_cast<uint32_t>(mdatSize));
+      out->writeU32(MP4_FOURCC('m', 'd', 'a', 't'));
+
+      if (!video_.samples.empty() && video_.samples.front().isSync)
+        randomAccessPoints_.push_back({ video_.samples.front().decodeTime, outputOffset_ });
+      outputOffset_ += moofSize + mdatSize;
+
+      iov->clear();
+      iov->push_back({ out->data() + moofStart, out->size() - moofStart });
+      for (const auto track : tracks) {
+        if (!track->inInit)
+          continue;
+        for (const auto& sample : track->samples) {
+          iov->push_back({ sample.packet->buffer, sample.packet->length });
+          written_.push_back(sample.packet);
+        }
+      }
+
+      if (info) {
+        const auto timing = video_.samples.empty() ? &audio_ : &video_;
+        uint64_t duration = 0;
+        for (const auto& sample : timing->samples)
+          duration += sample.duration;
+        info->startTime = rescale(timing->samples.front().decodeTime, timing->timescale, MP4_TIMESTAMP_RATE);
+        info->duration = rescale(duration, timing->timescale, MP4_TIMESTAMP_RATE);
+        info->size = static_cast<uint32_t>(moofSize + mdatSize);
+        info->independent = !video_.samples.empty() && video_.samples.front().isSync;
+      }
+
+      // the references move to written_ until the caller is done with the payloads
+      for (const auto track : tracks) {
+        if (!track->inInit) {
+          for (auto& sample : track->samples)
+            sample.packet->release();
+        } else if (!track->samples.empty())
+          track->writtenEnd = track->samples.back().decodeTime + track->samples.back().duration;
+        track->samples.clear();
+      }
+      return true;
+    }
+
+    void Mp4Muxer::releaseFragment() {
+      for (auto packet : written_)
+        packet->release();
+      written_.clear();
+    }
+
+    bool Mp4Muxer::writeRandomAccessIndex(Mp4BoxWriter* out) {
+      if (randomAccessPoints_.empty())
+        return false;
+
+      const auto mfraStart = out->size();
+      out->beginBox(MP4_FOURCC('m', 'f', 'r', 'a'));
+
+      out->beginFullBox(MP4_FOURCC('t', 'f', 'r', 'a'), 1, 0);
+      out->writeU32(video_.id);
+      out->writeU32(0);                  // 1 byte traf, trun and sample numbers
+      out->writeU32(static_cast<uint32_t>(randomAccessPoints_.size()));
+      for (const auto& point : randomAccessPoints_) {
+        out->writeU64(point.decodeTime);
+        out->writeU64(point.moofOffset);
+        out->writeU8(1);                 // the video traf comes first
+        out->writeU8(1);                 // trun_number
+        out->writeU8(1);                 // sample_number
+      }
+      out->endBox();
+
+      // mfro at the very end lets readers find mfra from the end of the file
+      out->beginFullBox(MP4_FOURCC('m', 'f', 'r', 'o'), 0, 0);
+      out->writeU32(static_cast<uint32_t>(out->size() - mfraStart + 4));  // mfra size, up to the end of this field
+      out->endBox();
+
+      out->endBox();  // mfra
+      outputOffset_ += out->size() - mfraStart;
+      return true;
+    }
+
+    uint64_t Mp4Muxer::fragmentDurationOffset() const {
+      return fragmentDurationOffset_;
+    }
+
+    uint64_t Mp4Muxer::movieDuration() const {
+      const auto videoDuration = rescale(video_.writtenEnd, video_.timescale, kMovieTimescale);
+      const auto audioDuration = audio_.inInit ? rescale(audio_.writtenEnd, audio_.timescale, kMovieTimescale) : 0;
+      return max(videoDuration, audioDuration);
+    }
+  }
+}
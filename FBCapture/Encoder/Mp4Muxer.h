@@ -0,0 +1,223 @@
+/****************************************************************************************************************
+
+Filename	:	Mp4Muxer.h
+Content		:	Muxes encoded packets into fragmented mp4, an init segment followed by moof/mdat fragments
+Copyright	:
+
+****************************************************************************************************************/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "EncodePacket.h"
+#include "FlvPacketizer.h"
+#include "IoVec.h"
+#include "Mp4BoxWriter.h"
+
+using namespace std;
+
+namespace FBCapture {
+  namespace Streaming {
+
+    // Times in 100 nanosec unit like the packet timestamps, relative to the first keyframe
+    struct Mp4FragmentInfo {
+      uint64_t startTime;
+      uint64_t duration;
+      uint32_t size;         // moof and mdat
+      bool independent;      // starts with a video sync sample
+    };
+
+    // A fragment that starts with a video sync sample, for the mfra index of a progressively written file
+    struct Mp4RandomAccessPoint {
+      uint64_t decodeTime;   // in the video timescale
+      uint64_t moofOffset;   // from the start of the file
+    };
+
+    /*
+    * Takes packets in decode order, video and audio interleaved, and queues them as samples of the next fragment.
+    * The media timeline starts at the first keyframe, earlier packets are dropped. A sample's duration is the
+    * distance to the next sample of its track, so the last sample of each track is held back until the next
+    * packet of that track comes in, or endOfStream().
+    *
+    * Samples reference the packets instead of copying them. writeFragment() serializes moof and the mdat header
+    * and lists the payloads straight from the packet buffers, which are released by releaseFragment() once written.
+    * The track layout is fixed by writeInitSegment(): audio that first shows up after it is dropped.
+    *
+    * File offsets count the init segment and the fragments as if they were written back to back into one file,
+    * which is only meaningful for a single fragmented mp4 file.
+    *
+    * A faststart file takes writeFileHeader(), then writeChunks() instead of writeFragment(), and writeMovie() once
+    * every chunk is written. The samples are only described by the sample tables of that moov, which goes into
+    * the free box reserved by writeFileHeader() when it fits, so players can start before the mdat is loaded.
+    */
+    class Mp4Muxer {
+    public:
+      static const uint32_t kMovieTimescale = 1000;
+      static const uint32_t kVideoTimescale = 90000;
+      static const uint32_t kVideoTrackId = 1;
+      static const uint32_t kAudioTrackId = 2;
+
+      Mp4Muxer();
+      ~Mp4Muxer();
+
+      // Drops every queued sample and the track layout, for a new file
+      void reset();
+
+      /*
+      * Marks the video track as spherical in the init segment: the V1 uuid box with xml in the trak, and the V2
+      * st3d and sv3d boxes for monoscopic equirectangular video in the sample entry. Kept across reset().
+      */
+      void setSphericalMetadata(const string& xml, const string& metadataSource);
+
+      // Queues the packet and takes a reference to it. False if it was dropped.
+      bool addPacket(EncodePacket* packet);
+
+      // Queues the held back samples, each with the duration of the sample before it
+      void endOfStream();
+
+      bool isReady() const;  // the video track is known, so the init segment can be written
+      bool hasPendingSamples() const;
+      uint64_t pendingVideoDuration() const;  // of the queued video samples, not counting the held back one
+
+      // ftyp and moov with an mvex box for the fragments to follow. cmaf writes the CMAF brands if video is the only
+      // track, otherwise mvex gets an mehd box whose duration can be patched at fragmentDurationOffset() once the file is complete.
+      bool writeInitSegment(Mp4BoxWriter* out, bool cmaf);
+
+      /*
+      * Serializes the queued samples into out as moof and mdat header and fills iov with out's data followed by
+      * the sample payloads, ready for WriteV(). out and the packets must stay untouched until the iov are written.
+      * Returns false if no sample is queued. info may be NULL.
+      */
+      bool writeFragment(Mp4BoxWriter* out, vector<IoVec>* iov, Mp4FragmentInfo* info);
+
+      // Releases the packets of the last written fragment
+      void releaseFragment();
+
+      // mfra box indexing every written fragment that starts with a video sync sample, so players can seek
+      // without scanning all the moof boxes. Goes at the end of the file.
+      bool writeRandomAccessIndex(Mp4BoxWriter* out);
+
+      uint64_t fragmentDurationOffset() const;  // file offset of the mehd fragment_duration, 0 without mehd
+      uint64_t movieDuration() const;           // of the written fragments or chunks, in kMovieTimescale
+
+      // Size of the faststart moov for duration seconds of video at fps, written in chunks of chunkDuration.
+      // Capped at 32 MB, a longer capture gets its moov at the end of the file instead.
+      static uint32_t estimateMovieSize(uint32_t fps, uint32_t duration, uint64_t chunkDuration);
+
+      /*
+      * ftyp, a free box of reservedSize for the moov and the header of the mdat that takes the chunks to follow.
+      * Fills iov with them for WriteV(), the zeros of the free box taken from a shared block rather than out.
+      */
+      bool writeFileHeader(Mp4BoxWriter* out, uint32_t reservedSize, vector<IoVec>* iov);
+
+      // Lists the queued samples in iov for WriteV() as one chunk per track, appended to the mdat and added to
+      // the sample tables. The packets are released by releaseFragment() once written.
+      bool writeChunks(vector<IoVec>* iov);
+
+      // moov with the sample tables of every written chunk
+      bool writeMovie(Mp4BoxWriter* out);
+
+      uint64_t movieReserveOffset() const;      // file offset of the free box reserved for the moov
+      uint64_t mediaDataOffset() const;         // file offset of the mdat
+      uint64_t outputSize() const;              // end of the last chunk or fragment
+
+      // RFC 6381 codecs parameter of the tracks in the init segment, like avc1.640033,mp4a.40.2
+      string codecs() const;
+      bool hasAudioTrack() const;               // audio is muxed into the fragments next to the video
+      uint32_t width() const;
+      uint32_t height() const;
+
+    private:
+      struct Sample {
+        EncodePacket* packet;    // referenced
+        uint64_t decodeTime;     // in the track timescale
+        uint32_t duration;
+        bool isSync;
+      };
+
+      struct Run {
+        uint32_t count;
+        uint32_t value;
+      };
+
+      struct Chunk {
+        uint64_t offset;         // in the file
+        uint32_t sampleCount;
+      };
+
+      struct Track {
+        uint32_t id;
+        uint32_t timescale;
+        bool configured;
+        bool inInit;             // part of the written init segment
+
+        VIDEO_CODEC codec;
+        SequenceParams* seqParams;  // referenced
+        uint32_t width;
+        uint32_t height;
+
+        uint32_t profileLevel;
+        uint32_t sampleRate;
+        uint32_t numChannels;
+        uint32_t sampleRateIndex;
+
+        vector<Sample> samples;  // of the next fragment
+        Sample held;             // waiting for the next sample to know its duration
+        bool hasHeld;
+        uint32_t lastDuration;
+        uint64_t writtenEnd;     // decode time after the last written sample
+
+        // sample tables of the written chunks
+        uint64_t firstDecodeTime;
+        vector<uint32_t> sampleSizes;
+        vector<Run> durations;
+        vector<uint32_t> syncSamples;  // 1-based sample numbers
+        vector<Chunk> chunks;
+
+        Track();
+      };
+
+      Track video_;
+      Track audio_;
+      uint64_t baseTimestamp_;   // of the first keyframe
+      bool started_;
+      bool initWritten_;
+      uint32_t sequenceNumber_;
+      vector<EncodePacket*> written_;  // packets of the last written fragment
+
+      string sphericalXml_;            // empty unless spherical
+      string sphericalSource_;
+
+      uint64_t outputOffset_;          // bytes written so far
+      uint64_t fragmentDurationOffset_;
+      uint64_t movieReserveOffset_;
+      uint64_t mediaDataOffset_;
+      vector<Mp4RandomAccessPoint> randomAccessPoints_;
+
+      FlvPacketizer configPacketizer_;  // builds the decoder configuration records, which are the same bytes FLV sends
+      FlvTag configTag_;
+
+      bool configureVideo(const VideoEncodePacket* packet);
+      void configureAudio(const AudioEncodePacket* packet);
+      void queue(Track* track, EncodePacket* packet, uint64_t decodeTime, bool isSync);
+      void flushHeld(Track* track);
+
+      void fixTrackLayout();
+      void writeFtyp(Mp4BoxWriter* out, bool cmaf) const;
+      void writeMvhd(Mp4BoxWriter* out, uint64_t duration) const;
+      void writeTrak(Mp4BoxWriter* out, const Track& track, bool withSamples);
+      void writeSampleTables(Mp4BoxWriter* out, const Track& track);
+      void writeSampleEntry(Mp4BoxWriter* out, const Track& track);
+      bool writeDecoderConfig(Mp4BoxWriter* out, const Track& track);
+      void writeSphericalV2(Mp4BoxWriter* out) const;
+      static void writeEsds(Mp4BoxWriter* out, const Track& track);
+      static void writeMatrix(Mp4BoxWriter* out);
+      static void releaseTrack(Track* track);
+
+      static uint64_t rescale(uint64_t value, uint64_t from, uint64_t to);
+    };
+  }
+}
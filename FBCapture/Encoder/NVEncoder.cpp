@@ -93,10 +93,17 @@ namespace FBCapture {
       // Set encoding configuration
       encodeConfig_.endFrameIdx = INT_MAX;
       encodeConfig_.bitrate = bitrate_;
-      encodeConfig_.rcMode = NV_ENC_PARAMS_RC_CONSTQP;
+      if (adaptiveBitrate_) {
+        // constant QP ignores the bitrate, so reconfigureBitrate() would have no effect
+        encodeConfig_.rcMode = NV_ENC_PARAMS_RC_CBR;
+        encodeConfig_.vbvMaxBitrate = bitrate_;
+        encodeConfig_.vbvSize = getVbvSize(bitrate_);
+      } else {
+        encodeConfig_.rcMode = NV_ENC_PARAMS_RC_CONSTQP;
+      }
       encodeConfig_.gopLength = gop_ < 0 ? NVENC_INFINITE_GOPLENGTH : gop_;
       encodeConfig_.deviceType = NV_ENC_DX11;
-      encodeConfig_.codec = NV_ENC_H264;
+      encodeConfig_.codec = videoCodec_ == VIDEO_CODEC::HEVC ? NV_ENC_HEVC : NV_ENC_H264;
       encodeConfig_.fps = fps_;
       encodeConfig_.qp = 28;
       encodeConfig_.i_quant_factor = DEFAULT_I_QFACTOR;
@@ -114,6 +121,7 @@ namespace FBCapture {
 
       DEBUG_LOG_VAR("Video Codec info", encodeConfig_.codec == NV_ENC_H264 ? "NV_ENC_H264" : "NV_ENC_HEVC");
       DEBUG_LOG_VAR("Bitrate", std::to_string(encodeConfig_.bitrate));
+      DEBUG_LOG_VAR("Rate control", encodeConfig_.rcMode == NV_ENC_PARAMS_RC_CBR ? "CBR" : "Constant QP");
       DEBUG_LOG_VAR("FPS", std::to_string(encodeConfig_.fps));
       DEBUG_LOG_VAR("GOP Length", std::to_string(encodeConfig_.gopLength));
       DEBUG_LOG("Device type: DirectX 11");
@@ -121,6 +129,10 @@ namespace FBCapture {
       return FBCAPTURE_OK;
     }
 
+    uint32_t NVEncoder::getVbvSize(const uint32_t bitrate) {
+      return static_cast<uint32_t>(static_cast<uint64_t>(bitrate) * kVbvBufferMs / 1000);
+    }
+
     FBCAPTURE_STATUS NVEncoder::setGraphicsDeviceD3D11(ID3D11Device* device) {
       device_ = device;
       const auto hr = createResources();
@@ -434,9 +446,11 @@ namespace FBCapture {
     FBCAPTURE_STATUS NVEncoder::initialize(const uint32_t bitrate,
                                            const uint32_t fps,
                                            const uint32_t gop,
+                                           const VIDEO_CODEC codec,
                                            const bool flipTexture,
-                                           const bool enableAsyncMode) {
-      const auto status = GPUEncoder::initialize(bitrate, fps, gop, flipTexture, enableAsyncMode);
+                                           const bool enableAsyncMode,
+                                           const bool adaptiveBitrate) {
+      const auto status = GPUEncoder::initialize(bitrate, fps, gop, codec, flipTexture, enableAsyncMode, adaptiveBitrate);
       if (status != FBCAPTURE_OK)
         goto exit;
 
@@ -500,6 +514,7 @@ namespace FBCapture {
     }
 
     FBCAPTURE_STATUS NVEncoder::processOutput(void **buffer,
+                                              uint32_t *capacity,
                                               uint32_t *length,
                                               uint64_t *timestamp,
                                               uint64_t *duration,
@@ -514,7 +529,7 @@ namespace FBCapture {
         return status;
       }
 
-      auto nvStatus = nvHwEncoder_->ProcessOutput(encodeBuffer, buffer, length, timestamp, duration, frameIdx, isKeyframe);
+      auto nvStatus = nvHwEncoder_->ProcessOutput(encodeBuffer, buffer, capacity, length, timestamp, duration, frameIdx, isKeyframe);
       if (nvStatus != NV_ENC_SUCCESS) {
         DEBUG_ERROR_VAR("Failed processing output ", to_string(nvStatus));
         return FBCAPTURE_GPU_ENCODER_PROCESS_OUTPUT_FAILED;
@@ -531,7 +546,9 @@ namespace FBCapture {
       return encodeBufferQueue_.getPendingCount();
     }
 
-    FBCAPTURE_STATUS NVEncoder::getSequenceParams(uint8_t **sps, uint32_t *spsLen, uint8_t **pps, uint32_t *ppsLen) {
+    FBCAPTURE_STATUS NVEncoder::getSequenceParams(uint8_t **sps, uint32_t *spsLen,
+                                                  uint8_t **pps, uint32_t *ppsLen,
+                                                  uint8_t **vps, uint32_t *vpsLen) {
       // Retrieve Sequence Parameters
       uint32_t outSize = 0;
       char tmpHeader[NV_MAX_SEQ_HDR_LEN];
@@ -547,6 +564,50 @@ namespace FBCapture {
         return FBCAPTURE_GPU_ENCODER_GET_SEQUENCE_PARAMS_FAILED;
       }
 
+      // The payload is an Annex-B SPS followed by a PPS, with a VPS in front for HEVC.
+      // Split it on the start codes and hand out copies without them.
+      const auto header = reinterpret_cast<const uint8_t*>(tmpHeader);
+      const auto isHevc = videoCodec_ == VIDEO_CODEC::HEVC;
+      const uint8_t spsType = isHevc ? HEVC_NAL_SPS : NAL_SPS;
+      const uint8_t ppsType = isHevc ? HEVC_NAL_PPS : NAL_PPS;
+      vector<NalUnit> nals;
+      ParseAnnexB(header, outSize, &nals, videoCodec_);
+      for (const auto& nal : nals) {
+        const auto isVps = isHevc && nal.type == HEVC_NAL_VPS;
+        uint8_t **out = nal.type == spsType ? sps : nal.type == ppsType ? pps : isVps ? vps : nullptr;
+        uint32_t *outLen = nal.type == spsType ? spsLen : nal.type == ppsType ? ppsLen : isVps ? vpsLen : nullptr;
+        if (out && !*out) {
+          *out = static_cast<uint8_t*>(malloc(nal.length));
+          memcpy(*out, header + nal.offset, nal.length);
+          *outLen = nal.length;
+        }
+      }
+
+      return FBCAPTURE_OK;
+    }
+
+    FBCAPTURE_STATUS NVEncoder::reconfigureBitrate(const uint32_t bitrate) {
+      // the session is created on the first frame, with bitrate_
+      if (!encodingInitiated_) {
+        bitrate_ = bitrate;
+        return FBCAPTURE_OK;
+      }
+
+      // Resize the VBV buffer with the bitrate, NvEncReconfigureEncoder() would shrink it to one frame otherwise
+      NvEncPictureCommand command = {};
+      command.bBitrateChangePending = true;
+      command.newBitrate = bitrate;
+      command.newVBVSize = getVbvSize(bitrate);
+      const auto nvStatus = nvHwEncoder_->NvEncReconfigureEncoder(&command);
+      if (nvStatus != NV_ENC_SUCCESS) {
+        DEBUG_ERROR_VAR("Failed to reconfigure bitrate", to_string(nvStatus));
+        return FBCAPTURE_GPU_ENCODER_RECONFIGURE_FAILED;
+      }
+
+      bitrate_ = bitrate;
+      encodeConfig_.bitrate = bitrate;
+      encodeConfig_.vbvMaxBitrate = bitrate;
+      encodeConfig_.vbvSize = command.newVBVSize;
       return FBCAPTURE_OK;
     }
 
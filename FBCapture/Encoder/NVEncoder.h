@@ -126,6 +126,10 @@ namespace FBCapture {
 
     class NVEncoder : public GPUEncoder {
     public:
+      // With adaptive bitrate the VBV buffer holds this much video at the target bitrate, so a keyframe can
+      // overshoot a frame's share without the rate control starving the frames after it
+      static const uint32_t kVbvBufferMs = 500;
+
       NVEncoder();  // Constructor
       virtual ~NVEncoder();  // Destructor
 
@@ -133,17 +137,23 @@ namespace FBCapture {
       FBCAPTURE_STATUS initialize(uint32_t bitrate,
                                   uint32_t fps,
                                   uint32_t gop,
+                                  VIDEO_CODEC codec,
                                   bool flipTexture,
-                                  bool enableAsyncMode) override;
+                                  bool enableAsyncMode,
+                                  bool adaptiveBitrate) override;
       FBCAPTURE_STATUS encode(void* texturePtr) override;
       FBCAPTURE_STATUS finalize() override;
+      FBCAPTURE_STATUS reconfigureBitrate(uint32_t bitrate) override;
       FBCAPTURE_STATUS processOutput(void **buffer,
+                                     uint32_t *capacity,
                                      uint32_t *length,
                                      uint64_t *timestamp,
                                      uint64_t *duration,
                                      uint32_t *frameIdx,
                                      bool *isKeyframe) override;
-      FBCAPTURE_STATUS getSequenceParams(uint8_t **sps, uint32_t *spsLen, uint8_t **pps, uint32_t *ppsLen) override;
+      FBCAPTURE_STATUS getSequenceParams(uint8_t **sps, uint32_t *spsLen,
+                                         uint8_t **pps, uint32_t *ppsLen,
+                                         uint8_t **vps, uint32_t *vpsLen) override;
       FBCAPTURE_STATUS saveScreenShot(void* texturePtr, const DESTINATION_URL dstUrl, bool flipTexture) override;
       uint32_t getPendingCount() override;
 
@@ -183,6 +193,7 @@ namespace FBCapture {
       // Set all configurations need to be set for encoding
       // It's called only once when starting encoding
       FBCAPTURE_STATUS setEncodeConfigures(uint32_t width, uint32_t height);
+      static uint32_t getVbvSize(uint32_t bitrate);
 
       // Allocate Buffers
       // Input buffers and bit steam buffers need to be allocated only once
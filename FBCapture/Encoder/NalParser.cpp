@@ -0,0 +1,238 @@
+/****************************************************************************************************************
+
+Filename	:	NalParser.cpp
+Content		:
+Copyright	:
+
+****************************************************************************************************************/
+
+#include "NalParser.h"
+#include "EncodePacket.h"
+
+#include <string.h>
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define NAL_PARSER_X64
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define NAL_PARSER_TARGET_AVX2
+#else
+#include <cpuid.h>
+#define NAL_PARSER_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace FBCapture {
+  namespace Streaming {
+
+    namespace {
+
+      typedef const uint8_t* (*FIND_START_CODE)(const uint8_t*, const uint8_t*);
+
+      const uint8_t* findStartCodeScalar(const uint8_t* p, const uint8_t* end) {
+        // look at every third byte: anything above 1 can't be inside a start code
+        while (p + 3 <= end) {
+          if (p[2] > 1)
+            p += 3;
+          else if (p[2] == 0)
+            p++;
+          else if (p[0] == 0 && p[1] == 0)
+            return p;
+          else
+            p += 3;
+        }
+        return end;
+      }
+
+#if defined(NAL_PARSER_X64)
+      inline uint32_t countTrailingZeros(uint32_t mask) {
+#if defined(_MSC_VER)
+        unsigned long index;
+        _BitScanForward(&index, mask);
+        return index;
+#else
+        return __builtin_ctz(mask);
+#endif
+      }
+
+      // Compares 16 positions at once for 00 at p, 00 at p + 1 and 01 at p + 2
+      const uint8_t* findStartCodeSse2(const uint8_t* p, const uint8_t* end) {
+        const auto zero = _mm_setzero_si128();
+        const auto one = _mm_set1_epi8(1);
+        while (p + 16 + 2 <= end) {
+          const auto b0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+          const auto b1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 1));
+          const auto b2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 2));
+          const auto match = _mm_and_si128(_mm_and_si128(_mm_cmpeq_epi8(b0, zero), _mm_cmpeq_epi8(b1, zero)),
+                                           _mm_cmpeq_epi8(b2, one));
+          const auto mask = static_cast<uint32_t>(_mm_movemask_epi8(match));
+          if (mask)
+            return p + countTrailingZeros(mask);
+          p += 16;
+        }
+        return findStartCodeScalar(p, end);
+      }
+
+      NAL_PARSER_TARGET_AVX2 const uint8_t* findStartCodeAvx2(const uint8_t* p, const uint8_t* end) {
+        const auto zero = _mm256_setzero_si256();
+        const auto one = _mm256_set1_epi8(1);
+        while (p + 32 + 2 <= end) {
+          const auto b0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+          const auto b1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 1));
+          const auto b2 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 2));
+          const auto match = _mm256_and_si256(_mm256_and_si256(_mm256_cmpeq_epi8(b0, zero), _mm256_cmpeq_epi8(b1, zero)),
+                                              _mm256_cmpeq_epi8(b2, one));
+          const auto mask = static_cast<uint32_t>(_mm256_movemask_epi8(match));
+          if (mask)
+            return p + countTrailingZeros(mask);
+          p += 32;
+        }
+        return findStartCodeSse2(p, end);
+      }
+
+      bool cpuHasAvx2() {
+#if defined(_MSC_VER)
+        int info[4] = { 0 };
+        __cpuid(info, 0);
+        if (info[0] < 7)
+          return false;
+        __cpuid(info, 1);
+        const auto osxsave = (info[2] & (1 << 27)) != 0;
+        const auto avx = (info[2] & (1 << 28)) != 0;
+        // the OS has to save the ymm registers on context switches
+        if (!osxsave || !avx || (_xgetbv(0) & 0x6) != 0x6)
+          return false;
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1 << 5)) != 0;
+#else
+        unsigned int eax, ebx, ecx, edx;
+        if (__get_cpuid_max(0, nullptr) < 7)
+          return false;
+        __cpuid(1, eax, ebx, ecx, edx);
+        if (!(ecx & (1 << 27)) || !(ecx & (1 << 28)))
+          return false;
+        unsigned int xcr0, xcr0High;
+        __asm__("xgetbv" : "=a"(xcr0), "=d"(xcr0High) : "c"(0));
+        if ((xcr0 & 0x6) != 0x6)
+          return false;
+        __cpuid_count(7, 0, eax, ebx, ecx, edx);
+        return (ebx & (1 << 5)) != 0;
+#endif
+      }
+#endif
+
+      FIND_START_CODE selectFindStartCode() {
+#if defined(NAL_PARSER_X64)
+        return cpuHasAvx2() ? findStartCodeAvx2 : findStartCodeSse2;
+#else
+        return findStartCodeScalar;
+#endif
+      }
+
+      const FIND_START_CODE findStartCodeImpl = selectFindStartCode();
+
+      inline void writeLength(uint8_t* p, const uint32_t length) {
+        p[0] = static_cast<uint8_t>(length >> 24);
+        p[1] = static_cast<uint8_t>(length >> 16);
+        p[2] = static_cast<uint8_t>(length >> 8);
+        p[3] = static_cast<uint8_t>(length);
+      }
+    }
+
+    const uint8_t* FindStartCode(const uint8_t* begin, const uint8_t* end) {
+      return findStartCodeImpl(begin, end);
+    }
+
+    void ParseAnnexB(const uint8_t* data, const uint32_t length, vector<NalUnit>* nals, const VIDEO_CODEC codec) {
+      nals->clear();
+      const auto end = data + length;
+
+      auto startCode = FindStartCode(data, end);
+      while (startCode < end) {
+        const auto nalStart = startCode + 3;
+        startCode = FindStartCode(nalStart, end);
+
+        // zeros in front of the next start code are its leading zero or trailing_zero_8bits
+        auto nalEnd = startCode;
+        while (nalEnd > nalStart && nalEnd[-1] == 0)
+          nalEnd--;
+        if (nalEnd == nalStart)
+          continue;
+
+        NalUnit nal;
+        nal.offset = static_cast<uint32_t>(nalStart - data);
+        nal.length = static_cast<uint32_t>(nalEnd - nalStart);
+        if (codec == VIDEO_CODEC::HEVC) {
+          nal.type = (nalStart[0] >> 1) & 0x3f;
+          nal.refIdc = nal.type <= HEVC_NAL_RSV_VCL_N14 && (nal.type & 1) == 0 ? 0 : 1;
+        } else {
+          nal.type = nalStart[0] & 0x1f;
+          nal.refIdc = (nalStart[0] >> 5) & 0x3;
+        }
+        nals->push_back(nal);
+      }
+    }
+
+    bool AnnexBToAvcc(EncodePacket* packet, vector<NalUnit>* nals, const VIDEO_CODEC codec) {
+      ParseAnnexB(packet->buffer, packet->length, nals, codec);
+      if (nals->empty())
+        return false;
+
+      // Where every NAL unit ends up, and whether that is in front of or behind where it is now
+      uint32_t avccLength = 0;
+      auto movesForward = false;
+      auto movesBackward = false;
+      for (const auto& nal : *nals) {
+        const auto dst = avccLength + AVCC_LENGTH_SIZE;
+        movesForward |= dst < nal.offset;
+        movesBackward |= dst > nal.offset;
+        avccLength = dst + nal.length;
+      }
+
+      auto buffer = packet->buffer;
+      if (!movesBackward) {
+        // 4 byte start codes only write the lengths, extra zeros shift the rest towards the front
+        uint32_t dst = 0;
+        for (auto& nal : *nals) {
+          writeLength(buffer + dst, nal.length);
+          dst += AVCC_LENGTH_SIZE;
+          if (dst != nal.offset)
+            memmove(buffer + dst, buffer + nal.offset, nal.length);
+          nal.offset = dst;
+          dst += nal.length;
+        }
+      } else if (!movesForward) {
+        // 3 byte start codes make the frame grow, so move the NAL units back to front
+        if (!packet->reserve(avccLength, true))
+          return false;
+        buffer = packet->buffer;
+        auto dst = avccLength;
+        for (auto nal = nals->rbegin(); nal != nals->rend(); ++nal) {
+          dst -= nal->length;
+          memmove(buffer + dst, buffer + nal->offset, nal->length);
+          nal->offset = dst;
+          dst -= AVCC_LENGTH_SIZE;
+          writeLength(buffer + dst, nal->length);
+        }
+      } else {
+        // mixed start code lengths in both directions, rare enough to go through a copy
+        vector<uint8_t> avcc(avccLength);
+        uint32_t dst = 0;
+        for (auto& nal : *nals) {
+          writeLength(avcc.data() + dst, nal.length);
+          dst += AVCC_LENGTH_SIZE;
+          memcpy(avcc.data() + dst, buffer + nal.offset, nal.length);
+          nal.offset = dst;
+          dst += nal.length;
+        }
+        if (!packet->reserve(avccLength))
+          return false;
+        memcpy(packet->buffer, avcc.data(), avccLength);
+      }
+
+      packet->length = avccLength;
+      return true;
+    }
+  }
+}
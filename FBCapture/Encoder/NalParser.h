@@ -0,0 +1,70 @@
+/****************************************************************************************************************
+
+Filename	:	NalParser.h
+Content		:	Finds H.264/HEVC NAL units in Annex-B byte streams and rewrites them to length prefixed AVCC
+Copyright	:
+
+****************************************************************************************************************/
+
+#pragma once
+
+#include <vector>
+#include <stdint.h>
+
+using namespace std;
+
+#define AVCC_LENGTH_SIZE 4  // matches lengthSizeMinusOne = 3 in the AVC/HEVC decoder configuration records
+
+namespace FBCapture {
+  namespace Streaming {
+
+    class EncodePacket;
+
+    using VIDEO_CODEC = enum class VideoCodec {
+      H264,
+      HEVC
+    };
+
+    enum H264_NAL_TYPE {
+      NAL_SLICE = 1,
+      NAL_IDR_SLICE = 5,
+      NAL_SEI = 6,
+      NAL_SPS = 7,
+      NAL_PPS = 8,
+      NAL_AUD = 9,
+    };
+
+    enum HEVC_NAL_TYPE {
+      HEVC_NAL_RSV_VCL_N14 = 14, // the even VCL types up to here are sub-layer non-reference
+      HEVC_NAL_IDR_W_RADL = 19,
+      HEVC_NAL_IDR_N_LP = 20,
+      HEVC_NAL_CRA = 21,
+      HEVC_NAL_VCL_END = 31,     // types up to here are VCL
+      HEVC_NAL_VPS = 32,
+      HEVC_NAL_SPS = 33,
+      HEVC_NAL_PPS = 34,
+      HEVC_NAL_AUD = 35,
+    };
+
+    struct NalUnit {
+      uint32_t offset;  // of the NAL header byte in the buffer
+      uint32_t length;  // without start code or length prefix
+      uint8_t type;     // nal_unit_type
+      uint8_t refIdc;   // nal_ref_idc, 0 for NAL units no other frame is predicted from. HEVC has no nal_ref_idc,
+                        // so it is 0 for the sub-layer non-reference slice types and 1 for everything else.
+    };
+
+    // Returns the first 00 00 01 in [begin, end), or end. Uses AVX2 or SSE2 when the CPU has them.
+    const uint8_t* FindStartCode(const uint8_t* begin, const uint8_t* end);
+
+    // Lists the NAL units of an Annex-B buffer. Zero bytes in front of a start code aren't counted as part of the NAL before it.
+    void ParseAnnexB(const uint8_t* data, uint32_t length, vector<NalUnit>* nals, VIDEO_CODEC codec = VIDEO_CODEC::H264);
+
+    /*
+    * Rewrites the Annex-B frame in packet->buffer to AVCC, each NAL unit prefixed with its 4 byte big endian length,
+    * and lists the NAL units with their offsets in the rewritten buffer. Encoders emit 4 byte start codes in practice,
+    * which are overwritten in place. Shorter start codes make the frame grow, and the NAL units are moved back to front.
+    */
+    bool AnnexBToAvcc(EncodePacket* packet, vector<NalUnit>* nals, VIDEO_CODEC codec = VIDEO_CODEC::H264);
+  }
+}
@@ -0,0 +1,113 @@
+/****************************************************************************************************************
+
+Filename	:	PacketPool.h
+Content		:	Recycles EncodePackets and their payload buffers across frames of an encoding session
+Copyright	:
+
+****************************************************************************************************************/
+
+#pragma once
+
+#include <mutex>
+#include <vector>
+#include <stdint.h>
+
+#include "EncodePacket.h"
+
+using namespace std;
+
+namespace FBCapture {
+  namespace Streaming {
+
+    // Released packets go back on a free list with their payload buffer, so a steady stream of frames
+    // stops hitting the heap once the pool has warmed up and every buffer has grown to the largest frame.
+    //
+    // Packets can still be in flight on the mux thread after the encoder that owns the pool is gone,
+    // so the owner calls destroy() instead of deleting the pool, and the last returned packet frees it.
+    template<class T>
+    class PacketPool : public EncodePacketRecycler {
+    public:
+      static PacketPool* create(uint32_t maxFreePackets) {
+        return new PacketPool(maxFreePackets);
+      }
+
+      // Owner side. Frees the idle packets and lets go of the pool.
+      void destroy() {
+        vector<T*> idle;
+        bool last;
+        {
+          lock_guard<mutex> lock(mtx_);
+          closed_ = true;
+          idle.swap(free_);
+          last = outstanding_ == 0;
+        }
+
+        for (auto packet : idle)
+          delete packet;
+        if (last)
+          delete this;
+      }
+
+      // Returns a packet holding one reference with a buffer of at least size bytes, or NULL if out of memory
+      T* acquire(uint32_t size) {
+        T* packet = nullptr;
+        {
+          lock_guard<mutex> lock(mtx_);
+          if (!free_.empty()) {
+            packet = free_.back();
+            free_.pop_back();
+          }
+          outstanding_++;
+        }
+
+        if (!packet) {
+          packet = new T();
+          packet->recycler_ = this;
+        }
+        packet->refCount_ = 1;
+
+        if (!packet->reserve(size)) {
+          packet->release();
+          return NULL;
+        }
+        return packet;
+      }
+
+      void recycle(EncodePacket* packet) override {
+        auto typedPacket = static_cast<T*>(packet);
+        typedPacket->reset();
+
+        bool keep, last;
+        {
+          lock_guard<mutex> lock(mtx_);
+          outstanding_--;
+          keep = !closed_ && free_.size() < maxFreePackets_;
+          if (keep)
+            free_.push_back(typedPacket);
+          last = closed_ && outstanding_ == 0;
+        }
+
+        if (!keep)
+          delete typedPacket;
+        if (last)
+          delete this;
+      }
+
+    private:
+      mutex mtx_;
+      vector<T*> free_;
+      uint32_t maxFreePackets_;
+      uint32_t outstanding_;  // packets handed out by acquire() and not yet recycled
+      bool closed_;
+
+      explicit PacketPool(uint32_t maxFreePackets) :
+        maxFreePackets_(maxFreePackets),
+        outstanding_(0),
+        closed_(false) {
+        free_.reserve(maxFreePackets);
+      }
+
+      ~PacketPool() {}
+    };
+  }
+}
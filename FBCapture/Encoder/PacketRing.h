@@ -0,0 +1,103 @@
+/****************************************************************************************************************
+
+Filename	:	PacketRing.h
+Content		:	Bounded lock-free single-producer/single-consumer ring for handing encoded packets across threads
+Copyright	:
+
+****************************************************************************************************************/
+
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+
+using namespace std;
+
+#define PACKET_RING_CACHE_LINE 64
+
+namespace FBCapture {
+  namespace Streaming {
+
+    // Exactly one thread may push() and exactly one other thread may peek()/pop().
+    // The capacity is rounded up to a power of two so indices wrap with a mask.
+    template<class T>
+    class PacketRing {
+      T* buffer_;
+      uint32_t capacity_;
+      uint32_t mask_;
+
+      // head_ is only written by the consumer and tail_ only by the producer.
+      // Keep them on separate cache lines so the two threads don't false share.
+      alignas(PACKET_RING_CACHE_LINE) atomic<uint32_t> head_;
+      alignas(PACKET_RING_CACHE_LINE) atomic<uint32_t> tail_;
+
+    public:
+      PacketRing() : buffer_(NULL), capacity_(0), mask_(0), head_(0), tail_(0) {}
+
+      ~PacketRing() {
+        delete[] buffer_;
+      }
+
+      PacketRing(const PacketRing&) = delete;
+      PacketRing& operator=(const PacketRing&) = delete;
+
+      bool initialize(const uint32_t capacity) {
+        if (buffer_ || capacity == 0)
+          return false;
+
+        capacity_ = 1;
+        while (capacity_ < capacity)
+          capacity_ <<= 1;
+        mask_ = capacity_ - 1;
+        buffer_ = new T[capacity_];
+        head_ = 0;
+        tail_ = 0;
+        return true;
+      }
+
+      // Producer side. Returns false if the ring is full.
+      bool push(const T& item) {
+        const auto tail = tail_.load(memory_order_relaxed);
+        if (tail - head_.load(memory_order_acquire) == capacity_)
+          return false;
+
+        buffer_[tail & mask_] = item;
+        tail_.store(tail + 1, memory_order_release);
+        return true;
+      }
+
+      // Consumer side. Reads the oldest item without removing it.
+      bool peek(T* item) const {
+        const auto head = head_.load(memory_order_relaxed);
+        if (head == tail_.load(memory_order_acquire))
+          return false;
+
+        *item = buffer_[head & mask_];
+        return true;
+      }
+
+      // Consumer side. Removes the oldest item.
+      bool pop(T* item) {
+        const auto head = head_.load(memory_order_relaxed);
+        if (head == tail_.load(memory_order_acquire))
+          return false;
+
+        *item = buffer_[head & mask_];
+        head_.store(head + 1, memory_order_release);
+        return true;
+      }
+
+      uint32_t size() const {
+        return tail_.load(memory_order_acquire) - head_.load(memory_order_acquire);
+      }
+
+      uint32_t capacity() const {
+        return capacity_;
+      }
+
+      bool empty() const {
+        return size() == 0;
+      }
+    };
+  }
+}
@@ -0,0 +1,38 @@
+/****************************************************************************************************************
+
+Filename	:	PacketSink.h
+Content		:	Output destination for encoded packets, fed by its own SinkWorker
+Copyright	:
+
+****************************************************************************************************************/
+
+#pragma once
+
+#include "EncodePacket.h"
+#include "FBCaptureStatus.h"
+
+namespace FBCapture {
+  namespace Streaming {
+
+    using SINK_OVERFLOW_POLICY = enum class SinkOverflowPolicy {
+      BLOCK,  // wait for the sink to catch up. For archives that must not lose packets.
+      DROP    // drop packets while the sink is behind. For live outputs that must not throttle the others.
+    };
+
+    /*
+    * EncodePacketProcessor hands every packet to all of its sinks in mux order. open() is called before
+    * the session starts, write() runs on the sink's own worker thread and close() once that thread is joined,
+    * so a sink never needs to lock against itself. write() doesn't take ownership of the packet.
+    */
+    class PacketSink {
+    public:
+      virtual ~PacketSink() {}
+
+      virtual FBCAPTURE_STATUS open() = 0;
+      virtual FBCAPTURE_STATUS write(EncodePacket* packet) = 0;
+      virtual FBCAPTURE_STATUS close() = 0;
+
+      virtual const char* name() const = 0;
+    };
+  }
+}
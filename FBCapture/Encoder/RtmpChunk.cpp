@@ -0,0 +1,264 @@
+/****************************************************************************************************************
+
+Filename	:	RtmpChunk.cpp
+Content		:
+Copyright	:
+
+****************************************************************************************************************/
+
+#include "RtmpChunk.h"
+#include "FlvPacketizer.h"
+
+namespace FBCapture {
+  namespace Streaming {
+
+    namespace {
+      const uint32_t kExtendedTimestamp = 0xffffff;
+      const uint32_t kMaxChunkSize = 0x7fffffff;
+
+      uint32_t bytesToUi24(const uint8_t* buf) {
+        return buf[0] << 16 | buf[1] << 8 | buf[2];
+      }
+    }
+
+    RtmpChunkWriter::RtmpChunkWriter() :
+      chunkSize_(RTMP_DEFAULT_CHUNK_SIZE) {
+      reset();
+    }
+
+    void RtmpChunkWriter::reset() {
+      chunkSize_ = RTMP_DEFAULT_CHUNK_SIZE;
+      for (auto& stream : streams_)
+        stream = { false, 0, 0 };
+    }
+
+    void RtmpChunkWriter::setChunkSize(const uint32_t chunkSize) {
+      chunkSize_ = chunkSize;
+    }
+
+    void RtmpChunkWriter::write(const uint32_t channel, const uint8_t type, const uint32_t timestamp, const uint32_t streamId,
+                                const IoVec* body, const uint32_t count, vector<IoVec>* iov) {
+      auto& stream = streams_[channel & kMaxChannel];
+
+      uint32_t bodySize = 0;
+      for (uint32_t i = 0; i < count; i++)
+        bodySize += body[i].length;
+
+      // Type 1 headers carry the timestamp delta and leave out the message stream id
+      const auto compressed = stream.started && stream.streamId == streamId && timestamp >= stream.timestamp;
+      const auto headerTimestamp = compressed ? timestamp - stream.timestamp : timestamp;
+      const auto extended = headerTimestamp >= kExtendedTimestamp;
+      const uint32_t extendedSize = extended ? 4 : 0;
+      const auto chunkCount = bodySize == 0 ? 1 : (bodySize + chunkSize_ - 1) / chunkSize_;
+
+      // Sized up front, iov points into it
+      headers_.resize(1 + 11 + extendedSize + (chunkCount - 1) * (1 + extendedSize));
+      iov->clear();
+
+      auto header = headers_.data();
+      auto p = header;
+      *p++ = static_cast<uint8_t>((compressed ? 1 : 0) << 6 | channel);
+      p = FlvPacketizer::ui24ToBytes(p, extended ? kExtendedTimestamp : headerTimestamp);
+      p = FlvPacketizer::ui24ToBytes(p, bodySize);
+      *p++ = type;
+      if (!compressed) {
+        // the message stream id is the only little endian field
+        for (auto i = 0; i < 4; i++)
+          *p++ = static_cast<uint8_t>(streamId >> (8 * i));
+      }
+      if (extended)
+        p = FlvPacketizer::ui32ToBytes(p, headerTimestamp);
+      iov->push_back({ header, static_cast<uint32_t>(p - header) });
+
+      auto chunkLeft = chunkSize_;
+      for (uint32_t i = 0; i < count; i++) {
+        auto data = body[i].data;
+        auto length = body[i].length;
+        while (length > 0) {
+          if (chunkLeft == 0) {
+            header = p;
+            *p++ = static_cast<uint8_t>(3 << 6 | channel);
+            if (extended)
+              p = FlvPacketizer::ui32ToBytes(p, headerTimestamp);
+            iov->push_back({ header, static_cast<uint32_t>(p - header) });
+            chunkLeft = chunkSize_;
+          }
+
+          const auto chunkLength = length < chunkLeft ? length : chunkLeft;
+          iov->push_back({ data, chunkLength });
+          data += chunkLength;
+          length -= chunkLength;
+          chunkLeft -= chunkLength;
+        }
+      }
+
+      stream.started = true;
+      stream.timestamp = timestamp;
+      stream.streamId = streamId;
+    }
+
+    RtmpChunkReader::RtmpChunkReader() :
+      chunkSize_(RTMP_DEFAULT_CHUNK_SIZE),
+      inputOffset_(0) {}
+
+    void RtmpChunkReader::reset() {
+      chunkSize_ = RTMP_DEFAULT_CHUNK_SIZE;
+      streams_.clear();
+      input_.clear();
+      inputOffset_ = 0;
+    }
+
+    bool RtmpChunkReader::read(TcpSocket* socket, RtmpMessage* message) {
+      while (true) {
+        switch (parseChunk(message)) {
+          case CHUNK_RESULT::MESSAGE:
+            return true;
+          case CHUNK_RESULT::MALFORMED:
+            return false;
+          case CHUNK_RESULT::INCOMPLETE:
+            if (!receive(socket))
+              return false;
+            break;
+          default:
+            break;
+        }
+      }
+    }
+
+    bool RtmpChunkReader::readAvailable(TcpSocket* socket, RtmpMessage* message, bool* received) {
+      *received = false;
+      while (true) {
+        switch (parseChunk(message)) {
+          case CHUNK_RESULT::MESSAGE:
+            *received = true;
+            return true;
+          case CHUNK_RESULT::MALFORMED:
+            return false;
+          case CHUNK_RESULT::INCOMPLETE:
+            if (!socket->waitReadable(0))
+              return true;
+            if (!receive(socket))
+              return false;
+            break;
+          default:
+            break;
+        }
+      }
+    }
+
+    bool RtmpChunkReader::receive(TcpSocket* socket) {
+      input_.erase(input_.begin(), input_.begin() + inputOffset_);
+      inputOffset_ = 0;
+
+      const auto size = input_.size();
+      input_.resize(size + kReceiveSize);
+      const auto received = socket->recvSome(input_.data() + size, kReceiveSize);
+      input_.resize(size + received);
+      return received > 0;
+    }
+
+    RtmpChunkReader::CHUNK_RESULT RtmpChunkReader::parseChunk(RtmpMessage* message) {
+      const auto p = input_.data() + inputOffset_;
+      const auto available = input_.size() - inputOffset_;
+      if (available < 1)
+        return CHUNK_RESULT::INCOMPLETE;
+
+      // basic header, with chunk stream ids above 63 in one or two more bytes
+      const auto format = p[0] >> 6;
+      uint32_t channel = p[0] & 0x3f;
+      size_t used = 1;
+      if (channel == 0) {
+        if (available < 2)
+          return CHUNK_RESULT::INCOMPLETE;
+        channel = 64 + p[1];
+        used = 2;
+      } else if (channel == 1) {
+        if (available < 3)
+          return CHUNK_RESULT::INCOMPLETE;
+        channel = 64 + p[1] + (p[2] << 8);
+        used = 3;
+      }
+
+      auto& stream = streams_[channel];
+      if (format != 0 && !stream.started)
+        return CHUNK_RESULT::MALFORMED;
+
+      static const uint32_t kHeaderSizes[] = { 11, 7, 3, 0 };
+      const auto header = p + used;
+      used += kHeaderSizes[format];
+      if (available < used)
+        return CHUNK_RESULT::INCOMPLETE;
+
+      const auto startsMessage = stream.body.empty();
+      if (format != 3 && !startsMessage)
+        return CHUNK_RESULT::MALFORMED;  // a new header in the middle of a message
+
+      // The stream only changes once the whole chunk is buffered
+      auto extended = stream.extended;
+      auto length = stream.length;
+      auto type = stream.type;
+      uint32_t timestamp = 0;
+      if (format != 3) {
+        timestamp = bytesToUi24(header);
+        extended = timestamp == kExtendedTimestamp;
+        if (format <= 1) {
+          length = bytesToUi24(header + 3);
+          type = header[6];
+        }
+      }
+      // type 3 chunks repeat the extended timestamp of the last header
+      if (extended) {
+        if (available < used + 4)
+          return CHUNK_RESULT::INCOMPLETE;
+        if (format != 3)
+          timestamp = FlvPacketizer::bytesToUi32(p + used);
+        used += 4;
+      }
+
+      const auto received = static_cast<uint32_t>(stream.body.size());
+      const auto left = length - received;
+      const auto chunkLength = left < chunkSize_ ? left : chunkSize_;
+      if (available < used + chunkLength)
+        return CHUNK_RESULT::INCOMPLETE;
+
+      if (format == 3) {
+        if (startsMessage)
+          stream.timestamp += stream.delta;
+      } else {
+        stream.extended = extended;
+        stream.length = length;
+        stream.type = type;
+        if (format == 0) {
+          stream.streamId = header[7] | header[8] << 8 | header[9] << 16 | static_cast<uint32_t>(header[10]) << 24;
+          stream.timestamp = timestamp;
+          stream.started = true;
+        } else {
+          stream.timestamp += timestamp;
+        }
+        stream.delta = timestamp;
+      }
+      stream.body.insert(stream.body.end(), p + used, p + used + chunkLength);
+      inputOffset_ += used + chunkLength;
+      if (stream.body.size() < stream.length)
+        return CHUNK_RESULT::PARTIAL;
+
+      message->type = stream.type;
+      message->timestamp = stream.timestamp;
+      message->streamId = stream.streamId;
+      message->body.swap(stream.body);
+      stream.body.clear();
+
+      if (message->type == RTMP_MSG_SET_CHUNK_SIZE && message->body.size() >= 4) {
+        const auto chunkSize = FlvPacketizer::bytesToUi32(message->body.data()) & kMaxChunkSize;
+        if (chunkSize == 0)
+          return CHUNK_RESULT::MALFORMED;
+        chunkSize_ = chunkSize;
+      } else if (message->type == RTMP_MSG_ABORT && message->body.size() >= 4) {
+        const auto aborted = streams_.find(FlvPacketizer::bytesToUi32(message->body.data()));
+        if (aborted != streams_.end())
+          aborted->second.body.clear();
+      }
+      return CHUNK_RESULT::MESSAGE;
+    }
+  }
+}
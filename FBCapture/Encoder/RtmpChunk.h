@@ -0,0 +1,149 @@
+/****************************************************************************************************************
+
+Filename	:	RtmpChunk.h
+Content		:	Splits RTMP messages into chunks and reassembles them, without going through librtmp
+Copyright	:
+
+****************************************************************************************************************/
+
+#pragma once
+
+#include <map>
+#include <vector>
+#include <stdint.h>
+
+#include "IoVec.h"
+#include "TcpSocket.h"
+
+using namespace std;
+
+#define RTMP_HANDSHAKE_SIZE 1536
+#define RTMP_DEFAULT_CHUNK_SIZE 128
+
+namespace FBCapture {
+  namespace Streaming {
+
+    enum RTMP_MESSAGE_TYPE {
+      RTMP_MSG_SET_CHUNK_SIZE = 0x01,
+      RTMP_MSG_ABORT = 0x02,
+      RTMP_MSG_ACKNOWLEDGEMENT = 0x03,
+      RTMP_MSG_USER_CONTROL = 0x04,
+      RTMP_MSG_WINDOW_ACK_SIZE = 0x05,
+      RTMP_MSG_SET_PEER_BANDWIDTH = 0x06,
+      RTMP_MSG_AUDIO = 0x08,
+      RTMP_MSG_VIDEO = 0x09,
+      RTMP_MSG_DATA_AMF0 = 0x12,
+      RTMP_MSG_COMMAND_AMF0 = 0x14,
+    };
+
+    enum RTMP_USER_CONTROL_EVENT {
+      RTMP_EVENT_STREAM_BEGIN = 0,
+      RTMP_EVENT_PING_REQUEST = 6,
+      RTMP_EVENT_PING_RESPONSE = 7,
+    };
+
+    // Chunk stream ids. Protocol control messages have to go on 2, the rest is convention.
+    enum RTMP_CHANNEL {
+      RTMP_CHANNEL_CONTROL = 0x02,
+      RTMP_CHANNEL_COMMAND = 0x03,
+      RTMP_CHANNEL_STREAM_COMMAND = 0x04,
+      RTMP_CHANNEL_VIDEO = 0x06,
+      RTMP_CHANNEL_AUDIO = 0x07,
+    };
+
+    struct RtmpMessage {
+      uint8_t type;
+      uint32_t timestamp;
+      uint32_t streamId;
+      vector<uint8_t> body;
+    };
+
+    /*
+    * Writes the chunk headers of outgoing messages and interleaves them with slices of the message body,
+    * so a message goes to the socket in one gather send without its body being copied.
+    * Keeps the header compression state of every chunk stream it has written on.
+    */
+    class RtmpChunkWriter {
+    public:
+      RtmpChunkWriter();
+
+      // Forgets the header compression state, for a new connection
+      void reset();
+
+      void setChunkSize(uint32_t chunkSize);
+      uint32_t chunkSize() const {
+        return chunkSize_;
+      }
+
+      // Replaces iov with the chunked message. The chunk headers live in the writer until the next call.
+      // channel must be below 64, which all of RTMP_CHANNEL are.
+      void write(uint32_t channel, uint8_t type, uint32_t timestamp, uint32_t streamId,
+                 const IoVec* body, uint32_t count, vector<IoVec>* iov);
+
+    private:
+      static const uint32_t kMaxChannel = 63;  // the largest id that fits a one byte basic header
+
+      struct ChunkStream {
+        bool started;        // a type 0 header went out, so type 1 headers can follow
+        uint32_t timestamp;  // of the last message
+        uint32_t streamId;
+      };
+
+      uint32_t chunkSize_;
+      ChunkStream streams_[kMaxChannel + 1];
+      vector<uint8_t> headers_;
+    };
+
+    /*
+    * Reads chunks off a socket and reassembles the messages of every chunk stream. Set Chunk Size
+    * and Abort messages are applied here before they are returned. What arrives from the socket is buffered
+    * and a chunk is only parsed once all of it is there, so a chunk split across TCP segments never blocks
+    * readAvailable().
+    */
+    class RtmpChunkReader {
+    public:
+      RtmpChunkReader();
+
+      void reset();
+
+      uint32_t chunkSize() const {
+        return chunkSize_;
+      }
+
+      // Blocks until a whole message arrived. False on socket errors and malformed chunks.
+      bool read(TcpSocket* socket, RtmpMessage* message);
+      // Takes what already arrived without waiting for more. received is set if that completed a message.
+      bool readAvailable(TcpSocket* socket, RtmpMessage* message, bool* received);
+
+    private:
+      static const uint32_t kReceiveSize = 16 * 1024;
+
+      enum class CHUNK_RESULT {
+        INCOMPLETE,   // more bytes are needed for the next chunk
+        PARTIAL,      // a chunk was taken but its message isn't complete yet
+        MESSAGE,
+        MALFORMED
+      };
+
+      struct ChunkStream {
+        bool started;        // a type 0 header arrived, so compressed headers can follow
+        bool extended;       // the last header used an extended timestamp, which type 3 chunks repeat
+        uint8_t type;
+        uint32_t timestamp;
+        uint32_t delta;      // of the last type 1 or 2 header, reapplied by type 3 headers that start a message
+        uint32_t length;
+        uint32_t streamId;
+        vector<uint8_t> body;  // the message being reassembled
+      };
+
+      uint32_t chunkSize_;
+      map<uint32_t, ChunkStream> streams_;
+      vector<uint8_t> input_;   // received but not parsed yet from inputOffset_ on
+      size_t inputOffset_;
+
+      CHUNK_RESULT parseChunk(RtmpMessage* message);
+      // Appends what the socket has, waiting for at least a byte
+      bool receive(TcpSocket* socket);
+    };
+  }
+}
@@ -0,0 +1,397 @@
+/****************************************************************************************************************
+
+Filename	:	RtmpPublisher.cpp
+Content		:
+Copyright	:
+
+****************************************************************************************************************/
+
+#include "RtmpPublisher.h"
+#include "FlvPacketizer.h"
+#include "Log.h"
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <random>
+
+namespace FBCapture {
+  namespace Streaming {
+
+    namespace {
+      const uint8_t kRtmpVersion = 3;
+      const char* kFlashVersion = "FMLE/3.0 (compatible; FBCapture)";
+
+      enum TRANSACTION_ID {
+        CONNECT_TRANSACTION = 1,
+        RELEASE_STREAM_TRANSACTION,
+        FC_PUBLISH_TRANSACTION,
+        CREATE_STREAM_TRANSACTION,
+        PUBLISH_TRANSACTION,
+        FC_UNPUBLISH_TRANSACTION,
+        DELETE_STREAM_TRANSACTION,
+      };
+    }
+
+    RtmpPublisher::RtmpPublisher() :
+      url_ {},
+      streamId_(0),
+      windowAckSize_(0),
+      acknowledged_(0),
+      connected_(false) {}
+
+    RtmpPublisher::~RtmpPublisher() {
+      close();
+    }
+
+    bool RtmpPublisher::parseUrl(const string& url, RtmpUrl* parsed) {
+      const string scheme = "rtmp://";
+      if (url.size() <= scheme.size())
+        return false;
+      for (size_t i = 0; i < scheme.size(); i++) {
+        if (tolower(static_cast<unsigned char>(url[i])) != scheme[i])
+          return false;
+      }
+
+      const auto hostStart = scheme.size();
+      const auto pathStart = url.find('/', hostStart);
+      if (pathStart == string::npos)
+        return false;
+
+      auto host = url.substr(hostStart, pathStart - hostStart);
+      parsed->port = kDefaultPort;
+      const auto portStart = host.rfind(':');
+      if (portStart != string::npos && host.find(']', portStart) == string::npos) {
+        const auto port = strtoul(host.c_str() + portStart + 1, NULL, 10);
+        if (port == 0 || port > 0xffff)
+          return false;
+        parsed->port = static_cast<uint16_t>(port);
+        host.resize(portStart);
+      }
+      // [::1] style IPv6 literals
+      if (host.size() >= 2 && host.front() == '[' && host.back() == ']')
+        host = host.substr(1, host.size() - 2);
+      if (host.empty())
+        return false;
+      parsed->host = host;
+
+      const auto keyStart = url.rfind('/');
+      if (keyStart <= pathStart || keyStart + 1 == url.size())
+        return false;
+      parsed->app = url.substr(pathStart + 1, keyStart - pathStart - 1);
+      parsed->streamKey = url.substr(keyStart + 1);
+      parsed->tcUrl = url.substr(0, keyStart);
+      return true;
+    }
+
+    FBCAPTURE_STATUS RtmpPublisher::connect(const string& url) {
+      close();
+
+      if (!parseUrl(url, &url_)) {
+        DEBUG_ERROR("Failed to parse RTMP stream url.");
+        return FBCAPTURE_RTMP_INVALID_STREAM_URL;
+      }
+
+      DEBUG_LOG_VAR("Live streaming server: ", url_.tcUrl);
+      if (!socket_.connect(url_.host, url_.port, kTimeoutMs)) {
+        DEBUG_ERROR_VAR("Failed to connect to RTMP server", url_.host);
+        return FBCAPTURE_RTMP_CONNECTION_FAILED;
+      }
+
+      // Frames go out as soon as they are encoded instead of waiting for ACKs of the previous ones
+      if (!socket_.setNoDelay(true))
+        DEBUG_LOG("Failed to disable Nagle's algorithm on RTMP socket");
+      if (!socket_.setSendBufferSize(kSendBufferSize))
+        DEBUG_LOG("Failed to grow RTMP socket send buffer");
+
+      writer_.reset();
+      reader_.reset();
+      streamId_ = 0;
+      windowAckSize_ = 0;
+      acknowledged_ = 0;
+
+      if (!handshake()) {
+        DEBUG_ERROR("RTMP handshake failed");
+        socket_.close();
+        return FBCAPTURE_RTMP_CONNECTION_FAILED;
+      }
+
+      // Larger chunks than the default 128 bytes mean fewer chunk headers and gather buffers per frame.
+      // Sent first so even the connect command goes out with them.
+      if (!sendControl(RTMP_MSG_SET_CHUNK_SIZE, kOutChunkSize)) {
+        socket_.close();
+        return FBCAPTURE_RTMP_CONNECTION_FAILED;
+      }
+      writer_.setChunkSize(kOutChunkSize);
+
+      command_.clear();
+      command_.writeString("connect");
+      command_.writeNumber(CONNECT_TRANSACTION);
+      command_.writeObjectStart();
+      command_.writeStringProperty("app", url_.app);
+      command_.writeStringProperty("type", "nonprivate");
+      command_.writeStringProperty("flashVer", kFlashVersion);
+      command_.writeStringProperty("tcUrl", url_.tcUrl);
+      // enhanced RTMP: the FourCC codecs we may send besides the legacy codec ids
+      command_.writePropertyName("fourCcList");
+      command_.writeStrictArrayStart(1);
+      command_.writeString("hvc1");
+      command_.writeObjectEnd();
+      if (!sendCommand(RTMP_CHANNEL_COMMAND, 0) || !waitForResult(CONNECT_TRANSACTION)) {
+        DEBUG_ERROR_VAR("RTMP server refused to connect to app", url_.app);
+        socket_.close();
+        return FBCAPTURE_RTMP_CONNECTION_FAILED;
+      }
+
+      // Some servers want the stream released from a previous session first. Their answers aren't waited for.
+      command_.clear();
+      command_.writeString("releaseStream");
+      command_.writeNumber(RELEASE_STREAM_TRANSACTION);
+      command_.writeNull();
+      command_.writeString(url_.streamKey);
+      auto sent = sendCommand(RTMP_CHANNEL_COMMAND, 0);
+
+      command_.clear();
+      command_.writeString("FCPublish");
+      command_.writeNumber(FC_PUBLISH_TRANSACTION);
+      command_.writeNull();
+      command_.writeString(url_.streamKey);
+      sent = sent && sendCommand(RTMP_CHANNEL_COMMAND, 0);
+
+      command_.clear();
+      command_.writeString("createStream");
+      command_.writeNumber(CREATE_STREAM_TRANSACTION);
+      command_.writeNull();
+      sent = sent && sendCommand(RTMP_CHANNEL_COMMAND, 0);
+
+      double streamId = 0;
+      if (sent && waitForResult(CREATE_STREAM_TRANSACTION)) {
+        Amf0Reader reader(message_.body.data(), static_cast<uint32_t>(message_.body.size()));
+        string name;
+        double transactionId;
+        if (!readCommandName(&reader, &name, &transactionId) || !reader.skip() || !reader.readNumber(&streamId))
+          streamId = 0;
+      }
+      if (streamId <= 0) {
+        DEBUG_ERROR("Failed to create RTMP stream");
+        socket_.close();
+        return FBCAPTURE_RTMP_CONNECTION_FAILED;
+      }
+      streamId_ = static_cast<uint32_t>(streamId);
+
+      command_.clear();
+      command_.writeString("publish");
+      command_.writeNumber(PUBLISH_TRANSACTION);
+      command_.writeNull();
+      command_.writeString(url_.streamKey);
+      command_.writeString("live");
+      if (!sendCommand(RTMP_CHANNEL_STREAM_COMMAND, streamId_) || !waitForPublishStart()) {
+        DEBUG_ERROR("RTMP server refused to publish the stream");
+        socket_.close();
+        return FBCAPTURE_RTMP_CONNECTION_FAILED;
+      }
+
+      connected_ = true;
+      return FBCAPTURE_OK;
+    }
+
+    bool RtmpPublisher::handshake() {
+      // C0 and C1: version, then time, zero and random bytes the server echoes back in S2
+      vector<uint8_t> c0c1(1 + RTMP_HANDSHAKE_SIZE, 0);
+      c0c1[0] = kRtmpVersion;
+      mt19937 random(random_device {}());
+      for (auto i = 1 + 8; i < 1 + RTMP_HANDSHAKE_SIZE; i++)
+        c0c1[i] = static_cast<uint8_t>(random());
+      if (!socket_.send(c0c1.data(), static_cast<uint32_t>(c0c1.size())))
+        return false;
+
+      vector<uint8_t> s0s1(1 + RTMP_HANDSHAKE_SIZE);
+      if (!socket_.recv(s0s1.data(), static_cast<uint32_t>(s0s1.size())))
+        return false;
+      if (s0s1[0] != kRtmpVersion) {
+        DEBUG_ERROR_VAR("Unsupported RTMP version", to_string(s0s1[0]));
+        return false;
+      }
+
+      // C2 echoes S1
+      if (!socket_.send(s0s1.data() + 1, RTMP_HANDSHAKE_SIZE))
+        return false;
+
+      // S2 should echo C1, but servers doing the digest handshake don't, so it isn't checked
+      vector<uint8_t> s2(RTMP_HANDSHAKE_SIZE);
+      return socket_.recv(s2.data(), RTMP_HANDSHAKE_SIZE);
+    }
+
+    bool RtmpPublisher::send(const uint32_t channel, const uint8_t type, const uint32_t timestamp, const uint32_t streamId,
+                             const uint8_t* body, const uint32_t length) {
+      const IoVec iov = { body, length };
+      writer_.write(channel, type, timestamp, streamId, &iov, 1, &iov_);
+      return socket_.sendV(iov_.data(), static_cast<uint32_t>(iov_.size()));
+    }
+
+    bool RtmpPublisher::sendControl(const uint8_t type, const uint32_t value) {
+      uint8_t body[4];
+      FlvPacketizer::ui32ToBytes(body, value);
+      return send(RTMP_CHANNEL_CONTROL, type, 0, 0, body, sizeof(body));
+    }
+
+    bool RtmpPublisher::sendUserControl(const uint16_t event, const uint32_t value) {
+      uint8_t body[6];
+      FlvPacketizer::ui32ToBytes(FlvPacketizer::ui16ToBytes(body, event), value);
+      return send(RTMP_CHANNEL_CONTROL, RTMP_MSG_USER_CONTROL, 0, 0, body, sizeof(body));
+    }
+
+    bool RtmpPublisher::sendCommand(const uint32_t channel, const uint32_t streamId) {
+      return send(channel, RTMP_MSG_COMMAND_AMF0, 0, streamId, command_.data(), command_.size());
+    }
+
+    bool RtmpPublisher::readMessage() {
+      return reader_.read(&socket_, &message_) && handleMessage();
+    }
+
+    bool RtmpPublisher::handleMessage() {
+      if (windowAckSize_ > 0 && socket_.bytesReceived() - acknowledged_ >= windowAckSize_) {
+        acknowledged_ = socket_.bytesReceived();
+        if (!sendControl(RTMP_MSG_ACKNOWLEDGEMENT, static_cast<uint32_t>(acknowledged_)))
+          return false;
+      }
+
+      const auto& body = message_.body;
+      if (message_.type == RTMP_MSG_WINDOW_ACK_SIZE && body.size() >= 4) {
+        windowAckSize_ = FlvPacketizer::bytesToUi32(body.data());
+      } else if (message_.type == RTMP_MSG_USER_CONTROL && body.size() >= 6) {
+        const auto event = body[0] << 8 | body[1];
+        if (event == RTMP_EVENT_PING_REQUEST)
+          return sendUserControl(RTMP_EVENT_PING_RESPONSE, FlvPacketizer::bytesToUi32(body.data() + 2));
+      }
+      return true;
+    }
+
+    bool RtmpPublisher::readCommandName(Amf0Reader* reader, string* name, double* transactionId) {
+      return reader->readString(name) && reader->readNumber(transactionId);
+    }
+
+    bool RtmpPublisher::waitForResult(const double transactionId) {
+      while (readMessage()) {
+        if (message_.type != RTMP_MSG_COMMAND_AMF0)
+          continue;
+
+        Amf0Reader reader(message_.body.data(), static_cast<uint32_t>(message_.body.size()));
+        string name;
+        double id;
+        if (!readCommandName(&reader, &name, &id) || id != transactionId)
+          continue;
+        if (name == "_result")
+          return true;
+        if (name == "_error") {
+          map<string, string> info;
+          if (reader.skip() && reader.readObject(&info))
+            DEBUG_ERROR_VAR("RTMP command failed", info["code"] + " " + info["description"]);
+          return false;
+        }
+      }
+      return false;
+    }
+
+    bool RtmpPublisher::waitForPublishStart() {
+      while (readMessage()) {
+        if (message_.type != RTMP_MSG_COMMAND_AMF0)
+          continue;
+
+        Amf0Reader reader(message_.body.data(), static_cast<uint32_t>(message_.body.size()));
+        string name;
+        double id;
+        map<string, string> info;
+        if (!readCommandName(&reader, &name, &id) || (name != "onStatus" && name != "_error"))
+          continue;
+        if (!reader.skip() || !reader.readObject(&info))
+          return false;
+        if (name == "onStatus" && info["code"] == "NetStream.Publish.Start")
+          return true;
+        if (name == "_error" || info["level"] == "error") {
+          DEBUG_ERROR_VAR("RTMP publish failed", info["code"] + " " + info["description"]);
+          return false;
+        }
+      }
+      return false;
+    }
+
+    bool RtmpPublisher::pollIncoming() {
+      while (true) {
+        bool received;
+        if (!reader_.readAvailable(&socket_, &message_, &received))
+          return false;
+        if (!received)
+          return true;
+        if (!handleMessage())
+          return false;
+
+        if (message_.type == RTMP_MSG_COMMAND_AMF0) {
+          Amf0Reader reader(message_.body.data(), static_cast<uint32_t>(message_.body.size()));
+          string name;
+          double id;
+          map<string, string> info;
+          if (readCommandName(&reader, &name, &id) && name == "onStatus" &&
+              reader.skip() && reader.readObject(&info) && info["level"] == "error")
+            DEBUG_ERROR_VAR("RTMP server reported an error", info["code"] + " " + info["description"]);
+        }
+      }
+    }
+
+    FBCAPTURE_STATUS RtmpPublisher::sendMessage(const uint8_t type, const uint32_t timestamp, const IoVec* body, const uint32_t count) {
+      if (!connected_) {
+        DEBUG_ERROR("RTMP is disconnected");
+        return FBCAPTURE_RTMP_DISCONNECTED;
+      }
+
+      if (!pollIncoming()) {
+        DEBUG_ERROR("RTMP server closed the connection");
+        connected_ = false;
+        socket_.close();
+        return FBCAPTURE_RTMP_DISCONNECTED;
+      }
+
+      const auto channel = type == RTMP_MSG_AUDIO ? RTMP_CHANNEL_AUDIO : RTMP_CHANNEL_VIDEO;
+      writer_.write(channel, type, timestamp, streamId_, body, count, &iov_);
+      if (!socket_.sendV(iov_.data(), static_cast<uint32_t>(iov_.size()))) {
+        DEBUG_ERROR("Failed to send RTMP message");
+        connected_ = false;
+        socket_.close();
+        return FBCAPTURE_RTMP_SEND_PACKET_FAILED;
+      }
+      return FBCAPTURE_OK;
+    }
+
+    FBCAPTURE_STATUS RtmpPublisher::close() {
+      if (connected_) {
+        // answers what the server sent so far, like acknowledgements
+        pollIncoming();
+
+        // Lets the server finish the stream right away instead of waiting for the connection to time out
+        command_.clear();
+        command_.writeString("FCUnpublish");
+        command_.writeNumber(FC_UNPUBLISH_TRANSACTION);
+        command_.writeNull();
+        command_.writeString(url_.streamKey);
+        sendCommand(RTMP_CHANNEL_COMMAND, 0);
+
+        command_.clear();
+        command_.writeString("deleteStream");
+        command_.writeNumber(DELETE_STREAM_TRANSACTION);
+        command_.writeNull();
+        command_.writeNumber(streamId_);
+        sendCommand(RTMP_CHANNEL_COMMAND, 0);
+
+        // closing with server messages unread would reset the connection and lose the tail of the stream
+        socket_.shutdown(kCloseTimeoutMs);
+      }
+
+      connected_ = false;
+      socket_.close();
+      return FBCAPTURE_OK;
+    }
+
+    bool RtmpPublisher::isConnected() const {
+      return connected_;
+    }
+  }
+}
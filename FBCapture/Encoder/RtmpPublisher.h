@@ -0,0 +1,98 @@
+/****************************************************************************************************************
+
+Filename	:	RtmpPublisher.h
+Content		:	Publishes a live stream to an RTMP server over a plain TCP connection, without librtmp
+Copyright	:
+
+****************************************************************************************************************/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "Amf0Reader.h"
+#include "Amf0Writer.h"
+#include "FBCaptureStatus.h"
+#include "IoVec.h"
+#include "RtmpChunk.h"
+#include "TcpSocket.h"
+
+using namespace std;
+
+namespace FBCapture {
+  namespace Streaming {
+
+    // rtmp://host[:port]/app/streamKey. The app is everything up to the last slash of the path.
+    struct RtmpUrl {
+      string host;
+      uint16_t port;
+      string app;
+      string streamKey;
+      string tcUrl;   // the URL without the stream key, as the connect command reports it
+    };
+
+    /*
+    * Runs the handshake and the connect/createStream/publish exchange, then sends audio and video messages
+    * with large chunks whose headers are interleaved with the message body in one gather send per message.
+    * Control messages from the server, like pings and window acknowledgements, are answered between sends.
+    */
+    class RtmpPublisher {
+    public:
+      RtmpPublisher();
+      ~RtmpPublisher();
+
+      RtmpPublisher(const RtmpPublisher&) = delete;
+      RtmpPublisher& operator=(const RtmpPublisher&) = delete;
+
+      // False for anything but a plain rtmp:// URL with an app and a stream key
+      static bool parseUrl(const string& url, RtmpUrl* parsed);
+
+      FBCAPTURE_STATUS connect(const string& url);
+      FBCAPTURE_STATUS close();
+      bool isConnected() const;
+
+      // Sends one audio or video message whose body is the buffers back to back
+      FBCAPTURE_STATUS sendMessage(uint8_t type, uint32_t timestamp, const IoVec* body, uint32_t count);
+
+    private:
+      static const uint32_t kOutChunkSize = 4096;
+      // Room for a few frames of a high bitrate stream, so a keyframe doesn't block the sender on every ACK
+      static const int kSendBufferSize = 1024 * 1024;
+      static const uint32_t kTimeoutMs = 10000;
+      static const uint32_t kCloseTimeoutMs = 2000;   // for the server to take the rest of the stream and hang up
+      static const uint16_t kDefaultPort = 1935;
+
+      bool handshake();
+      bool send(uint32_t channel, uint8_t type, uint32_t timestamp, uint32_t streamId, const uint8_t* body, uint32_t length);
+      bool sendControl(uint8_t type, uint32_t value);
+      bool sendUserControl(uint16_t event, uint32_t value);
+      bool sendCommand(uint32_t channel, uint32_t streamId);
+
+      // Reads the next message and answers it if it is a control message
+      bool readMessage();
+      // Acknowledges what was received and answers message_ if it is a control message
+      bool handleMessage();
+      // Reads until the result of the command with transactionId arrives, which is left in message_
+      bool waitForResult(double transactionId);
+      bool waitForPublishStart();
+      // Answers whatever the server sent without waiting for the rest of a partly received message
+      bool pollIncoming();
+
+      static bool readCommandName(Amf0Reader* reader, string* name, double* transactionId);
+
+      TcpSocket socket_;
+      RtmpChunkWriter writer_;
+      RtmpChunkReader reader_;
+      Amf0Writer command_;
+      RtmpMessage message_;
+      vector<IoVec> iov_;
+      RtmpUrl url_;
+      uint32_t streamId_;
+      uint32_t windowAckSize_;   // the server wants an acknowledgement after this many bytes
+      uint64_t acknowledged_;    // bytes received when the last acknowledgement went out
+      bool connected_;
+    };
+  }
+}
@@ -0,0 +1,212 @@
+/****************************************************************************************************************
+
+Filename	:	RtmpSink.cpp
+Content		:
+Copyright	:
+
+****************************************************************************************************************/
+
+#include "RtmpSink.h"
+#include "Log.h"
+
+#include <algorithm>
+
+namespace FBCapture {
+  namespace Streaming {
+
+    RtmpSink::RtmpSink(const string& streamUrl) :
+      streamUrl_(streamUrl),
+      publisher_(NULL),
+      rtmp_(NULL),
+      gopBytes_(0),
+      gopOverflow_(false),
+      connected_(false),
+      waitForKeyframe_(false),
+      reconnectAttempts_(0),
+      timestampOffset_(0),
+      lastTimestamp_(-1) {}
+
+    RtmpSink::~RtmpSink() {
+      close();
+      if (publisher_)
+        delete publisher_;
+      publisher_ = nullptr;
+      if (rtmp_)
+        delete rtmp_;
+      rtmp_ = nullptr;
+    }
+
+    FBCAPTURE_STATUS RtmpSink::open() {
+      clearGop();
+      gopOverflow_ = false;
+      waitForKeyframe_ = false;
+      reconnectAttempts_ = 0;
+      timestampOffset_ = 0;
+      lastTimestamp_ = -1;
+      return connect();
+    }
+
+    FBCAPTURE_STATUS RtmpSink::connect() {
+      RtmpUrl url;
+      FBCAPTURE_STATUS status;
+      if (RtmpPublisher::parseUrl(streamUrl_, &url)) {
+        if (!publisher_)
+          publisher_ = new RtmpPublisher();
+        status = publisher_->connect(streamUrl_);
+      } else {
+        if (!rtmp_)
+          rtmp_ = new LibRTMP();
+        status = rtmp_->initialize(streamUrl_);
+      }
+      if (status != FBCAPTURE_OK)
+        return status;
+
+      resetStream();
+      connected_ = true;
+      return FBCAPTURE_OK;
+    }
+
+    void RtmpSink::disconnect() {
+      if (publisher_)
+        publisher_->close();
+      if (rtmp_)
+        rtmp_->close();
+      connected_ = false;
+    }
+
+    FBCAPTURE_STATUS RtmpSink::write(EncodePacket* packet) {
+      bufferPacket(packet);
+
+      if (connected_) {
+        const auto status = send(packet);
+        if (!isConnectionError(status))
+          return status;
+
+        DEBUG_ERROR_VAR("Lost RTMP connection, reconnecting", to_string(status));
+        disconnect();
+        reconnectAttempts_ = 0;
+        nextReconnect_ = Clock::now();
+      }
+
+      return reconnect();
+    }
+
+    FBCAPTURE_STATUS RtmpSink::send(EncodePacket* packet) {
+      if (waitForKeyframe_ && packet->type() == PACKET_TYPE::VIDEO) {
+        if (!static_cast<VideoEncodePacket*>(packet)->isKeyframe)
+          return FBCAPTURE_OK;
+        waitForKeyframe_ = false;
+      }
+      return FlvSink::write(packet);
+    }
+
+    FBCAPTURE_STATUS RtmpSink::reconnect() {
+      // Packets keep going into the GOP buffer in between attempts
+      const auto now = Clock::now();
+      if (now < nextReconnect_)
+        return FBCAPTURE_OK;
+
+      if (reconnectAttempts_ >= kMaxReconnectAttempts) {
+        DEBUG_ERROR("Giving up reconnecting to RTMP server");
+        return FBCAPTURE_RTMP_DISCONNECTED;
+      }
+
+      auto delayMs = kReconnectDelayMs << min(reconnectAttempts_, 16u);
+      if (delayMs > kMaxReconnectDelayMs)
+        delayMs = kMaxReconnectDelayMs;
+      reconnectAttempts_++;
+      nextReconnect_ = now + chrono::milliseconds(delayMs);
+
+      const auto status = connect();
+      if (status != FBCAPTURE_OK) {
+        DEBUG_LOG_VAR("RTMP reconnect failed, attempt", to_string(reconnectAttempts_));
+        return FBCAPTURE_OK;
+      }
+
+      DEBUG_LOG_VAR("Reconnected to RTMP server, resending buffered packets", to_string(gop_.size()));
+      return resume();
+    }
+
+    FBCAPTURE_STATUS RtmpSink::resume() {
+      if (gop_.empty()) {
+        waitForKeyframe_ = true;
+        return FBCAPTURE_OK;
+      }
+
+      // The buffered keyframe goes out 1 ms after the last message the server got, everything else keeps its distance
+      if (lastTimestamp_ >= 0)
+        timestampOffset_ = lastTimestamp_ + 1 - toFlvTimestamp(gop_.front()->timestamp);
+
+      // send() can't add to the buffer while it is being replayed
+      for (size_t i = 0; i < gop_.size(); i++) {
+        const auto status = send(gop_[i]);
+        if (status == FBCAPTURE_OK)
+          continue;
+        if (!isConnectionError(status))
+          return status;
+
+        DEBUG_ERROR_VAR("Lost RTMP connection while resuming", to_string(status));
+        disconnect();
+        return FBCAPTURE_OK;
+      }
+
+      reconnectAttempts_ = 0;
+      return FBCAPTURE_OK;
+    }
+
+    void RtmpSink::bufferPacket(EncodePacket* packet) {
+      if (packet->type() == PACKET_TYPE::VIDEO && static_cast<VideoEncodePacket*>(packet)->isKeyframe) {
+        clearGop();
+        gopOverflow_ = false;
+      } else if (gop_.empty() || gopOverflow_) {
+        // nothing to resume from before the first keyframe
+        return;
+      }
+
+      if (gop_.size() >= kMaxGopPackets || gopBytes_ + packet->length > kMaxGopBytes) {
+        clearGop();
+        gopOverflow_ = true;
+        return;
+      }
+
+      gop_.push_back(packet->addRef());
+      gopBytes_ += packet->length;
+    }
+
+    void RtmpSink::clearGop() {
+      for (auto packet : gop_)
+        packet->release();
+      gop_.clear();
+      gopBytes_ = 0;
+    }
+
+    bool RtmpSink::isConnectionError(const FBCAPTURE_STATUS status) {
+      return status == FBCAPTURE_RTMP_SEND_PACKET_FAILED || status == FBCAPTURE_RTMP_DISCONNECTED;
+    }
+
+    FBCAPTURE_STATUS RtmpSink::writeTag(const FlvTag& tag) {
+      auto timestamp = max<int64_t>(tag.timestamp() + timestampOffset_, 0);
+      // Sequence headers are stamped 0, which would go back in time when they are resent after a reconnect
+      if (tag.isSequenceHeader())
+        timestamp = max(timestamp, lastTimestamp_);
+
+      // An RTMP message body is the FLV tag body, codec header and the packet payload it still references
+      const IoVec body[] = {
+        { tag.codecHeader(), tag.codecHeaderLength() },
+        { tag.payload, tag.payloadLength },
+      };
+      const auto status = publisher_ ?
+        publisher_->sendMessage(tag.type(), static_cast<uint32_t>(timestamp), body, 2) :
+        rtmp_->sendMessage(tag.type(), static_cast<uint32_t>(timestamp), body, 2);
+      if (status == FBCAPTURE_OK)
+        lastTimestamp_ = max(lastTimestamp_, timestamp);
+      return status;
+    }
+
+    FBCAPTURE_STATUS RtmpSink::close() {
+      disconnect();
+      clearGop();
+      return FBCAPTURE_OK;
+    }
+  }
+}
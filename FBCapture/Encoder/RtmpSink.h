@@ -0,0 +1,84 @@
+/****************************************************************************************************************
+
+Filename	:	RtmpSink.h
+Content		:	Publishes FLV tags to an RTMP server
+Copyright	:
+
+****************************************************************************************************************/
+
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "FlvSink.h"
+#include "LibRTMP.h"
+#include "RtmpPublisher.h"
+
+using namespace std;
+
+namespace FBCapture {
+  namespace Streaming {
+
+    /*
+    * Plain rtmp:// URLs are published with RtmpPublisher. librtmp handles the tunneled, encrypted and TLS variants.
+    *
+    * The packets since the last keyframe are kept referenced. When the connection drops, the sink reconnects
+    * with a growing delay between attempts, keeping the latest GOP meanwhile, and resumes from its keyframe
+    * after sending the sequence headers again. Timestamps after a reconnect are shifted to carry on right after
+    * the last message sent, so a network blip costs at most a GOP instead of the session.
+    */
+    class RtmpSink : public FlvSink {
+    public:
+      static const uint32_t kMaxReconnectAttempts = 10;
+      static const uint32_t kReconnectDelayMs = 500;      // doubled after every failed attempt
+      static const uint32_t kMaxReconnectDelayMs = 8000;
+      static const uint32_t kMaxGopPackets = 1024;         // ~8 sec of 60 fps video with audio
+      static const uint64_t kMaxGopBytes = 64 * 1024 * 1024;
+
+      explicit RtmpSink(const string& streamUrl);
+      ~RtmpSink();
+
+      FBCAPTURE_STATUS open() override;
+      FBCAPTURE_STATUS write(EncodePacket* packet) override;
+      FBCAPTURE_STATUS close() override;
+
+      const char* name() const override {
+        return "RTMP sink";
+      }
+
+    protected:
+      FBCAPTURE_STATUS writeTag(const FlvTag& tag) override;
+
+    private:
+      using Clock = chrono::steady_clock;
+
+      string streamUrl_;
+      RtmpPublisher* publisher_;
+      LibRTMP* rtmp_;
+
+      vector<EncodePacket*> gop_;   // referenced, the last keyframe and every packet after it
+      uint64_t gopBytes_;
+      bool gopOverflow_;            // too long to keep, nothing is buffered until the next keyframe
+
+      bool connected_;
+      bool waitForKeyframe_;        // resumed without a buffered GOP, video has to start at a keyframe
+      uint32_t reconnectAttempts_;
+      Clock::time_point nextReconnect_;
+      int64_t timestampOffset_;     // in millisec, added to every tag sent since the first reconnect
+      int64_t lastTimestamp_;       // of the last tag sent, with the offset
+
+      FBCAPTURE_STATUS connect();
+      void disconnect();
+      FBCAPTURE_STATUS reconnect();
+      FBCAPTURE_STATUS resume();
+      FBCAPTURE_STATUS send(EncodePacket* packet);
+
+      void bufferPacket(EncodePacket* packet);
+      void clearGop();
+
+      static bool isConnectionError(FBCAPTURE_STATUS status);
+    };
+  }
+}
@@ -0,0 +1,221 @@
+/****************************************************************************************************************
+
+Filename	:	RtpPacketizer.cpp
+Content		:
+Copyright	:
+
+****************************************************************************************************************/
+
+#include "RtpPacketizer.h"
+
+#include <random>
+
+#define RTP_H264_STAP_A 24
+#define RTP_H264_FU_A 28
+#define RTP_HEVC_AP 48
+#define RTP_HEVC_FU 49
+#define RTP_AAC_MAX_AU_SIZE 0x1fff  // 13 bit AU-size
+
+namespace FBCapture {
+  namespace Streaming {
+
+    namespace {
+      inline uint8_t* writeU16(uint8_t* p, const uint32_t value) {
+        p[0] = static_cast<uint8_t>(value >> 8);
+        p[1] = static_cast<uint8_t>(value);
+        return p + 2;
+      }
+
+      inline uint8_t* writeU32(uint8_t* p, const uint32_t value) {
+        p[0] = static_cast<uint8_t>(value >> 24);
+        p[1] = static_cast<uint8_t>(value >> 16);
+        p[2] = static_cast<uint8_t>(value >> 8);
+        p[3] = static_cast<uint8_t>(value);
+        return p + 4;
+      }
+    }
+
+    RtpPacketizer::RtpPacketizer(const uint8_t payloadType,
+                                 const uint32_t ssrc,
+                                 const uint32_t clockRate,
+                                 const uint32_t maxPayloadSize) :
+      payloadType_(payloadType),
+      ssrc_(ssrc),
+      clockRate_(clockRate),
+      maxPayloadSize_(maxPayloadSize),
+      packetsSent_(0),
+      octetsSent_(0),
+      headersUsed_(0) {
+      random_device random;
+      sequenceNumber_ = static_cast<uint16_t>(random());
+      timestampBase_ = random();
+    }
+
+    uint32_t RtpPacketizer::toRtpTimestamp(const uint64_t timestamp) const {
+      // the RTP timestamp wraps around, which receivers expect
+      return timestampBase_ + static_cast<uint32_t>(timestamp * clockRate_ / 10000000);
+    }
+
+    void RtpPacketizer::clear(const uint32_t maxPackets, const uint32_t maxAggregatedUnits) {
+      const auto headersSize = maxPackets * kMaxHeaderSize + maxAggregatedUnits * 2;
+      if (headers_.size() < headersSize)
+        headers_.resize(headersSize);
+      headersUsed_ = 0;
+      iovs_.clear();
+      ioVecCounts_.clear();
+    }
+
+    uint8_t* RtpPacketizer::allocHeader(const uint32_t size) {
+      const auto header = headers_.data() + headersUsed_;
+      headersUsed_ += size;
+      iovs_.push_back({ header, size });
+      ioVecCounts_.back()++;
+      return header;
+    }
+
+    uint8_t* RtpPacketizer::beginPacket(const uint32_t rtpTimestamp, const bool marker, const uint32_t payloadHeaderSize) {
+      ioVecCounts_.push_back(0);
+      auto p = allocHeader(RTP_HEADER_SIZE + payloadHeaderSize);
+      *p++ = RTP_VERSION << 6;  // no padding, extension or CSRCs
+      *p++ = static_cast<uint8_t>((marker ? 0x80 : 0) | payloadType_);
+      p = writeU16(p, sequenceNumber_++);
+      p = writeU32(p, rtpTimestamp);
+      p = writeU32(p, ssrc_);
+      packetsSent_++;
+      octetsSent_ += payloadHeaderSize;
+      return p;
+    }
+
+    void RtpPacketizer::addPayload(const uint8_t* data, const uint32_t length) {
+      iovs_.push_back({ data, length });
+      ioVecCounts_.back()++;
+      octetsSent_ += length;
+    }
+
+    void RtpPacketizer::packetizeVideo(const VideoEncodePacket* packet) {
+      const auto isHevc = packet->codec == VIDEO_CODEC::HEVC;
+      const uint32_t fuHeaderSize = isHevc ? 3 : 2;
+
+      // access unit delimiters carry nothing the RTP timestamp and marker bit don't already say
+      nals_.clear();
+      const uint32_t audType = isHevc ? static_cast<uint32_t>(HEVC_NAL_AUD) : static_cast<uint32_t>(NAL_AUD);
+      uint32_t maxPackets = 0;
+      for (const auto& nal : packet->nals) {
+        if (nal.type == audType || nal.length == 0)
+          continue;
+        nals_.push_back(nal);
+        maxPackets += 1 + nal.length / (maxPayloadSize_ - fuHeaderSize);
+      }
+      clear(maxPackets, static_cast<uint32_t>(nals_.size()));
+
+      const auto rtpTimestamp = toRtpTimestamp(packet->timestamp);
+      const uint32_t aggregationHeaderSize = isHevc ? 2 : 1;
+      for (size_t i = 0; i < nals_.size();) {
+        if (nals_[i].length > maxPayloadSize_) {
+          fragment(packet, nals_[i], rtpTimestamp, i + 1 == nals_.size());
+          i++;
+          continue;
+        }
+
+        // take the following NAL units along as long as they fit
+        auto last = i;
+        auto size = aggregationHeaderSize + 2 + nals_[i].length;
+        while (last + 1 < nals_.size() && size + 2 + nals_[last + 1].length <= maxPayloadSize_) {
+          last++;
+          size += 2 + nals_[last].length;
+        }
+
+        const auto marker = last + 1 == nals_.size();
+        if (last == i) {
+          // single NAL unit packet
+          beginPacket(rtpTimestamp, marker, 0);
+          addPayload(packet->buffer + nals_[i].offset, nals_[i].length);
+        } else
+          aggregate(packet, i, last, rtpTimestamp, marker);
+        i = last + 1;
+      }
+    }
+
+    void RtpPacketizer::aggregate(const VideoEncodePacket* packet,
+                                  const size_t first,
+                                  const size_t last,
+                                  const uint32_t rtpTimestamp,
+                                  const bool marker) {
+      const auto isHevc = packet->codec == VIDEO_CODEC::HEVC;
+      if (isHevc) {
+        // AP payload header: F 0, type 48, the lowest LayerId and TID of the aggregated NAL units
+        uint8_t layerIdHigh = 1, layerIdLowTid = 0xff;
+        for (auto i = first; i <= last; i++) {
+          const auto nal = packet->buffer + nals_[i].offset;
+          layerIdHigh &= nal[0] & 1;
+          if (nal[1] < layerIdLowTid)
+            layerIdLowTid = nal[1];
+        }
+        auto p = beginPacket(rtpTimestamp, marker, 2);
+        p[0] = static_cast<uint8_t>(RTP_HEVC_AP << 1 | layerIdHigh);
+        p[1] = layerIdLowTid;
+      } else {
+        // STAP-A NAL header: F and NRI are the highest of the aggregated NAL units
+        uint8_t forbidden = 0, nri = 0;
+        for (auto i = first; i <= last; i++) {
+          const auto header = packet->buffer[nals_[i].offset];
+          forbidden |= header & 0x80;
+          if ((header & 0x60) > nri)
+            nri = header & 0x60;
+        }
+        auto p = beginPacket(rtpTimestamp, marker, 1);
+        p[0] = static_cast<uint8_t>(forbidden | nri | RTP_H264_STAP_A);
+      }
+
+      for (auto i = first; i <= last; i++) {
+        writeU16(allocHeader(2), nals_[i].length);
+        addPayload(packet->buffer + nals_[i].offset, nals_[i].length);
+      }
+    }
+
+    void RtpPacketizer::fragment(const VideoEncodePacket* packet,
+                                 const NalUnit& nal,
+                                 const uint32_t rtpTimestamp,
+                                 const bool marker) {
+      const auto isHevc = packet->codec == VIDEO_CODEC::HEVC;
+      const auto header = packet->buffer + nal.offset;
+      const uint32_t nalHeaderSize = isHevc ? 2 : 1;
+      const uint32_t fuHeaderSize = nalHeaderSize + 1;
+      const auto fragmentSize = maxPayloadSize_ - fuHeaderSize;
+
+      // the NAL header itself isn't sent, the FU headers carry its fields
+      auto data = header + nalHeaderSize;
+      auto left = nal.length - nalHeaderSize;
+      auto start = true;
+      while (left > 0) {
+        const auto size = left < fragmentSize ? left : fragmentSize;
+        const auto end = size == left;
+        auto p = beginPacket(rtpTimestamp, marker && end, fuHeaderSize);
+        if (isHevc) {
+          p[0] = static_cast<uint8_t>((header[0] & 0x81) | RTP_HEVC_FU << 1);
+          p[1] = header[1];
+          p[2] = static_cast<uint8_t>((start ? 0x80 : 0) | (end ? 0x40 : 0) | nal.type);
+        } else {
+          p[0] = static_cast<uint8_t>((header[0] & 0xe0) | RTP_H264_FU_A);
+          p[1] = static_cast<uint8_t>((start ? 0x80 : 0) | (end ? 0x40 : 0) | nal.type);
+        }
+        addPayload(data, size);
+        data += size;
+        left -= size;
+        start = false;
+      }
+    }
+
+    bool RtpPacketizer::packetizeAudio(const AudioEncodePacket* packet) {
+      if (packet->length == 0 || packet->length > RTP_AAC_MAX_AU_SIZE)
+        return false;
+
+      clear(1, 0);
+      auto p = beginPacket(toRtpTimestamp(packet->timestamp), true, 4);
+      p = writeU16(p, 16);                        // AU-headers-length in bits, one AU header
+      writeU16(p, packet->length << 3);           // AU-size (13 bits), AU-Index 0 (3 bits)
+      addPayload(packet->buffer, packet->length);
+      return true;
+    }
+  }
+}
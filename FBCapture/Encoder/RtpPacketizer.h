@@ -0,0 +1,99 @@
+/****************************************************************************************************************
+
+Filename	:	RtpPacketizer.h
+Content		:	Splits encoded packets into RTP packets, RFC 6184 for H.264, RFC 7798 for HEVC and RFC 3640 for AAC
+Copyright	:
+
+****************************************************************************************************************/
+
+#pragma once
+
+#include <vector>
+#include <stdint.h>
+
+#include "EncodePacket.h"
+#include "IoVec.h"
+
+using namespace std;
+
+#define RTP_HEADER_SIZE 12
+#define RTP_VERSION 2
+
+namespace FBCapture {
+  namespace Streaming {
+
+    /*
+    * Packetizes one RTP stream. The packets reference the encoded packet's buffer, only the RTP headers and
+    * the few bytes of aggregation and fragmentation headers are written into the packetizer's own storage,
+    * so they are valid until the next packetize call and as long as the encoded packet.
+    *
+    * Video NAL units that fit in a packet on their own are aggregated into STAP-A (HEVC: AP) packets
+    * with the NAL units next to them, bigger ones are fragmented into FU-A (HEVC: FU) packets.
+    * The marker bit is set on the last packet of a frame. Audio goes one AAC frame per packet behind an
+    * AU-headers-length and a 13 bit size, 3 bit index AU header, mode AAC-hbr.
+    */
+    class RtpPacketizer {
+    public:
+      static const uint32_t kMaxHeaderSize = RTP_HEADER_SIZE + 4;  // RTP header plus the biggest payload header
+
+      RtpPacketizer(uint8_t payloadType, uint32_t ssrc, uint32_t clockRate, uint32_t maxPayloadSize);
+
+      void packetizeVideo(const VideoEncodePacket* packet);
+      // False if the frame is too big for the 13 bit AU size
+      bool packetizeAudio(const AudioEncodePacket* packet);
+
+      // The packets of the last packetize call. Packet i is gathered from the next ioVecCounts()[i] IoVecs.
+      const IoVec* ioVecs() const {
+        return iovs_.data();
+      }
+
+      const uint32_t* ioVecCounts() const {
+        return ioVecCounts_.data();
+      }
+
+      uint32_t packetCount() const {
+        return static_cast<uint32_t>(ioVecCounts_.size());
+      }
+
+      uint32_t ssrc() const {
+        return ssrc_;
+      }
+
+      // In clock rate units, from a packet timestamp in 100 nanosec unit
+      uint32_t toRtpTimestamp(uint64_t timestamp) const;
+
+      // Totals for RTCP sender reports
+      uint32_t packetsSent() const {
+        return packetsSent_;
+      }
+
+      uint32_t octetsSent() const {
+        return octetsSent_;
+      }
+
+    private:
+      uint8_t payloadType_;
+      uint32_t ssrc_;
+      uint32_t clockRate_;
+      uint32_t maxPayloadSize_;
+      uint16_t sequenceNumber_;
+      uint32_t timestampBase_;  // random like the first sequence number, see RFC 3550 5.1
+      uint32_t packetsSent_;
+      uint32_t octetsSent_;     // payload only, as RTCP counts it
+
+      vector<uint8_t> headers_;  // sized before each call so the IoVecs pointing into it stay valid
+      uint32_t headersUsed_;
+      vector<IoVec> iovs_;
+      vector<uint32_t> ioVecCounts_;
+      vector<NalUnit> nals_;     // the NAL units of the frame that are sent
+
+      void clear(uint32_t maxPackets, uint32_t maxAggregatedUnits);
+      uint8_t* allocHeader(uint32_t size);
+      uint8_t* beginPacket(uint32_t rtpTimestamp, bool marker, uint32_t payloadHeaderSize);
+      void addPayload(const uint8_t* data, uint32_t length);
+
+      void aggregate(const VideoEncodePacket* packet, size_t first, size_t last, uint32_t rtpTimestamp, bool marker);
+      void fragment(const VideoEncodePacket* packet, const NalUnit& nal, uint32_t rtpTimestamp, bool marker);
+    };
+  }
+}
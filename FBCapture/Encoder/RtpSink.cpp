@@ -0,0 +1,296 @@
+/****************************************************************************************************************
+
+Filename	:	RtpSink.cpp
+Content		:
+Copyright	:
+
+****************************************************************************************************************/
+
+#include "RtpSink.h"
+#include "FileUtil.h"
+#include "Log.h"
+
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define RTCP_SENDER_REPORT 200
+#define RTCP_SENDER_REPORT_SIZE 28
+#define NTP_UNIX_EPOCH_OFFSET 2208988800ULL  // seconds from 1900 to 1970
+
+namespace FBCapture {
+  namespace Streaming {
+
+    namespace {
+      string toBase64(const uint8_t* data, const uint32_t length) {
+        static const char kAlphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+        string encoded;
+        encoded.reserve((length + 2) / 3 * 4);
+        for (uint32_t i = 0; i < length; i += 3) {
+          const uint32_t left = length - i;
+          const uint32_t bits = data[i] << 16 | (left > 1 ? data[i + 1] << 8 : 0) | (left > 2 ? data[i + 2] : 0);
+          encoded += kAlphabet[bits >> 18 & 0x3f];
+          encoded += kAlphabet[bits >> 12 & 0x3f];
+          encoded += left > 1 ? kAlphabet[bits >> 6 & 0x3f] : '=';
+          encoded += left > 2 ? kAlphabet[bits & 0x3f] : '=';
+        }
+        return encoded;
+      }
+
+      // 100 nanosec units to NTP's 32.32 fixed point seconds
+      uint64_t toNtp(const uint64_t time) {
+        const auto seconds = time / 10000000;
+        const auto fraction = ((time % 10000000) << 32) / 10000000;
+        return seconds << 32 | fraction;
+      }
+
+      void destroyStream(RtpPacketizer** packetizer, UdpSocket* rtp, UdpSocket* rtcp) {
+        if (*packetizer)
+          delete *packetizer;
+        *packetizer = NULL;
+        rtp->close();
+        rtcp->close();
+      }
+    }
+
+    RtpSink::RtpSink(const string& streamUrl, const string* sdpPath) :
+      streamUrl_(streamUrl),
+      sdpPath_(sdpPath),
+      port_(kDefaultPort),
+      ntpBase_(0),
+      sdpSeqParams_(NULL),
+      sdpCodec_(VIDEO_CODEC::H264),
+      sdpAudioConfig_(0),
+      sdpSampleRate_(0),
+      sdpChannels_(0) {}
+
+    RtpSink::~RtpSink() {
+      close();
+    }
+
+    bool RtpSink::parseUrl(const string& url, string* host, uint16_t* port) {
+      const string scheme = "rtp://";
+      if (url.size() <= scheme.size())
+        return false;
+      for (size_t i = 0; i < scheme.size(); i++) {
+        if (tolower(static_cast<unsigned char>(url[i])) != scheme[i])
+          return false;
+      }
+
+      auto address = url.substr(scheme.size());
+      address = address.substr(0, address.find_first_of("/?"));
+      *port = kDefaultPort;
+      const auto portStart = address.rfind(':');
+      if (portStart != string::npos && address.find(']', portStart) == string::npos) {
+        const auto value = strtoul(address.c_str() + portStart + 1, NULL, 10);
+        // the audio RTCP port is 3 above
+        if (value == 0 || value > 0xffff - 3)
+          return false;
+        *port = static_cast<uint16_t>(value);
+        address.resize(portStart);
+      }
+      // [::1] style IPv6 literals
+      if (address.size() >= 2 && address.front() == '[' && address.back() == ']')
+        address = address.substr(1, address.size() - 2);
+      if (address.empty())
+        return false;
+      *host = address;
+      return true;
+    }
+
+    FBCAPTURE_STATUS RtpSink::open() {
+      close();
+
+      if (!parseUrl(streamUrl_, &host_, &port_)) {
+        DEBUG_ERROR_VAR("Failed to parse RTP stream url", streamUrl_);
+        return FBCAPTURE_RTP_INVALID_STREAM_URL;
+      }
+
+      if (!video_.rtp.connect(host_, port_) || !video_.rtcp.connect(host_, port_ + 1) ||
+          !audio_.rtp.connect(host_, port_ + 2) || !audio_.rtcp.connect(host_, port_ + 3)) {
+        DEBUG_ERROR_VAR("Failed to open RTP sockets to", host_);
+        close();
+        return FBCAPTURE_RTP_CONNECTION_FAILED;
+      }
+      video_.rtp.setSendBufferSize(kSendBufferSize);
+
+      random_device random;
+      video_.packetizer = new RtpPacketizer(kVideoPayloadType, random(), kVideoClockRate, kMaxPayloadSize);
+      video_.reported = false;
+      audio_.reported = false;
+
+      // sender reports tie media timestamps to this wall clock, the same for both streams so receivers can sync them
+      const auto sinceEpoch = chrono::duration_cast<chrono::microseconds>(chrono::system_clock::now().time_since_epoch());
+      ntpBase_ = (static_cast<uint64_t>(sinceEpoch.count()) + NTP_UNIX_EPOCH_OFFSET * 1000000) * 10;
+
+      DEBUG_LOG_VAR("Sending RTP to", host_ + ":" + to_string(port_));
+      return FBCAPTURE_OK;
+    }
+
+    FBCAPTURE_STATUS RtpSink::write(EncodePacket* packet) {
+      if (packet->type() == PACKET_TYPE::VIDEO) {
+        const auto videoPacket = static_cast<VideoEncodePacket*>(packet);
+        const auto status = updateSdp(videoPacket);
+        if (status != FBCAPTURE_OK)
+          return status;
+        video_.packetizer->packetizeVideo(videoPacket);
+        return send(&video_, packet->timestamp);
+      }
+
+      if (packet->type() == PACKET_TYPE::AUDIO) {
+        const auto audioPacket = static_cast<AudioEncodePacket*>(packet);
+        const auto status = updateSdp(audioPacket);
+        if (status != FBCAPTURE_OK)
+          return status;
+        if (!audio_.packetizer->packetizeAudio(audioPacket)) {
+          DEBUG_ERROR_VAR("AAC frame too big for an RTP AU header", to_string(packet->length));
+          return FBCAPTURE_OK;
+        }
+        return send(&audio_, packet->timestamp);
+      }
+
+      return FBCAPTURE_UNKNOWN_ENCODE_PACKET_TYPE;
+    }
+
+    FBCAPTURE_STATUS RtpSink::send(Stream* stream, const uint64_t timestamp) {
+      const auto packetizer = stream->packetizer;
+      const auto count = packetizer->packetCount();
+      const auto sent = stream->rtp.sendBatch(packetizer->ioVecs(), packetizer->ioVecCounts(), count);
+      if (sent == 0 && count > 0) {
+        DEBUG_ERROR_VAR("Failed sending RTP packets to", host_);
+        return FBCAPTURE_RTP_SEND_PACKET_FAILED;
+      }
+
+      if (!stream->reported || timestamp >= stream->lastReport + kSenderReportInterval) {
+        sendSenderReport(stream, timestamp);
+        stream->lastReport = timestamp;
+        stream->reported = true;
+      }
+      return FBCAPTURE_OK;
+    }
+
+    void RtpSink::sendSenderReport(Stream* stream, const uint64_t timestamp) {
+      const auto packetizer = stream->packetizer;
+      const auto ntp = toNtp(ntpBase_ + timestamp);
+      const uint32_t words[] = {
+        static_cast<uint32_t>(RTP_VERSION) << 30 | RTCP_SENDER_REPORT << 16 | (RTCP_SENDER_REPORT_SIZE / 4 - 1),
+        packetizer->ssrc(),
+        static_cast<uint32_t>(ntp >> 32),
+        static_cast<uint32_t>(ntp),
+        packetizer->toRtpTimestamp(timestamp),
+        packetizer->packetsSent(),
+        packetizer->octetsSent(),
+      };
+
+      uint8_t report[RTCP_SENDER_REPORT_SIZE];
+      for (uint32_t i = 0; i < RTCP_SENDER_REPORT_SIZE / 4; i++) {
+        report[i * 4] = static_cast<uint8_t>(words[i] >> 24);
+        report[i * 4 + 1] = static_cast<uint8_t>(words[i] >> 16);
+        report[i * 4 + 2] = static_cast<uint8_t>(words[i] >> 8);
+        report[i * 4 + 3] = static_cast<uint8_t>(words[i]);
+      }
+
+      const IoVec iov = { report, sizeof(report) };
+      const uint32_t count = 1;
+      stream->rtcp.sendBatch(&iov, &count, 1);
+    }
+
+    FBCAPTURE_STATUS RtpSink::updateSdp(const VideoEncodePacket* packet) {
+      const auto seqParams = packet->seqParams;
+      if (!seqParams || seqParams == sdpSeqParams_)
+        return FBCAPTURE_OK;
+
+      const auto changed = !sdpSeqParams_ || sdpCodec_ != packet->codec || !sdpSeqParams_->matches(*seqParams);
+      if (sdpSeqParams_)
+        sdpSeqParams_->release();
+      sdpSeqParams_ = seqParams->addRef();
+      sdpCodec_ = packet->codec;
+      return changed ? writeSdp() : FBCAPTURE_OK;
+    }
+
+    FBCAPTURE_STATUS RtpSink::updateSdp(const AudioEncodePacket* packet) {
+      // AudioSpecificConfig: audioObjectType (5 bits), samplingFrequencyIndex (4 bits), channelConfiguration (4 bits)
+      const auto config = packet->profileLevel << 11 | packet->sampleRateIndex() << 7 | (packet->numChannels & 0xf) << 3;
+      if (audio_.packetizer && config == sdpAudioConfig_ && packet->sampleRate == sdpSampleRate_)
+        return FBCAPTURE_OK;
+
+      // the RTP clock of AAC is its sample rate
+      if (!audio_.packetizer || packet->sampleRate != sdpSampleRate_) {
+        if (audio_.packetizer)
+          delete audio_.packetizer;
+        random_device random;
+        audio_.packetizer = new RtpPacketizer(kAudioPayloadType, random(), packet->sampleRate, kMaxPayloadSize);
+        audio_.reported = false;
+      }
+
+      sdpAudioConfig_ = config;
+      sdpSampleRate_ = packet->sampleRate;
+      sdpChannels_ = packet->numChannels;
+      return writeSdp();
+    }
+
+    FBCAPTURE_STATUS RtpSink::writeSdp() const {
+      if (!sdpPath_)
+        return FBCAPTURE_OK;
+
+      const auto ipVersion = host_.find(':') != string::npos ? "IP6" : "IP4";
+      string sdp;
+      sdp += "v=0\r\n";
+      sdp += string("o=- 0 0 IN ") + ipVersion + " " + host_ + "\r\n";
+      sdp += "s=FBCapture\r\n";
+      sdp += string("c=IN ") + ipVersion + " " + host_ + "\r\n";
+      sdp += "t=0 0\r\n";
+
+      const auto videoPt = to_string(kVideoPayloadType);
+      sdp += "m=video " + to_string(port_) + " RTP/AVP " + videoPt + "\r\n";
+      if (sdpCodec_ == VIDEO_CODEC::HEVC) {
+        sdp += "a=rtpmap:" + videoPt + " H265/" + to_string(kVideoClockRate) + "\r\n";
+        if (sdpSeqParams_) {
+          sdp += "a=fmtp:" + videoPt +
+            " sprop-vps=" + toBase64(sdpSeqParams_->vps, sdpSeqParams_->vpsLen) +
+            ";sprop-sps=" + toBase64(sdpSeqParams_->sps, sdpSeqParams_->spsLen) +
+            ";sprop-pps=" + toBase64(sdpSeqParams_->pps, sdpSeqParams_->ppsLen) + "\r\n";
+        }
+      } else {
+        sdp += "a=rtpmap:" + videoPt + " H264/" + to_string(kVideoClockRate) + "\r\n";
+        if (sdpSeqParams_ && sdpSeqParams_->spsLen >= 4) {
+          char profileLevelId[7];
+          snprintf(profileLevelId, sizeof(profileLevelId), "%02x%02x%02x",
+                   sdpSeqParams_->sps[1], sdpSeqParams_->sps[2], sdpSeqParams_->sps[3]);
+          sdp += "a=fmtp:" + videoPt + " packetization-mode=1;profile-level-id=" + profileLevelId +
+            ";sprop-parameter-sets=" + toBase64(sdpSeqParams_->sps, sdpSeqParams_->spsLen) +
+            "," + toBase64(sdpSeqParams_->pps, sdpSeqParams_->ppsLen) + "\r\n";
+        } else
+          sdp += "a=fmtp:" + videoPt + " packetization-mode=1\r\n";
+      }
+
+      if (sdpAudioConfig_) {
+        const auto audioPt = to_string(kAudioPayloadType);
+        char config[5];
+        snprintf(config, sizeof(config), "%04x", sdpAudioConfig_);
+        sdp += "m=audio " + to_string(port_ + 2) + " RTP/AVP " + audioPt + "\r\n";
+        sdp += "a=rtpmap:" + audioPt + " MPEG4-GENERIC/" + to_string(sdpSampleRate_) + "/" + to_string(sdpChannels_) + "\r\n";
+        sdp += "a=fmtp:" + audioPt + " streamtype=5;profile-level-id=1;mode=AAC-hbr;"
+          "sizelength=13;indexlength=3;indexdeltalength=3;config=" + config + "\r\n";
+      }
+
+      FILE* file = NULL;
+      OPEN_FILE(file, (*sdpPath_));
+      fwrite(sdp.data(), 1, sdp.size(), file);
+      CLOSE_FILE(file);
+      return FBCAPTURE_OK;
+    }
+
+    FBCAPTURE_STATUS RtpSink::close() {
+      destroyStream(&video_.packetizer, &video_.rtp, &video_.rtcp);
+      destroyStream(&audio_.packetizer, &audio_.rtp, &audio_.rtcp);
+      if (sdpSeqParams_)
+        sdpSeqParams_->release();
+      sdpSeqParams_ = NULL;
+      sdpAudioConfig_ = 0;
+      sdpSampleRate_ = 0;
+      sdpChannels_ = 0;
+      return FBCAPTURE_OK;
+    }
+  }
+}
@@ -0,0 +1,89 @@
+/****************************************************************************************************************
+
+Filename	:	RtpSink.h
+Content		:	Sends encoded packets as RTP over UDP for low latency previews on the local network
+Copyright	:
+
+****************************************************************************************************************/
+
+#pragma once
+
+#include <chrono>
+#include <string>
+
+#include "PacketSink.h"
+#include "RtpPacketizer.h"
+#include "UdpSocket.h"
+
+using namespace std;
+
+namespace FBCapture {
+  namespace Streaming {
+
+    /*
+    * Sends rtp://host:port destinations, video to port and AAC audio to port + 2, with RTCP sender reports
+    * on the port above each. Every frame goes out in as few sendmmsg calls as its packets take, on the
+    * sink's worker thread. Nothing is retransmitted or buffered: a lost packet is lost, which is what keeps
+    * the latency down to the network's.
+    *
+    * Receivers need the SDP written to sdpPath, e.g. ffplay -protocol_whitelist file,udp,rtp <sdpPath>.
+    * It is rewritten whenever the video parameter sets or the audio format change.
+    */
+    class RtpSink : public PacketSink {
+    public:
+      static const uint16_t kDefaultPort = 5004;
+      static const uint8_t kVideoPayloadType = 96;
+      static const uint8_t kAudioPayloadType = 97;
+      static const uint32_t kVideoClockRate = 90000;
+      static const uint32_t kMaxPayloadSize = 1200;         // leaves room for IP, UDP and tunnel headers in a 1500 byte MTU
+      static const int kSendBufferSize = 4 * 1024 * 1024;   // a 4K keyframe goes out in one burst
+      static const uint64_t kSenderReportInterval = 10000000; // in 100 nanosec unit
+
+      RtpSink(const string& streamUrl, const string* sdpPath);
+      ~RtpSink();
+
+      FBCAPTURE_STATUS open() override;
+      FBCAPTURE_STATUS write(EncodePacket* packet) override;
+      FBCAPTURE_STATUS close() override;
+
+      const char* name() const override {
+        return "RTP sink";
+      }
+
+      static bool parseUrl(const string& url, string* host, uint16_t* port);
+
+    private:
+      // One RTP stream and its RTCP port
+      struct Stream {
+        UdpSocket rtp;
+        UdpSocket rtcp;
+        RtpPacketizer* packetizer;  // made once the stream's clock rate is known
+        uint64_t lastReport;        // media timestamp of the last sender report
+        bool reported;
+
+        Stream() : packetizer(NULL), lastReport(0), reported(false) {}
+      };
+
+      string streamUrl_;
+      const string* sdpPath_;
+      string host_;
+      uint16_t port_;
+
+      Stream video_;
+      Stream audio_;
+      uint64_t ntpBase_;           // wall clock at open() in NTP format, what media timestamp 0 maps to
+
+      SequenceParams* sdpSeqParams_;  // referenced, the parameter sets in the SDP
+      VIDEO_CODEC sdpCodec_;
+      uint32_t sdpAudioConfig_;       // AudioSpecificConfig in the SDP, 0 before the first audio packet
+      uint32_t sdpSampleRate_;
+      uint32_t sdpChannels_;
+
+      FBCAPTURE_STATUS send(Stream* stream, uint64_t timestamp);
+      void sendSenderReport(Stream* stream, uint64_t timestamp);
+      FBCAPTURE_STATUS updateSdp(const VideoEncodePacket* packet);
+      FBCAPTURE_STATUS updateSdp(const AudioEncodePacket* packet);
+      FBCAPTURE_STATUS writeSdp() const;
+    };
+  }
+}
@@ -0,0 +1,246 @@
+/****************************************************************************************************************
+
+Filename	:	SinkWorker.cpp
+Content		:
+Copyright	:
+
+****************************************************************************************************************/
+
+#include "SinkWorker.h"
+#include "Log.h"
+
+namespace FBCapture {
+  namespace Streaming {
+
+    SinkWorker::SinkWorker(PacketSink* sink, const uint32_t queueCapacity, const SINK_OVERFLOW_POLICY policy) :
+      sink_(sink),
+      policy_(policy),
+      thread_(NULL),
+      stopRequested_(false),
+      flushRequested_(false),
+      status_(FBCAPTURE_OK),
+      dropped_(0),
+      pending_(0),
+      pendingBytes_(0),
+      writtenBytes_(0),
+      newestTimestamp_(0),
+      writingTimestamp_(kIdleTimestamp),
+      waitForKeyframe_(false),
+      detached_(false) {
+      queue_.initialize(queueCapacity);
+    }
+
+    SinkWorker::~SinkWorker() {
+      stop(false);
+      if (sink_)
+        delete sink_;
+      sink_ = nullptr;
+    }
+
+    FBCAPTURE_STATUS SinkWorker::start() {
+      if (thread_)
+        return FBCAPTURE_OK;
+
+      stopRequested_ = false;
+      flushRequested_ = false;
+      status_ = FBCAPTURE_OK;
+      dropped_ = 0;
+      pending_ = 0;
+      pendingBytes_ = 0;
+      writtenBytes_ = 0;
+      newestTimestamp_ = 0;
+      writingTimestamp_ = kIdleTimestamp;
+      waitForKeyframe_ = false;
+      detached_ = false;
+
+      const auto status = sink_->open();
+      if (status != FBCAPTURE_OK) {
+        DEBUG_ERROR_VAR("Failed opening packet sink", sink_->name());
+        return status;
+      }
+
+      thread_ = new thread([this] { this->run(); });
+      return FBCAPTURE_OK;
+    }
+
+    FBCAPTURE_STATUS SinkWorker::submit(EncodePacket* packet) {
+      const FBCAPTURE_STATUS status = status_;
+      if (status != FBCAPTURE_OK)
+        return status;
+      if (!thread_)
+        return FBCAPTURE_THREAD_NOT_INITIALIZED;
+
+      if (shouldDrop(packet)) {
+        dropped_++;
+        return FBCAPTURE_OK;
+      }
+
+      // counted before the push so the consumer can't see the packet before it is accounted for
+      pending_++;
+      pendingBytes_ += packet->length;
+      packet->addRef();
+      while (!queue_.push(packet)) {
+        if (policy_ == SINK_OVERFLOW_POLICY::DROP || stopRequested_.load()) {
+          pending_--;
+          pendingBytes_ -= packet->length;
+          packet->release();
+          dropped_++;
+          if (packet->type() == PACKET_TYPE::VIDEO)
+            waitForKeyframe_ = true;
+          return FBCAPTURE_OK;
+        }
+        unique_lock<mutex> lock(mtx_);
+        spaceCv_.wait_for(lock, chrono::milliseconds(kIdleWaitMs));
+      }
+
+      newestTimestamp_ = packet->timestamp;
+      notify(cv_);
+      return FBCAPTURE_OK;
+    }
+
+    bool SinkWorker::shouldDrop(EncodePacket* packet) {
+      if (packet->type() != PACKET_TYPE::VIDEO)
+        return false;
+
+      const auto videoPacket = static_cast<VideoEncodePacket*>(packet);
+      if (videoPacket->isKeyframe) {
+        waitForKeyframe_ = false;
+        return false;
+      }
+      if (waitForKeyframe_)
+        return true;
+      if (policy_ != SINK_OVERFLOW_POLICY::DROP)
+        return false;
+
+      const auto backlog = backlogMs();
+      if (backlog >= kDropToKeyframeMs) {
+        DEBUG_LOG_VAR(string(sink_->name()) + " is congested, dropping video until the next keyframe. Backlog ms", to_string(backlog));
+        waitForKeyframe_ = true;
+        return true;
+      }
+      return backlog >= kDropDisposableMs && !videoPacket->isReference();
+    }
+
+    uint32_t SinkWorker::backlogMs() const {
+      if (pending_.load() == 0)
+        return 0;
+      const uint64_t newest = newestTimestamp_;
+      const uint64_t writing = writingTimestamp_;
+      // an idle worker has no backlog, timestamps are in 100 nanosecond units
+      return writing != kIdleTimestamp && newest > writing ? static_cast<uint32_t>((newest - writing) / 10000) : 0;
+    }
+
+    void SinkWorker::notify(condition_variable& cv) {
+      // Taking the lock orders the notification after a waiter's predicate check
+      { lock_guard<mutex> lock(mtx_); }
+      cv.notify_one();
+    }
+
+    void SinkWorker::stop(const bool flush) {
+      if (flush)
+        flushRequested_ = true;
+      else
+        stopRequested_ = true;
+      notify(cv_);
+      spaceCv_.notify_all();
+
+      if (thread_) {
+        if (thread_->joinable())
+          thread_->join();
+        delete thread_;
+        thread_ = nullptr;
+
+        const auto status = sink_->close();
+        if (status != FBCAPTURE_OK)
+          DEBUG_ERROR_VAR("Failed closing packet sink", sink_->name());
+      }
+
+      // Anything left behind was dropped by a non-flushing stop
+      EncodePacket* packet;
+      while (queue_.pop(&packet)) {
+        pendingBytes_ -= packet->length;
+        pending_--;
+        packet->release();
+      }
+
+      const auto dropped = dropped_.exchange(0);
+      if (dropped > 0)
+        DEBUG_LOG_VAR(string(sink_->name()) + " dropped packets", to_string(dropped));
+    }
+
+    void SinkWorker::run() {
+      while (!stopRequested_.load()) {
+        EncodePacket* packet = nullptr;
+        if (!queue_.pop(&packet)) {
+          if (flushRequested_.load())
+            break;
+
+          unique_lock<mutex> lock(mtx_);
+          cv_.wait_for(lock, chrono::milliseconds(kIdleWaitMs), [this] {
+            return stopRequested_.load() || flushRequested_.load() || !queue_.empty();
+          });
+          continue;
+        }
+
+        writingTimestamp_ = packet->timestamp;
+
+        // Keep draining after a failure so the mux thread never blocks on a full queue;
+        // the failure is reported to it through submit()
+        if (status_ == FBCAPTURE_OK) {
+          const auto status = sink_->write(packet);
+          if (status != FBCAPTURE_OK) {
+            DEBUG_ERROR_VAR(string("Failed writing packet to ") + sink_->name(), to_string(status));
+            status_ = status;
+          }
+          writtenBytes_ += packet->length;
+        }
+        pendingBytes_ -= packet->length;
+        pending_--;
+        packet->release();
+
+        // the backlog starts at the next queued packet. A packet pushed right after the peek reads as no backlog
+        // until it is popped on the next iteration.
+        EncodePacket* next = nullptr;
+        if (queue_.peek(&next))
+          writingTimestamp_ = next->timestamp;
+        else
+          writingTimestamp_ = kIdleTimestamp;
+        spaceCv_.notify_one();
+      }
+    }
+
+    void SinkWorker::detach() {
+      detached_ = true;
+    }
+
+    bool SinkWorker::isDetached() const {
+      return detached_;
+    }
+
+    FBCAPTURE_STATUS SinkWorker::status() const {
+      return status_;
+    }
+
+    SINK_OVERFLOW_POLICY SinkWorker::policy() const {
+      return policy_;
+    }
+
+    uint32_t SinkWorker::droppedCount() const {
+      return dropped_;
+    }
+
+    SinkQueueStats SinkWorker::queueStats() const {
+      SinkQueueStats stats;
+      stats.packets = pending_;
+      stats.bytes = pendingBytes_;
+      stats.durationMs = backlogMs();
+      stats.dropped = dropped_;
+      stats.writtenBytes = writtenBytes_;
+      return stats;
+    }
+
+    PacketSink* SinkWorker::sink() const {
+      return sink_;
+    }
+  }
+}
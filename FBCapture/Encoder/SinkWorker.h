@@ -0,0 +1,93 @@
+/****************************************************************************************************************
+
+Filename	:	SinkWorker.h
+Content		:	Bounded packet queue and worker thread in front of a PacketSink
+Copyright	:
+
+****************************************************************************************************************/
+
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+
+#include "PacketSink.h"
+#include "PacketRing.h"
+
+using namespace std;
+
+namespace FBCapture {
+  namespace Streaming {
+
+    // Backlog of a sink, counting the packet it is writing
+    struct SinkQueueStats {
+      uint32_t packets;
+      uint64_t bytes;
+      uint32_t durationMs;  // media time from the packet being written to the newest queued one
+      uint32_t dropped;
+      uint64_t writtenBytes;  // since the sink was started
+    };
+
+    /*
+    * The mux thread is the only producer and the worker thread the only consumer of the queue.
+    * With SINK_OVERFLOW_POLICY::DROP the backlog is measured in media time and video is shed as it grows:
+    * disposable frames past kDropDisposableMs, then every frame up to the next keyframe past kDropToKeyframeMs
+    * or when the queue overflows, because a dropped reference frame breaks the frames predicted from it.
+    * Audio is only lost if the queue is full. Sequence headers are made by the sinks from the packets they
+    * receive, so they can't be dropped here.
+    */
+    class SinkWorker {
+    public:
+      static const uint32_t kIdleWaitMs = 10;
+      static const uint32_t kDropDisposableMs = 500;
+      static const uint32_t kDropToKeyframeMs = 1000;
+      static const uint64_t kIdleTimestamp = UINT64_MAX;
+
+      SinkWorker(PacketSink* sink, uint32_t queueCapacity, SINK_OVERFLOW_POLICY policy);
+      ~SinkWorker();
+
+      FBCAPTURE_STATUS start();
+      FBCAPTURE_STATUS submit(EncodePacket* packet);
+      void stop(bool flush);
+
+      // The producer stops feeding a failed sink it can do without. Cleared by start().
+      void detach();
+      bool isDetached() const;
+
+      FBCAPTURE_STATUS status() const;
+      SINK_OVERFLOW_POLICY policy() const;
+      uint32_t droppedCount() const;
+      SinkQueueStats queueStats() const;
+      PacketSink* sink() const;
+
+    private:
+      PacketSink* sink_;
+      SINK_OVERFLOW_POLICY policy_;
+      PacketRing<EncodePacket*> queue_;
+
+      thread* thread_;
+      mutex mtx_;
+      condition_variable cv_;                // signalled when a packet is queued or the worker is asked to stop
+      condition_variable spaceCv_;           // signalled when the worker frees a queue slot
+      atomic<bool> stopRequested_;           // stop immediately, dropping queued packets
+      atomic<bool> flushRequested_;          // stop once every queued packet has been written
+      atomic<FBCAPTURE_STATUS> status_;      // first failure of the sink
+      atomic<uint32_t> dropped_;
+      atomic<uint32_t> pending_;             // packets queued or being written
+      atomic<uint64_t> pendingBytes_;
+      atomic<uint64_t> writtenBytes_;
+      atomic<uint64_t> newestTimestamp_;     // of the last queued packet, written by the producer
+      atomic<uint64_t> writingTimestamp_;    // of the packet being written or next up, kIdleTimestamp if the queue is empty.
+                                             // Only written by the consumer.
+      bool waitForKeyframe_;                 // only touched by the producer
+      bool detached_;                        // only touched by the producer
+
+      void run();
+      void notify(condition_variable& cv);
+      bool shouldDrop(EncodePacket* packet);
+      uint32_t backlogMs() const;
+    };
+  }
+}
@@ -0,0 +1,252 @@
+/****************************************************************************************************************
+
+Filename	:	SpsParser.cpp
+Content		:
+Copyright	:
+
+****************************************************************************************************************/
+
+#include "SpsParser.h"
+
+#include <vector>
+
+using namespace std;
+
+namespace FBCapture {
+  namespace Streaming {
+
+    namespace {
+
+      // Reads the RBSP bits of a NAL unit. Reads past the end return zeros and set overrun.
+      class BitReader {
+      public:
+        BitReader(const uint8_t* data, const uint32_t length) : overrun(false), data_(data), length_(length), bitPos_(0) {}
+
+        uint32_t readBit() {
+          if (bitPos_ >= static_cast<uint64_t>(length_) * 8) {
+            overrun = true;
+            return 0;
+          }
+          const auto bit = (data_[bitPos_ >> 3] >> (7 - (bitPos_ & 7))) & 1;
+          bitPos_++;
+          return bit;
+        }
+
+        uint32_t readBits(uint32_t count) {
+          uint32_t value = 0;
+          while (count--)
+            value = (value << 1) | readBit();
+          return value;
+        }
+
+        // unsigned Exp-Golomb
+        uint32_t readUe() {
+          uint32_t leadingZeros = 0;
+          while (readBit() == 0 && !overrun && leadingZeros < 32)
+            leadingZeros++;
+          if (leadingZeros >= 32)
+            return 0;
+          return (1u << leadingZeros) - 1 + readBits(leadingZeros);
+        }
+
+        // signed Exp-Golomb
+        int32_t readSe() {
+          const auto value = readUe();
+          return value & 1 ? static_cast<int32_t>((value + 1) / 2) : -static_cast<int32_t>(value / 2);
+        }
+
+        bool overrun;
+
+      private:
+        const uint8_t* data_;
+        uint32_t length_;
+        uint64_t bitPos_;
+      };
+
+      // Strips the NAL header and the emulation prevention bytes (00 00 03) to get the RBSP
+      void toRbsp(const uint8_t* nal, const uint32_t nalLen, const uint32_t headerSize, vector<uint8_t>* rbsp) {
+        rbsp->reserve(nalLen);
+        uint32_t zeros = 0;
+        for (auto i = headerSize; i < nalLen; i++) {
+          if (zeros >= 2 && nal[i] == 3) {
+            zeros = 0;
+            continue;
+          }
+          zeros = nal[i] == 0 ? zeros + 1 : 0;
+          rbsp->push_back(nal[i]);
+        }
+      }
+
+      void skipScalingList(BitReader* reader, const uint32_t size) {
+        int32_t lastScale = 8, nextScale = 8;
+        for (uint32_t i = 0; i < size && nextScale != 0; i++) {
+          nextScale = (lastScale + reader->readSe() + 256) % 256;
+          if (nextScale != 0)
+            lastScale = nextScale;
+        }
+      }
+    }
+
+    bool ParseSps(const uint8_t* sps, const uint32_t spsLen, SpsInfo* info) {
+      if (!sps || spsLen < 4 || (sps[0] & 0x1f) != 7)
+        return false;
+
+      vector<uint8_t> rbsp;
+      toRbsp(sps, spsLen, 1, &rbsp);
+
+      BitReader reader(rbsp.data(), static_cast<uint32_t>(rbsp.size()));
+      info->profileIdc = reader.readBits(8);
+      reader.readBits(8);  // constraint flags
+      info->levelIdc = reader.readBits(8);
+      reader.readUe();     // seq_parameter_set_id
+
+      uint32_t chromaFormatIdc = 1;
+      auto separateColourPlane = false;
+      switch (info->profileIdc) {
+        case 100: case 110: case 122: case 244: case 44:
+        case 83: case 86: case 118: case 128: case 138: case 139: case 134: case 135:
+          chromaFormatIdc = reader.readUe();
+          if (chromaFormatIdc == 3)
+            separateColourPlane = reader.readBit() == 1;
+          reader.readUe();   // bit_depth_luma_minus8
+          reader.readUe();   // bit_depth_chroma_minus8
+          reader.readBit();  // qpprime_y_zero_transform_bypass_flag
+          if (reader.readBit()) {  // seq_scaling_matrix_present_flag
+            const auto count = chromaFormatIdc != 3 ? 8 : 12;
+            for (auto i = 0; i < count; i++) {
+              if (reader.readBit())
+                skipScalingList(&reader, i < 6 ? 16 : 64);
+            }
+          }
+          break;
+        default:
+          break;
+      }
+
+      reader.readUe();  // log2_max_frame_num_minus4
+      const auto picOrderCntType = reader.readUe();
+      if (picOrderCntType == 0) {
+        reader.readUe();  // log2_max_pic_order_cnt_lsb_minus4
+      } else if (picOrderCntType == 1) {
+        reader.readBit(); // delta_pic_order_always_zero_flag
+        reader.readSe();  // offset_for_non_ref_pic
+        reader.readSe();  // offset_for_top_to_bottom_field
+        const auto numRefFramesInCycle = reader.readUe();
+        for (uint32_t i = 0; i < numRefFramesInCycle && !reader.overrun; i++)
+          reader.readSe();
+      }
+
+      reader.readUe();   // max_num_ref_frames
+      reader.readBit();  // gaps_in_frame_num_value_allowed_flag
+      const auto widthInMbs = reader.readUe() + 1;
+      const auto heightInMapUnits = reader.readUe() + 1;
+      const auto frameMbsOnly = reader.readBit();
+      if (!frameMbsOnly)
+        reader.readBit();  // mb_adaptive_frame_field_flag
+      reader.readBit();    // direct_8x8_inference_flag
+
+      uint32_t cropLeft = 0, cropRight = 0, cropTop = 0, cropBottom = 0;
+      if (reader.readBit()) {  // frame_cropping_flag
+        cropLeft = reader.readUe();
+        cropRight = reader.readUe();
+        cropTop = reader.readUe();
+        cropBottom = reader.readUe();
+      }
+
+      if (reader.overrun)
+        return false;
+
+      // crop offsets are in chroma sample units, see ITU-T H.264 7.4.2.1.1
+      const auto chromaArrayType = separateColourPlane ? 0 : chromaFormatIdc;
+      const uint32_t subWidthC = chromaFormatIdc == 3 ? 1 : 2;
+      const uint32_t subHeightC = chromaFormatIdc == 1 ? 2 : 1;
+      const auto cropUnitX = chromaArrayType == 0 ? 1 : subWidthC;
+      const auto cropUnitY = (chromaArrayType == 0 ? 1 : subHeightC) * (2 - frameMbsOnly);
+
+      const auto width = widthInMbs * 16;
+      const auto height = heightInMapUnits * 16 * (2 - frameMbsOnly);
+      const auto cropX = (cropLeft + cropRight) * cropUnitX;
+      const auto cropY = (cropTop + cropBottom) * cropUnitY;
+      if (cropX >= width || cropY >= height)
+        return false;
+
+      info->width = width - cropX;
+      info->height = height - cropY;
+      return true;
+    }
+
+    bool ParseHevcSps(const uint8_t* sps, const uint32_t spsLen, HevcSpsInfo* info) {
+      if (!sps || spsLen < 16 || ((sps[0] >> 1) & 0x3f) != 33)
+        return false;
+
+      vector<uint8_t> rbsp;
+      toRbsp(sps, spsLen, 2, &rbsp);
+
+      BitReader reader(rbsp.data(), static_cast<uint32_t>(rbsp.size()));
+      reader.readBits(4);  // sps_video_parameter_set_id
+      info->maxSubLayersMinus1 = static_cast<uint8_t>(reader.readBits(3));
+      info->temporalIdNesting = static_cast<uint8_t>(reader.readBit());
+
+      // profile_tier_level(1, sps_max_sub_layers_minus1), see ITU-T H.265 7.3.3
+      info->profileSpace = static_cast<uint8_t>(reader.readBits(2));
+      info->tierFlag = static_cast<uint8_t>(reader.readBit());
+      info->profileIdc = static_cast<uint8_t>(reader.readBits(5));
+      info->profileCompatibilityFlags = reader.readBits(32);
+      // the 48 constraint flags are read in two steps, the operands of | are unsequenced
+      const uint64_t constraintFlagsHigh = reader.readBits(16);
+      info->constraintIndicatorFlags = constraintFlagsHigh << 32 | reader.readBits(32);
+      info->levelIdc = static_cast<uint8_t>(reader.readBits(8));
+
+      uint32_t subLayerProfilePresent = 0, subLayerLevelPresent = 0;
+      for (uint32_t i = 0; i < info->maxSubLayersMinus1; i++) {
+        subLayerProfilePresent |= reader.readBit() << i;
+        subLayerLevelPresent |= reader.readBit() << i;
+      }
+      if (info->maxSubLayersMinus1 > 0) {
+        for (auto i = info->maxSubLayersMinus1; i < 8; i++)
+          reader.readBits(2);  // reserved_zero_2bits
+      }
+      for (uint32_t i = 0; i < info->maxSubLayersMinus1; i++) {
+        if (subLayerProfilePresent & (1 << i)) {
+          reader.readBits(32);  // the 88 bits of sub_layer profile
+          reader.readBits(32);
+          reader.readBits(24);
+        }
+        if (subLayerLevelPresent & (1 << i))
+          reader.readBits(8);   // sub_layer_level_idc
+      }
+
+      reader.readUe();  // sps_seq_parameter_set_id
+      info->chromaFormatIdc = reader.readUe();
+      if (info->chromaFormatIdc == 3)
+        reader.readBit();  // separate_colour_plane_flag
+      const auto width = reader.readUe();
+      const auto height = reader.readUe();
+
+      uint32_t cropLeft = 0, cropRight = 0, cropTop = 0, cropBottom = 0;
+      if (reader.readBit()) {  // conformance_window_flag
+        cropLeft = reader.readUe();
+        cropRight = reader.readUe();
+        cropTop = reader.readUe();
+        cropBottom = reader.readUe();
+      }
+      info->bitDepthLumaMinus8 = reader.readUe();
+      info->bitDepthChromaMinus8 = reader.readUe();
+
+      if (reader.overrun || info->chromaFormatIdc > 3)
+        return false;
+
+      // conformance window offsets are in chroma sample units, see ITU-T H.265 7.4.3.2.1
+      const uint32_t subWidthC = info->chromaFormatIdc == 1 || info->chromaFormatIdc == 2 ? 2 : 1;
+      const uint32_t subHeightC = info->chromaFormatIdc == 1 ? 2 : 1;
+      const auto cropX = (cropLeft + cropRight) * subWidthC;
+      const auto cropY = (cropTop + cropBottom) * subHeightC;
+      if (cropX >= width || cropY >= height)
+        return false;
+
+      info->width = width - cropX;
+      info->height = height - cropY;
+      return true;
+    }
+  }
+}
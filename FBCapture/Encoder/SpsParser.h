@@ -0,0 +1,46 @@
+/****************************************************************************************************************
+
+Filename	:	SpsParser.h
+Content		:	Reads the stream properties we need out of H.264 and HEVC sequence parameter sets
+Copyright	:
+
+****************************************************************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+
+namespace FBCapture {
+  namespace Streaming {
+
+    struct SpsInfo {
+      uint32_t profileIdc;
+      uint32_t levelIdc;
+      uint32_t width;   // in pixels, after cropping
+      uint32_t height;
+    };
+
+    // The general profile_tier_level() fields the HEVCDecoderConfigurationRecord repeats, and the picture format
+    struct HevcSpsInfo {
+      uint8_t profileSpace;
+      uint8_t tierFlag;
+      uint8_t profileIdc;
+      uint32_t profileCompatibilityFlags;
+      uint64_t constraintIndicatorFlags;  // 48 bits
+      uint8_t levelIdc;
+      uint8_t maxSubLayersMinus1;
+      uint8_t temporalIdNesting;
+      uint32_t chromaFormatIdc;
+      uint32_t bitDepthLumaMinus8;
+      uint32_t bitDepthChromaMinus8;
+      uint32_t width;   // in pixels, after the conformance window
+      uint32_t height;
+    };
+
+    // sps is a single NAL unit without start code, including the NAL header byte and emulation prevention bytes
+    bool ParseSps(const uint8_t* sps, uint32_t spsLen, SpsInfo* info);
+
+    // Same for an HEVC SPS, which has a 2 byte NAL header
+    bool ParseHevcSps(const uint8_t* sps, uint32_t spsLen, HevcSpsInfo* info);
+  }
+}
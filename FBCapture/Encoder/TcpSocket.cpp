@@ -0,0 +1,374 @@
+/****************************************************************************************************************
+
+Filename	:	TcpSocket.cpp
+Content		:
+Copyright	:
+
+****************************************************************************************************************/
+
+#include "TcpSocket.h"
+
+#ifdef WIN32
+#pragma comment(lib, "Ws2_32.lib")
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/time.h>
+#endif
+
+#include <chrono>
+#include <mutex>
+#include <string.h>
+
+namespace FBCapture {
+  namespace Streaming {
+
+    namespace {
+
+#ifndef WIN32
+#ifdef MSG_NOSIGNAL
+      const int kSendFlags = MSG_NOSIGNAL;
+#else
+      const int kSendFlags = 0;  // SO_NOSIGPIPE is set on the socket instead
+#endif
+
+      void disableSigPipe(const SOCKET socket) {
+#ifdef SO_NOSIGPIPE
+        const int value = 1;
+        setsockopt(socket, SOL_SOCKET, SO_NOSIGPIPE, &value, sizeof(value));
+#else
+        (void)socket;
+#endif
+      }
+#endif
+
+      bool setBlocking(const SOCKET socket, const bool blocking) {
+#ifdef WIN32
+        u_long nonBlocking = blocking ? 0 : 1;
+        return ioctlsocket(socket, FIONBIO, &nonBlocking) == 0;
+#else
+        const auto flags = fcntl(socket, F_GETFL, 0);
+        return flags >= 0 && fcntl(socket, F_SETFL, blocking ? flags & ~O_NONBLOCK : flags | O_NONBLOCK) == 0;
+#endif
+      }
+
+      // Connects without blocking past timeoutMs, then puts the socket back in blocking mode
+      bool connectWithin(const SOCKET socket, const addrinfo* address, const uint32_t timeoutMs) {
+        if (!setBlocking(socket, false))
+          return false;
+
+        if (::connect(socket, address->ai_addr, static_cast<int>(address->ai_addrlen)) != 0) {
+#ifdef WIN32
+          if (WSAGetLastError() != WSAEWOULDBLOCK)
+            return false;
+          // select rather than WSAPoll, which doesn't report a refused connection on older Windows
+          fd_set writable, failed;
+          FD_ZERO(&writable);
+          FD_ZERO(&failed);
+          FD_SET(socket, &writable);
+          FD_SET(socket, &failed);
+          timeval timeout = { static_cast<long>(timeoutMs / 1000), static_cast<long>(timeoutMs % 1000 * 1000) };
+          if (select(0, NULL, &writable, &failed, &timeout) <= 0 || FD_ISSET(socket, &failed))
+            return false;
+#else
+          if (errno != EINPROGRESS)
+            return false;
+          pollfd fd = { socket, POLLOUT, 0 };
+          if (poll(&fd, 1, static_cast<int>(timeoutMs)) <= 0)
+            return false;
+#endif
+          int error = 0;
+          socklen_t length = sizeof(error);
+          if (getsockopt(socket, SOL_SOCKET, SO_ERROR, reinterpret_cast<char*>(&error), &length) != 0 || error != 0)
+            return false;
+        }
+        return setBlocking(socket, true);
+      }
+    }
+
+#ifdef WIN32
+    bool SocketStartup() {
+      static once_flag once;
+      static bool started = false;
+      call_once(once, [] {
+        WSADATA wsaData;
+        started = WSAStartup(MAKEWORD(2, 2), &wsaData) == 0;
+      });
+      return started;
+    }
+
+    bool SocketInterrupted() {
+      return WSAGetLastError() == WSAEINTR;
+    }
+
+    void SocketClose(const SOCKET socket) {
+      closesocket(socket);
+    }
+#else
+    bool SocketStartup() {
+      return true;
+    }
+
+    bool SocketInterrupted() {
+      return errno == EINTR;
+    }
+
+    void SocketClose(const SOCKET socket) {
+      ::close(socket);
+    }
+#endif
+
+    bool SocketSendV(const SOCKET socket, const IoVec* iov, const uint32_t count, vector<SOCKET_BUFFER>* buffers) {
+      buffers->resize(count);
+      for (uint32_t i = 0; i < count; i++) {
+#ifdef WIN32
+        (*buffers)[i].buf = reinterpret_cast<CHAR*>(const_cast<uint8_t*>(iov[i].data));
+        (*buffers)[i].len = iov[i].length;
+#else
+        (*buffers)[i].iov_base = const_cast<uint8_t*>(iov[i].data);
+        (*buffers)[i].iov_len = iov[i].length;
+#endif
+      }
+
+      auto next = buffers->data();
+      auto left = count;
+      while (left > 0) {
+#ifdef WIN32
+        DWORD sent = 0;
+        if (WSASend(socket, next, left, &sent, 0, NULL, NULL) == SOCKET_ERROR) {
+          if (SocketInterrupted())
+            continue;
+          return false;
+        }
+        // A blocking socket normally takes everything. Otherwise resume in the middle of the first unsent buffer.
+        while (left > 0 && sent >= next->len) {
+          sent -= next->len;
+          next++;
+          left--;
+        }
+        if (left > 0) {
+          next->buf += sent;
+          next->len -= sent;
+        }
+#else
+        // sendmsg instead of writev so a dropped connection fails the call instead of raising SIGPIPE
+        msghdr message = {};
+        message.msg_iov = next;
+        message.msg_iovlen = left > IOV_MAX ? IOV_MAX : left;
+        auto sent = sendmsg(socket, &message, kSendFlags);
+        if (sent < 0) {
+          if (SocketInterrupted())
+            continue;
+          return false;
+        }
+        while (left > 0 && static_cast<size_t>(sent) >= next->iov_len) {
+          sent -= next->iov_len;
+          next++;
+          left--;
+        }
+        if (left > 0) {
+          next->iov_base = static_cast<uint8_t*>(next->iov_base) + sent;
+          next->iov_len -= sent;
+        }
+#endif
+      }
+      return true;
+    }
+
+    TcpSocket::TcpSocket() :
+      socket_(INVALID_SOCKET),
+      bytesReceived_(0) {}
+
+    TcpSocket::~TcpSocket() {
+      close();
+    }
+
+    bool TcpSocket::connect(const string& host, const uint16_t port, const uint32_t timeoutMs) {
+      close();
+      if (!SocketStartup())
+        return false;
+
+      addrinfo hints = {};
+      hints.ai_family = AF_UNSPEC;
+      hints.ai_socktype = SOCK_STREAM;
+      hints.ai_protocol = IPPROTO_TCP;
+      addrinfo* addresses = nullptr;
+      if (getaddrinfo(host.c_str(), to_string(port).c_str(), &hints, &addresses) != 0)
+        return false;
+
+      const auto deadline = chrono::steady_clock::now() + chrono::milliseconds(timeoutMs);
+      for (auto address = addresses; address && socket_ == INVALID_SOCKET; address = address->ai_next) {
+        const auto left = chrono::duration_cast<chrono::milliseconds>(deadline - chrono::steady_clock::now()).count();
+        if (left <= 0)
+          break;
+        const auto s = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+        if (s == INVALID_SOCKET)
+          continue;
+        if (!connectWithin(s, address, static_cast<uint32_t>(left))) {
+          SocketClose(s);
+          continue;
+        }
+        socket_ = s;
+      }
+      freeaddrinfo(addresses);
+      if (socket_ == INVALID_SOCKET)
+        return false;
+
+      setTimeout(timeoutMs);
+#ifndef WIN32
+      disableSigPipe(socket_);
+#endif
+      bytesReceived_ = 0;
+      return true;
+    }
+
+    bool TcpSocket::listen(const uint16_t port) {
+      close();
+      if (!SocketStartup())
+        return false;
+
+      socket_ = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+      if (socket_ == INVALID_SOCKET)
+        return false;
+
+      const int reuse = 1;
+      setsockopt(socket_, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&reuse), sizeof(reuse));
+
+      sockaddr_in address = {};
+      address.sin_family = AF_INET;
+      address.sin_addr.s_addr = htonl(INADDR_ANY);
+      address.sin_port = htons(port);
+      if (bind(socket_, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || ::listen(socket_, SOMAXCONN) != 0) {
+        close();
+        return false;
+      }
+      return true;
+    }
+
+    bool TcpSocket::accept(TcpSocket* client, const uint32_t timeoutMs) {
+      if (!waitReadable(timeoutMs))
+        return false;
+
+      const auto s = ::accept(socket_, NULL, NULL);
+      if (s == INVALID_SOCKET)
+        return false;
+
+      client->close();
+      client->socket_ = s;
+      client->bytesReceived_ = 0;
+      client->setTimeout(timeoutMs);
+#ifndef WIN32
+      disableSigPipe(s);
+#endif
+      return true;
+    }
+
+    void TcpSocket::setTimeout(const uint32_t timeoutMs) {
+#ifdef WIN32
+      const DWORD timeout = timeoutMs;
+#else
+      timeval timeout = { static_cast<time_t>(timeoutMs / 1000), static_cast<suseconds_t>(timeoutMs % 1000 * 1000) };
+#endif
+      setsockopt(socket_, SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<const char*>(&timeout), sizeof(timeout));
+      setsockopt(socket_, SOL_SOCKET, SO_SNDTIMEO, reinterpret_cast<const char*>(&timeout), sizeof(timeout));
+    }
+
+    void TcpSocket::close() {
+      if (socket_ != INVALID_SOCKET)
+        SocketClose(socket_);
+      socket_ = INVALID_SOCKET;
+    }
+
+    void TcpSocket::shutdown(const uint32_t timeoutMs) {
+      if (socket_ == INVALID_SOCKET)
+        return;
+#ifdef WIN32
+      if (::shutdown(socket_, SD_SEND) != 0)
+        return;
+#else
+      if (::shutdown(socket_, SHUT_WR) != 0)
+        return;
+#endif
+      char discarded[4096];
+      const auto deadline = chrono::steady_clock::now() + chrono::milliseconds(timeoutMs);
+      while (true) {
+        const auto left = chrono::duration_cast<chrono::milliseconds>(deadline - chrono::steady_clock::now()).count();
+        if (left <= 0 || !waitReadable(static_cast<uint32_t>(left)) || recvSome(discarded, sizeof(discarded)) == 0)
+          return;
+      }
+    }
+
+    bool TcpSocket::isOpen() const {
+      return socket_ != INVALID_SOCKET;
+    }
+
+    bool TcpSocket::setNoDelay(const bool noDelay) {
+      const int value = noDelay ? 1 : 0;
+      return setsockopt(socket_, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&value), sizeof(value)) == 0;
+    }
+
+    bool TcpSocket::setSendBufferSize(const int size) {
+      return setsockopt(socket_, SOL_SOCKET, SO_SNDBUF, reinterpret_cast<const char*>(&size), sizeof(size)) == 0;
+    }
+
+    bool TcpSocket::setReceiveBufferSize(const int size) {
+      return setsockopt(socket_, SOL_SOCKET, SO_RCVBUF, reinterpret_cast<const char*>(&size), sizeof(size)) == 0;
+    }
+
+    bool TcpSocket::send(const void* data, const uint32_t length) {
+      const IoVec iov = { static_cast<const uint8_t*>(data), length };
+      return sendV(&iov, 1);
+    }
+
+    bool TcpSocket::sendV(const IoVec* iov, const uint32_t count) {
+      if (socket_ == INVALID_SOCKET)
+        return false;
+      return SocketSendV(socket_, iov, count, &buffers_);
+    }
+
+    bool TcpSocket::recv(void* data, const uint32_t length) {
+      auto p = static_cast<char*>(data);
+      auto left = length;
+      while (left > 0) {
+        const auto received = ::recv(socket_, p, static_cast<int>(left), 0);
+        if (received < 0 && SocketInterrupted())
+          continue;
+        if (received <= 0)
+          return false;
+        p += received;
+        left -= static_cast<uint32_t>(received);
+        bytesReceived_ += received;
+      }
+      return true;
+    }
+
+    uint32_t TcpSocket::recvSome(void* data, const uint32_t length) {
+      while (true) {
+        const auto received = ::recv(socket_, static_cast<char*>(data), static_cast<int>(length), 0);
+        if (received < 0 && SocketInterrupted())
+          continue;
+        if (received <= 0)
+          return 0;
+        bytesReceived_ += received;
+        return static_cast<uint32_t>(received);
+      }
+    }
+
+    bool TcpSocket::waitReadable(const uint32_t timeoutMs) {
+      if (socket_ == INVALID_SOCKET)
+        return false;
+#ifdef WIN32
+      WSAPOLLFD fd = { socket_, POLLRDNORM, 0 };
+      return WSAPoll(&fd, 1, static_cast<INT>(timeoutMs)) > 0;
+#else
+      pollfd fd = { socket_, POLLIN, 0 };
+      return poll(&fd, 1, static_cast<int>(timeoutMs)) > 0;
+#endif
+    }
+  }
+}
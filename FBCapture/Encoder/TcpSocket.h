@@ -0,0 +1,103 @@
+/****************************************************************************************************************
+
+Filename	:	TcpSocket.h
+Content		:	Blocking TCP client socket over Winsock or BSD sockets, with gather writes
+Copyright	:
+
+****************************************************************************************************************/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#ifdef WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#ifndef IOV_MAX
+#define IOV_MAX 16  // the POSIX minimum
+#endif
+#endif
+
+#include "IoVec.h"
+
+using namespace std;
+
+#ifdef WIN32
+typedef WSABUF SOCKET_BUFFER;
+#else
+#ifndef SOCKET
+typedef int SOCKET;
+#endif
+typedef struct iovec SOCKET_BUFFER;
+#ifndef INVALID_SOCKET
+#define INVALID_SOCKET (-1)
+#endif
+#endif
+
+namespace FBCapture {
+  namespace Streaming {
+
+    // Initializes Winsock once per process. Always true elsewhere.
+    bool SocketStartup();
+    // The last call failed because a signal interrupted it
+    bool SocketInterrupted();
+    void SocketClose(SOCKET socket);
+
+    // Sends every buffer, resuming after partial sends. buffers is scratch space reused across calls.
+    bool SocketSendV(SOCKET socket, const IoVec* iov, uint32_t count, vector<SOCKET_BUFFER>* buffers);
+
+    class TcpSocket {
+    public:
+      TcpSocket();
+      ~TcpSocket();
+
+      TcpSocket(const TcpSocket&) = delete;
+      TcpSocket& operator=(const TcpSocket&) = delete;
+
+      // Gives up once timeoutMs passed, across every address host resolves to. Sends and receives then time out
+      // after timeoutMs too.
+      bool connect(const string& host, uint16_t port, uint32_t timeoutMs);
+      // Server side. Listens on every interface.
+      bool listen(uint16_t port);
+      // Waits up to timeoutMs for the next connection and hands it to client
+      bool accept(TcpSocket* client, uint32_t timeoutMs);
+
+      void close();
+      // Sends what is queued and a FIN, then reads until the peer closes too or timeoutMs passed. Data left unread
+      // would make close() reset the connection and discard what the peer hadn't received yet.
+      void shutdown(uint32_t timeoutMs);
+      bool isOpen() const;
+
+      bool setNoDelay(bool noDelay);
+      bool setSendBufferSize(int size);
+      bool setReceiveBufferSize(int size);
+
+      bool send(const void* data, uint32_t length);
+      bool sendV(const IoVec* iov, uint32_t count);
+      // Fills the whole buffer or fails
+      bool recv(void* data, uint32_t length);
+      // Waits for data and returns what arrived, up to length. 0 on errors and a closed connection.
+      uint32_t recvSome(void* data, uint32_t length);
+      // Waits up to timeoutMs for incoming data. 0 only checks.
+      bool waitReadable(uint32_t timeoutMs);
+
+      uint64_t bytesReceived() const {
+        return bytesReceived_;
+      }
+
+    private:
+      void setTimeout(uint32_t timeoutMs);
+
+      SOCKET socket_;
+      uint64_t bytesReceived_;
+      vector<SOCKET_BUFFER> buffers_;
+    };
+  }
+}
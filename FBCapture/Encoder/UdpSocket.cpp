@@ -0,0 +1,177 @@
+/****************************************************************************************************************
+
+Filename	:	UdpSocket.cpp
+Content		:
+Copyright	:
+
+****************************************************************************************************************/
+
+#include "UdpSocket.h"
+
+#ifndef WIN32
+#include <errno.h>
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#endif
+
+namespace FBCapture {
+  namespace Streaming {
+
+    UdpSocket::UdpSocket() :
+      socket_(INVALID_SOCKET) {}
+
+    UdpSocket::~UdpSocket() {
+      close();
+    }
+
+    bool UdpSocket::connect(const string& host, const uint16_t port) {
+      close();
+      if (!SocketStartup())
+        return false;
+
+      addrinfo hints = {};
+      hints.ai_family = AF_UNSPEC;
+      hints.ai_socktype = SOCK_DGRAM;
+      hints.ai_protocol = IPPROTO_UDP;
+      addrinfo* addresses = nullptr;
+      if (getaddrinfo(host.c_str(), to_string(port).c_str(), &hints, &addresses) != 0)
+        return false;
+
+      // connecting a UDP socket only fixes the destination, so send() needs no address and the kernel skips the route lookup
+      for (auto address = addresses; address && socket_ == INVALID_SOCKET; address = address->ai_next) {
+        const auto s = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+        if (s == INVALID_SOCKET)
+          continue;
+        if (::connect(s, address->ai_addr, static_cast<int>(address->ai_addrlen)) != 0) {
+          SocketClose(s);
+          continue;
+        }
+        socket_ = s;
+      }
+      freeaddrinfo(addresses);
+      return socket_ != INVALID_SOCKET;
+    }
+
+    bool UdpSocket::bind(const uint16_t port) {
+      close();
+      if (!SocketStartup())
+        return false;
+
+      socket_ = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+      if (socket_ == INVALID_SOCKET)
+        return false;
+
+      sockaddr_in address = {};
+      address.sin_family = AF_INET;
+      address.sin_addr.s_addr = htonl(INADDR_ANY);
+      address.sin_port = htons(port);
+      if (::bind(socket_, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+        close();
+        return false;
+      }
+      return true;
+    }
+
+    void UdpSocket::close() {
+      if (socket_ != INVALID_SOCKET)
+        SocketClose(socket_);
+      socket_ = INVALID_SOCKET;
+    }
+
+    bool UdpSocket::isOpen() const {
+      return socket_ != INVALID_SOCKET;
+    }
+
+    bool UdpSocket::setSendBufferSize(const int size) {
+      return setsockopt(socket_, SOL_SOCKET, SO_SNDBUF, reinterpret_cast<const char*>(&size), sizeof(size)) == 0;
+    }
+
+    bool UdpSocket::setReceiveBufferSize(const int size) {
+      return setsockopt(socket_, SOL_SOCKET, SO_RCVBUF, reinterpret_cast<const char*>(&size), sizeof(size)) == 0;
+    }
+
+    uint32_t UdpSocket::sendBatch(const IoVec* iov, const uint32_t* ioVecCounts, const uint32_t count) {
+      if (socket_ == INVALID_SOCKET || count == 0)
+        return 0;
+
+      uint32_t totalIoVecs = 0;
+      for (uint32_t i = 0; i < count; i++)
+        totalIoVecs += ioVecCounts[i];
+
+      buffers_.resize(totalIoVecs);
+      for (uint32_t i = 0; i < totalIoVecs; i++) {
+#ifdef WIN32
+        buffers_[i].buf = reinterpret_cast<CHAR*>(const_cast<uint8_t*>(iov[i].data));
+        buffers_[i].len = iov[i].length;
+#else
+        buffers_[i].iov_base = const_cast<uint8_t*>(iov[i].data);
+        buffers_[i].iov_len = iov[i].length;
+#endif
+      }
+
+      uint32_t sent = 0;
+#if defined(__linux__)
+      messages_.resize(count);
+      auto buffer = buffers_.data();
+      for (uint32_t i = 0; i < count; i++) {
+        messages_[i] = {};
+        messages_[i].msg_hdr.msg_iov = buffer;
+        messages_[i].msg_hdr.msg_iovlen = ioVecCounts[i];
+        buffer += ioVecCounts[i];
+      }
+
+      while (sent < count) {
+        const auto batch = count - sent < kMaxBatchSize ? count - sent : kMaxBatchSize;
+        const auto result = sendmmsg(socket_, messages_.data() + sent, batch, 0);
+        if (result < 0) {
+          if (SocketInterrupted())
+            continue;
+          // a full send buffer or nobody listening on a connected socket costs the datagram, not the stream
+          if (errno == ENOBUFS || errno == EAGAIN || errno == ECONNREFUSED) {
+            sent++;
+            continue;
+          }
+          break;
+        }
+        sent += static_cast<uint32_t>(result);
+      }
+#else
+      auto buffer = buffers_.data();
+      for (; sent < count; sent++) {
+#ifdef WIN32
+        DWORD bytes = 0;
+        if (WSASend(socket_, buffer, ioVecCounts[sent], &bytes, 0, NULL, NULL) == SOCKET_ERROR &&
+            WSAGetLastError() != WSAECONNRESET)  // ICMP port unreachable from an earlier datagram
+          break;
+#else
+        msghdr message = {};
+        message.msg_iov = buffer;
+        message.msg_iovlen = ioVecCounts[sent];
+        if (sendmsg(socket_, &message, 0) < 0 && errno != ENOBUFS && errno != EAGAIN && errno != ECONNREFUSED)
+          break;
+#endif
+        buffer += ioVecCounts[sent];
+      }
+#endif
+      return sent;
+    }
+
+    int32_t UdpSocket::recv(void* data, const uint32_t capacity, const uint32_t timeoutMs) {
+      if (socket_ == INVALID_SOCKET)
+        return -1;
+#ifdef WIN32
+      WSAPOLLFD fd = { socket_, POLLRDNORM, 0 };
+      if (WSAPoll(&fd, 1, static_cast<INT>(timeoutMs)) <= 0)
+        return -1;
+#else
+      pollfd fd = { socket_, POLLIN, 0 };
+      if (poll(&fd, 1, static_cast<int>(timeoutMs)) <= 0)
+        return -1;
+#endif
+      const auto received = ::recv(socket_, static_cast<char*>(data), static_cast<int>(capacity), 0);
+      return received < 0 ? -1 : static_cast<int32_t>(received);
+    }
+  }
+}
@@ -0,0 +1,61 @@
+/****************************************************************************************************************
+
+Filename	:	UdpSocket.h
+Content		:	Connected UDP socket over Winsock or BSD sockets that sends datagrams in batches
+Copyright	:
+
+****************************************************************************************************************/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "TcpSocket.h"
+
+using namespace std;
+
+namespace FBCapture {
+  namespace Streaming {
+
+    class UdpSocket {
+    public:
+      static const uint32_t kMaxBatchSize = 64;  // datagrams per sendmmsg call
+
+      UdpSocket();
+      ~UdpSocket();
+
+      UdpSocket(const UdpSocket&) = delete;
+      UdpSocket& operator=(const UdpSocket&) = delete;
+
+      // Every datagram goes to host:port
+      bool connect(const string& host, uint16_t port);
+      // Receiving side. Binds to port on every interface.
+      bool bind(uint16_t port);
+
+      void close();
+      bool isOpen() const;
+
+      bool setSendBufferSize(int size);
+      bool setReceiveBufferSize(int size);
+
+      /*
+      * Sends count datagrams, datagram i gathered from the next ioVecCounts[i] buffers of iov.
+      * Uses sendmmsg where there is one so a whole frame goes out in a few syscalls.
+      * Returns how many were sent. UDP may still lose them on the way.
+      */
+      uint32_t sendBatch(const IoVec* iov, const uint32_t* ioVecCounts, uint32_t count);
+
+      // Waits up to timeoutMs for one datagram and returns its size, or -1 if none came
+      int32_t recv(void* data, uint32_t capacity, uint32_t timeoutMs);
+
+    private:
+      SOCKET socket_;
+      vector<SOCKET_BUFFER> buffers_;
+#if defined(__linux__)
+      vector<struct mmsghdr> messages_;
+#endif
+    };
+  }
+}
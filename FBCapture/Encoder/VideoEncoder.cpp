@@ -18,6 +18,7 @@ namespace FBCapture {
                                const uint32_t bitrate,
                                const uint32_t fps,
                                const uint32_t gop,
+                               const VIDEO_CODEC codec,
                                const bool flipTexture,
                                const bool enableAsyncMode) :
       FBCaptureEncoderModule(mainDelegate, processorDelegate),
@@ -25,8 +26,11 @@ namespace FBCapture {
       graphicsCardType_(graphicsCardType),
       device_(device),
       bitrate_(bitrate),
+      targetBitrate_(0),
+      adaptiveBitrate_(false),
       fps_(fps),
       gop_(gop),
+      codec_(codec),
       flipTexture_(flipTexture) {
       enableAsyncMode_ = enableAsyncMode;
     }
@@ -37,14 +41,19 @@ namespace FBCapture {
     }
 
     FBCAPTURE_STATUS VideoEncoder::init() {
-      // Initialize hardware-accelerated video encoder that encodes input texture frame to h264 packets
+      // Initialize hardware-accelerated video encoder that encodes input texture frame to h264 or hevc packets
       gpuEncoder_ = GPUEncoder::getInstance(graphicsCardType_, device_);
       if (!gpuEncoder_) {
         DEBUG_ERROR("Unsupported graphics card. The SDK supports only nVidia and AMD GPUs");
         return FBCAPTURE_GPU_ENCODER_UNSUPPORTED_DRIVER;
       }
 
-      auto status = gpuEncoder_->initialize(bitrate_, fps_, gop_, flipTexture_, enableAsyncMode_);
+      // Frames are signalled from encode(), but an encoder may still be holding output when it's signalled.
+      // Poll once per frame interval so that output is never stuck waiting for the next frame.
+      if (fps_ > 0)
+        period_ = chrono::milliseconds(max(1u, 1000u / fps_));
+
+      auto status = gpuEncoder_->initialize(bitrate_, fps_, gop_, codec_, flipTexture_, enableAsyncMode_, adaptiveBitrate_);
       if (status != FBCAPTURE_OK)
         DEBUG_ERROR_VAR("Failed initializing hardware encoder", to_string(status));
       return status;
@@ -56,17 +65,40 @@ namespace FBCapture {
         return FBCAPTURE_GPU_ENCODER_NULL_TEXTURE_POINTER;
       }
 
-      const auto status = gpuEncoder_->encode(texturePtr);
-      if (status != FBCAPTURE_OK || enableAsyncMode_)
+      // The encoder isn't thread safe, so the bitrate is changed here between frames.
+      // A failed change isn't fatal, the session carries on at the old bitrate.
+      const auto targetBitrate = targetBitrate_.exchange(0);
+      if (targetBitrate > 0 && gpuEncoder_->reconfigureBitrate(targetBitrate) != FBCAPTURE_OK)
+        DEBUG_ERROR_VAR("Failed changing video bitrate", to_string(targetBitrate));
+
+      auto status = gpuEncoder_->encode(texturePtr);
+      if (status != FBCAPTURE_OK)
+        return status;
+
+      if (enableAsyncMode_) {
+        signal();
         return status;
+      }
+
+      status = process();
+      return status == FBCAPTURE_ENCODER_NEED_MORE_INPUT ? FBCAPTURE_OK : status;
+    }
+
+    void VideoEncoder::setAdaptiveBitrate(const bool enabled) {
+      adaptiveBitrate_ = enabled;
+      targetBitrate_ = 0;
+    }
 
-      return process();
+    void VideoEncoder::onTargetBitrate(const uint32_t bitrate) {
+      targetBitrate_ = bitrate;
     }
 
     FBCAPTURE_STATUS VideoEncoder::getPacket(EncodePacket** packet) {
       VideoEncodePacket* videoPacket;
 
       auto status = gpuEncoder_->getEncodePacket(&videoPacket);
+      if (status == FBCAPTURE_GPU_ENCODER_BUFFER_EMPTY)
+        return FBCAPTURE_ENCODER_NEED_MORE_INPUT;
       if (status != FBCAPTURE_OK) {
         DEBUG_ERROR_VAR("Failed creating VideoEncodePacket from Video Encoder", to_string(status));
         return status;
@@ -2,13 +2,14 @@
 
 #include "FBCaptureEncoderModule.h"
 #include "GPUEncoder.h"
+#include "AbrController.h"
 
 using namespace FBCapture::Streaming;
 
 namespace FBCapture {
   namespace Video {
 
-    class VideoEncoder : public FBCaptureEncoderModule {
+    class VideoEncoder : public FBCaptureEncoderModule, public AbrControllerDelegate {
     public:
       VideoEncoder(FBCaptureEncoderDelegate *mainDelegate,
                    EncodePacketProcessorDelegate *processorDelegate,
@@ -17,12 +18,19 @@ namespace FBCapture {
                    uint32_t bitrate,
                    uint32_t fps,
                    uint32_t gop,
+                   VIDEO_CODEC codec,
                    bool flipTexture,
                    bool enableAsyncMode);
       ~VideoEncoder();
 
       FBCAPTURE_STATUS encode(void *texturePtr);
 
+      // Whether the next session's bitrate is driven by the adaptive bitrate controller. Must be called before start().
+      void setAdaptiveBitrate(bool enabled);
+
+      /* AbrControllerDelegate */
+      void onTargetBitrate(uint32_t bitrate) override;
+
     protected:
       GPUEncoder* gpuEncoder_;
 
@@ -30,8 +38,11 @@ namespace FBCapture {
       ID3D11Device* device_;
 
       uint32_t bitrate_;
+      atomic<uint32_t> targetBitrate_;  // set by the adaptive bitrate controller, applied before the next frame. 0 if none.
+      bool adaptiveBitrate_;
       uint32_t fps_;
       uint32_t gop_;
+      VIDEO_CODEC codec_;
       bool flipTexture_;
 
       /* FBCaptureEncoderModule */
@@ -209,7 +209,7 @@ public:
                                                                         int8_t *qpDeltaMapArray = NULL, uint32_t qpDeltaMapArraySize = 0);
   NVENCSTATUS                                          CreateEncoder(EncodeConfig *pEncCfg);
   GUID                                                 GetPresetGUID(char* encoderPreset, int codec);
-  NVENCSTATUS                                          ProcessOutput(const EncodeBuffer *pEncodeBuffer, void **buffer, UINT32 *length, UINT64 *timestamp, UINT64 *duration, UINT32 *frameIdx, bool* is_keyframe);
+  NVENCSTATUS                                          ProcessOutput(const EncodeBuffer *pEncodeBuffer, void **buffer, UINT32 *capacity, UINT32 *length, UINT64 *timestamp, UINT64 *duration, UINT32 *frameIdx, bool* is_keyframe);
   NVENCSTATUS                                          ProcessMVOutput(const MotionEstimationBuffer *pEncodeBuffer);
   NVENCSTATUS                                          ValidateEncodeGUID(GUID inputCodecGuid);
   NVENCSTATUS                                          ValidatePresetGUID(GUID presetCodecGuid, GUID inputCodecGuid);
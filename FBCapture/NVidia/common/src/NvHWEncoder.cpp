@@ -774,7 +774,7 @@ GUID CNvHWEncoder::GetPresetGUID(char* encoderPreset, int codec) {
   return presetGUID;
 }
 
-NVENCSTATUS CNvHWEncoder::ProcessOutput(const EncodeBuffer *pEncodeBuffer, void **buffer, UINT32 *length, UINT64 *timestamp, UINT64 *duration, UINT32 *frameIdx, bool *is_keyframe) {
+NVENCSTATUS CNvHWEncoder::ProcessOutput(const EncodeBuffer *pEncodeBuffer, void **buffer, UINT32 *capacity, UINT32 *length, UINT64 *timestamp, UINT64 *duration, UINT32 *frameIdx, bool *is_keyframe) {
   NVENCSTATUS nvStatus = NV_ENC_SUCCESS;
   if (pEncodeBuffer->stOutputBfr.hBitstreamBuffer == NULL && pEncodeBuffer->stOutputBfr.bEOSFlag == FALSE) {
     return NV_ENC_ERR_INVALID_PARAM;
@@ -810,8 +810,16 @@ NVENCSTATUS CNvHWEncoder::ProcessOutput(const EncodeBuffer *pEncodeBuffer, void
     if (m_fOutput)
       fwrite(lockBitstreamData.bitstreamBufferPtr, 1, lockBitstreamData.bitstreamSizeInBytes, m_fOutput);
 
-    *buffer = malloc(lockBitstreamData.bitstreamSizeInBytes);
-    memcpy(*buffer, lockBitstreamData.bitstreamBufferPtr, lockBitstreamData.bitstreamSizeInBytes);
+    // *buffer is reused across frames and only grown when a frame doesn't fit
+    if (lockBitstreamData.bitstreamSizeInBytes > *capacity) {
+      free(*buffer);
+      *buffer = malloc(lockBitstreamData.bitstreamSizeInBytes);
+      *capacity = *buffer ? lockBitstreamData.bitstreamSizeInBytes : 0;
+    }
+    if (*buffer)
+      memcpy(*buffer, lockBitstreamData.bitstreamBufferPtr, lockBitstreamData.bitstreamSizeInBytes);
+    else
+      nvStatus = NV_ENC_ERR_OUT_OF_MEMORY;
     *length = lockBitstreamData.bitstreamSizeInBytes;
     *timestamp = lockBitstreamData.outputTimeStamp;
     *duration = lockBitstreamData.outputDuration;
@@ -819,7 +827,9 @@ NVENCSTATUS CNvHWEncoder::ProcessOutput(const EncodeBuffer *pEncodeBuffer, void
     *is_keyframe = lockBitstreamData.pictureType == NV_ENC_PIC_TYPE_I ||
       lockBitstreamData.pictureType == NV_ENC_PIC_TYPE_IDR;
 
-    nvStatus = m_pEncodeAPI->nvEncUnlockBitstream(m_hEncoder, pEncodeBuffer->stOutputBfr.hBitstreamBuffer);
+    const NVENCSTATUS unlockStatus = m_pEncodeAPI->nvEncUnlockBitstream(m_hEncoder, pEncodeBuffer->stOutputBfr.hBitstreamBuffer);
+    if (nvStatus == NV_ENC_SUCCESS)
+      nvStatus = unlockStatus;
   }
 
   return nvStatus;
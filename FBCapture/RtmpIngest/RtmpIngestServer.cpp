@@ -0,0 +1,387 @@
+/****************************************************************************************************************
+
+Filename	:	RtmpIngestServer.cpp
+Content		:
+Copyright	:
+
+****************************************************************************************************************/
+
+#include "RtmpIngestServer.h"
+#include "Encoder/FlvPacketizer.h"
+
+#include <algorithm>
+#include <math.h>
+#include <thread>
+
+namespace FBCapture {
+  namespace Streaming {
+
+    namespace {
+      const uint8_t kRtmpVersion = 3;
+      const uint32_t kMessageStreamId = 1;
+      const uint8_t kPeerBandwidthDynamic = 2;
+    }
+
+    RtmpIngestServer::RtmpIngestServer(const IngestOptions& options) :
+      options_(options),
+      random_(random_device {}()),
+      session_(0),
+      publishing_(false),
+      acknowledged_(0),
+      flv_(NULL),
+      stats_(NULL),
+      firstArrival_(true),
+      firstArrivalMs_(0),
+      firstTimestamp_(0),
+      window_ {},
+      total_ {},
+      throttledBytes_(0),
+      lostSegments_(0) {}
+
+    RtmpIngestServer::~RtmpIngestServer() {
+      closeRecording();
+    }
+
+    bool RtmpIngestServer::start() {
+      if (!listener_.listen(options_.port)) {
+        printf("Failed to listen on port %u\n", options_.port);
+        return false;
+      }
+      printf("Listening on rtmp://localhost:%u\n", options_.port);
+      return true;
+    }
+
+    bool RtmpIngestServer::serveOne() {
+      // wait for as long as it takes a publisher to show up
+      while (!listener_.accept(&socket_, kIdleTimeoutMs)) {
+        if (!listener_.isOpen())
+          return false;
+      }
+
+      if (options_.throttleKbps > 0) {
+        // a small window makes the publisher feel the throttled reads right away
+        socket_.setReceiveBufferSize(kThrottledReceiveBuffer);
+      }
+
+      writer_.reset();
+      reader_.reset();
+      publishing_ = false;
+      acknowledged_ = 0;
+      firstArrival_ = true;
+      window_ = {};
+      total_ = {};
+      lags_.clear();
+      throttledBytes_ = 0;
+      lostSegments_ = 0;
+      sessionStart_ = Clock::now();
+      lastReport_ = sessionStart_;
+
+      if (!handshake()) {
+        printf("Handshake failed\n");
+        socket_.close();
+        return true;
+      }
+
+      openRecording();
+      while (reader_.read(&socket_, &message_)) {
+        if (socket_.bytesReceived() - acknowledged_ >= kWindowAckSize) {
+          acknowledged_ = socket_.bytesReceived();
+          uint8_t body[4];
+          FlvPacketizer::ui32ToBytes(body, static_cast<uint32_t>(acknowledged_));
+          sendControl(RTMP_MSG_ACKNOWLEDGEMENT, body, sizeof(body));
+        }
+
+        if (message_.type == RTMP_MSG_COMMAND_AMF0) {
+          if (!handleCommand())
+            break;
+        } else if (message_.type == RTMP_MSG_AUDIO || message_.type == RTMP_MSG_VIDEO || message_.type == RTMP_MSG_DATA_AMF0) {
+          if (message_.type != RTMP_MSG_DATA_AMF0)
+            recordArrival(message_);
+          writeTag(message_);
+        }
+
+        simulateUplink();
+        if (elapsedMs(lastReport_) >= kReportIntervalMs)
+          report(false);
+      }
+
+      report(true);
+      closeRecording();
+      socket_.close();
+      session_++;
+      return true;
+    }
+
+    bool RtmpIngestServer::handshake() {
+      // C0 and C1, answered with S0, S1 and S2 echoing C1
+      vector<uint8_t> c0c1(1 + RTMP_HANDSHAKE_SIZE);
+      if (!socket_.recv(c0c1.data(), static_cast<uint32_t>(c0c1.size())) || c0c1[0] != kRtmpVersion)
+        return false;
+
+      vector<uint8_t> s0s1s2(1 + 2 * RTMP_HANDSHAKE_SIZE, 0);
+      s0s1s2[0] = kRtmpVersion;
+      for (auto i = 1 + 8; i < 1 + RTMP_HANDSHAKE_SIZE; i++)
+        s0s1s2[i] = static_cast<uint8_t>(random_());
+      copy(c0c1.begin() + 1, c0c1.end(), s0s1s2.begin() + 1 + RTMP_HANDSHAKE_SIZE);
+      if (!socket_.send(s0s1s2.data(), static_cast<uint32_t>(s0s1s2.size())))
+        return false;
+
+      vector<uint8_t> c2(RTMP_HANDSHAKE_SIZE);
+      return socket_.recv(c2.data(), RTMP_HANDSHAKE_SIZE);
+    }
+
+    bool RtmpIngestServer::handleCommand() {
+      Amf0Reader reader(message_.body.data(), static_cast<uint32_t>(message_.body.size()));
+      string name;
+      double transactionId;
+      if (!reader.readString(&name) || !reader.readNumber(&transactionId))
+        return true;
+
+      if (name == "connect") {
+        map<string, string> properties;
+        reader.readObject(&properties);
+        printf("Publisher connected to app \"%s\" (%s)\n", properties["app"].c_str(), properties["flashVer"].c_str());
+
+        uint8_t body[5];
+        FlvPacketizer::ui32ToBytes(body, kWindowAckSize);
+        auto sent = sendControl(RTMP_MSG_WINDOW_ACK_SIZE, body, 4);
+        body[4] = kPeerBandwidthDynamic;
+        sent = sent && sendControl(RTMP_MSG_SET_PEER_BANDWIDTH, body, 5);
+        FlvPacketizer::ui32ToBytes(body, kOutChunkSize);
+        sent = sent && sendControl(RTMP_MSG_SET_CHUNK_SIZE, body, 4);
+        writer_.setChunkSize(kOutChunkSize);
+
+        command_.clear();
+        command_.writeString("_result");
+        command_.writeNumber(transactionId);
+        command_.writeObjectStart();
+        command_.writeStringProperty("fmsVer", "FMS/3,0,1,123");
+        command_.writeNumberProperty("capabilities", 31);
+        command_.writeObjectEnd();
+        command_.writeObjectStart();
+        command_.writeStringProperty("level", "status");
+        command_.writeStringProperty("code", "NetConnection.Connect.Success");
+        command_.writeStringProperty("description", "Connection succeeded.");
+        command_.writeNumberProperty("objectEncoding", 0);
+        command_.writeObjectEnd();
+        return sent && sendCommand(RTMP_CHANNEL_COMMAND, 0);
+      }
+
+      if (name == "releaseStream" || name == "FCPublish" || name == "createStream") {
+        command_.clear();
+        command_.writeString("_result");
+        command_.writeNumber(transactionId);
+        command_.writeNull();
+        if (name == "createStream")
+          command_.writeNumber(kMessageStreamId);
+        else
+          command_.writeNull();
+        return sendCommand(RTMP_CHANNEL_COMMAND, 0);
+      }
+
+      if (name == "publish") {
+        string streamKey;
+        reader.readNull();
+        reader.readString(&streamKey);
+        printf("Publishing stream \"%s\"\n", streamKey.c_str());
+
+        uint8_t body[6];
+        FlvPacketizer::ui32ToBytes(FlvPacketizer::ui16ToBytes(body, RTMP_EVENT_STREAM_BEGIN), kMessageStreamId);
+        publishing_ = sendControl(RTMP_MSG_USER_CONTROL, body, sizeof(body)) &&
+          sendStatus("NetStream.Publish.Start", "Start publishing");
+        sessionStart_ = Clock::now();
+        return publishing_;
+      }
+
+      if (name == "FCUnpublish" || name == "deleteStream" || name == "closeStream") {
+        printf("Publisher stopped (%s)\n", name.c_str());
+        return false;
+      }
+      return true;
+    }
+
+    bool RtmpIngestServer::send(const uint32_t channel, const uint8_t type, const uint32_t streamId,
+                                const uint8_t* body, const uint32_t length) {
+      const IoVec iov = { body, length };
+      writer_.write(channel, type, 0, streamId, &iov, 1, &iov_);
+      return socket_.sendV(iov_.data(), static_cast<uint32_t>(iov_.size()));
+    }
+
+    bool RtmpIngestServer::sendControl(const uint8_t type, const uint8_t* body, const uint32_t length) {
+      return send(RTMP_CHANNEL_CONTROL, type, 0, body, length);
+    }
+
+    bool RtmpIngestServer::sendCommand(const uint32_t channel, const uint32_t streamId) {
+      return send(channel, RTMP_MSG_COMMAND_AMF0, streamId, command_.data(), command_.size());
+    }
+
+    bool RtmpIngestServer::sendStatus(const string& code, const string& description) {
+      command_.clear();
+      command_.writeString("onStatus");
+      command_.writeNumber(0);
+      command_.writeNull();
+      command_.writeObjectStart();
+      command_.writeStringProperty("level", "status");
+      command_.writeStringProperty("code", code);
+      command_.writeStringProperty("description", description);
+      command_.writeObjectEnd();
+      return sendCommand(RTMP_CHANNEL_STREAM_COMMAND, kMessageStreamId);
+    }
+
+    void RtmpIngestServer::openRecording() {
+      const auto suffix = session_ > 0 ? "." + to_string(session_) : "";
+      if (!options_.flvPath.empty()) {
+        const auto path = options_.flvPath + suffix;
+        flv_ = fopen(path.c_str(), "wb");
+        if (flv_) {
+          // audio and video, followed by the first PreviousTagSize
+          static const uint8_t kFlvHeader[] = { 'F', 'L', 'V', 1, 0x05, 0, 0, 0, 9, 0, 0, 0, 0 };
+          fwrite(kFlvHeader, 1, sizeof(kFlvHeader), flv_);
+        } else {
+          printf("Failed to open %s\n", path.c_str());
+        }
+      }
+
+      if (!options_.statsPath.empty()) {
+        const auto path = options_.statsPath + suffix;
+        stats_ = fopen(path.c_str(), "w");
+        if (stats_)
+          fprintf(stats_, "arrival_ms,timestamp_ms,type,size,lag_ms\n");
+        else
+          printf("Failed to open %s\n", path.c_str());
+      }
+    }
+
+    void RtmpIngestServer::closeRecording() {
+      if (flv_)
+        fclose(flv_);
+      flv_ = NULL;
+      if (stats_)
+        fclose(stats_);
+      stats_ = NULL;
+    }
+
+    void RtmpIngestServer::writeTag(const RtmpMessage& message) {
+      if (!flv_)
+        return;
+
+      auto data = message.body.data();
+      auto size = static_cast<uint32_t>(message.body.size());
+      if (message.type == RTMP_MSG_DATA_AMF0) {
+        // publishers wrap onMetaData in @setDataFrame, which isn't part of the FLV script tag
+        Amf0Reader reader(data, size);
+        string name;
+        if (reader.readString(&name) && name == "@setDataFrame") {
+          const auto skipped = 3 + static_cast<uint32_t>(name.size());
+          data += skipped;
+          size -= skipped;
+        }
+      }
+
+      uint8_t header[FLV_TAG_HEADER_SIZE];
+      auto p = FlvPacketizer::ui08ToBytes(header, message.type);
+      p = FlvPacketizer::ui24ToBytes(p, size);
+      p = FlvPacketizer::ui24ToBytes(p, message.timestamp & 0xffffff);
+      p = FlvPacketizer::ui08ToBytes(p, static_cast<uint8_t>(message.timestamp >> 24));
+      FlvPacketizer::ui24ToBytes(p, 0);
+
+      uint8_t footer[FLV_TAG_FOOTER_SIZE];
+      FlvPacketizer::ui32ToBytes(footer, FLV_TAG_HEADER_SIZE + size);
+
+      const IoVec iov[] = {
+        { header, FLV_TAG_HEADER_SIZE },
+        { data, size },
+        { footer, FLV_TAG_FOOTER_SIZE },
+      };
+      WriteV(flv_, iov, 3);
+    }
+
+    void RtmpIngestServer::recordArrival(const RtmpMessage& message) {
+      const auto arrivalMs = elapsedMs(sessionStart_);
+      if (firstArrival_) {
+        firstArrival_ = false;
+        firstArrivalMs_ = arrivalMs;
+        firstTimestamp_ = message.timestamp;
+      }
+
+      const auto lagMs = (arrivalMs - firstArrivalMs_) - (static_cast<double>(message.timestamp) - firstTimestamp_);
+      lags_.push_back(lagMs);
+
+      for (auto window : { &window_, &total_ }) {
+        window->bytes += message.body.size();
+        window->messages++;
+        window->lagSumMs += lagMs;
+        window->lagMaxMs = max(window->lagMaxMs, lagMs);
+      }
+
+      if (stats_) {
+        fprintf(stats_, "%.3f,%u,%s,%u,%.3f\n", arrivalMs, message.timestamp,
+                message.type == RTMP_MSG_VIDEO ? "video" : "audio", static_cast<uint32_t>(message.body.size()), lagMs);
+      }
+    }
+
+    void RtmpIngestServer::simulateUplink() {
+      if (!publishing_)
+        return;
+
+      if (options_.segmentLossRate > 0) {
+        // Reading the message took this many segments, any of which may have needed a retransmission
+        const auto received = socket_.bytesReceived();
+        const auto segments = static_cast<uint32_t>((received - throttledBytes_ + kSegmentSize - 1) / kSegmentSize);
+        throttledBytes_ = received;
+        bernoulli_distribution lost(options_.segmentLossRate);
+        uint32_t stalls = 0;
+        for (uint32_t i = 0; i < segments; i++)
+          stalls += lost(random_) ? 1 : 0;
+        if (stalls > 0) {
+          lostSegments_ += stalls;
+          this_thread::sleep_for(chrono::milliseconds(static_cast<uint64_t>(stalls) * options_.retransmitDelayMs));
+        }
+      }
+
+      if (options_.throttleKbps > 0) {
+        // don't read ahead of the rate the uplink would have delivered the bytes at
+        const auto dueMs = static_cast<double>(socket_.bytesReceived()) * 8 / options_.throttleKbps;
+        const auto aheadMs = dueMs - elapsedMs(sessionStart_);
+        if (aheadMs > 1)
+          this_thread::sleep_for(chrono::microseconds(static_cast<int64_t>(aheadMs * 1000)));
+      }
+    }
+
+    void RtmpIngestServer::report(const bool final) {
+      const auto windowMs = max(elapsedMs(lastReport_), 1.0);
+      lastReport_ = Clock::now();
+
+      if (!final) {
+        printf("%7.1fs %8.0f kbps %5u msgs  lag avg %7.1f ms max %7.1f ms\n",
+               elapsedMs(sessionStart_) / 1000, window_.bytes * 8 / windowMs, window_.messages,
+               window_.messages ? window_.lagSumMs / window_.messages : 0, window_.lagMaxMs);
+        window_ = {};
+        return;
+      }
+
+      if (lags_.empty()) {
+        printf("No audio or video received\n");
+        return;
+      }
+
+      auto sorted = lags_;
+      sort(sorted.begin(), sorted.end());
+      const auto percentile = [&sorted](const double p) {
+        return sorted[static_cast<size_t>(floor(p * (sorted.size() - 1)))];
+      };
+      const auto durationMs = max(elapsedMs(sessionStart_), 1.0);
+
+      printf("Session %u: %u messages, %llu bytes in %.1f s, %.0f kbps\n", session_, total_.messages,
+             static_cast<unsigned long long>(total_.bytes), durationMs / 1000, total_.bytes * 8 / durationMs);
+      printf("Lag p50 %.1f ms, p95 %.1f ms, p99 %.1f ms, max %.1f ms\n",
+             percentile(0.5), percentile(0.95), percentile(0.99), sorted.back());
+      if (options_.segmentLossRate > 0)
+        printf("Simulated %u lost segments\n", lostSegments_);
+    }
+
+    double RtmpIngestServer::elapsedMs(const Clock::time_point since) const {
+      return chrono::duration<double, milli>(Clock::now() - since).count();
+    }
+  }
+}
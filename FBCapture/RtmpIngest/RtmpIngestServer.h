@@ -0,0 +1,125 @@
+/****************************************************************************************************************
+
+Filename	:	RtmpIngestServer.h
+Content		:	Stand-in RTMP ingest server that records what a publisher sends and measures how it arrives
+Copyright	:
+
+****************************************************************************************************************/
+
+#pragma once
+
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "Encoder/Amf0Reader.h"
+#include "Encoder/Amf0Writer.h"
+#include "Encoder/RtmpChunk.h"
+#include "Encoder/TcpSocket.h"
+
+using namespace std;
+
+namespace FBCapture {
+  namespace Streaming {
+
+    struct IngestOptions {
+      uint16_t port;
+      string flvPath;             // received stream, empty to not record
+      string statsPath;           // CSV with one line per received audio/video message, empty for none
+      uint32_t throttleKbps;      // caps how fast the server reads, 0 for no limit
+      double segmentLossRate;     // chance that a TCP segment is lost, 0 to 1
+      uint32_t retransmitDelayMs; // stall the sender sees for each lost segment
+      bool keepListening;         // serve one publisher after another instead of exiting after the first
+
+      IngestOptions() :
+        port(1935),
+        throttleKbps(0),
+        segmentLossRate(0),
+        retransmitDelayMs(200),
+        keepListening(false) {}
+    };
+
+    /*
+    * Accepts one publisher at a time, answers the connect/createStream/publish exchange and writes
+    * the audio, video and script messages it receives to an FLV file.
+    *
+    * Latency is measured per message as how far its arrival lags behind its own timestamp, relative to
+    * the first message, so it shows how much the uplink delays the stream rather than the absolute
+    * glass to glass latency. A throttled uplink is simulated by reading no faster than the given rate,
+    * which backs the publisher up through TCP flow control. A lossy one by stalling reads for a
+    * retransmission timeout for each segment that is deemed lost, which is what a loss costs a TCP sender.
+    */
+    class RtmpIngestServer {
+    public:
+      explicit RtmpIngestServer(const IngestOptions& options);
+      ~RtmpIngestServer();
+
+      bool start();
+      // Serves the next publisher until it unpublishes or disconnects. False if none could be accepted.
+      bool serveOne();
+
+    private:
+      using Clock = chrono::steady_clock;
+
+      static const uint32_t kOutChunkSize = 4096;
+      static const uint32_t kWindowAckSize = 2500000;
+      static const uint32_t kSegmentSize = 1460;
+      static const int kThrottledReceiveBuffer = 64 * 1024;
+      static const uint32_t kIdleTimeoutMs = 30000;
+      static const uint32_t kReportIntervalMs = 1000;
+
+      struct Window {
+        uint64_t bytes;
+        uint32_t messages;
+        double lagSumMs;
+        double lagMaxMs;
+      };
+
+      bool handshake();
+      bool handleCommand();
+      bool send(uint32_t channel, uint8_t type, uint32_t streamId, const uint8_t* body, uint32_t length);
+      bool sendControl(uint8_t type, const uint8_t* body, uint32_t length);
+      bool sendCommand(uint32_t channel, uint32_t streamId);
+      bool sendStatus(const string& code, const string& description);
+
+      void openRecording();
+      void closeRecording();
+      void writeTag(const RtmpMessage& message);
+      void recordArrival(const RtmpMessage& message);
+      void simulateUplink();
+      void report(bool final);
+
+      double elapsedMs(Clock::time_point since) const;
+
+      IngestOptions options_;
+      TcpSocket listener_;
+      TcpSocket socket_;
+      RtmpChunkWriter writer_;
+      RtmpChunkReader reader_;
+      Amf0Writer command_;
+      RtmpMessage message_;
+      vector<IoVec> iov_;
+      mt19937 random_;
+
+      uint32_t session_;
+      bool publishing_;
+      uint64_t acknowledged_;
+      FILE* flv_;
+      FILE* stats_;
+
+      Clock::time_point sessionStart_;
+      Clock::time_point lastReport_;
+      bool firstArrival_;
+      double firstArrivalMs_;
+      uint32_t firstTimestamp_;
+      Window window_;
+      Window total_;
+      vector<double> lags_;
+      uint64_t throttledBytes_;   // bytes received when throttling started
+      uint32_t lostSegments_;
+    };
+  }
+}
@@ -0,0 +1,64 @@
+/****************************************************************************************************************
+
+Filename	:	main.cpp
+Content		:	Command line of the stand-in RTMP ingest server used to benchmark streaming
+Copyright	:
+
+****************************************************************************************************************/
+
+#include "RtmpIngestServer.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+using namespace FBCapture::Streaming;
+
+namespace {
+  void usage() {
+    printf("Usage: RtmpIngest [options]\n"
+           "  -p <port>      port to listen on, 1935 by default\n"
+           "  -o <file.flv>  record the received stream\n"
+           "  -s <file.csv>  write the arrival time and lag of every audio/video message\n"
+           "  -r <kbps>      throttle the uplink to this rate\n"
+           "  -l <percent>   lose this share of TCP segments\n"
+           "  -t <ms>        retransmission timeout a lost segment costs, 200 by default\n"
+           "  -k             keep serving publishers after the first one\n");
+  }
+}
+
+int main(int argc, char** argv) {
+  IngestOptions options;
+  for (auto i = 1; i < argc; i++) {
+    const auto hasValue = i + 1 < argc;
+    if (!strcmp(argv[i], "-p") && hasValue)
+      options.port = static_cast<uint16_t>(atoi(argv[++i]));
+    else if (!strcmp(argv[i], "-o") && hasValue)
+      options.flvPath = argv[++i];
+    else if (!strcmp(argv[i], "-s") && hasValue)
+      options.statsPath = argv[++i];
+    else if (!strcmp(argv[i], "-r") && hasValue)
+      options.throttleKbps = static_cast<uint32_t>(atoi(argv[++i]));
+    else if (!strcmp(argv[i], "-l") && hasValue)
+      options.segmentLossRate = atof(argv[++i]) / 100;
+    else if (!strcmp(argv[i], "-t") && hasValue)
+      options.retransmitDelayMs = static_cast<uint32_t>(atoi(argv[++i]));
+    else if (!strcmp(argv[i], "-k"))
+      options.keepListening = true;
+    else {
+      usage();
+      return 1;
+    }
+  }
+
+  if (options.segmentLossRate < 0 || options.segmentLossRate > 1) {
+    usage();
+    return 1;
+  }
+
+  RtmpIngestServer server(options);
+  if (!server.start())
+    return 1;
+
+  while (server.serveOne() && options.keepListening) {}
+  return 0;
+}
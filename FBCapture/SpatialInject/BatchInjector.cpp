@@ -0,0 +1,268 @@
+/****************************************************************************************************************
+
+Filename	:	BatchInjector.cpp
+Content		:
+Copyright	:
+
+****************************************************************************************************************/
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
+#include "BatchInjector.h"
+
+#include <chrono>
+#include <iostream>
+#include <stdio.h>
+#include <ctype.h>
+
+#define BATCH_KB 1024.0
+#define BATCH_MB (1024.0 * 1024.0)
+
+namespace FBCapture {
+  namespace SpatialMedia {
+
+    namespace {
+      // Drops what the metadata utils print for each step, which would be interleaved across workers
+      class NullBuffer : public streambuf {
+      protected:
+        int overflow(const int c) override {
+          return c;
+        }
+      };
+
+      uint64_t fileSize(const string& path) {
+        fstream file(path.c_str(), ios::in | ios::binary | ios::ate);
+        return file.is_open() ? static_cast<uint64_t>(file.tellg()) : 0;
+      }
+
+      bool isMpeg4(const string& name) {
+        const auto dot = name.rfind('.');
+        if (dot == string::npos)
+          return false;
+        auto extension = name.substr(dot);
+        for (auto& c : extension)
+          c = static_cast<char>(tolower(c));
+        for (const auto known : MPEG_FILE_EXTENSIONS) {
+          if (extension == known)
+            return true;
+        }
+        return false;
+      }
+
+      double megabytesPerSecond(const uint64_t bytes, const double seconds) {
+        return seconds > 0 ? bytes / BATCH_MB / seconds : 0;
+      }
+
+      // files patched in place only get a moov of a few KB written
+      string formatSize(const uint64_t bytes) {
+        char value[32];
+        if (bytes < BATCH_MB)
+          snprintf(value, sizeof(value), "%.1f KB", bytes / BATCH_KB);
+        else
+          snprintf(value, sizeof(value), "%.1f MB", bytes / BATCH_MB);
+        return value;
+      }
+    }
+
+    BatchInjector::BatchInjector(const BatchOptions& options) :
+      options_(options),
+      next_(0),
+      ioInFlight_(0) {
+      Utils utils;
+      sphericalXml_ = utils.generate_spherical_xml(
+        options_.projection,
+        options_.stereoMode,
+        options_.stitchingSoftware,
+        NULL
+      );
+    }
+
+    bool BatchInjector::collectFiles(const string& path, vector<string>* files) {
+#ifdef _WIN32
+      const auto attributes = GetFileAttributesA(path.c_str());
+      if (attributes == INVALID_FILE_ATTRIBUTES)
+        return false;
+      if (!(attributes & FILE_ATTRIBUTE_DIRECTORY)) {
+        files->push_back(path);
+        return true;
+      }
+
+      WIN32_FIND_DATAA entry;
+      const auto find = FindFirstFileA((path + "\\*").c_str(), &entry);
+      if (find == INVALID_HANDLE_VALUE)
+        return false;
+      do {
+        if (!(entry.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) && isMpeg4(entry.cFileName))
+          files->push_back(path + "\\" + entry.cFileName);
+      } while (FindNextFileA(find, &entry));
+      FindClose(find);
+#else
+      struct stat info;
+      if (stat(path.c_str(), &info) != 0)
+        return false;
+      if (!S_ISDIR(info.st_mode)) {
+        files->push_back(path);
+        return true;
+      }
+
+      const auto dir = opendir(path.c_str());
+      if (!dir)
+        return false;
+      while (const auto entry = readdir(dir)) {
+        const auto file = path + "/" + entry->d_name;
+        if (stat(file.c_str(), &info) == 0 && S_ISREG(info.st_mode) && isMpeg4(entry->d_name))
+          files->push_back(file);
+      }
+      closedir(dir);
+#endif
+      return true;
+    }
+
+    bool BatchInjector::run(const vector<string>& files) {
+      if (sphericalXml_.length() <= 1) {
+        fprintf(stderr, "Failed to generate spherical video metadata\n");
+        return false;
+      }
+
+      vector<pair<uint64_t, string>> bySize;
+      for (const auto& file : files)
+        bySize.push_back(make_pair(fileSize(file), file));
+      stable_sort(bySize.begin(), bySize.end(), [](const pair<uint64_t, string>& a, const pair<uint64_t, string>& b) {
+        return a.first > b.first;
+      });
+      files_.clear();
+      for (const auto& file : bySize)
+        files_.push_back(file.second);
+
+      results_.assign(files_.size(), BatchFileResult());
+      next_ = 0;
+      ioInFlight_ = 0;
+
+      NullBuffer quiet;
+      streambuf* coutBuffer = NULL;
+      if (!options_.verbose)
+        coutBuffer = cout.rdbuf(&quiet);
+
+      const auto start = chrono::steady_clock::now();
+      const auto workerCount = max<size_t>(min<size_t>(options_.workers, files_.size()), 1);
+      vector<thread> workers;
+      for (size_t i = 0; i < workerCount; i++)
+        workers.emplace_back([this] { this->work(); });
+      for (auto& worker : workers)
+        worker.join();
+      const auto seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+      if (coutBuffer)
+        cout.rdbuf(coutBuffer);
+
+      uint32_t injected = 0, skipped = 0, failed = 0;
+      uint64_t bytes = 0;
+      for (const auto& result : results_) {
+        switch (result.result) {
+          case BATCH_RESULT::INJECTED:
+            injected++;
+            bytes += result.bytes;
+            break;
+          case BATCH_RESULT::SKIPPED:
+            skipped++;
+            break;
+          default:
+            failed++;
+            break;
+        }
+      }
+
+      // over the wall time of the whole batch, so it shows what the pool and the I/O slots achieve together
+      printf("%u injected, %u skipped, %u failed: %s written in %.2f s, %.1f MB/s\n",
+             injected, skipped, failed, formatSize(bytes).c_str(), seconds, megabytesPerSecond(bytes, seconds));
+      return failed == 0;
+    }
+
+    void BatchInjector::work() {
+      for (auto index = next_++; index < files_.size(); index = next_++) {
+        results_[index] = process(files_[index]);
+        report(results_[index]);
+      }
+    }
+
+    BatchFileResult BatchInjector::process(const string& path) {
+      BatchFileResult result;
+      result.path = path;
+      result.result = BATCH_RESULT::FAILED;
+      result.bytes = 0;
+      result.seconds = 0;
+
+      Utils utils;
+      if (utils.has_spherical_uuid(path)) {
+        result.result = BATCH_RESULT::SKIPPED;
+        return result;
+      }
+
+      auto xml = sphericalXml_;
+      Metadata metadata;
+      metadata.setVideoXML(xml);
+
+      acquireIo();
+      const auto start = chrono::steady_clock::now();
+      bool injected;
+      if (options_.outputDirectory.empty()) {
+        injected = utils.inject_mpeg4_in_place(path, &metadata, &result.bytes);
+      } else {
+        auto output = outputPath(path);
+        injected = utils.inject_metadata(path, output, &metadata);
+        if (injected)
+          result.bytes = fileSize(output);
+      }
+      result.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+      releaseIo();
+
+      if (injected)
+        result.result = BATCH_RESULT::INJECTED;
+      return result;
+    }
+
+    string BatchInjector::outputPath(const string& path) const {
+      const auto nameStart = path.find_last_of("/\\");
+      const auto name = nameStart == string::npos ? path : path.substr(nameStart + 1);
+      const auto last = options_.outputDirectory.back();
+      return options_.outputDirectory + (last == '/' || last == '\\' ? "" : "/") + name;
+    }
+
+    void BatchInjector::acquireIo() {
+      unique_lock<mutex> lock(ioMtx_);
+      ioCv_.wait(lock, [this] { return ioInFlight_ < options_.maxInFlightIo; });
+      ioInFlight_++;
+    }
+
+    void BatchInjector::releaseIo() {
+      {
+        lock_guard<mutex> lock(ioMtx_);
+        ioInFlight_--;
+      }
+      ioCv_.notify_one();
+    }
+
+    void BatchInjector::report(const BatchFileResult& result) {
+      lock_guard<mutex> lock(printMtx_);
+      switch (result.result) {
+        case BATCH_RESULT::INJECTED:
+          printf("injected  %s: %s written in %.2f s, %.1f MB/s\n", result.path.c_str(),
+                 formatSize(result.bytes).c_str(), result.seconds, megabytesPerSecond(result.bytes, result.seconds));
+          break;
+        case BATCH_RESULT::SKIPPED:
+          printf("skipped   %s: already has spherical metadata\n", result.path.c_str());
+          break;
+        default:
+          printf("FAILED    %s\n", result.path.c_str());
+          break;
+      }
+      fflush(stdout);
+    }
+  }
+}
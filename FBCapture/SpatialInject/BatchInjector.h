@@ -0,0 +1,96 @@
+/****************************************************************************************************************
+
+Filename	:	BatchInjector.h
+Content		:	Injects spherical metadata into a batch of mp4 files on a pool of worker threads
+Copyright	:
+
+****************************************************************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+
+#include "metadata_utils.h"
+
+using namespace std;
+
+namespace FBCapture {
+  namespace SpatialMedia {
+
+    struct BatchOptions {
+      uint32_t workers;            // threads checking and injecting files
+      uint32_t maxInFlightIo;      // injections running at once, each one reads and writes the file
+      string outputDirectory;      // injected copies are written there, files are patched in place if empty
+      string stitchingSoftware;
+      Projection projection;
+      StereoMode stereoMode;
+      bool verbose;                // keep the step by step output of the metadata utils
+
+      BatchOptions() :
+        workers(max(thread::hardware_concurrency(), 1u)),
+        maxInFlightIo(2),
+        stitchingSoftware("Facebook 360 Capture SDK"),
+        projection(Projection::EQUIRECT),
+        stereoMode(StereoMode::SM_NONE),
+        verbose(false) {}
+    };
+
+    enum class BATCH_RESULT {
+      INJECTED,
+      SKIPPED,   // already carries the spherical uuid
+      FAILED
+    };
+
+    struct BatchFileResult {
+      string path;
+      BATCH_RESULT result;
+      uint64_t bytes;              // written by the injection, only the moov for files patched in place
+      double seconds;              // spent injecting, not waiting for an I/O slot
+    };
+
+    /*
+    * Every worker takes the next file, checks it for the spherical uuid and injects the metadata if it has none.
+    * The check only maps the moov so it runs on all workers at once, while the injections themselves wait for one
+    * of maxInFlightIo slots, so a large pool doesn't thrash the disk. The largest files are started first, which
+    * keeps a big file from being the last one left running alone.
+    */
+    class BatchInjector {
+    public:
+      explicit BatchInjector(const BatchOptions& options);
+
+      // Prints a line per file as it completes and the totals at the end. False if any file failed.
+      bool run(const vector<string>& files);
+
+      // Adds path if it is a file, or the mp4 and mov files in it if it is a directory
+      static bool collectFiles(const string& path, vector<string>* files);
+
+    private:
+      BatchOptions options_;
+      string sphericalXml_;
+
+      vector<string> files_;
+      vector<BatchFileResult> results_;
+      atomic<size_t> next_;          // index of the next file to take
+
+      mutex ioMtx_;
+      condition_variable ioCv_;      // signalled when an injection completes
+      uint32_t ioInFlight_;
+
+      mutex printMtx_;
+
+      void work();
+      BatchFileResult process(const string& path);
+      string outputPath(const string& path) const;
+      void acquireIo();
+      void releaseIo();
+      void report(const BatchFileResult& result);
+    };
+  }
+}
@@ -0,0 +1,89 @@
+/****************************************************************************************************************
+
+Filename	:	main.cpp
+Content		:	Command line of the batch spherical metadata injector
+Copyright	:
+
+****************************************************************************************************************/
+
+#include "BatchInjector.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+using namespace FBCapture::SpatialMedia;
+
+namespace {
+  void usage() {
+    printf("Usage: SpatialInject [options] <file or directory>...\n"
+           "  -j <workers>     worker threads, the hardware threads by default\n"
+           "  -i <jobs>        injections reading and writing files at once, 2 by default\n"
+           "  -o <directory>   write injected copies there instead of patching the files in place\n"
+           "  -p <projection>  equirect (default) or cubemap\n"
+           "  -m <stereo>      none (default), top-bottom or left-right\n"
+           "  -s <software>    stitching software written in the metadata\n"
+           "  -v               print every step of every injection\n"
+           "Files that already have spherical metadata are skipped. Directories add their mp4 and mov files.\n");
+  }
+
+  bool parseProjection(const char* value, Projection* projection) {
+    if (!strcmp(value, "equirect"))
+      *projection = Projection::EQUIRECT;
+    else if (!strcmp(value, "cubemap"))
+      *projection = Projection::CUBEMAP;
+    else
+      return false;
+    return true;
+  }
+
+  bool parseStereoMode(const char* value, StereoMode* stereoMode) {
+    if (!strcmp(value, "none"))
+      *stereoMode = StereoMode::SM_NONE;
+    else if (!strcmp(value, "top-bottom"))
+      *stereoMode = StereoMode::SM_TOP_BOTTOM;
+    else if (!strcmp(value, "left-right"))
+      *stereoMode = StereoMode::SM_LEFT_RIGHT;
+    else
+      return false;
+    return true;
+  }
+}
+
+int main(int argc, char** argv) {
+  BatchOptions options;
+  vector<string> files;
+  for (auto i = 1; i < argc; i++) {
+    const auto hasValue = i + 1 < argc;
+    if (!strcmp(argv[i], "-j") && hasValue)
+      options.workers = static_cast<uint32_t>(atoi(argv[++i]));
+    else if (!strcmp(argv[i], "-i") && hasValue)
+      options.maxInFlightIo = static_cast<uint32_t>(atoi(argv[++i]));
+    else if (!strcmp(argv[i], "-o") && hasValue)
+      options.outputDirectory = argv[++i];
+    else if (!strcmp(argv[i], "-p") && hasValue && parseProjection(argv[i + 1], &options.projection))
+      i++;
+    else if (!strcmp(argv[i], "-m") && hasValue && parseStereoMode(argv[i + 1], &options.stereoMode))
+      i++;
+    else if (!strcmp(argv[i], "-s") && hasValue)
+      options.stitchingSoftware = argv[++i];
+    else if (!strcmp(argv[i], "-v"))
+      options.verbose = true;
+    else if (argv[i][0] != '-') {
+      if (!BatchInjector::collectFiles(argv[i], &files)) {
+        fprintf(stderr, "Can't read %s\n", argv[i]);
+        return 1;
+      }
+    } else {
+      usage();
+      return 1;
+    }
+  }
+
+  if (files.empty() || options.workers == 0 || options.maxInFlightIo == 0) {
+    usage();
+    return 1;
+  }
+
+  BatchInjector injector(options);
+  return injector.run(files) ? 0 : 1;
+}
@@ -18,6 +18,8 @@
 
 #include <iostream>
 #include <sstream>
+#include <algorithm>
+#include <stdio.h>
 
 #include "mpeg/constants.h"
 #include "mpeg/mpeg4_container.h"
@@ -78,7 +80,9 @@ namespace FBCapture {
       m_iNumAudioChannels = 0;
     }
 
-    ParsedMetadata::~ParsedMetadata() {}
+    ParsedMetadata::~ParsedMetadata() {
+      delete m_pAudio;
+    }
 
     Utils::Utils() {}
 
@@ -118,27 +122,27 @@ namespace FBCapture {
       if (!pMoov)
         return false;
 
-      vector<mpeg::Box *>::iterator it = pMoov->m_listContents.begin();
-      while (it != pMoov->m_listContents.end()) {
+      vector<mpeg::Box *>::iterator it = pMoov->contents().begin();
+      while (it != pMoov->contents().end()) {
         mpeg::Container *pBox = (mpeg::Container *)*it++;
         if (memcmp(pBox->m_name, mpeg::constants::TAG_TRAK, 4) == 0) {
           bAdded = false;
           pBox->remove(mpeg::constants::TAG_UUID);
 
-          vector<mpeg::Box *>::iterator it2 = pBox->m_listContents.begin();
-          while (it2 != pBox->m_listContents.end()) {
+          vector<mpeg::Box *>::iterator it2 = pBox->contents().begin();
+          while (it2 != pBox->contents().end()) {
             mpeg::Container *pSub = (mpeg::Container *)*it2++;
             if (memcmp(pSub->m_name, mpeg::constants::TAG_MDIA, 4) != 0)
               continue;
 
-            vector<mpeg::Box *>::iterator it3 = pSub->m_listContents.begin();
-            while (it3 != pSub->m_listContents.end()) {
+            vector<mpeg::Box *>::iterator it3 = pSub->contents().begin();
+            while (it3 != pSub->contents().end()) {
               mpeg::Box *pMDIA = *it3++;
               if (memcmp(pMDIA->m_name, mpeg::constants::TAG_HDLR, 4) != 0)
                 continue;
 
               char name[4];
-              int iPos = pMDIA->content_start() + 8;
+              uint64_t iPos = pMDIA->content_start() + 8;
               inFile.seekg(iPos);
               inFile.read(name, 4);
               if (memcmp(name, mpeg::constants::TRAK_TYPE_VIDE, 4) == 0) {
@@ -170,26 +174,26 @@ namespace FBCapture {
       if (!pMoov)
         return false;
 
-      vector<mpeg::Box *>::iterator it = pMoov->m_listContents.begin();
-      while (it != pMoov->m_listContents.end()) {
+      vector<mpeg::Box *>::iterator it = pMoov->contents().begin();
+      while (it != pMoov->contents().end()) {
         mpeg::Container *pBox = (mpeg::Container *)*it++;
         if (memcmp(pBox->m_name, mpeg::constants::TAG_TRAK, 4) != 0)
           continue;
 
-        vector<mpeg::Box *>::iterator it2 = pBox->m_listContents.begin();
-        while (it2 != pBox->m_listContents.end()) {
+        vector<mpeg::Box *>::iterator it2 = pBox->contents().begin();
+        while (it2 != pBox->contents().end()) {
           mpeg::Container *pSub = (mpeg::Container *)*it2++;
           if (memcmp(pSub->m_name, mpeg::constants::TAG_MDIA, 4) != 0)
             continue;
 
-          vector<mpeg::Box *>::iterator it3 = pSub->m_listContents.begin();
-          while (it3 != pSub->m_listContents.end()) {
+          vector<mpeg::Box *>::iterator it3 = pSub->contents().begin();
+          while (it3 != pSub->contents().end()) {
             mpeg::Box *pMDIA = *it3++;
             if (memcmp(pMDIA->m_name, mpeg::constants::TAG_HDLR, 4) != 0)
               continue;
 
             char name[4];
-            int iPos = pMDIA->content_start() + 8;
+            uint64_t iPos = pMDIA->content_start() + 8;
             inFile.seekg(iPos);
             inFile.read(name, 4);
             if (memcmp(name, mpeg::constants::TAG_SOUN, 4) == 0)
@@ -209,6 +213,23 @@ namespace FBCapture {
       return mpeg4_add_spatial_audio(pMPEG4, inFile, pAudio);
     }
 
+    bool Utils::mpeg4_add_metadata(mpeg::Mpeg4Container *pMPEG4, fstream &inFile, Metadata *pMetadata) {
+      // Adds the spherical and, if any, the spatial audio metadata to the file_ structure.
+      bool bRet = mpeg4_add_spherical(pMPEG4, inFile, pMetadata->getVideoXML());
+      if (!bRet) {
+        cerr << "Error failed to insert spherical data" << endl;
+        return false;
+      }
+      if (pMetadata->getAudio()) {
+        bRet = mpeg4_add_audio_metadata(pMPEG4, inFile, pMetadata->getAudio());
+        if (!bRet) {
+          cerr << "Error failed to insert spatial audio data" << endl;
+          return false;
+        }
+      }
+      return true;
+    }
+
     bool inArray(char *pName, const char **ppArray, int iSize) {
       if (pName == NULL)
         return false;
@@ -227,26 +248,26 @@ namespace FBCapture {
       int iArraySize = sizeof(mpeg::constants::SOUND_SAMPLE_DESCRIPTIONS);
       mpeg::Container *pMediaAtom = (mpeg::Container *)pAudioMediaAtom;
 
-      vector<mpeg::Box *>::iterator it = pMediaAtom->m_listContents.begin();
-      while (it != pMediaAtom->m_listContents.end()) {
+      vector<mpeg::Box *>::iterator it = pMediaAtom->contents().begin();
+      while (it != pMediaAtom->contents().end()) {
         mpeg::Container *pAtom = (mpeg::Container *)*it++;
         if (memcmp(pAtom->m_name, mpeg::constants::TAG_MINF, 4) != 0)
           continue;
 
-        vector<mpeg::Box *>::iterator it2 = pAtom->m_listContents.begin();
-        while (it2 != pAtom->m_listContents.end()) {
+        vector<mpeg::Box *>::iterator it2 = pAtom->contents().begin();
+        while (it2 != pAtom->contents().end()) {
           mpeg::Container *pElement = (mpeg::Container *)*it2++;
           if (memcmp(pElement->m_name, mpeg::constants::TAG_STBL, 4) != 0)
             continue;
 
-          vector<mpeg::Box *>::iterator it3 = pElement->m_listContents.begin();
-          while (it3 != pElement->m_listContents.end()) {
+          vector<mpeg::Box *>::iterator it3 = pElement->contents().begin();
+          while (it3 != pElement->contents().end()) {
             mpeg::Container *pSub = (mpeg::Container *)*it3++;
             if (memcmp(pSub->m_name, mpeg::constants::TAG_STSD, 4) != 0)
               continue;
 
-            vector<mpeg::Box *>::iterator it4 = pSub->m_listContents.begin();
-            while (it4 != pSub->m_listContents.end()) {
+            vector<mpeg::Box *>::iterator it4 = pSub->contents().begin();
+            while (it4 != pSub->contents().end()) {
               mpeg::Container *pSample = (mpeg::Container *)*it4++;
               if (inArray(pSample->m_name, mpeg::constants::SOUND_SAMPLE_DESCRIPTIONS, iArraySize)) {
                 inFile.seekg(pSample->m_iPosition + pSample->m_iHeaderSize + 16);
@@ -261,7 +282,7 @@ namespace FBCapture {
                   return false;
                 }
                 mpeg::Box *pSA3DAtom = mpeg::SA3DBox::create(iNumChannels, *pAudio);
-                pSample->m_listContents.push_back(pSA3DAtom);
+                pSample->contents().push_back(pSA3DAtom);
               }
             }
           }
@@ -343,8 +364,8 @@ namespace FBCapture {
         return NULL;
 
       ParsedMetadata *pMetadata = new ParsedMetadata;
-      vector<mpeg::Box *>::iterator it = pMoov->m_listContents.begin();
-      while (it != pMoov->m_listContents.end()) {
+      vector<mpeg::Box *>::iterator it = pMoov->contents().begin();
+      while (it != pMoov->contents().end()) {
         mpeg::Container *pBox = (mpeg::Container *)*it++;
         if (memcmp(pBox->m_name, mpeg::constants::TAG_TRAK, 4) != 0)
           continue;
@@ -354,8 +375,8 @@ namespace FBCapture {
         string trackName = ss.str();
         cout << "\t" << trackName << endl;
 
-        vector<mpeg::Box *>::iterator it2 = pBox->m_listContents.begin();
-        while (it2 != pBox->m_listContents.end()) {
+        vector<mpeg::Box *>::iterator it2 = pBox->contents().begin();
+        while (it2 != pBox->contents().end()) {
           mpeg::Container *pSub = (mpeg::Container *)*it2++;
           if (memcmp(pSub->m_name, mpeg::constants::TAG_UUID, 4) == 0) {
             if (pSub->m_pContents)
@@ -371,7 +392,7 @@ namespace FBCapture {
               else {
                 // fh.read(sub_element.content_size - 16)
                 pNewedBuffer = new  char[pSub->m_iContentSize - 16];
-                file_.read(pNewedBuffer, pSub->m_iContentSize - 16);
+                file_.read(pNewedBuffer, (streamsize)(pSub->m_iContentSize - 16));
                 pContents = (uint8_t *)pNewedBuffer;
               }
               // metadata.video[trackName] = parse_spherical_xml(contents, console)
@@ -389,33 +410,33 @@ namespace FBCapture {
           //     if sub_element.name == mpeg.constants.TAG_MDIA:
           //       ...
           if (memcmp(pSub->m_name, mpeg::constants::TAG_MDIA, 4) == 0) {
-            vector<mpeg::Box *>::iterator it3 = pSub->m_listContents.begin();
-            while (it3 != pSub->m_listContents.end()) {
+            vector<mpeg::Box *>::iterator it3 = pSub->contents().begin();
+            while (it3 != pSub->contents().end()) {
               mpeg::Container *pMDIA = (mpeg::Container *)*it3++;
               if (memcmp(pMDIA->m_name, mpeg::constants::TAG_MINF, 4) != 0)
                 continue;
 
-              vector<mpeg::Box *>::iterator it4 = pMDIA->m_listContents.begin();
-              while (it4 != pMDIA->m_listContents.end()) {
+              vector<mpeg::Box *>::iterator it4 = pMDIA->contents().begin();
+              while (it4 != pMDIA->contents().end()) {
                 mpeg::Container *pSTBL = (mpeg::Container *)*it4++;
                 if (memcmp(pSTBL->m_name, mpeg::constants::TAG_STBL, 4) != 0)
                   continue;
 
-                vector<mpeg::Box *>::iterator it5 = pSTBL->m_listContents.begin();
-                while (it5 != pSTBL->m_listContents.end()) {
+                vector<mpeg::Box *>::iterator it5 = pSTBL->contents().begin();
+                while (it5 != pSTBL->contents().end()) {
                   mpeg::Container *pSTSD = (mpeg::Container *)*it5++;
                   if (memcmp(pSTSD->m_name, mpeg::constants::TAG_STSD, 4) != 0)
                     continue;
 
-                  vector<mpeg::Box *>::iterator it6 = pSTSD->m_listContents.begin();
-                  while (it6 != pSTSD->m_listContents.end()) {
+                  vector<mpeg::Box *>::iterator it6 = pSTSD->contents().begin();
+                  while (it6 != pSTSD->contents().end()) {
                     mpeg::Container *pSA3D = (mpeg::Container *)*it6++;
                     if (!inArray(pSA3D->m_name, mpeg::constants::SOUND_SAMPLE_DESCRIPTIONS, iArraySize))
                       continue;
 
                     pMetadata->m_iNumAudioChannels = get_num_audio_channels(pSTSD, file_);
-                    vector<mpeg::Box *>::iterator it7 = pSA3D->m_listContents.begin();
-                    while (it7 != pSA3D->m_listContents.end()) {
+                    vector<mpeg::Box *>::iterator it7 = pSA3D->contents().begin();
+                    while (it7 != pSA3D->contents().end()) {
                       mpeg::Container *pItem = (mpeg::Container *)*it7++;
                       if (memcmp(pItem->m_name, mpeg::constants::TAG_SA3D, 4) == 0) {
                         mpeg::SA3DBox *pSA = (mpeg::SA3DBox *)pItem;
@@ -437,56 +458,222 @@ namespace FBCapture {
     }
 
     void Utils::parse_mpeg4(string &strFileName) {
-      fstream file_(strFileName.c_str(), ios::in | ios::binary | ios::ate);
-      if (!file_.is_open()) {
+      // the boxes are parsed from the mapping, box contents are read through file_
+      mpeg::MappedFile mapping;
+      fstream file_(strFileName.c_str(), ios::in | ios::binary);
+      if (!file_.is_open() || !mapping.open(strFileName)) {
         cerr << "Error \"" << strFileName << "\" does not exist or do not have permission." << endl;
         return;
       }
-      mpeg::Mpeg4Container *pMPEG4 = mpeg::Mpeg4Container::load(file_);
+      mpeg::Mpeg4Container *pMPEG4 = mpeg::Mpeg4Container::load(mapping);
       if (!pMPEG4) {
         cerr << "Error, file_ could not be opened." << endl;
         return;
       }
       cout << "File loaded." << endl;
-      parse_spherical_mpeg4(pMPEG4, file_);
+      delete parse_spherical_mpeg4(pMPEG4, file_);
+      delete pMPEG4;
+    }
+
+    bool Utils::has_spherical_uuid(const string &strFileName) {
+      // True if any track already carries a spherical uuid box. Only the moov is read, from the mapping.
+      mpeg::MappedFile mapping;
+      if (!mapping.open(strFileName))
+        return false;
+      mpeg::Mpeg4Container *pMPEG4 = mpeg::Mpeg4Container::load(mapping);
+      if (!pMPEG4)
+        return false;
+
+      bool bFound = false;
+      vector<mpeg::Box *>::iterator it = ((mpeg::Container *)pMPEG4->m_pMoovBox)->contents().begin();
+      while (!bFound && it != ((mpeg::Container *)pMPEG4->m_pMoovBox)->contents().end()) {
+        mpeg::Container *pBox = (mpeg::Container *)*it++;
+        if (memcmp(pBox->m_name, mpeg::constants::TAG_TRAK, 4) != 0)
+          continue;
+
+        vector<mpeg::Box *>::iterator it2 = pBox->contents().begin();
+        while (it2 != pBox->contents().end()) {
+          mpeg::Box *pSub = *it2++;
+          if (memcmp(pSub->m_name, mpeg::constants::TAG_UUID, 4) != 0)
+            continue;
+          const uint8_t *pID = mapping.at(pSub->content_start(), 16);
+          if (pID && memcmp(pID, SPHERICAL_UUID_ID, 16) == 0) {
+            bFound = true;
+            break;
+          }
+        }
+      }
+      delete pMPEG4;
+      return bFound;
     }
 
     bool Utils::inject_mpeg4(const string &strInFile, string &strOutFile, Metadata *pMetadata) {
-      fstream inFile(strInFile.c_str(), ios::in | ios::binary | ios::ate);
-      if (!inFile.is_open()) {
+      // the boxes are parsed from the mapping, box contents are read through inFile
+      mpeg::MappedFile mapping;
+      fstream inFile(strInFile.c_str(), ios::in | ios::binary);
+      if (!inFile.is_open() || !mapping.open(strInFile)) {
         cerr << "Error \"" << strInFile << "\" does not exist or do not have permission." << endl;
         return false;
       }
-      mpeg::Mpeg4Container *pMPEG4 = mpeg::Mpeg4Container::load(inFile);
+      mpeg::Mpeg4Container *pMPEG4 = mpeg::Mpeg4Container::load(mapping);
       if (!pMPEG4) {
         cerr << "Error, file_ could not be opened." << endl;
         return false;
       }
-      bool bRet = mpeg4_add_spherical(pMPEG4, inFile, pMetadata->getVideoXML());
-      if (!bRet) {
-        cerr << "Error failed to insert spherical data" << endl;
+      if (!mpeg4_add_metadata(pMPEG4, inFile, pMetadata)) {
+        delete pMPEG4;
         return false;
       }
-      if (pMetadata->getAudio()) {
-        bRet = mpeg4_add_audio_metadata(pMPEG4, inFile, pMetadata->getAudio());
-        if (!bRet) {
-          cerr << "Error failed to insert spatial audio data" << endl;
-          return false;
-        }
-      }
       cout << "Saved file_ settings" << endl;
-      parse_spherical_mpeg4(pMPEG4, inFile);
+      delete parse_spherical_mpeg4(pMPEG4, inFile);
 
       fstream outFile(strOutFile.c_str(), ios::out | ios::binary);
       if (!outFile.is_open()) {
         cerr << "Error file_: \"" << strOutFile << "\" could not create or do not have permission." << endl;
+        delete pMPEG4;
         return false;
       }
       pMPEG4->save(inFile, outFile, 0);
+      delete pMPEG4;
+      if (!outFile.good()) {
+        cerr << "Error file_: \"" << strOutFile << "\" could not be written." << endl;
+        outFile.close();
+        remove(strOutFile.c_str());
+        return false;
+      }
 
       return true;
     }
 
+    bool Utils::inject_mpeg4_in_place(const string &strFile, Metadata *pMetadata, uint64_t *pBytesWritten) {
+      // Injects the metadata by rewriting the moov only, so the mdat is neither copied nor moved and no chunk
+      // offset changes. The moov goes back where it is if it fits in its old space plus the free boxes right after
+      // it, or if nothing but free boxes follows it. Otherwise it moves to the end of the file_ and its old space
+      // becomes a free box. Files that can't be patched this way are copied with inject_mpeg4() instead.
+      // pBytesWritten, if not NULL, gets what went to disk: the moov and free box header, or the whole copy.
+      if (pBytesWritten)
+        *pBytesWritten = 0;
+      string strMoov;
+      uint64_t iMoovPos = 0;
+      uint64_t iMoovSize = 0;
+      uint64_t iWritePos = 0;
+      uint64_t iFreeSize = 0;
+      bool bInPlace = false;
+      bool bAppend = false;
+      {
+        mpeg::MappedFile mapping;
+        fstream inFile(strFile.c_str(), ios::in | ios::binary);
+        if (!inFile.is_open() || !mapping.open(strFile)) {
+          cerr << "Error \"" << strFile << "\" does not exist or do not have permission." << endl;
+          return false;
+        }
+        mpeg::Mpeg4Container *pMPEG4 = mpeg::Mpeg4Container::load(mapping);
+        if (!pMPEG4) {
+          cerr << "Error, file_ could not be opened." << endl;
+          return false;
+        }
+
+        mpeg::Box *pMoov = pMPEG4->m_pMoovBox;
+        iMoovPos = pMoov->m_iPosition;
+        iMoovSize = pMoov->size();
+
+        // free boxes right after the moov can take its growth
+        uint64_t iRoomEnd = iMoovPos + iMoovSize;
+        vector<mpeg::Box *>::iterator it = find(pMPEG4->m_listContents.begin(), pMPEG4->m_listContents.end(), pMoov);
+        while (++it != pMPEG4->m_listContents.end()) {
+          mpeg::Box *pBox = *it;
+          if (memcmp(pBox->m_name, mpeg::constants::TAG_FREE, 4) != 0 && memcmp(pBox->m_name, "skip", 4) != 0)
+            break;
+          iRoomEnd = pBox->m_iPosition + pBox->size();
+        }
+        const bool bLast = iRoomEnd == mapping.size();
+
+        // a last box of size 0 runs to the end of the file_ and would take in anything appended,
+        // and players look for the mfra of fragmented files at the very end
+        mpeg::Box *pLastBox = pMPEG4->m_listContents.back();
+        const uint8_t *pLastSize = mapping.at(pLastBox->m_iPosition, 4);
+        const bool bOpenEnded = (pLastSize && mpeg::Box::readUint32(pLastSize) == 0) || memcmp(pLastBox->m_name, "mfra", 4) == 0;
+
+        if (!mpeg4_add_metadata(pMPEG4, inFile, pMetadata)) {
+          delete pMPEG4;
+          return false;
+        }
+
+        ostringstream moov(ios::out | ios::binary);
+        pMoov->save(inFile, moov, 0);
+        strMoov = moov.str();
+        delete pMPEG4;
+
+        const uint64_t iNewSize = strMoov.size();
+        const uint64_t iRoom = iRoomEnd - iMoovPos;
+        if (iNewSize == iRoom || iNewSize + 8 <= iRoom || (bLast && iNewSize > iRoom)) {
+          bInPlace = true;
+          iWritePos = iMoovPos;
+          iFreeSize = iNewSize < iRoom ? iRoom - iNewSize : 0;
+        } else if (!bOpenEnded) {
+          bInPlace = true;
+          bAppend = true;
+          iWritePos = mapping.size();
+        }
+        // the mapping is closed here, Windows doesn't let a mapped file_ be written
+      }
+
+      if (!bInPlace) {
+        cout << "The moov can't be patched in place, copying the file_." << endl;
+        string strTmpFile = strFile + ".tmp";
+        if (!inject_mpeg4(strFile, strTmpFile, pMetadata)) {
+          remove(strTmpFile.c_str());
+          return false;
+        }
+        if (remove(strFile.c_str()) != 0 || rename(strTmpFile.c_str(), strFile.c_str()) != 0) {
+          cerr << "Error could not replace \"" << strFile << "\" with \"" << strTmpFile << "\"" << endl;
+          return false;
+        }
+        if (pBytesWritten) {
+          fstream copy(strFile.c_str(), ios::in | ios::binary | ios::ate);
+          *pBytesWritten = copy.is_open() ? (uint64_t)copy.tellg() : 0;
+        }
+        return true;
+      }
+
+      fstream outFile(strFile.c_str(), ios::in | ios::out | ios::binary);
+      if (!outFile.is_open()) {
+        cerr << "Error file_: \"" << strFile << "\" could not be opened for writing." << endl;
+        return false;
+      }
+      // the new moov is in place before the old one is given up
+      outFile.seekp(iWritePos);
+      outFile.write(strMoov.data(), strMoov.size());
+      if (bAppend) {
+        iFreeSize = iMoovSize;
+        iWritePos = iMoovPos;
+      } else
+        iWritePos += strMoov.size();
+
+      uint64_t iWritten = strMoov.size();
+      if (iFreeSize > 0) {
+        outFile.seekp(iWritePos);
+        iWritten += iFreeSize > UINT32_MAX ? 16 : 8;
+        if (iFreeSize > UINT32_MAX) {
+          mpeg::Box::writeUint32(outFile, 1);
+          outFile.write(mpeg::constants::TAG_FREE, 4);
+          mpeg::Box::writeUint64(outFile, iFreeSize);
+        } else {
+          mpeg::Box::writeUint32(outFile, (uint32_t)iFreeSize);
+          outFile.write(mpeg::constants::TAG_FREE, 4);
+        }
+      }
+      outFile.flush();
+      if (!outFile.good()) {
+        cerr << "Error failed writing the moov of \"" << strFile << "\"" << endl;
+        return false;
+      }
+      cout << "Saved file_ settings " << (bAppend ? "with the moov moved to the end" : "in place") << endl;
+      if (pBytesWritten)
+        *pBytesWritten = iWritten;
+      return true;
+    }
+
     void Utils::parse_metadata(string &strFile) {
       fstream inFile(strFile.c_str(), ios::in | ios::binary | ios::ate);
       if (!inFile.is_open()) {
@@ -643,8 +830,8 @@ namespace FBCapture {
       }
 
       int iArraySize = (int)(sizeof(mpeg::constants::SOUND_SAMPLE_DESCRIPTIONS) / sizeof(mpeg::constants::SOUND_SAMPLE_DESCRIPTIONS[0]));
-      vector<mpeg::Box *>::iterator it = pSTSD->m_listContents.begin();
-      while (it != pSTSD->m_listContents.end()) {
+      vector<mpeg::Box *>::iterator it = pSTSD->contents().begin();
+      while (it != pSTSD->contents().end()) {
         mpeg::Container *pSample = (mpeg::Container *)*it++;
         if (memcmp(pSample->m_name, mpeg::constants::TAG_MP4A, 4) == 0)
           return get_aac_num_channels(pSample, inFile);
@@ -656,7 +843,7 @@ namespace FBCapture {
 
     uint32_t Utils::get_sample_description_num_channels(mpeg::Container *pSample, fstream &inFile) {
       // Reads the number of audio channels from a sound sample description.
-      int iPos = (int)inFile.tellg();
+      streampos iPos = inFile.tellg();
       inFile.seekg(pSample->content_start() + 8);
 
       int16_t iAudioChannels, iSampleSizeBytes;
@@ -697,15 +884,15 @@ namespace FBCapture {
     int32_t Utils::get_aac_num_channels(mpeg::Container *pBox, fstream &inFile) {
       // Reads the number of audio channels from AAC's AudioSpecificConfig
       // descriptor within the esds child box of the input mp4a or wave box.
-      int iPos = (int)inFile.tellg();
+      streampos iPos = inFile.tellg();
       bool bFound = memcmp(pBox->m_name, mpeg::constants::TAG_MP4A, 4) == 0;
       bFound |= memcmp(pBox->m_name, mpeg::constants::TAG_WAVE, 4) == 0;
       if (!bFound)
         return -1;
 
       int32_t channel_configuration = 0;
-      vector<mpeg::Box *>::iterator it = pBox->m_listContents.begin();
-      while (it != pBox->m_listContents.end()) {
+      vector<mpeg::Box *>::iterator it = pBox->contents().begin();
+      while (it != pBox->contents().end()) {
         mpeg::Container *pElement = (mpeg::Container *)*it++;
         if (memcmp(pElement->m_name, mpeg::constants::TAG_WAVE, 4) == 0) {
           channel_configuration = get_aac_num_channels(pElement, inFile);
@@ -764,25 +951,25 @@ namespace FBCapture {
       if (!pMoov)
         return 0;
 
-      vector<mpeg::Box *>::iterator it = pMoov->m_listContents.begin();
-      while (it != pMoov->m_listContents.end()) {
+      vector<mpeg::Box *>::iterator it = pMoov->contents().begin();
+      while (it != pMoov->contents().end()) {
         mpeg::Container *pBox = (mpeg::Container *)*it++;
         if (memcmp(pBox->m_name, mpeg::constants::TAG_TRAK, 4) != 0)
           continue;
 
-        vector<mpeg::Box *>::iterator it2 = pBox->m_listContents.begin();
-        while (it2 != pBox->m_listContents.end()) {
+        vector<mpeg::Box *>::iterator it2 = pBox->contents().begin();
+        while (it2 != pBox->contents().end()) {
           mpeg::Container *pSub = (mpeg::Container *)*it2++;
           if (memcmp(pSub->m_name, mpeg::constants::TAG_MDIA, 4) != 0)
             continue;
 
-          vector<mpeg::Box *>::iterator it3 = pSub->m_listContents.begin();
-          while (it3 != pSub->m_listContents.end()) {
+          vector<mpeg::Box *>::iterator it3 = pSub->contents().begin();
+          while (it3 != pSub->contents().end()) {
             mpeg::Container *pMDIA = (mpeg::Container *)*it3++;
             if (memcmp(pMDIA->m_name, mpeg::constants::TAG_HDLR, 4) != 0)
               continue;
 
-            int iPos = pMDIA->content_start() + 8;
+            uint64_t iPos = pMDIA->content_start() + 8;
             inFile.seekg(iPos);
             char buffer[4];
             inFile.read(buffer, 4);
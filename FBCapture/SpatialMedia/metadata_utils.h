@@ -127,11 +127,14 @@ namespace FBCapture {
       bool mpeg4_add_spherical(mpeg::Mpeg4Container *, fstream &, string &);
       bool mpeg4_add_spatial_audio(mpeg::Mpeg4Container *, fstream &, AudioMetadata *);
       bool mpeg4_add_audio_metadata(mpeg::Mpeg4Container *, fstream &, AudioMetadata *);
+      bool mpeg4_add_metadata(mpeg::Mpeg4Container *, fstream &, Metadata *);
       bool inject_spatial_audio_atom(fstream &, mpeg::Box *, AudioMetadata *);
       map<string, string> parse_spherical_xml(uint8_t *); // return sphericalDictionary
       ParsedMetadata *parse_spherical_mpeg4(mpeg::Mpeg4Container *, fstream &); // return metadata
       void parse_mpeg4(string &);
+      bool has_spherical_uuid(const string &);
       bool inject_mpeg4(const string &, string &, Metadata *);
+      bool inject_mpeg4_in_place(const string &, Metadata *, uint64_t *pBytesWritten = NULL);
       void parse_metadata(string &);
       bool inject_metadata(const string &, string &, Metadata *);
       string &generate_spherical_xml(
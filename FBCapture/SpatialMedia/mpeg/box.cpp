@@ -24,10 +24,108 @@
 #include "constants.h"
 #include "box.h"
 
+#if defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#include <emmintrin.h>
+#define BOX_SSE2
+#endif
+
 namespace FBCapture {
   namespace SpatialMedia {
     namespace mpeg {
 
+#ifdef BOX_SSE2
+      static inline __m128i bswap16_lanes(__m128i v) {
+        return _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+      }
+
+      static inline __m128i bswap32_lanes(__m128i v) {
+        v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+        v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+        return bswap16_lanes(v);
+      }
+
+      static inline __m128i bswap64_lanes(__m128i v) {
+        v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+        v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+        return bswap16_lanes(v);
+      }
+#endif
+
+      static uint64_t decode_offsets(const uint8_t *pIn, uint64_t iCount, bool bBigMode, int64_t iDelta, uint64_t *pOut) {
+        // Converts iCount BigEndian chunk offsets to host order and adds iDelta.
+        // Returns all results or'ed together, so the upper half tells whether any of them needs 64 bits.
+        uint64_t iBits = 0;
+        uint64_t i = 0;
+#ifdef BOX_SSE2
+        const __m128i delta = _mm_set1_epi64x(iDelta);
+        const __m128i zero = _mm_setzero_si128();
+        __m128i bits = zero;
+        if (bBigMode) {
+          for (; i + 2 <= iCount; i += 2) {
+            __m128i v = bswap64_lanes(_mm_loadu_si128((const __m128i *)(pIn + i * 8)));
+            v = _mm_add_epi64(v, delta);
+            bits = _mm_or_si128(bits, v);
+            _mm_storeu_si128((__m128i *)(pOut + i), v);
+          }
+        } else {
+          for (; i + 4 <= iCount; i += 4) {
+            const __m128i v = bswap32_lanes(_mm_loadu_si128((const __m128i *)(pIn + i * 4)));
+            const __m128i lo = _mm_add_epi64(_mm_unpacklo_epi32(v, zero), delta);
+            const __m128i hi = _mm_add_epi64(_mm_unpackhi_epi32(v, zero), delta);
+            bits = _mm_or_si128(bits, _mm_or_si128(lo, hi));
+            _mm_storeu_si128((__m128i *)(pOut + i), lo);
+            _mm_storeu_si128((__m128i *)(pOut + i + 2), hi);
+          }
+        }
+        uint64_t lanes[2];
+        _mm_storeu_si128((__m128i *)lanes, bits);
+        iBits = lanes[0] | lanes[1];
+#endif
+        for (; i < iCount; i++) {
+          uint64_t iVal;
+          if (bBigMode) {
+            memcpy(&iVal, pIn + i * 8, 8);
+            iVal = be64toh(iVal);
+          } else {
+            uint32_t iVal32;
+            memcpy(&iVal32, pIn + i * 4, 4);
+            iVal = be32toh(iVal32);
+          }
+          pOut[i] = iVal + iDelta;
+          iBits |= pOut[i];
+        }
+        return iBits;
+      }
+
+      static void encode_offsets(const uint64_t *pIn, uint64_t iCount, bool bBigMode, uint8_t *pOut) {
+        // Writes iCount host order chunk offsets as BigEndian Uint64, or as BigEndian Uint32 truncating them.
+        uint64_t i = 0;
+#ifdef BOX_SSE2
+        if (bBigMode) {
+          for (; i + 2 <= iCount; i += 2) {
+            const __m128i v = _mm_loadu_si128((const __m128i *)(pIn + i));
+            _mm_storeu_si128((__m128i *)(pOut + i * 8), bswap64_lanes(v));
+          }
+        } else {
+          for (; i + 4 <= iCount; i += 4) {
+            // gather the low halves of four 64-bit lanes
+            const __m128i lo = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)(pIn + i)), _MM_SHUFFLE(3, 1, 2, 0));
+            const __m128i hi = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)(pIn + i + 2)), _MM_SHUFFLE(3, 1, 2, 0));
+            _mm_storeu_si128((__m128i *)(pOut + i * 4), bswap32_lanes(_mm_unpacklo_epi64(lo, hi)));
+          }
+        }
+#endif
+        for (; i < iCount; i++) {
+          if (bBigMode) {
+            const uint64_t iVal = htobe64(pIn[i]);
+            memcpy(pOut + i * 8, &iVal, 8);
+          } else {
+            const uint32_t iVal = htobe32((uint32_t)pIn[i]);
+            memcpy(pOut + i * 4, &iVal, 4);
+          }
+        }
+      }
+
       Box::Box() {
         memset((char *)m_name, ' ', sizeof(m_name));
         m_iType = constants::Box;
@@ -39,7 +137,7 @@ namespace FBCapture {
 
       Box::~Box() {
         if (m_pContents)
-          delete m_pContents;
+          delete[] m_pContents;
         m_pContents = NULL;
         m_iContentSize = m_iHeaderSize = m_iPosition = 0;
       }
@@ -116,7 +214,28 @@ namespace FBCapture {
         return be64toh(buf.iVal);
       }
 
-      void Box::writeUint8(std::fstream &fs, uint8_t iVal) {
+      int16_t Box::readInt16(const uint8_t *p) {
+        int16_t iVal;
+        memcpy(&iVal, p, 2);
+        // BigEndian to Host
+        return be16toh(iVal);
+      }
+
+      uint32_t Box::readUint32(const uint8_t *p) {
+        uint32_t iVal;
+        memcpy(&iVal, p, 4);
+        // BigEndian to Host
+        return be32toh(iVal);
+      }
+
+      uint64_t Box::readUint64(const uint8_t *p) {
+        uint64_t iVal;
+        memcpy(&iVal, p, 8);
+        // BigEndian to Host
+        return be64toh(iVal);
+      }
+
+      void Box::writeUint8(std::ostream &fs, uint8_t iVal) {
         union {
           uint8_t iVal;
           char bytes[1];
@@ -125,7 +244,7 @@ namespace FBCapture {
         fs.write((char *)buf.bytes, 1);
       }
 
-      void Box::writeInt16(std::fstream &fs, int16_t iVal) {
+      void Box::writeInt16(std::ostream &fs, int16_t iVal) {
         union {
           int16_t iVal;
           char bytes[2];
@@ -134,7 +253,7 @@ namespace FBCapture {
         fs.write((char *)buf.bytes, 2);
       }
 
-      void Box::writeInt32(std::fstream &fs, int32_t iVal) {
+      void Box::writeInt32(std::ostream &fs, int32_t iVal) {
         union {
           int32_t iVal;
           char bytes[4];
@@ -143,7 +262,7 @@ namespace FBCapture {
         fs.write((char *)buf.bytes, 4);
       }
 
-      void Box::writeUint32(std::fstream &fs, uint32_t iVal) {
+      void Box::writeUint32(std::ostream &fs, uint32_t iVal) {
         union {
           uint32_t iVal;
           char bytes[4];
@@ -152,7 +271,7 @@ namespace FBCapture {
         fs.write((char *)buf.bytes, 4);
       }
 
-      void Box::writeUint64(std::fstream &fs, uint64_t iVal) {
+      void Box::writeUint64(std::ostream &fs, uint64_t iVal) {
         union {
           uint64_t iVal;
           char bytes[8];
@@ -162,45 +281,62 @@ namespace FBCapture {
       }
 
       const char *Box::name() {
-        static char name[5];
+        // per thread, so files can be processed in parallel
+        static thread_local char name[5];
         memcpy(name, m_name, 4);
         name[4] = 0;
         return name;
       }
 
-      Box *Box::load(std::fstream &fs, uint32_t iPos, uint32_t iEnd) {
-        // Loads the box located at a position in a mp4 file_
-        //
-      //  if ( iPos < 1 ) // iPos is None:
-      //       iPos = fs.tellg ( );
-
-        uint32_t iHeaderSize, tmp = 0;
-        uint64_t iSize = 0LL;
-        char name[4];
-
-        fs.seekg(iPos);
+      bool Box::load_header(const MappedFile &file, uint64_t iPos, uint64_t iEnd, char *pName, uint64_t &iSize, uint32_t &iHeaderSize) {
+        // Reads the size and name of the box at iPos straight from the mapping.
+        const uint8_t *pHeader = file.at(iPos, 8);
+        if (!pHeader || iPos + 8 > iEnd) {
+          std::cerr << "Error: box header at " << iPos << " exceeds bounds." << std::endl;
+          return false;
+        }
+        memcpy(pName, pHeader + 4, 4);
         iHeaderSize = 8;
-        iSize = (uint64_t)readUint32(fs);
-        fs.read(name, 4);
+        iSize = readUint32(pHeader);
 
         if (iSize == 1) {
-          iSize = readUint64(fs);
+          pHeader = file.at(iPos + 8, 8);
+          if (!pHeader || iPos + 16 > iEnd) {
+            std::cerr << "Error: box header at " << iPos << " exceeds bounds." << std::endl;
+            return false;
+          }
+          iSize = readUint64(pHeader);
           iHeaderSize = 16;
+        } else if (iSize == 0) {
+          // the last box may run to the end of the file_
+          iSize = iEnd - iPos;
         }
-        if (iSize < 8) {
-          std::cerr << "Error, invalid size " << iSize << " in " << name << " at " << iPos << std::endl;
-          return NULL;
+
+        if (iSize < iHeaderSize) {
+          std::cerr << "Error, invalid size " << iSize << " in " << std::string(pName, 4) << " at " << iPos << std::endl;
+          return false;
         }
+        if (iSize > iEnd - iPos) {
+          std::cerr << "Error: " << std::string(pName, 4) << " box size exceeds bounds." << std::endl;
+          return false;
+        }
+        return true;
+      }
 
-        if (iPos + iSize > iEnd) {
-          std::cerr << "Error: Leaf box size exceeds bounds." << std::endl;
+      Box *Box::load(const MappedFile &file, uint64_t iPos, uint64_t iEnd) {
+        // Loads the box located at a position in a mp4 file_. Only the header is read, so an mdat is skipped
+        // without touching its pages.
+        uint32_t iHeaderSize;
+        uint64_t iSize;
+        char name[4];
+        if (!load_header(file, iPos, iEnd, name, iSize, iHeaderSize))
           return NULL;
-        }
+
         Box *pNewBox = new Box();
         memcpy(pNewBox->m_name, name, sizeof(name));
         pNewBox->m_iPosition = iPos;
         pNewBox->m_iHeaderSize = iHeaderSize;
-        pNewBox->m_iContentSize = (uint32_t)iSize - iHeaderSize;
+        pNewBox->m_iContentSize = iSize - iHeaderSize;
         pNewBox->m_pContents = NULL;
         return pNewBox;
       }
@@ -218,11 +354,11 @@ namespace FBCapture {
         list.clear();
       }
 
-      int32_t Box::content_start() {
+      uint64_t Box::content_start() {
         return m_iPosition + m_iHeaderSize;
       }
 
-      void Box::save(std::fstream &fsIn, std::fstream &fsOut, int32_t iDelta) {
+      void Box::save(std::fstream &fsIn, std::ostream &fsOut, int64_t iDelta) {
         // Save box contents prioritizing set contents.
         // iDelta = index update amount
         if (m_iHeaderSize == 16) {
@@ -231,7 +367,7 @@ namespace FBCapture {
           fsOut.write(m_name, 4);
           writeUint64(fsOut, iBigSize);
         } else if (m_iHeaderSize == 8) {
-          writeUint32(fsOut, size());
+          writeUint32(fsOut, (uint32_t)size());
           fsOut.write(m_name, 4);
         }
 
@@ -254,7 +390,7 @@ namespace FBCapture {
         m_iContentSize = iSize;
       }
 
-      int32_t Box::size() {
+      uint64_t Box::size() {
         return m_iHeaderSize + m_iContentSize;
       }
 
@@ -263,99 +399,107 @@ namespace FBCapture {
         std::cout << "[{" << m_iHeaderSize << "}, {" << m_iContentSize << "}]" << std::endl;
       }
 
-      void Box::tag_copy(std::fstream &fsIn, std::fstream &fsOut, int32_t iSize) {
+      void Box::tag_copy(std::fstream &fsIn, std::ostream &fsOut, uint64_t iSize) {
         // Copies a block of data from fsIn to fsOut.
 
         //  On 32-bit systems reading / writing is limited to 2GB chunks.
         //  To prevent overflow, read/write 64 MB chunks.
-        int32_t block_size = 64 * 1024 * 1024;
-        m_pContents = new uint8_t[block_size + 1];
+        //  The buffer is not kept in m_pContents, which would make save() write it in place of the file_ contents.
+        const uint64_t block_size = 64 * 1024 * 1024;
+        std::vector<char> buffer((size_t)(iSize < block_size ? iSize : block_size));
         while (iSize > block_size) {
-          fsIn.read((char *)m_pContents, block_size);
-          fsOut.write((char *)m_pContents, block_size);
+          fsIn.read(buffer.data(), block_size);
+          fsOut.write(buffer.data(), block_size);
           iSize -= block_size;
         }
-        fsIn.read((char *)m_pContents, iSize);
-        fsOut.write((char *)m_pContents, iSize);
+        if (iSize > 0) {
+          fsIn.read(buffer.data(), (std::streamsize)iSize);
+          fsOut.write(buffer.data(), (std::streamsize)iSize);
+        }
       }
 
-      void Box::index_copy(std::fstream &fsIn, std::fstream &fsOut, Box *pBox, bool bBigMode, int32_t iDelta) {
+      void Box::index_copy(std::fstream &fsIn, std::ostream &fsOut, Box *pBox, bool bBigMode, int64_t iDelta) {
         // Update and copy index table for stco/co64 file_s.
         // pBox: box, stco/co64 box to copy.
         // bBigMode: if true == BigEndian Uint64, else BigEndian Int32
         // iDelta: int, offset change for index entries.
-        std::fstream &fs = fsIn;
-        if (!pBox->m_pContents)
-          fs.seekg(pBox->content_start());
-        else {
-          //fs = StringIO.StringIO ( box->m_pContents );
-          return index_copy_from_contents(fsOut, pBox, bBigMode, iDelta);
+        // The table is read, adjusted and written in one go instead of one stream call per entry.
+        if (!pBox->load_contents(fsIn)) {
+          std::cerr << "Error: failed to read " << pBox->name() << " at " << pBox->m_iPosition << std::endl;
+          return;
         }
 
-        uint32_t iHeader = readUint32(fs);
-        uint32_t iValues = readUint32(fs);
-
-        writeUint32(fsOut, iHeader);
-        writeUint32(fsOut, iValues);
-        if (bBigMode) {
-          for (int i = 0; i < (int)iValues; i++) {
-            uint64_t iVal = readUint64(fsIn) + iDelta;
-            writeUint64(fsOut, iVal);
-          }
-        } else {
-          for (int i = 0; i < (int)iValues; i++) {
-            uint32_t iVal = readUint32(fsIn) + iDelta;
-            writeUint32(fsOut, iVal);
-          }
+        const uint8_t *pTable = pBox->m_pContents;
+        const uint64_t iTableSize = pBox->m_iContentSize;
+        const uint32_t iEntrySize = bBigMode ? 8 : 4;
+        const uint32_t iValues = iTableSize < 8 ? 0 : readUint32(pTable + 4);
+        if (iTableSize < 8 || (uint64_t)iValues * iEntrySize > iTableSize - 8) {
+          std::cerr << "Error: " << pBox->name() << " entries exceed the box size." << std::endl;
+          fsOut.write((const char *)pTable, iTableSize);
+          return;
         }
-      }
 
-      uint32_t Box::uint32FromCont(int32_t &iIDX) {
-        union {
-          uint32_t iVal;
-          char bytes[4];
-        } buf;
-        memcpy(buf.bytes, (char *)&m_pContents[iIDX], 4);
-        iIDX += 4;
-        return be32toh(buf.iVal);
+        std::vector<uint64_t> offsets(iValues);
+        const uint64_t iBits = decode_offsets(pTable + 8, iValues, bBigMode, iDelta, offsets.data());
+        // Mpeg4Container::save() promotes the stco boxes that would overflow before any header is written
+        if (!bBigMode && (iBits >> 32) != 0)
+          std::cerr << "Error: stco offsets exceed 32 bits, the box needs to be a co64." << std::endl;
+
+        // version / flags, count, entries and whatever trails them
+        std::vector<uint8_t> table((size_t)iTableSize);
+        memcpy(table.data(), pTable, 8);
+        encode_offsets(offsets.data(), iValues, bBigMode, table.data() + 8);
+        const uint64_t iTableEnd = 8 + (uint64_t)iValues * iEntrySize;
+        memcpy(table.data() + iTableEnd, pTable + iTableEnd, (size_t)(iTableSize - iTableEnd));
+        fsOut.write((const char *)table.data(), table.size());
       }
 
-      uint64_t Box::uint64FromCont(int32_t &iIDX) {
-        union {
-          uint64_t iVal;
-          char bytes[8];
-        } buf;
-        memcpy(buf.bytes, (char *)&m_pContents[iIDX], 8);
-        iIDX += 8;
-        return be64toh(buf.iVal);
+      bool Box::load_contents(std::fstream &fsIn) {
+        // Reads the box contents from the file_ into m_pContents, unless they were set already.
+        if (m_pContents)
+          return true;
+        m_pContents = new uint8_t[(size_t)m_iContentSize];
+        fsIn.seekg(content_start());
+        fsIn.read((char *)m_pContents, (std::streamsize)m_iContentSize);
+        if (fsIn.good())
+          return true;
+        delete[] m_pContents;
+        m_pContents = NULL;
+        return false;
       }
 
-      void Box::index_copy_from_contents(std::fstream &fsOut, Box *pBox, bool bBigMode, int32_t iDelta) {
-        int32_t iIDX = 0;
-
-        uint32_t iHeader = uint32FromCont(iIDX);
-        uint32_t iValues = uint32FromCont(iIDX);
-        writeUint32(fsOut, iHeader);
-        writeUint32(fsOut, iValues);
-        if (bBigMode) {
-          for (int i = 0; i < (int)iValues; i++) {
-            uint64_t iVal = uint64FromCont(iIDX) + iDelta;
-            writeUint64(fsOut, iVal);
-          }
-        } else {
-          for (int i = 0; i < (int)iValues; i++) {
-            uint32_t iVal = uint32FromCont(iIDX) + iDelta;
-            writeUint32(fsOut, iVal);
-          }
-        }
+      bool Box::promote_to_co64(std::fstream &fsIn, int64_t iDelta) {
+        // Turns a stco box into a co64 one if any of its offsets moved by iDelta no longer fits in 32 bits.
+        // The co64 keeps the offsets unadjusted, save() adds iDelta as usual.
+        if (memcmp(m_name, constants::TAG_STCO, 4) != 0 || !load_contents(fsIn) || m_iContentSize < 8)
+          return false;
+
+        const uint32_t iValues = readUint32(m_pContents + 4);
+        if ((uint64_t)iValues * 4 > m_iContentSize - 8)
+          return false;
+
+        std::vector<uint64_t> offsets(iValues);
+        if ((decode_offsets(m_pContents + 8, iValues, false, iDelta, offsets.data()) >> 32) == 0)
+          return false;
+
+        decode_offsets(m_pContents + 8, iValues, false, 0, offsets.data());
+        const uint64_t iNewSize = 8 + (uint64_t)iValues * 8;
+        uint8_t *pContents = new uint8_t[(size_t)iNewSize];
+        memcpy(pContents, m_pContents, 8);
+        encode_offsets(offsets.data(), iValues, true, pContents + 8);
+        delete[] m_pContents;
+        m_pContents = pContents;
+        m_iContentSize = iNewSize;
+        memcpy(m_name, constants::TAG_CO64, 4);
+        return true;
       }
 
-      void Box::stco_copy(std::fstream &fsIn, std::fstream &fsOut, Box *pBox, int32_t iDelta) {
+      void Box::stco_copy(std::fstream &fsIn, std::ostream &fsOut, Box *pBox, int64_t iDelta) {
         // Copy for stco box.
         index_copy(fsIn, fsOut, pBox, false, iDelta);
       }
 
-      void Box::co64_copy(std::fstream &fsIn, std::fstream &fsOut, Box *pBox, int32_t iDelta) {
+      void Box::co64_copy(std::fstream &fsIn, std::ostream &fsOut, Box *pBox, int64_t iDelta) {
         // Copy for co64 box.
         index_copy(fsIn, fsOut, pBox, true, iDelta);
       }
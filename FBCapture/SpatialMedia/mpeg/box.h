@@ -23,6 +23,8 @@
 
 #include <fstream>
 
+#include "mapped_file.h"
+
 namespace FBCapture {
   namespace SpatialMedia {
     namespace mpeg {
@@ -33,19 +35,22 @@ namespace FBCapture {
         virtual ~Box();
         virtual int32_t type();
 
-        static Box *load(std::fstream &, uint32_t, uint32_t);
+        static Box *load(const MappedFile &, uint64_t, uint64_t);
+        static bool load_header(const MappedFile &, uint64_t, uint64_t, char *, uint64_t &, uint32_t &);
         static void clear(std::vector<Box *> &);
 
-        int content_start();
-        virtual void save(std::fstream &, std::fstream &, int32_t);
+        uint64_t content_start();
+        virtual void save(std::fstream &, std::ostream &, int64_t);
         void set(uint8_t *, uint32_t);
-        int  size();
+        uint64_t size();
         const char *name();
         virtual void print_structure(const char *);
-        void tag_copy(std::fstream &, std::fstream &, int32_t);
-        void index_copy(std::fstream &, std::fstream &, Box *, bool, int32_t);
-        void stco_copy(std::fstream &, std::fstream &, Box *, int32_t);
-        void co64_copy(std::fstream &, std::fstream &, Box *, int32_t);
+        void tag_copy(std::fstream &, std::ostream &, uint64_t);
+        void index_copy(std::fstream &, std::ostream &, Box *, bool, int64_t);
+        void stco_copy(std::fstream &, std::ostream &, Box *, int64_t);
+        void co64_copy(std::fstream &, std::ostream &, Box *, int64_t);
+        bool load_contents(std::fstream &);
+        bool promote_to_co64(std::fstream &, int64_t);
 
       public:
         static   int8_t readInt8(std::fstream &fs);
@@ -56,24 +61,23 @@ namespace FBCapture {
         static uint64_t readUint64(std::fstream &fs);
         static double   readDouble(std::fstream &fs);
 
-        static void     writeInt16(std::fstream &fs, int16_t);
-        static void     writeInt32(std::fstream &fs, int32_t);
-        static void     writeUint8(std::fstream &fs, uint8_t);
-        static void     writeUint32(std::fstream &fs, uint32_t);
-        static void     writeUint64(std::fstream &fs, uint64_t);
+        static  int16_t readInt16(const uint8_t *p);
+        static uint32_t readUint32(const uint8_t *p);
+        static uint64_t readUint64(const uint8_t *p);
 
-        int32_t  m_iType;
+        static void     writeInt16(std::ostream &fs, int16_t);
+        static void     writeInt32(std::ostream &fs, int32_t);
+        static void     writeUint8(std::ostream &fs, uint8_t);
+        static void     writeUint32(std::ostream &fs, uint32_t);
+        static void     writeUint64(std::ostream &fs, uint64_t);
 
-      private:
-        uint32_t uint32FromCont(int32_t &iIDX);
-        uint64_t uint64FromCont(int32_t &iIDX);
-        void index_copy_from_contents(std::fstream &fsOut, Box *pBox, bool bBigMode, int32_t iDelta);
+        int32_t  m_iType;
 
       public:
         char      m_name[4];
-        uint32_t  m_iPosition;
+        uint64_t  m_iPosition;
         uint32_t  m_iHeaderSize;
-        uint32_t  m_iContentSize;
+        uint64_t  m_iContentSize;
         uint8_t  *m_pContents;
       };
 
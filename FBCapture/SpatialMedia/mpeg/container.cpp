@@ -32,19 +32,22 @@ namespace FBCapture {
       Container::Container(uint32_t iPadding) : Box() {
         m_iType = constants::Container;
         m_iPadding = iPadding;
+        m_pFile = NULL;
+        m_bLoaded = true;
+        m_bLoadFailed = false;
       }
 
-      Container::~Container() {}
-
-      Box *Container::load(std::fstream &fs, uint32_t iPos, uint32_t iEnd) {
-      //  if ( iPos == 0 )
-      //       iPos = fs.tellg ( );
+      Container::~Container() {
+        // the children are owned, along with the sample tables they loaded
+        clear(m_listContents);
+      }
 
-        fs.seekg(iPos);
-        uint32_t iHeaderSize = 8;
-        uint32_t t, iSize = readUint32(fs);
+      Box *Container::load(const MappedFile &file, uint64_t iPos, uint64_t iEnd) {
+        uint32_t t, iHeaderSize;
+        uint64_t iSize;
         char name[4];
-        fs.read(name, 4);
+        if (!load_header(file, iPos, iEnd, name, iSize, iHeaderSize))
+          return NULL;
 
         uint32_t iArrSize = (uint32_t)(sizeof(constants::CONTAINERS_LIST) / sizeof(constants::CONTAINERS_LIST[0]));
         bool bIsBox = true;
@@ -61,39 +64,19 @@ namespace FBCapture {
 
         if (bIsBox) {
           if (memcmp(name, constants::TAG_SA3D, 4) == 0)
-            return SA3DBox::load(fs, iPos, iEnd);
-          return Box::load(fs, iPos, iEnd);
-        }
-
-        if (iSize == 1) {
-          iSize = (uint32_t)readUint64(fs);
-          iHeaderSize = 16;
-        }
-
-        if (iSize < 8) {
-          std::cerr << "Error, invalid size " << iSize << " in " << name << " at " << iPos << std::endl;
-          return NULL;
-        }
-
-        if (iPos + iSize > iEnd) {
-          std::cerr << "Error: Container box size exceeds bounds." << std::endl;
-          return NULL;
+            return SA3DBox::load(file, iPos, iEnd);
+          return Box::load(file, iPos, iEnd);
         }
 
         uint32_t iPadding = 0;
         if (memcmp(name, constants::TAG_STSD, 4) == 0)
           iPadding = 8;
 
-        uint32_t iCurrentPos = 0;
-        int16_t  iSampleDescVersion = 0;
         iArrSize = (uint32_t)(sizeof(constants::SOUND_SAMPLE_DESCRIPTIONS) / sizeof(constants::SOUND_SAMPLE_DESCRIPTIONS[0]));
         for (t = 0; t < iArrSize; t++) {
           if (memcmp(name, constants::SOUND_SAMPLE_DESCRIPTIONS[t], 4) == 0) {
-            iCurrentPos = (uint32_t)fs.tellg();
-            fs.seekg(iCurrentPos + 8);
-            fs.read((char *)&iSampleDescVersion, 2);
-            iSampleDescVersion = be16toh(iSampleDescVersion);
-            fs.seekg(iCurrentPos);
+            const uint8_t *pVersion = file.at(iPos + iHeaderSize + 8, 2);
+            int16_t iSampleDescVersion = pVersion ? readInt16(pVersion) : -1;
 
             switch (iSampleDescVersion) {
               case 0:
@@ -111,26 +94,28 @@ namespace FBCapture {
             }
           }
         }
+
+        if (iHeaderSize + iPadding > iSize) {
+          std::cerr << "Error: Container box padding exceeds bounds." << std::endl;
+          return NULL;
+        }
+
+        // the children are only loaded once visited
         Container *pNewBox = new Container();
         memcpy(pNewBox->m_name, name, 4);
         pNewBox->m_iPosition = iPos;
         pNewBox->m_iHeaderSize = iHeaderSize;
         pNewBox->m_iContentSize = iSize - iHeaderSize;
         pNewBox->m_iPadding = iPadding;
-        pNewBox->m_listContents = load_multiple(fs, iPos + iHeaderSize + iPadding, iPos + iSize);
-
-        if (pNewBox->m_listContents.empty()) {
-          delete pNewBox;
-          return NULL;
-        }
-
+        pNewBox->m_pFile = &file;
+        pNewBox->m_bLoaded = false;
         return pNewBox;
       }
 
-      std::vector<Box *> Container::load_multiple(std::fstream &fs, uint32_t iPos, uint32_t iEnd) {
+      std::vector<Box *> Container::load_multiple(const MappedFile &file, uint64_t iPos, uint64_t iEnd) {
         std::vector<Box *> list, empty;
         while (iPos < iEnd) {
-          Box *pBox = load(fs, iPos, iEnd);
+          Box *pBox = load(file, iPos, iEnd);
           if (!pBox) {
             std::cerr << "Error, failed to load box." << std::endl;
             clear(list);
@@ -142,8 +127,25 @@ namespace FBCapture {
         return list;
       }
 
+      std::vector<Box *> &Container::contents() {
+        if (m_pFile) {
+          const uint64_t iStart = content_start() + m_iPadding;
+          const uint64_t iEnd = m_iPosition + size();
+          m_listContents = load_multiple(*m_pFile, iStart, iEnd);
+          // children that fail to load leave the box unloaded, so it is saved as it is in the file_ and the
+          // chunk offsets it may hold can't be moved
+          m_bLoaded = !m_listContents.empty();
+          m_bLoadFailed = !m_bLoaded && iStart < iEnd;
+          m_pFile = NULL;
+        }
+        return m_listContents;
+      }
+
       void Container::resize() {
         // Recomputes the box size and recurses on contents."""
+        // boxes that were never visited haven't changed
+        if (!m_bLoaded)
+          return;
         m_iContentSize = m_iPadding;
         std::vector<Box *>::iterator it = m_listContents.begin();
         while (it != m_listContents.end()) {
@@ -159,10 +161,10 @@ namespace FBCapture {
       void Container::print_structure(const char *pIndent) {
         // Prints the box structure and recurses on contents."""
         uint32_t iSize1 = m_iHeaderSize;
-        uint32_t iSize2 = m_iContentSize;
+        uint64_t iSize2 = m_iContentSize;
         std::cout << "{" << pIndent << "} {" << name() << "} [{" << iSize1 << "}, {" << iSize2 << "}]" << std::endl;
 
-        int32_t iCount = (int32_t)m_listContents.size();
+        int32_t iCount = (int32_t)contents().size();
         std::string strIndent = pIndent;
         std::vector<Box *>::iterator it = m_listContents.begin();
         while (it != m_listContents.end()) {
@@ -183,7 +185,10 @@ namespace FBCapture {
 
       void Container::remove(const char *pName) {
         std::vector<Box *> list;
-        m_iContentSize = 0;
+        contents();
+        if (!m_bLoaded)
+          return;
+        m_iContentSize = m_iPadding;
         std::vector<Box *>::iterator it = m_listContents.begin();
         while (it != m_listContents.end()) {
           Box *pBox = *it++;
@@ -205,7 +210,7 @@ namespace FBCapture {
 
       bool Container::add(Box *pElement) {
         // Adds an element, merging with containers of the same type.
-        std::vector<Box *>::iterator it = m_listContents.begin();
+        std::vector<Box *>::iterator it = contents().begin();
         while (it != m_listContents.end()) {
           Box *pBox = *it++;
           if (memcmp(pElement->m_name, pBox->m_name, 4) == 0) {
@@ -227,24 +232,30 @@ namespace FBCapture {
         // Merges structure with container.
         int iRet = memcmp(m_name, pElement->m_name, 4);
         assert(iRet == 0);
-        std::vector<Box *>::iterator it = pElement->m_listContents.begin();
+        std::vector<Box *>::iterator it = pElement->contents().begin();
         while (it != pElement->m_listContents.end()) {
           Box *pSubElement = *it++;
           if (!add(pSubElement))
             return false;
         }
+        // the children belong to this container now
+        pElement->m_listContents.clear();
         return true;
       }
 
-      void Container::save(std::fstream &fsIn, std::fstream &fsOut, int32_t iDelta) {
+      void Container::save(std::fstream &fsIn, std::ostream &fsOut, int64_t iDelta) {
         // Saves box to out_fh reading uncached content from in_fh.
         // iDelta : file_ change size for updating stco and co64 file_s.
+        contents();
+        if (!m_bLoaded)
+          return Box::save(fsIn, fsOut, iDelta);
+
         if (m_iHeaderSize == 16) {
           writeUint32(fsOut, 1);
           fsOut.write(m_name, 4);
           writeUint64(fsOut, size());
         } else if (m_iHeaderSize == 8) {
-          writeUint32(fsOut, size());
+          writeUint32(fsOut, (uint32_t)size());
           fsOut.write(m_name, 4);
         }
         if (m_iPadding > 0) {
@@ -33,19 +33,29 @@ namespace FBCapture {
         Container(uint32_t iPadding = 0);
         virtual ~Container();
 
-        static Box *load(std::fstream &, uint32_t iPos, uint32_t iEnd);
-        static std::vector<Box *>load_multiple(std::fstream &, uint32_t iPos, uint32_t iEnd);
+        static Box *load(const MappedFile &, uint64_t iPos, uint64_t iEnd);
+        static std::vector<Box *>load_multiple(const MappedFile &, uint64_t iPos, uint64_t iEnd);
+
+        // The children, loaded from the mapping the first time they are visited. Deleted with the container.
+        std::vector<Box *> &contents();
+        // True if the children were visited and failed to parse, the box can then only be copied as it is.
+        bool load_failed() const { return m_bLoadFailed; }
 
         void resize();
         virtual void print_structure(const char *);
         void remove(const char *);
         bool add(Box *);
         bool merge(Box *);
-        virtual void save(std::fstream &, std::fstream &, int32_t);
+        virtual void save(std::fstream &, std::ostream &, int64_t);
 
       public:
         uint32_t m_iPadding;
         std::vector<Box *> m_listContents;
+
+      protected:
+        const MappedFile *m_pFile;   // NULL once the children are loaded, or for created boxes
+        bool m_bLoaded;
+        bool m_bLoadFailed;
       };
 
     }
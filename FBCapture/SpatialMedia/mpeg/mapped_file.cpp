@@ -0,0 +1,109 @@
+#include <iostream>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "mapped_file.h"
+
+namespace FBCapture {
+  namespace SpatialMedia {
+    namespace mpeg {
+
+      MappedFile::MappedFile() {
+#ifdef _WIN32
+        m_hFile = INVALID_HANDLE_VALUE;
+        m_hMapping = NULL;
+#else
+        m_iFile = -1;
+#endif
+        m_pData = NULL;
+        m_iSize = 0;
+      }
+
+      MappedFile::~MappedFile() {
+        close();
+      }
+
+      bool MappedFile::open(const std::string &strFileName) {
+        close();
+#ifdef _WIN32
+        m_hFile = CreateFileA(strFileName.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        LARGE_INTEGER iFileSize;
+        if (m_hFile == INVALID_HANDLE_VALUE || !GetFileSizeEx(m_hFile, &iFileSize) || iFileSize.QuadPart == 0) {
+          close();
+          return false;
+        }
+        m_iSize = (uint64_t)iFileSize.QuadPart;
+
+        m_hMapping = CreateFileMappingA(m_hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (m_hMapping)
+          m_pData = (const uint8_t *)MapViewOfFile(m_hMapping, FILE_MAP_READ, 0, 0, 0);
+#else
+        m_iFile = ::open(strFileName.c_str(), O_RDONLY);
+        struct stat fileStat;
+        if (m_iFile < 0 || fstat(m_iFile, &fileStat) != 0 || fileStat.st_size == 0) {
+          close();
+          return false;
+        }
+        m_iSize = (uint64_t)fileStat.st_size;
+
+        void *pData = mmap(NULL, (size_t)m_iSize, PROT_READ, MAP_PRIVATE, m_iFile, 0);
+        if (pData != MAP_FAILED)
+          m_pData = (const uint8_t *)pData;
+#endif
+        if (!m_pData) {
+          std::cerr << "Error, could not map " << strFileName << " of " << m_iSize << " bytes." << std::endl;
+          close();
+          return false;
+        }
+        return true;
+      }
+
+      void MappedFile::close() {
+#ifdef _WIN32
+        if (m_pData)
+          UnmapViewOfFile(m_pData);
+        if (m_hMapping)
+          CloseHandle(m_hMapping);
+        if (m_hFile != INVALID_HANDLE_VALUE)
+          CloseHandle(m_hFile);
+        m_hFile = INVALID_HANDLE_VALUE;
+        m_hMapping = NULL;
+#else
+        if (m_pData)
+          munmap((void *)m_pData, (size_t)m_iSize);
+        if (m_iFile >= 0)
+          ::close(m_iFile);
+        m_iFile = -1;
+#endif
+        m_pData = NULL;
+        m_iSize = 0;
+      }
+
+      bool MappedFile::is_open() const {
+        return m_pData != NULL;
+      }
+
+      const uint8_t *MappedFile::data() const {
+        return m_pData;
+      }
+
+      uint64_t MappedFile::size() const {
+        return m_iSize;
+      }
+
+      const uint8_t *MappedFile::at(uint64_t iPos, uint64_t iSize) const {
+        if (!m_pData || iPos > m_iSize || iSize > m_iSize - iPos)
+          return NULL;
+        return m_pData + iPos;
+      }
+
+    }
+  }
+}
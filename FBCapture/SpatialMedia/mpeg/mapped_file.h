@@ -0,0 +1,44 @@
+#pragma once
+
+// Read-only memory mapping of an mpeg4 file_, for parsing the boxes in place with 64-bit offsets.
+#include <stdint.h>
+#include <string>
+
+namespace FBCapture {
+  namespace SpatialMedia {
+    namespace mpeg {
+
+      // Only the pages that get read are loaded, so the mdat of a multi GB capture is never touched
+      // while the boxes around it are parsed. A 32-bit process can't map files over ~2 GB.
+      class MappedFile {
+      public:
+        MappedFile();
+        virtual ~MappedFile();
+
+        bool open(const std::string &);
+        void close();
+        bool is_open() const;
+
+        const uint8_t *data() const;
+        uint64_t size() const;
+
+        // iSize bytes at iPos, NULL if they run past the end of the file_.
+        const uint8_t *at(uint64_t iPos, uint64_t iSize) const;
+
+      private:
+        MappedFile(const MappedFile &);
+        MappedFile &operator=(const MappedFile &);
+
+#ifdef _WIN32
+        void *m_hFile;
+        void *m_hMapping;
+#else
+        int m_iFile;
+#endif
+        const uint8_t *m_pData;
+        uint64_t m_iSize;
+      };
+
+    }
+  }
+}
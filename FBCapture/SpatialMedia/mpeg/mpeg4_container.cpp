@@ -38,12 +38,9 @@ namespace FBCapture {
 
       }
 
-      Mpeg4Container *Mpeg4Container::load(std::fstream &fsIn) //, uint32_t /* iPos */, uint32_t /* iEnd */ )
-      {
+      Mpeg4Container *Mpeg4Container::load(const MappedFile &file) {
         // Load the mpeg4 file_ structure of a file_.
-        //  fsIn.seekg ( 0, 2 );
-        int32_t iSize = (int32_t)fsIn.tellg();
-        std::vector<Box *> list = load_multiple(fsIn, 0, iSize);
+        std::vector<Box *> list = load_multiple(file, 0, file.size());
 
         if (list.empty()) {
           std::cerr << "Error, failed to load .mp4 file_." << std::endl;
@@ -107,10 +104,37 @@ namespace FBCapture {
         }
       }
 
-      void Mpeg4Container::save(std::fstream &fsIn, std::fstream &fsOut, int32_t) {
-        // Save mpeg4 file_content to file_.
-        resize();
-        uint32_t iNewPos = 0;
+      static bool promote_chunk_offsets(Box *pBox, std::fstream &fsIn, int64_t iDelta) {
+        // Promotes every stco below pBox whose offsets no longer fit in 32 bits once moved by iDelta.
+        if (pBox->type() != constants::Container)
+          return pBox->promote_to_co64(fsIn, iDelta);
+        bool bPromoted = false;
+        std::vector<Box *> &list = ((Container *)pBox)->contents();
+        std::vector<Box *>::iterator it = list.begin();
+        while (it != list.end())
+          bPromoted |= promote_chunk_offsets(*it++, fsIn, iDelta);
+        return bPromoted;
+      }
+
+      static bool has_load_failure(Box *pBox) {
+        // True if a container below pBox failed to parse, its stco or co64 are then out of reach.
+        if (pBox->type() != constants::Container)
+          return false;
+        Container *pContainer = (Container *)pBox;
+        std::vector<Box *> &list = pContainer->contents();
+        if (pContainer->load_failed())
+          return true;
+        std::vector<Box *>::iterator it = list.begin();
+        while (it != list.end()) {
+          if (has_load_failure(*it++))
+            return true;
+        }
+        return false;
+      }
+
+      int64_t Mpeg4Container::mdat_delta() {
+        // How far the first mdat contents move with the current box sizes.
+        uint64_t iNewPos = 0;
         std::vector<Box *>::iterator it = m_listContents.begin();
         while (it != m_listContents.end()) {
           Box *pBox = *it++;
@@ -120,8 +144,24 @@ namespace FBCapture {
           }
           iNewPos += pBox->size();
         }
-        uint32_t iDelta = iNewPos - m_iFirstMDatPos;
-        it = m_listContents.begin();
+        return (int64_t)(iNewPos - m_iFirstMDatPos);
+      }
+
+      void Mpeg4Container::save(std::fstream &fsIn, std::ostream &fsOut, int64_t) {
+        // Save mpeg4 file_content to file_.
+        resize();
+        int64_t iDelta = mdat_delta();
+        // A stco turned co64 grows the moov, which moves the mdat further when the moov comes first.
+        while (iDelta > 0 && m_pMoovBox && promote_chunk_offsets(m_pMoovBox, fsIn, iDelta)) {
+          resize();
+          iDelta = mdat_delta();
+        }
+        if (iDelta != 0 && m_pMoovBox && has_load_failure(m_pMoovBox)) {
+          std::cerr << "Error, the moov has boxes that failed to load, their chunk offsets can't follow the mdat." << std::endl;
+          fsOut.setstate(std::ios::failbit);
+          return;
+        }
+        std::vector<Box *>::iterator it = m_listContents.begin();
         while (it != m_listContents.end()) {
           Box *pBox = *it++;
           pBox->save(fsIn, fsOut, iDelta);
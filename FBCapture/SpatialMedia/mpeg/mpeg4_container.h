@@ -34,18 +34,23 @@ namespace FBCapture {
         Mpeg4Container();
         virtual ~Mpeg4Container();
 
-        static Mpeg4Container *load(std::fstream &); //, uint32_t iPos, uint32_t iEnd );
+        // Only the top level box headers are read here, the moov children are loaded as they are visited.
+        // file must stay open for as long as the boxes are used.
+        static Mpeg4Container *load(const MappedFile &file);
 
         void merge(Box *);
         virtual void print_structure(const char *p = "");
-        virtual void save(std::fstream &, std::fstream &, int32_t);
+        virtual void save(std::fstream &, std::ostream &, int64_t);
+
+      private:
+        int64_t mdat_delta();
 
       public:
         Box *m_pMoovBox;
         Box *m_pFreeBox;
         Box *m_pFTYPBox;
         Mpeg4Container *m_pFirstMDatBox;
-        uint32_t m_iFirstMDatPos;
+        uint64_t m_iFirstMDatPos;
       };
 
     }
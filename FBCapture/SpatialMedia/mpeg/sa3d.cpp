@@ -54,46 +54,47 @@ namespace FBCapture {
       SA3DBox::~SA3DBox() {}
 
       // Loads the SA3D box located at position pos in a mp4 file_.
-      Box *SA3DBox::load(std::fstream &fs, uint32_t iPos, uint32_t iEnd) {
+      Box *SA3DBox::load(const MappedFile &file, uint64_t iPos, uint64_t iEnd) {
         SA3DBox *pNewBox = NULL;
-        if (iPos < 0)
-          iPos = (uint32_t)fs.tellg();
-
+        uint32_t iHeaderSize;
+        uint64_t iSize;
         char name[4];
+        if (!load_header(file, iPos, iEnd, name, iSize, iHeaderSize))
+          return NULL;
 
-        fs.seekg(iPos);
-        uint32_t iSize = readUint32(fs);
-        fs.read(name, 4);
-        // Test if iSize == 1
-        // Added for 360Tube to have load and save in-sync.
-        if (iSize == 1) {
-          iSize = (int32_t)readUint64(fs);
-        }
-
-        if (0 != memcmp(name, constants::TAG_SA3D, sizeof(constants::TAG_SA3D))) {
+        if (0 != memcmp(name, constants::TAG_SA3D, 4)) {
           std::cerr << "Error: box is not an SA3D box." << std::endl;
           return NULL;
         }
 
-        if (iPos + iSize > iEnd) {
+        // version, type, order, ordering, normalization and the channel count
+        const uint64_t iFixedSize = 1 + 1 + 4 + 1 + 1 + 4;
+        const uint8_t *p = file.at(iPos + iHeaderSize, iFixedSize);
+        if (!p || iSize < iHeaderSize + iFixedSize) {
           std::cerr << "Error: SA3D box size exceeds bounds." << std::endl;
           return NULL;
         }
 
         pNewBox = new SA3DBox();
         pNewBox->m_iPosition = iPos;
-        pNewBox->m_iContentSize = iSize - pNewBox->m_iHeaderSize;
-        pNewBox->m_iVersion = readUint8(fs);
-        pNewBox->m_iAmbisonicType = readUint8(fs);
-        pNewBox->m_iAmbisonicOrder = readUint32(fs);
-        pNewBox->m_iAmbisonicChannelOrdering = readUint8(fs);
-        pNewBox->m_iAmbisonicNormalization = readUint8(fs);
-        pNewBox->m_iNumChannels = readUint32(fs);
-
-        for (int i = 0; i < (int)pNewBox->m_iNumChannels; i++) {
-          uint32_t iVal = readUint32(fs);
-          pNewBox->m_ChannelMap.push_back(iVal);
+        pNewBox->m_iHeaderSize = iHeaderSize;
+        pNewBox->m_iContentSize = iSize - iHeaderSize;
+        pNewBox->m_iVersion = p[0];
+        pNewBox->m_iAmbisonicType = p[1];
+        pNewBox->m_iAmbisonicOrder = readUint32(p + 2);
+        pNewBox->m_iAmbisonicChannelOrdering = p[6];
+        pNewBox->m_iAmbisonicNormalization = p[7];
+        pNewBox->m_iNumChannels = readUint32(p + 8);
+
+        const uint64_t iMapSize = (uint64_t)pNewBox->m_iNumChannels * 4;
+        p = file.at(iPos + iHeaderSize + iFixedSize, iMapSize);
+        if (!p || iSize < iHeaderSize + iFixedSize + iMapSize) {
+          std::cerr << "Error: SA3D channel map exceeds bounds." << std::endl;
+          delete pNewBox;
+          return NULL;
         }
+        for (uint32_t i = 0; i < pNewBox->m_iNumChannels; i++)
+          pNewBox->m_ChannelMap.push_back(readUint32(p + i * 4));
         return pNewBox;
       }
 
@@ -125,7 +126,7 @@ namespace FBCapture {
         return pNewBox;
       }
 
-      void SA3DBox::save(std::fstream &fsIn, std::fstream &fsOut) {
+      void SA3DBox::save(std::fstream &fsIn, std::ostream &fsOut) {
         //char tmp, name[4];
         uint64_t iSize = m_iContentSize;
 
@@ -46,11 +46,11 @@ namespace FBCapture {
         virtual ~SA3DBox();
 
         // Loads the SA3D box located at position pos in a mp4 file_.
-        static Box *load(std::fstream &fs, uint32_t iPos, uint32_t iEnd);
+        static Box *load(const MappedFile &file, uint64_t iPos, uint64_t iEnd);
 
         static Box *create(int32_t iNumChannels, AudioMetadata &);
 
-        void save(std::fstream &fsIn, std::fstream &fsOut);
+        void save(std::fstream &fsIn, std::ostream &fsOut);
         const char *ambisonic_type_name();
         const char *ambisonic_channel_ordering_name();
         const char *ambisonic_normalization_name();
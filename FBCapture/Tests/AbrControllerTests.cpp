@@ -0,0 +1,138 @@
+/****************************************************************************************************************
+
+Filename	:	AbrControllerTests.cpp
+Content		:	Bitrate steps of AbrController through congestion and recovery of the RTMP link
+Copyright	:
+
+****************************************************************************************************************/
+
+#include "TestRunner.h"
+#include "AbrController.h"
+
+#include <vector>
+
+using namespace FBCapture::Streaming;
+
+namespace {
+  const uint32_t kMaxBitrate = 4000000;
+  const uint32_t kMinBitrate = 1000000;
+  const uint64_t kStartMs = 100000;  // a steady clock reading, far from 0
+
+  class RecordingDelegate : public AbrControllerDelegate {
+  public:
+    void onTargetBitrate(const uint32_t bitrate) override {
+      bitrates.push_back(bitrate);
+    }
+
+    std::vector<uint32_t> bitrates;
+  };
+
+  // A link that drains linkBitrate with backlogMs of media queued up, updated once per interval
+  class Link {
+  public:
+    Link() : nowMs(kStartMs) {
+      stats_.packets = 0;
+      stats_.bytes = 0;
+      stats_.durationMs = 0;
+      stats_.dropped = 0;
+      stats_.writtenBytes = 0;
+    }
+
+    void start(AbrController* abr) {
+      abr->update(stats_, nowMs);
+    }
+
+    void step(AbrController* abr, const uint32_t linkBitrate, const uint32_t backlogMs, const uint32_t dropped = 0) {
+      nowMs += AbrController::kUpdateIntervalMs;
+      stats_.writtenBytes += linkBitrate / 8 * AbrController::kUpdateIntervalMs / 1000;
+      stats_.durationMs = backlogMs;
+      stats_.packets = backlogMs > 0 ? backlogMs / 33 + 1 : 0;
+      stats_.dropped += dropped;
+      abr->update(stats_, nowMs);
+    }
+
+    uint64_t nowMs;
+
+  private:
+    SinkQueueStats stats_;
+  };
+}
+
+TEST(AbrHoldsBitrateOnClearLink) {
+  RecordingDelegate delegate;
+  AbrController abr(&delegate, kMaxBitrate, kMinBitrate);
+  Link link;
+  link.start(&abr);
+
+  for (auto i = 0; i < 30; i++)
+    link.step(&abr, kMaxBitrate, 20);
+  EXPECT(delegate.bitrates.empty());
+  EXPECT(abr.bitrate() == kMaxBitrate);
+}
+
+TEST(AbrStepsDownToThroughputAndRecovers) {
+  RecordingDelegate delegate;
+  AbrController abr(&delegate, kMaxBitrate, kMinBitrate);
+  Link link;
+  link.start(&abr);
+
+  // the link falls to 2 Mbps, so the backlog builds up
+  const uint32_t congestedBitrate = 2000000;
+  const auto drained = congestedBitrate / 100 * AbrController::kThroughputPercent;
+  link.step(&abr, congestedBitrate, 600);
+  EXPECT(delegate.bitrates.size() == 1);
+  EXPECT(abr.bitrate() == drained);
+
+  // updates in between intervals aren't evaluated
+  abr.update(SinkQueueStats{ 100, 0, 2000, 1, 0 }, link.nowMs + AbrController::kUpdateIntervalMs / 2);
+  EXPECT(abr.bitrate() == drained);
+
+  // below what the link drains, the backlog only needs time
+  link.step(&abr, congestedBitrate, 600);
+  link.step(&abr, congestedBitrate, 450);
+  link.step(&abr, congestedBitrate, 250);
+  EXPECT(delegate.bitrates.size() == 1);
+
+  // once it is clear, the bitrate climbs back one step per hold up to the configured bitrate and no further
+  uint64_t lastStepMs = link.nowMs;
+  for (auto i = 0; i < 120; i++) {
+    const auto steps = delegate.bitrates.size();
+    link.step(&abr, kMaxBitrate * 2, 0);
+    if (delegate.bitrates.size() == steps)
+      continue;
+    EXPECT(link.nowMs - lastStepMs >= AbrController::kStepUpHoldMs);
+    EXPECT(delegate.bitrates.back() > delegate.bitrates[steps - 1]);
+    EXPECT(delegate.bitrates.back() <= kMaxBitrate);
+    lastStepMs = link.nowMs;
+  }
+  EXPECT(abr.bitrate() == kMaxBitrate);
+  EXPECT(delegate.bitrates.size() > 2);
+}
+
+TEST(AbrStepsDownOnDropsToMinBitrate) {
+  RecordingDelegate delegate;
+  AbrController abr(&delegate, kMaxBitrate, kMinBitrate);
+  Link link;
+  link.start(&abr);
+
+  // drops step down even when the link drains more than the bitrate, once per kStepDownHoldMs
+  link.step(&abr, kMaxBitrate * 2, 0, 3);
+  EXPECT(abr.bitrate() == kMaxBitrate / 100 * AbrController::kStepDownPercent);
+  link.step(&abr, kMaxBitrate * 2, 0, 3);
+  EXPECT(delegate.bitrates.size() == 1);
+
+  for (auto i = 0; i < 20; i++)
+    link.step(&abr, kMaxBitrate * 2, 0, 3);
+  EXPECT(abr.bitrate() == kMinBitrate);
+  EXPECT(delegate.bitrates.back() == kMinBitrate);
+
+  // a backlog between clear and congested keeps it from stepping back up
+  for (auto i = 0; i < 20; i++)
+    link.step(&abr, kMaxBitrate * 2, AbrController::kClearBacklogMs + 100);
+  EXPECT(abr.bitrate() == kMinBitrate);
+
+  link.step(&abr, kMaxBitrate * 2, 0);
+  for (uint32_t i = 0; i < AbrController::kStepUpHoldMs / AbrController::kUpdateIntervalMs; i++)
+    link.step(&abr, kMaxBitrate * 2, 0);
+  EXPECT(abr.bitrate() > kMinBitrate);
+}
@@ -0,0 +1,269 @@
+/****************************************************************************************************************
+
+Filename	:	RtpLoopbackTests.cpp
+Content		:	RtpPacketizer output sent over a loopback UDP socket and reassembled on the other end
+Copyright	:
+
+****************************************************************************************************************/
+
+#include "TestRunner.h"
+#include "RtpPacketizer.h"
+#include "UdpSocket.h"
+
+using namespace FBCapture::Streaming;
+
+namespace {
+  const uint8_t kVideoPayloadType = 96;
+  const uint8_t kAudioPayloadType = 97;
+  const uint32_t kSsrc = 0x12345678;
+  const uint32_t kMaxPayloadSize = 1200;
+  const uint16_t kFirstPort = 47560;
+
+  struct RtpPacket {
+    uint8_t version;
+    bool marker;
+    uint8_t payloadType;
+    uint16_t sequenceNumber;
+    uint32_t timestamp;
+    uint32_t ssrc;
+    vector<uint8_t> payload;
+  };
+
+  uint32_t readU16(const uint8_t* p) {
+    return p[0] << 8 | p[1];
+  }
+
+  uint32_t readU32(const uint8_t* p) {
+    return static_cast<uint32_t>(p[0]) << 24 | p[1] << 16 | p[2] << 8 | p[3];
+  }
+
+  // Both ends of a loopback RTP session
+  class Loopback {
+  public:
+    bool open() {
+      for (uint16_t port = kFirstPort; port < kFirstPort + 20; port += 2) {
+        if (receiver_.bind(port))
+          return sender_.connect("127.0.0.1", port);
+      }
+      return false;
+    }
+
+    bool send(const RtpPacketizer& packetizer) {
+      const auto count = packetizer.packetCount();
+      return sender_.sendBatch(packetizer.ioVecs(), packetizer.ioVecCounts(), count) == count;
+    }
+
+    bool receive(const uint32_t count, vector<RtpPacket>* packets) {
+      uint8_t datagram[2048];
+      for (uint32_t i = 0; i < count; i++) {
+        const auto size = receiver_.recv(datagram, sizeof(datagram), 1000);
+        if (size < RTP_HEADER_SIZE)
+          return false;
+        RtpPacket packet;
+        packet.version = datagram[0] >> 6;
+        packet.marker = (datagram[1] & 0x80) != 0;
+        packet.payloadType = datagram[1] & 0x7f;
+        packet.sequenceNumber = static_cast<uint16_t>(readU16(datagram + 2));
+        packet.timestamp = readU32(datagram + 4);
+        packet.ssrc = readU32(datagram + 8);
+        packet.payload.assign(datagram + RTP_HEADER_SIZE, datagram + size);
+        packets->push_back(packet);
+      }
+      return true;
+    }
+
+  private:
+    UdpSocket sender_;
+    UdpSocket receiver_;
+  };
+
+  // A frame in AVCC form whose NAL units start with the given headers and are padded to the given lengths
+  VideoEncodePacket* makeFrame(const VIDEO_CODEC codec, const uint64_t timestamp, const vector<vector<uint8_t>>& headers,
+                               const vector<uint32_t>& lengths) {
+    auto packet = new VideoEncodePacket();
+    packet->codec = codec;
+    packet->timestamp = timestamp;
+    uint32_t size = 0;
+    for (const auto length : lengths)
+      size += 4 + length;
+    packet->reserve(size);
+    packet->length = size;
+
+    auto p = packet->buffer;
+    for (size_t i = 0; i < headers.size(); i++) {
+      const auto length = lengths[i];
+      p[0] = static_cast<uint8_t>(length >> 24);
+      p[1] = static_cast<uint8_t>(length >> 16);
+      p[2] = static_cast<uint8_t>(length >> 8);
+      p[3] = static_cast<uint8_t>(length);
+      p += 4;
+      NalUnit nal;
+      nal.offset = static_cast<uint32_t>(p - packet->buffer);
+      nal.length = length;
+      nal.type = codec == VIDEO_CODEC::HEVC ? headers[i][0] >> 1 & 0x3f : headers[i][0] & 0x1f;
+      nal.refIdc = 1;
+      packet->nals.push_back(nal);
+      for (uint32_t j = 0; j < length; j++)
+        p[j] = j < headers[i].size() ? headers[i][j] : static_cast<uint8_t>(i * 31 + j);
+      p += length;
+    }
+    return packet;
+  }
+
+  // Reassembles the NAL units of one frame from single NAL unit, STAP-A/AP and FU-A/FU packets
+  bool depacketize(const VIDEO_CODEC codec, const vector<RtpPacket>& packets, vector<vector<uint8_t>>* nals) {
+    const auto isHevc = codec == VIDEO_CODEC::HEVC;
+    const size_t nalHeaderSize = isHevc ? 2 : 1;
+    for (const auto& packet : packets) {
+      const auto& payload = packet.payload;
+      const auto type = isHevc ? payload[0] >> 1 & 0x3f : payload[0] & 0x1f;
+      if (type == (isHevc ? 48 : 24)) {
+        for (auto p = nalHeaderSize; p < payload.size();) {
+          const auto length = readU16(payload.data() + p);
+          if (p + 2 + length > payload.size())
+            return false;
+          nals->push_back(vector<uint8_t>(payload.begin() + p + 2, payload.begin() + p + 2 + length));
+          p += 2 + length;
+        }
+      } else if (type == (isHevc ? 49 : 28)) {
+        const auto fuHeader = payload[nalHeaderSize];
+        if (fuHeader & 0x80) {
+          vector<uint8_t> nal;
+          if (isHevc) {
+            nal.push_back(static_cast<uint8_t>((payload[0] & 0x81) | (fuHeader & 0x3f) << 1));
+            nal.push_back(payload[1]);
+          } else {
+            nal.push_back(static_cast<uint8_t>((payload[0] & 0xe0) | (fuHeader & 0x1f)));
+          }
+          nals->push_back(nal);
+        } else if (nals->empty()) {
+          return false;
+        }
+        nals->back().insert(nals->back().end(), payload.begin() + nalHeaderSize + 1, payload.end());
+      } else {
+        nals->push_back(payload);
+      }
+    }
+    return true;
+  }
+
+  // The packets of a frame are in order, share the timestamp and only the last one has the marker bit
+  bool isFrame(const vector<RtpPacket>& packets, const size_t first, const size_t count, const uint32_t timestamp,
+               const uint8_t payloadType) {
+    for (auto i = first; i < first + count; i++) {
+      const auto& packet = packets[i];
+      if (packet.version != RTP_VERSION || packet.payloadType != payloadType || packet.ssrc != kSsrc ||
+          packet.timestamp != timestamp || packet.marker != (i + 1 == first + count) || packet.payload.size() > kMaxPayloadSize)
+        return false;
+      if (i > 0 && packet.sequenceNumber != static_cast<uint16_t>(packets[i - 1].sequenceNumber + 1))
+        return false;
+    }
+    return true;
+  }
+
+  // Sends frame and returns what came out the other end
+  bool sendFrame(Loopback* loopback, RtpPacketizer* packetizer, VideoEncodePacket* frame, vector<RtpPacket>* received,
+                 vector<vector<uint8_t>>* nals) {
+    const auto first = received->size();
+    packetizer->packetizeVideo(frame);
+    const auto count = packetizer->packetCount();
+    if (!loopback->send(*packetizer) || !loopback->receive(count, received))
+      return false;
+
+    const auto timestamp = packetizer->toRtpTimestamp(frame->timestamp);
+    const vector<RtpPacket> packets(received->begin() + first, received->end());
+    return isFrame(*received, first, count, timestamp, kVideoPayloadType) && depacketize(frame->codec, packets, nals);
+  }
+
+  // The NAL units of frame that should have been sent, without access unit delimiters
+  vector<vector<uint8_t>> expectedNals(const VideoEncodePacket* frame) {
+    const auto audType = frame->codec == VIDEO_CODEC::HEVC ? static_cast<uint32_t>(HEVC_NAL_AUD) : static_cast<uint32_t>(NAL_AUD);
+    vector<vector<uint8_t>> nals;
+    for (const auto& nal : frame->nals) {
+      if (nal.type != audType)
+        nals.push_back(vector<uint8_t>(frame->buffer + nal.offset, frame->buffer + nal.offset + nal.length));
+    }
+    return nals;
+  }
+}
+
+TEST(RtpLoopbackH264AggregatesAndFragments) {
+  Loopback loopback;
+  EXPECT(loopback.open());
+  RtpPacketizer packetizer(kVideoPayloadType, kSsrc, 90000, kMaxPayloadSize);
+  vector<RtpPacket> received;
+
+  // AUD, SPS and PPS, then an IDR slice several packets long
+  auto keyframe = makeFrame(VIDEO_CODEC::H264, 0, { { 0x09, 0xf0 }, { 0x67 }, { 0x68 }, { 0x65 } }, { 2, 20, 6, 5000 });
+  vector<vector<uint8_t>> nals;
+  EXPECT(sendFrame(&loopback, &packetizer, keyframe, &received, &nals));
+  EXPECT(nals == expectedNals(keyframe));
+  // SPS and PPS share a STAP-A with the NRI of the higher one, the slice goes in FU-A packets
+  EXPECT(received.size() == 6);
+  EXPECT(received[0].payload[0] == (0x60 | 24));
+  EXPECT((received[1].payload[0] & 0x1f) == 28 && received[1].payload[1] == (0x80 | NAL_IDR_SLICE));
+  EXPECT(received.back().payload[1] == (0x40 | NAL_IDR_SLICE));
+
+  // a small slice goes on its own
+  auto frame = makeFrame(VIDEO_CODEC::H264, 333333, { { 0x41 } }, { 300 });
+  nals.clear();
+  EXPECT(sendFrame(&loopback, &packetizer, frame, &received, &nals));
+  EXPECT(nals == expectedNals(frame));
+  EXPECT(received.size() == 7);
+  EXPECT(received.back().timestamp - received.front().timestamp == 333333ull * 90000 / 10000000);
+  EXPECT(packetizer.packetsSent() == 7);
+
+  keyframe->release();
+  frame->release();
+}
+
+TEST(RtpLoopbackHevcAggregatesAndFragments) {
+  Loopback loopback;
+  EXPECT(loopback.open());
+  RtpPacketizer packetizer(kVideoPayloadType, kSsrc, 90000, kMaxPayloadSize);
+  vector<RtpPacket> received;
+
+  // AUD, VPS, SPS and PPS, then an IDR slice
+  auto keyframe = makeFrame(VIDEO_CODEC::HEVC, 0,
+    { { HEVC_NAL_AUD << 1, 1, 0x50 }, { HEVC_NAL_VPS << 1, 1 }, { HEVC_NAL_SPS << 1, 1 }, { HEVC_NAL_PPS << 1, 1 },
+      { HEVC_NAL_IDR_W_RADL << 1, 1 } },
+    { 3, 24, 40, 8, 3000 });
+  vector<vector<uint8_t>> nals;
+  EXPECT(sendFrame(&loopback, &packetizer, keyframe, &received, &nals));
+  EXPECT(nals == expectedNals(keyframe));
+  EXPECT(received.size() == 4);
+  EXPECT(received[0].payload[0] == 48 << 1 && received[0].payload[1] == 1);
+  EXPECT(received[1].payload[0] == 49 << 1 && received[1].payload[2] == (0x80 | HEVC_NAL_IDR_W_RADL));
+
+  keyframe->release();
+}
+
+TEST(RtpLoopbackAacAuHeaders) {
+  Loopback loopback;
+  EXPECT(loopback.open());
+  RtpPacketizer packetizer(kAudioPayloadType, kSsrc, 48000, kMaxPayloadSize);
+
+  auto frame = new AudioEncodePacket();
+  frame->timestamp = 213333;
+  frame->reserve(371);
+  frame->length = 371;
+  for (uint32_t i = 0; i < frame->length; i++)
+    frame->buffer[i] = static_cast<uint8_t>(i);
+
+  EXPECT(packetizer.packetizeAudio(frame));
+  vector<RtpPacket> received;
+  EXPECT(loopback.send(packetizer) && loopback.receive(1, &received));
+  EXPECT(isFrame(received, 0, 1, packetizer.toRtpTimestamp(frame->timestamp), kAudioPayloadType));
+  // one 16 bit AU header, 13 bit size and 3 bit index
+  const auto& payload = received[0].payload;
+  EXPECT(readU16(payload.data()) == 16);
+  EXPECT(readU16(payload.data() + 2) >> 3 == frame->length && (payload[3] & 0x7) == 0);
+  EXPECT(vector<uint8_t>(payload.begin() + 4, payload.end()) == vector<uint8_t>(frame->buffer, frame->buffer + frame->length));
+
+  // bigger than the 13 bit AU size
+  frame->reserve(0x2000);
+  frame->length = 0x2000;
+  EXPECT(!packetizer.packetizeAudio(frame));
+
+  frame->release();
+}
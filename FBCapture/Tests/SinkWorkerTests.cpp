@@ -0,0 +1,266 @@
+/****************************************************************************************************************
+
+Filename	:	SinkWorkerTests.cpp
+Content		:	Backlog and drop policy of SinkWorker, driven through a loopback sink
+Copyright	:
+
+****************************************************************************************************************/
+
+#include "TestRunner.h"
+#include "SinkWorker.h"
+
+#include <chrono>
+
+using namespace FBCapture::Streaming;
+
+namespace {
+  const uint64_t kFrameDuration = 333333;  // 30 fps, in 100 nanosec unit
+  const uint64_t kMillis = 10000;
+
+  /*
+  * Keeps the timestamps of the packets it is handed. While held, write() blocks like a congested link,
+  * so the worker's queue backs up behind the packet being written.
+  */
+  class LoopbackSink : public PacketSink {
+  public:
+    LoopbackSink() : held_(false), writing_(0) {}
+
+    FBCAPTURE_STATUS open() override {
+      return FBCAPTURE_OK;
+    }
+
+    FBCAPTURE_STATUS write(EncodePacket* packet) override {
+      unique_lock<mutex> lock(mtx_);
+      writing_++;
+      cv_.notify_all();
+      cv_.wait(lock, [this] { return !held_; });
+      written_.push_back(packet->timestamp);
+      writing_--;
+      cv_.notify_all();
+      return FBCAPTURE_OK;
+    }
+
+    FBCAPTURE_STATUS close() override {
+      return FBCAPTURE_OK;
+    }
+
+    const char* name() const override {
+      return "loopback sink";
+    }
+
+    void hold() {
+      lock_guard<mutex> lock(mtx_);
+      held_ = true;
+    }
+
+    void unhold() {
+      lock_guard<mutex> lock(mtx_);
+      held_ = false;
+      cv_.notify_all();
+    }
+
+    // Waits for the worker to be blocked in write()
+    bool waitWriting() {
+      unique_lock<mutex> lock(mtx_);
+      return cv_.wait_for(lock, chrono::seconds(5), [this] { return writing_ > 0; });
+    }
+
+    bool wasWritten(const uint64_t timestamp) {
+      lock_guard<mutex> lock(mtx_);
+      for (const auto written : written_) {
+        if (written == timestamp)
+          return true;
+      }
+      return false;
+    }
+
+  private:
+    mutex mtx_;
+    condition_variable cv_;
+    vector<uint64_t> written_;
+    bool held_;
+    uint32_t writing_;
+  };
+
+  // Fails every write like a stream that gave up reconnecting
+  class FailingSink : public PacketSink {
+  public:
+    FBCAPTURE_STATUS open() override {
+      return FBCAPTURE_OK;
+    }
+
+    FBCAPTURE_STATUS write(EncodePacket*) override {
+      return FBCAPTURE_RTMP_DISCONNECTED;
+    }
+
+    FBCAPTURE_STATUS close() override {
+      return FBCAPTURE_OK;
+    }
+
+    const char* name() const override {
+      return "failing sink";
+    }
+  };
+
+  // A P frame other frames are predicted from, or a disposable one if reference is false
+  VideoEncodePacket* makeFrame(const uint64_t timestamp, const bool keyframe, const bool reference) {
+    auto packet = new VideoEncodePacket();
+    packet->timestamp = timestamp;
+    packet->isKeyframe = keyframe;
+    NalUnit nal;
+    nal.offset = 4;
+    nal.length = 1;
+    nal.type = keyframe ? NAL_IDR_SLICE : NAL_SLICE;
+    nal.refIdc = keyframe || reference ? 1 : 0;
+    packet->nals.push_back(nal);
+    return packet;
+  }
+
+  // Waits for the worker to finish with every packet handed to it
+  bool waitIdle(SinkWorker* worker) {
+    const auto deadline = chrono::steady_clock::now() + chrono::seconds(5);
+    while (worker->queueStats().packets > 0) {
+      if (chrono::steady_clock::now() > deadline)
+        return false;
+      this_thread::sleep_for(chrono::milliseconds(1));
+    }
+    return true;
+  }
+
+  void submitFrame(SinkWorker* worker, const uint64_t timestamp, const bool keyframe, const bool reference) {
+    auto packet = makeFrame(timestamp, keyframe, reference);
+    worker->submit(packet);
+    packet->release();
+  }
+}
+
+TEST(SinkWorkerIdleHasNoBacklog) {
+  // the worker owns and deletes the sink
+  auto sink = new LoopbackSink();
+  SinkWorker worker(sink, 64, SINK_OVERFLOW_POLICY::DROP);
+  EXPECT(worker.start() == FBCAPTURE_OK);
+
+  // a frame handed to an idle sink long after the session start is no backlog
+  const auto start = 3600 * 1000 * kMillis;
+  submitFrame(&worker, start, true, true);
+  EXPECT(waitIdle(&worker));
+  EXPECT(worker.queueStats().durationMs == 0);
+
+  submitFrame(&worker, start + kFrameDuration, false, true);
+  EXPECT(waitIdle(&worker));
+  EXPECT(sink->wasWritten(start + kFrameDuration));
+  EXPECT(worker.queueStats().durationMs == 0);
+  EXPECT(worker.droppedCount() == 0);
+
+  worker.stop(true);
+}
+
+TEST(SinkWorkerBacklogFollowsCongestion) {
+  auto sink = new LoopbackSink();
+  SinkWorker worker(sink, 256, SINK_OVERFLOW_POLICY::DROP);
+  EXPECT(worker.start() == FBCAPTURE_OK);
+
+  sink->hold();
+  submitFrame(&worker, 0, true, true);
+  EXPECT(sink->waitWriting());
+
+  for (uint64_t i = 1; i <= 15; i++)
+    submitFrame(&worker, i * kFrameDuration, false, true);
+  auto stats = worker.queueStats();
+  EXPECT(stats.packets == 16);
+  EXPECT(stats.durationMs == 15 * kFrameDuration / kMillis);
+
+  // once the sink catches up the backlog is gone
+  sink->unhold();
+  EXPECT(waitIdle(&worker));
+  EXPECT(worker.queueStats().durationMs == 0);
+
+  worker.stop(true);
+}
+
+TEST(SinkWorkerDropsDisposableThenToKeyframe) {
+  auto sink = new LoopbackSink();
+  SinkWorker worker(sink, 256, SINK_OVERFLOW_POLICY::DROP);
+  EXPECT(worker.start() == FBCAPTURE_OK);
+
+  // the sink stalls on the first keyframe while 1.5 sec of alternating reference and disposable frames queue up
+  sink->hold();
+  submitFrame(&worker, 0, true, true);
+  EXPECT(sink->waitWriting());
+
+  const uint64_t frames = 45;
+  for (uint64_t i = 1; i < frames; i++)
+    submitFrame(&worker, i * kFrameDuration, false, i % 2 == 0);
+  const auto keyframe = frames * kFrameDuration;
+  submitFrame(&worker, keyframe, true, true);
+  const auto dropped = worker.droppedCount();
+
+  sink->unhold();
+  worker.stop(true);
+
+  // the backlog a frame sees is up to the frame queued before it, which is two frames back once the disposable
+  // frames in between are dropped
+  const auto disposableLimit = SinkWorker::kDropDisposableMs * kMillis + kFrameDuration;
+  const auto keyframeLimit = SinkWorker::kDropToKeyframeMs * kMillis + 2 * kFrameDuration;
+  uint32_t expectedDrops = 0;
+  for (uint64_t i = 1; i < frames; i++) {
+    const auto timestamp = i * kFrameDuration;
+    const auto reference = i % 2 == 0;
+    if (timestamp <= SinkWorker::kDropDisposableMs * kMillis) {
+      EXPECT(sink->wasWritten(timestamp));
+    } else if (timestamp > keyframeLimit) {
+      EXPECT(!sink->wasWritten(timestamp));
+    } else if (!reference && timestamp > disposableLimit) {
+      EXPECT(!sink->wasWritten(timestamp));
+    } else if (reference && timestamp < SinkWorker::kDropToKeyframeMs * kMillis) {
+      EXPECT(sink->wasWritten(timestamp));
+    }
+    if (!sink->wasWritten(timestamp))
+      expectedDrops++;
+  }
+  EXPECT(sink->wasWritten(keyframe));
+  EXPECT(dropped == expectedDrops);
+}
+
+TEST(SinkWorkerBlockPolicyKeepsEveryPacket) {
+  auto sink = new LoopbackSink();
+  SinkWorker worker(sink, 256, SINK_OVERFLOW_POLICY::BLOCK);
+  EXPECT(worker.start() == FBCAPTURE_OK);
+
+  sink->hold();
+  submitFrame(&worker, 0, true, true);
+  EXPECT(sink->waitWriting());
+  const uint64_t frames = 60;
+  for (uint64_t i = 1; i < frames; i++)
+    submitFrame(&worker, i * kFrameDuration, false, false);
+  EXPECT(worker.queueStats().durationMs >= SinkWorker::kDropToKeyframeMs);
+  EXPECT(worker.droppedCount() == 0);
+
+  sink->unhold();
+  worker.stop(true);
+  for (uint64_t i = 0; i < frames; i++)
+    EXPECT(sink->wasWritten(i * kFrameDuration));
+}
+
+TEST(SinkWorkerReportsFailureUntilRestarted) {
+  SinkWorker worker(new FailingSink(), 64, SINK_OVERFLOW_POLICY::DROP);
+  EXPECT(worker.start() == FBCAPTURE_OK);
+  EXPECT(worker.policy() == SINK_OVERFLOW_POLICY::DROP);
+
+  // the failure surfaces on a later submit, once the worker got to the packet
+  submitFrame(&worker, 0, true, true);
+  EXPECT(waitIdle(&worker));
+  EXPECT(worker.status() == FBCAPTURE_RTMP_DISCONNECTED);
+  auto packet = makeFrame(kFrameDuration, false, true);
+  EXPECT(worker.submit(packet) == FBCAPTURE_RTMP_DISCONNECTED);
+  packet->release();
+
+  worker.detach();
+  EXPECT(worker.isDetached());
+  worker.stop(false);
+
+  EXPECT(worker.start() == FBCAPTURE_OK);
+  EXPECT(!worker.isDetached());
+  EXPECT(worker.status() == FBCAPTURE_OK);
+  worker.stop(false);
+}
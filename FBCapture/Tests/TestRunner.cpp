@@ -0,0 +1,66 @@
+/****************************************************************************************************************
+
+Filename	:	TestRunner.cpp
+Content		:	Runs every registered test, or the ones whose name contains the first argument
+Copyright	:
+
+****************************************************************************************************************/
+
+#include "TestRunner.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+using namespace std;
+
+namespace FBCapture {
+  namespace Tests {
+
+    namespace {
+      struct TestCase {
+        const char* name;
+        TestFunction function;
+      };
+
+      vector<TestCase>& testCases() {
+        // constructed on first use, registrations run during static initialization of every test file
+        static vector<TestCase> cases;
+        return cases;
+      }
+
+      uint32_t currentFailures = 0;
+    }
+
+    TestRegistration::TestRegistration(const char* name, const TestFunction function) {
+      testCases().push_back({ name, function });
+    }
+
+    bool Check(const bool passed, const char* expression, const char* file, const int line) {
+      if (!passed) {
+        printf("  %s(%d): failed %s\n", file, line, expression);
+        currentFailures++;
+      }
+      return passed;
+    }
+  }
+}
+
+using namespace FBCapture::Tests;
+
+int main(int argc, char** argv) {
+  const auto filter = argc > 1 ? argv[1] : "";
+  uint32_t run = 0, failed = 0;
+  for (const auto& test : testCases()) {
+    if (!strstr(test.name, filter))
+      continue;
+    currentFailures = 0;
+    test.function();
+    run++;
+    if (currentFailures > 0)
+      failed++;
+    printf("%s %s\n", currentFailures > 0 ? "FAILED" : "ok    ", test.name);
+  }
+  printf("%u tests, %u failed\n", run, failed);
+  return failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,33 @@
+/****************************************************************************************************************
+
+Filename	:	TestRunner.h
+Content		:	Minimal registry and checks for the encoder's unit tests
+Copyright	:
+
+****************************************************************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+
+namespace FBCapture {
+  namespace Tests {
+
+    typedef void (*TestFunction)();
+
+    // Adds a test to the list main() runs, see TEST
+    struct TestRegistration {
+      TestRegistration(const char* name, TestFunction function);
+    };
+
+    // Reports a failed check of the running test with where it is, and returns passed
+    bool Check(bool passed, const char* expression, const char* file, int line);
+  }
+}
+
+#define TEST(name) \
+  static void name(); \
+  static FBCapture::Tests::TestRegistration name##Registration(#name, name); \
+  static void name()
+
+#define EXPECT(condition) FBCapture::Tests::Check((condition), #condition, __FILE__, __LINE__)
@@ -1,6 +1,7 @@
 ﻿using System;
 using System.Collections.Generic;
 using System.Linq;
+using System.Runtime.InteropServices;
 using System.Text;
 
 namespace FBCapture {
@@ -9,6 +10,7 @@ namespace FBCapture {
 
     // For screenshot, FBCaptureConfig options do not apply as they are only applicable to video encoding/streaming.
     // If only interested in screenshot not video in the application, simply pass in an empty FBCaptureConfig object.
+    // Mirrors FBCaptureConfig in FBCaptureConfig.h, whose bools are 1 byte rather than the 4 byte BOOL C# marshals by default.
     struct FBCaptureConfig {
 
         // Encoding option [required]
@@ -17,16 +19,33 @@ namespace FBCapture {
         public int gop;
 
         // Capture texture option [optional]
+        [MarshalAs(UnmanagedType.I1)]
         public bool flipTexture;
 
         // Audio capture option [optional]
+        [MarshalAs(UnmanagedType.I1)]
         public bool mute;
+        [MarshalAs(UnmanagedType.I1)]
         public bool mixMic;
+        [MarshalAs(UnmanagedType.I1)]
         public bool useRiftAudioSources;
 
         // Enable async encoding mode for non-blocking FBCaptureEncodeFrame() call [optional]
+        [MarshalAs(UnmanagedType.I1)]
         public bool enableAsyncMode;
 
+        // Encode HEVC instead of H.264, written as hvc1 mp4 and CMAF segments, sent as enhanced RTMP 'hvc1' video or RFC 7798 RTP [optional]
+        [MarshalAs(UnmanagedType.I1)]
+        public bool useHevc;
+
+        // Expected capture length in seconds, sizes the space reserved ahead of the media data for the mp4 moov.
+        // 0 reserves for 10 minutes. Longer captures still play, with the moov at the end of the file [optional]
+        public int expectedDuration;
+
+        // Seconds between flushes of the mp4 as moof/mdat fragments instead of writing it faststart. A crashed or killed
+        // capture then leaves an mp4 that plays up to at most this many seconds before the end. 0 disables it [optional]
+        public int fragmentInterval;
+
         public FBCaptureConfig(
             int bitrate,
             int fps,
@@ -35,7 +54,10 @@ namespace FBCapture {
             bool mute = false,
             bool mixMic = false,
             bool useRiftAudioSources = false,
-            bool enableAsyncMode = false
+            bool enableAsyncMode = false,
+            bool useHevc = false,
+            int expectedDuration = 0,
+            int fragmentInterval = 0
         ) {
             this.bitrate = bitrate;
             this.fps = fps;
@@ -45,6 +67,9 @@ namespace FBCapture {
             this.mixMic = mixMic;
             this.useRiftAudioSources = useRiftAudioSources;
             this.enableAsyncMode = enableAsyncMode;
+            this.useHevc = useHevc;
+            this.expectedDuration = expectedDuration;
+            this.fragmentInterval = fragmentInterval;
         }
     }
 
@@ -72,6 +97,7 @@ namespace FBCapture {
         INVALID_FUNCTION_CALL,
         INVALID_SESSION_STATUS,
         UNEXPECTED_EXCEPTION,
+        UNSUPPORTED_VIDEO_CODEC,
 
         // Video/Image encoding specific error codes
         GPU_ENCODER_UNSUPPORTED_DRIVER = 200,
@@ -88,6 +114,8 @@ namespace FBCapture {
         // WIC specific error codes
         GPU_ENCODER_WIC_SAVE_IMAGE_FAILED,
 
+        GPU_ENCODER_RECONFIGURE_FAILED,
+
         // Audio capture specific error codes
         AUDIO_CAPTURE_INIT_FAILED = 300,
         AUDIO_CAPTURE_NOT_INITIALIZED,
@@ -104,6 +132,8 @@ namespace FBCapture {
 
         // WAMEDIA muxing specific error codes
         WAMDEIA_MUXING_FAILED = 500,
+        MP4_WRITE_FAILED,
+        FLV_WRITE_FAILED,
 
         // FLV Packetizer specific error codes
         FLV_SET_HEADER_FAILED = 600,
@@ -111,6 +141,8 @@ namespace FBCapture {
         FLV_SET_AAC_DATA_FAILED,
         FLV_SET_AVC_SEQ_HEADER_FAILED,
         FLV_SET_AVC_DATA_FAILED,
+        FLV_SET_HEVC_SEQ_HEADER_FAILED,
+        FLV_SET_HEVC_DATA_FAILED,
 
         // RTMP specific error codes
         RTMP_INVALID_FLV_FILE = 700,
@@ -124,5 +156,10 @@ namespace FBCapture {
         METADATA_INVALID = 800,
         METADATA_INJECTION_NOT_READY,
         METADATA_INJECTION_FAIL,
+
+        // RTP specific error codes
+        RTP_INVALID_STREAM_URL = 900,
+        RTP_CONNECTION_FAILED,
+        RTP_SEND_PACKET_FAILED,
     }
 }